@@ -25,6 +25,12 @@ void phiGemmInit( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_mems
 
 void phiGemmShutdown();
 
+/* Independent phiGEMM instances, to be used with the phi?gemmEx calls.
+ * phiGemmCreate takes the same parameters as phiGemmInit */
+phiGemmContext_t * phiGemmCreate( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_memsize, int * deviceToBond, int tag);
+
+void phiGemmDestroy( phiGemmContext_t *ctx );
+
 #if !defined(__PHIGEMM_CPUONLY)
 int phiGemmIsInit();
 
@@ -33,6 +39,61 @@ void phigemmSetSplitFactor(float *x);
 float phigemmGetSplitFactor(int selection);
 
 void phiGemmSetAvaiableScratchSpace(int gpu_id, size_t new_dev_memsize);
+
+/* Cost model: type is one of 's', 'd', 'c', 'z'. If split < 0 the split
+ * minimizing the predicted makespan is chosen and returned in pred->split.
+ * The Ex variants use the model of the given context, the others the one
+ * of the default context */
+void phiGemmPredict(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero, float split,
+		phiGemmPrediction_t *pred);
+
+float phiGemmModelSplit(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero);
+
+void phiGemmModelCalibrate();
+
+void phiGemmPredictEx(phiGemmContext_t *ctx, char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero, float split,
+		phiGemmPrediction_t *pred);
+
+float phiGemmModelSplitEx(phiGemmContext_t *ctx, char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero);
+
+void phiGemmModelCalibrateEx(phiGemmContext_t *ctx);
+
+/* Tuning database: seed the split factors of type {'s','d','c','z'} from a
+ * phigemm.profile*.csv file (stored at phiGemmShutdown if PHI_TUNING_DB is set),
+ * of the default context or of the given one */
+int phiGemmTuningDBSeed(const char *csvfile, char type);
+
+int phiGemmTuningDBSeedEx(phiGemmContext_t *ctx, const char *csvfile, char type);
+
+/* Resource pool of a context (phiGemmPoolStats: the default one): pinned
+ * bytes held and their high-water mark in use, streams and events created */
+void phiGemmPoolStats(size_t *pinned_bytes, size_t *pinned_high_water, int *streams, int *events);
+
+void phiGemmPoolStatsEx(phiGemmContext_t *ctx, size_t *pinned_bytes, size_t *pinned_high_water,
+		int *streams, int *events);
+
+#if defined(__PHIGEMM_OPERAND_CACHE)
+/* Device operand cache: the cached copies of a host buffer with a
+ * generation stay valid until the generation changes (the others are
+ * checked by fingerprint, see phigemm_cache.c). The Ex variants act on
+ * the cache of the given context, the others on the default one */
+void phiGemmCacheSetGeneration(const void *host, unsigned long generation);
+
+void phiGemmCacheStats(unsigned long *hits, unsigned long *misses, size_t *bytes_saved);
+
+void phiGemmCacheFlush();
+
+void phiGemmCacheSetGenerationEx(phiGemmContext_t *ctx, const void *host, unsigned long generation);
+
+void phiGemmCacheStatsEx(phiGemmContext_t *ctx, unsigned long *hits, unsigned long *misses,
+		size_t *bytes_saved);
+
+void phiGemmCacheFlushEx(phiGemmContext_t *ctx);
+#endif
 #endif
 
 #if defined(__PHIGEMM_PROFILE)
@@ -71,6 +132,59 @@ void phizgemm_specialK (const char *transa, const char *transb, const int *m,
 		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
 		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C,
 		const int *ldc, const char *file, const char * line );
+
+void phiSgemmEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const float *alpha,
+		const float *A, const int *lda, const float *B,
+		const int *ldb, const float *beta, float *C, const int *ldc,
+		const char *file, const char * line );
+
+void phiDgemmEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *A, const int *lda, const double *B,
+		const int *ldb, const double *beta, double *C, const int *ldc,
+		const char *file, const char * line );
+
+void phiCgemmEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiComplex *alpha,
+		const phiComplex *A, const int *lda, const phiComplex *B,
+		const int *ldb, const phiComplex *beta, phiComplex *C,
+		const int *ldc, const char *file, const char * line );
+
+void phiZgemmEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C,
+		const int *ldc, const char *file, const char * line );
+
+/* Non-blocking variants (ctx NULL: default context). C must not be used,
+ * nor A and B modified, until phiGemmWait or phiGemmTest completes the
+ * returned request. The tiles enqueued by a request bypass the operand
+ * cache, the host merge of C, the pipeline and the packing (see
+ * phigemm_async.c) */
+phiGemmRequest_t * phiSgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const float *alpha,
+		const float *A, const int *lda, const float *B,
+		const int *ldb, const float *beta, float *C, const int *ldc,
+		const char *file, const char * line );
+
+phiGemmRequest_t * phiDgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *A, const int *lda, const double *B,
+		const int *ldb, const double *beta, double *C, const int *ldc,
+		const char *file, const char * line );
+
+phiGemmRequest_t * phiCgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiComplex *alpha,
+		const phiComplex *A, const int *lda, const phiComplex *B,
+		const int *ldb, const phiComplex *beta, phiComplex *C,
+		const int *ldc, const char *file, const char * line );
+
+phiGemmRequest_t * phiZgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C,
+		const int *ldc, const char *file, const char * line );
 #else
 	void phiSgemm (const char *transa, const char *transb, const int *m,
 			const int *n, const int *k, const float *alpha,
@@ -104,8 +218,167 @@ void phizgemm_specialK (const char *transa, const char *transb, const int *m,
 			const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
 			const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C,
 			const int *ldc);
+
+	void phiSgemmEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+			const int *n, const int *k, const float *alpha,
+			const float *A, const int *lda, const float *B,
+			const int *ldb, const float *beta, float *C, const int *ldc);
+
+	void phiDgemmEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+			const int *n, const int *k, const double *alpha,
+			const double *A, const int *lda, const double *B,
+			const int *ldb, const double *beta, double *C, const int *ldc);
+
+	void phiCgemmEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+			const int *n, const int *k, const phiComplex *alpha,
+			const phiComplex *A, const int *lda, const phiComplex *B,
+			const int *ldb, const phiComplex *beta, phiComplex *C,
+			const int *ldc);
+
+	void phiZgemmEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+			const int *n, const int *k, const phiDoubleComplex *alpha,
+			const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
+			const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C,
+			const int *ldc);
+
+	/* Non-blocking variants (ctx NULL: default context). C must not be used,
+	 * nor A and B modified, until phiGemmWait or phiGemmTest completes the
+	 * returned request. The tiles enqueued by a request bypass the operand
+	 * cache, the host merge of C, the pipeline and the packing (see
+	 * phigemm_async.c) */
+	phiGemmRequest_t * phiSgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+			const int *n, const int *k, const float *alpha,
+			const float *A, const int *lda, const float *B,
+			const int *ldb, const float *beta, float *C, const int *ldc);
+
+	phiGemmRequest_t * phiDgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+			const int *n, const int *k, const double *alpha,
+			const double *A, const int *lda, const double *B,
+			const int *ldb, const double *beta, double *C, const int *ldc);
+
+	phiGemmRequest_t * phiCgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+			const int *n, const int *k, const phiComplex *alpha,
+			const phiComplex *A, const int *lda, const phiComplex *B,
+			const int *ldb, const phiComplex *beta, phiComplex *C,
+			const int *ldc);
+
+	phiGemmRequest_t * phiZgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+			const int *n, const int *k, const phiDoubleComplex *alpha,
+			const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
+			const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C,
+			const int *ldc);
 #endif
 
+/* Completion of a phi?gemmAsync request: phiGemmWait blocks, phiGemmTest
+ * returns 1 if it has completed (0 otherwise). Both release the request
+ * once completed */
+void phiGemmWait( phiGemmRequest_t *req );
+
+int phiGemmTest( phiGemmRequest_t *req );
+
+/* Batched GEMMs: batchCount products of the same shape (and the same
+ * alpha, beta), given as arrays of pointers or as strided operands. The
+ * batch is split between the devices and the CPU threads (of the given
+ * context for the Ex variants, of the default one otherwise) */
+void phiDgemmBatched (const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *const A[], const int *lda, const double *const B[],
+		const int *ldb, const double *beta, double *const C[], const int *ldc,
+		const int *batchCount);
+
+void phiDgemmStridedBatched (const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *A, const int *lda, const long long *strideA,
+		const double *B, const int *ldb, const long long *strideB,
+		const double *beta, double *C, const int *ldc, const long long *strideC,
+		const int *batchCount);
+
+void phiZgemmBatched (const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *const A[], const int *lda, const phiDoubleComplex *const B[],
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *const C[],
+		const int *ldc, const int *batchCount);
+
+void phiZgemmStridedBatched (const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const long long *strideA,
+		const phiDoubleComplex *B, const int *ldb, const long long *strideB,
+		const phiDoubleComplex *beta, phiDoubleComplex *C, const int *ldc,
+		const long long *strideC, const int *batchCount);
+
+void phiDgemmBatchedEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *const A[], const int *lda, const double *const B[],
+		const int *ldb, const double *beta, double *const C[], const int *ldc,
+		const int *batchCount);
+
+void phiDgemmStridedBatchedEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *A, const int *lda, const long long *strideA,
+		const double *B, const int *ldb, const long long *strideB,
+		const double *beta, double *C, const int *ldc, const long long *strideC,
+		const int *batchCount);
+
+void phiZgemmBatchedEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *const A[], const int *lda, const phiDoubleComplex *const B[],
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *const C[],
+		const int *ldc, const int *batchCount);
+
+void phiZgemmStridedBatchedEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const long long *strideA,
+		const phiDoubleComplex *B, const int *ldb, const long long *strideB,
+		const phiDoubleComplex *beta, phiDoubleComplex *C, const int *ldc,
+		const long long *strideC, const int *batchCount);
+
+/* Grouped GEMMs: count independent products of any shape (see
+ * phiGemmProblem_t), bin-packed as a whole on the CPU and the devices
+ * and completed with a single synchronization (on the devices of the
+ * given context for the Ex variants, of the default one otherwise) */
+void phiSgemmGrouped( const phiGemmProblem_t *group, int count );
+
+void phiDgemmGrouped( const phiGemmProblem_t *group, int count );
+
+void phiCgemmGrouped( const phiGemmProblem_t *group, int count );
+
+void phiZgemmGrouped( const phiGemmProblem_t *group, int count );
+
+void phiSgemmGroupedEx( phiGemmContext_t *ctx, const phiGemmProblem_t *group, int count );
+
+void phiDgemmGroupedEx( phiGemmContext_t *ctx, const phiGemmProblem_t *group, int count );
+
+void phiCgemmGroupedEx( phiGemmContext_t *ctx, const phiGemmProblem_t *group, int count );
+
+void phiZgemmGroupedEx( phiGemmContext_t *ctx, const phiGemmProblem_t *group, int count );
+
+/* Shared-A GEMMs: C_i = alpha * op(A) * op(B_i) + beta_i * C_i for count
+ * right-hand sides (see phiGemmRhs_t), A uploaded once per device (of
+ * the given context for the Ex variants, of the default one otherwise) */
+void phiSgemmSharedA( char transa, char transb, int m, int k, const float *alpha,
+		const float *A, int lda, const phiGemmRhs_t *rhs, int count );
+
+void phiDgemmSharedA( char transa, char transb, int m, int k, const double *alpha,
+		const double *A, int lda, const phiGemmRhs_t *rhs, int count );
+
+void phiCgemmSharedA( char transa, char transb, int m, int k, const phiComplex *alpha,
+		const phiComplex *A, int lda, const phiGemmRhs_t *rhs, int count );
+
+void phiZgemmSharedA( char transa, char transb, int m, int k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, int lda, const phiGemmRhs_t *rhs, int count );
+
+void phiSgemmSharedAEx( phiGemmContext_t *ctx, char transa, char transb, int m, int k, const float *alpha,
+		const float *A, int lda, const phiGemmRhs_t *rhs, int count );
+
+void phiDgemmSharedAEx( phiGemmContext_t *ctx, char transa, char transb, int m, int k, const double *alpha,
+		const double *A, int lda, const phiGemmRhs_t *rhs, int count );
+
+void phiCgemmSharedAEx( phiGemmContext_t *ctx, char transa, char transb, int m, int k, const phiComplex *alpha,
+		const phiComplex *A, int lda, const phiGemmRhs_t *rhs, int count );
+
+void phiZgemmSharedAEx( phiGemmContext_t *ctx, char transa, char transb, int m, int k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, int lda, const phiGemmRhs_t *rhs, int count );
+
 /* Fortran interface */
 
 void phigemminit_(int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_memsize, int * deviceToBond, int tag);
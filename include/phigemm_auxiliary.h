@@ -15,7 +15,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-#if !defined(__PHIGEMM_CPUONLY)
+#if defined(__PHIGEMM_EMULATE)
+#include "phigemm_emulator.h"
+#elif !defined(__PHIGEMM_CPUONLY)
 #include "cuda.h"
 #include "cublas_api.h"
 #include <cuda_runtime.h>
@@ -31,19 +33,37 @@ extern "C"
 
 /* ------------------------- SHARED DATA STRUCTURES ------------------------ */
 
-extern phiGemmEnv_t myPhiGemmEnv;
+/* The context of the calling thread is the default one except inside the
+ * calls on a given context (the *Ex variants, phiGemmCreate and
+ * phiGemmDestroy): the my* names below always refer to the data of the
+ * context in use. Every public entry point holds the lock of its context */
+extern phiGemmContext_t phiGemmDefaultCtx;
+
+extern __thread phiGemmContext_t *phiGemmCtx;
+
+#define myPhiGemmEnv (phiGemmCtx->env)
+
+#define myPhiGemmTng (phiGemmCtx->tng)
 
 #if !defined(__PHIGEMM_CPUONLY)
-extern phiGemmHandler_t myPhiGemmHdl;
-#endif
+#define myPhiGemmHdl (phiGemmCtx->hdl)
 
-extern phiGemmTuning_t myPhiGemmTng;
+#define myPhiGemmMdl (phiGemmCtx->mdl)
+#endif
 
 /* ------------------------------------------------------------------------- */
 
 
 /* --------------------- INTERNAL FUNCTIONS PROTOTYPES --------------------- */
 
+phiGemmContext_t * phiGemmContextEnter(phiGemmContext_t *ctx);
+
+phiGemmContext_t * phiGemmContextLock(phiGemmContext_t *ctx);
+
+void phiGemmContextLeave(phiGemmContext_t *ctx, phiGemmContext_t *caller);
+
+void phiGemmAsyncStop(phiGemmContext_t *ctx);
+
 #if !defined(__PHIGEMM_CPUONLY)
 int phiGemmIsInternalMemAlloc();
 
@@ -51,15 +71,137 @@ int phiGemmIsExternalMemAlloc();
 
 void estmSplitFactor(const char* optype, char transa, char transb);
 
-size_t memOccupancy(int is_splitA, float split, int m_in, int n_in, int k_in);
+int cpuGPUheuristic(int m, int n, int k, char type);
 
-void bestFit(int is_splitA, float split, int m, int n, int k, int type_size, int *p1, int *p2);
+cublasOperation_t phiGemmCublasOp(char trans);
 
-int cpuGPUheuristic(int m, int n, int k, char type);
+cublasStatus_t phiGemmGpuGemm(char type, cublasHandle_t handle,
+		cublasOperation_t transa, cublasOperation_t transb, int m, int n, int k,
+		const void *alpha, const void *A, int lda, const void *B, int ldb,
+		const void *beta, void *C, int ldc);
 
 void phiGemmInitScratchMemory( );
+
+void phiGemmInitMemory( phiGemmMemSizes* dev_memsize );
+
+void phiGemmReleaseMemory( );
+
+cudaStream_t phiGemmPoolStream(int w, int s);
+
+cudaEvent_t phiGemmPoolEvent(int w, int e);
+
+void * phiGemmPoolHostAlloc(size_t bytes);
+
+void phiGemmPoolHostFree(void *ptr);
+
+int phiGemmPoolHostAvailable();
+
+void phiGemmPoolRelease();
+
+phiGemmShapeEntry_t * phiGemmShapeLookup(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero);
+
+void phiGemmShapeRecord(phiGemmShapeEntry_t *entry, double unbalance);
+
+void phiGemmShapeReset();
+
+int phiGemmShapeExport(phiGemmShapeEntry_t *out, int max);
+
+void phiGemmShapeImport(const phiGemmShapeEntry_t *entry);
+
+phiGemmSpecialKPlan_t * phiGemmSpecialKPlanLookup(char type, const char *transa, const char *transb,
+		int m, int n, int k, int *found);
+
+void phiGemmTilePlan(char type, int is_splitA, float split, int m, int n, int k,
+		phiGemmTilePlan_t *plan);
+
+void phiGemmTileAccumulate(char type, int m, int n, const void *partial, int ldp, void *C, int ldc);
+
+void phiGemmReduce(char type, int m, int n, const void *scale, const void *partial, int ldp,
+		void *C, int ldc);
+
+int phiGemmPipelinePanels(int m, int n);
+
+size_t phiGemmPipeline(char type, int w, const char *transa, const char *transb,
+		int m, int n, int k, const void *alpha, const void *A, int lda,
+		const void *B, int ldb, const void *beta, int upload_c, void *C, int ldc,
+		void *devA, void *devB, void *devC, int skip_a, int skip_b, cudaEvent_t *timing);
+
+int phiGemmPackTransposes(char type, char op);
+
+int phiGemmPackReserve(int w);
+
+void phiGemmPackRelease();
+
+cublasStatus_t phiGemmPackUpload(char type, int w, int rows, int cols, const void *host, int ld,
+		int transpose, void *dev, int ldd, cudaStream_t stream);
+
+void phiGemmStream(char type, const char *transa, const char *transb,
+		int m, int n, int k, const void *alpha, const void *A, int lda,
+		const void *B, int ldb, const void *beta, void *C, int ldc,
+		int is_splitA, float split);
+
+float phiGemmSchedule(char type, const char *transa, const char *transb,
+		int m, int n, int k, const void *alpha, const void *A, int lda,
+		const void *B, int ldb, const void *beta, void *C, int ldc);
+
+void phiGemmTuningDBLoad();
+
+void phiGemmTuningDBStore();
+
+#if defined(__PHIGEMM_OPERAND_CACHE)
+void phiGemmCacheInit();
+
+void phiGemmCacheRelease();
+
+void phiGemmCacheBegin();
+
+void * phiGemmCacheLookup(int w, const void *base, const void *host, int ld, int rows, int cols,
+		size_t ts, int *hit);
 #endif
 
+void phiGemmModelSetDefaults(double cpu_gflops, double gpu_gflops, double h2d_gbs, double d2h_gbs);
+
+void phiGemmModelPredict(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero, float split,
+		phiGemmPrediction_t *pred);
+
+float phiGemmModelBestSplit(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero);
+
+double phiGemmModelTime(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero, int iDev);
+
+float phiGemmModelBatchSplit(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero);
+
+double phiGemmModelSpecialK(char type, const char *transa, const char *transb,
+		int m, int n, int chunk, int chunks, int depth, int accumulate, int iDev);
+
+void phiGemmModelSpecialKPlan(char type, const char *transa, const char *transb,
+		int m, int n, int k, int splitk, size_t room, int buffers, int iDev,
+		int *chunk, int *depth, int *accumulate);
+
+int phiGemmModelMergeC(char type, int m, int n, int iDev);
+
+void phiGemmModelPack(char type, const char *transa, const char *transb, int m, int n, int k,
+		int pageable, int iDev, int *pack_a, int *pack_b);
+
+void phiGemmModelUpdateReduce(size_t bytes, double time);
+
+void phiGemmModelUpdatePack(size_t bytes, double time);
+
+void phiGemmModelUpdate(char type, int iDev, int m_cpu, int n_cpu, int k,
+		double time_cpu, int m_gpu, int n_gpu, int k_gpu, double time_h2d, size_t bytes_h2d,
+		double time_gpu, double time_d2h, size_t bytes_d2h);
+#endif
+
+size_t phiGemmTypeSize(char type);
+
+void phiGemmCpuGemm(char type, const char *transa, const char *transb, int m, int n, int k,
+		const void *alpha, const void *A, int lda, const void *B, int ldb,
+		const void *beta, void *C, int ldc);
+
 double phigemm_cclock(void);
 
 /* ------------------------------------------------------------------------- */
@@ -18,8 +18,11 @@
 #include <string.h>
 #include <dlfcn.h>
 #include <ctype.h>
+#include <pthread.h>
 
-#if !defined(__PHIGEMM_CPUONLY)
+#if defined(__PHIGEMM_EMULATE)
+#include "phigemm_emulator.h"
+#elif !defined(__PHIGEMM_CPUONLY)
 #include "cublas_v2.h"
 #endif
 
@@ -101,12 +104,97 @@ typedef double phiDoubleComplex[2];
 #define __UPPER_LIMIT_K 1023
 #endif
 
+/* Number of entries (power of 2) of the per-shape split-factor cache and
+ * length of the unbalance history kept for every shape */
+#ifndef __PHIGEMM_SHAPE_CACHE_SIZE
+#define __PHIGEMM_SHAPE_CACHE_SIZE 1024
+#endif
+
+#ifndef __PHIGEMM_SHAPE_HISTORY
+#define __PHIGEMM_SHAPE_HISTORY 8
+#endif
+
+/* Smallest K chunk of Special-K: when C does not fit the devices with
+ * chunks this large, C is tiled instead (see phigemm_dgemm_specialK.c) */
+#ifndef __PHIGEMM_SPECIALK_MIN_SPLIT
+#define __PHIGEMM_SPECIALK_MIN_SPLIT 256
+#endif
+
+/* Most buffers in flight on every device in Special-K */
+#ifndef __PHIGEMM_SPECIALK_MAX_DEPTH
+#define __PHIGEMM_SPECIALK_MAX_DEPTH 4
+#endif
+
+/* Special-K partitions kept, one per exact shape (see phigemm_shape.c) */
+#ifndef __PHIGEMM_SPECIALK_PLANS
+#define __PHIGEMM_SPECIALK_PLANS 64
+#endif
+
+/* Narrowest panel of the pipeline of a device share in the standard path
+ * (see phigemm_pipeline.c) */
+#ifndef __PHIGEMM_PIPELINE_MIN_PANEL
+#define __PHIGEMM_PIPELINE_MIN_PANEL 256
+#endif
+
+/* Bytes of each of the two pinned staging buffers of a worker packing
+ * its operands (see phigemm_pack.c) */
+#ifndef __PHIGEMM_PACK_BYTES
+#define __PHIGEMM_PACK_BYTES (4 << 20)
+#endif
+
+/* Buffers (2: double, 3: triple buffering) in flight on every device when
+ * the device share does not fit the scratch memory (see phigemm_stream.c) */
+#ifndef __PHIGEMM_STREAM_DEPTH
+#define __PHIGEMM_STREAM_DEPTH 3
+#endif
+
+/* Upper bound of the CPU threads pulling tiles with __PHIGEMM_WORK_STEALING
+ * (see phigemm_schedule.c) */
+#ifndef __PHIGEMM_MAX_CPU_WORKERS
+#define __PHIGEMM_MAX_CPU_WORKERS 64
+#endif
+
+/* Operands kept by every worker in the device operand cache, and host
+ * buffers with a caller-supplied generation (__PHIGEMM_OPERAND_CACHE, see
+ * phigemm_cache.c) */
+#ifndef __PHIGEMM_CACHE_ENTRIES
+#define __PHIGEMM_CACHE_ENTRIES 16
+#endif
+
+/* Streams kept by the resource pool for every worker */
+#define __PHIGEMM_POOL_STREAMS ( (__PHIGEMM_STREAM_DEPTH > __PHIGEMM_SPECIALK_MAX_DEPTH) ? __PHIGEMM_STREAM_DEPTH : __PHIGEMM_SPECIALK_MAX_DEPTH )
+
+/* Pinned host buffers kept by the resource pool of a context, in power of
+ * two size classes from __PHIGEMM_POOL_MIN_BYTES (see phigemm_pool.c).
+ * A call holds at most, for every worker, a buffer per stream (Special-K)
+ * or a merged C and two staging buffers (see phigemm_pack.c), plus a few
+ * buffers of the whole call */
+#ifndef __PHIGEMM_POOL_BUFFERS
+#define __PHIGEMM_POOL_BUFFERS ( MAX_GPUS * NSTREAMS * ( (__PHIGEMM_POOL_STREAMS > 3) ? __PHIGEMM_POOL_STREAMS : 3 ) + 4 )
+#endif
+
+#ifndef __PHIGEMM_POOL_MIN_BYTES
+#define __PHIGEMM_POOL_MIN_BYTES (1 << 20)
+#endif
+
+#define __PHIGEMM_POOL_CLASSES 32
+
 #if defined(__PHIGEMM_PINNED) || defined(__PHIGEMM_MULTI_GPU)
 #define __PHIGEMM_EVENTS 6
 #else
 #define __PHIGEMM_EVENTS 7
 #endif
 
+/* Events kept by the resource pool for every worker: the timing events
+ * above, then the shared operand is on the device (of the pipeline or of
+ * the shared-A calls, see phigemm_shared.c), every stream of the pipeline
+ * is done (see phigemm_pipeline.c) and the block of each staging buffer
+ * is uploaded (see phigemm_pack.c) */
+#define __PHIGEMM_EVENT_READY __PHIGEMM_EVENTS
+#define __PHIGEMM_EVENT_DONE ( __PHIGEMM_EVENTS + 1 )
+#define __PHIGEMM_EVENT_PACK ( __PHIGEMM_EVENT_DONE + __PHIGEMM_POOL_STREAMS )
+#define __PHIGEMM_POOL_EVENTS ( __PHIGEMM_EVENT_PACK + 2 )
+
 /* ------------------------------------------------------------------------- */
 
 
@@ -126,9 +214,68 @@ typedef struct phiGemmEnv
 	FILE *profileFile;
 	char filename [ FILENAME_MAX ];
 #endif
+#if !defined(__PHIGEMM_CPUONLY)
+	char tuningdb [ FILENAME_MAX ];
+	int cpu_workers;
+	size_t cache_bytes;
+	int pipeline_streams;
+#endif
 } phiGemmEnv_t;
 
 #if !defined(__PHIGEMM_CPUONLY)
+/* A read-only operand block (rows x cols, leading dimension ld, at host)
+ * kept at offset in the cache of a worker. key is its generation or its
+ * fingerprint, used the value of the cache clock at its last use (0: free) */
+typedef struct phiGemmCacheEntry
+{
+	const void *host;
+	int ld, rows, cols;
+	size_t ts;
+	unsigned long key;
+	size_t offset, bytes;
+	unsigned long used;
+} phiGemmCacheEntry_t;
+
+/* Device operand cache (see phigemm_cache.c): the top size[w] bytes of the
+ * scratch memory of every worker, the statistics and the generations the
+ * caller assigned to some host buffers */
+typedef struct phiGemmCache
+{
+	char *base[ NSTREAMS * MAX_GPUS ];
+	size_t size[ NSTREAMS * MAX_GPUS ];
+	phiGemmCacheEntry_t entry[ NSTREAMS * MAX_GPUS ][ __PHIGEMM_CACHE_ENTRIES ];
+	unsigned long clock;
+	unsigned long hits, misses;
+	size_t saved;
+	const void *gen_host[ __PHIGEMM_CACHE_ENTRIES ];
+	unsigned long gen_value[ __PHIGEMM_CACHE_ENTRIES ];
+} phiGemmCache_t;
+
+/* A pinned host buffer of the resource pool: next links the idle buffers
+ * of a size class (index + 1, 0 ends the list) */
+typedef struct phiGemmPoolBuffer
+{
+	void *ptr;
+	size_t bytes;
+	int busy;
+	int next;
+} phiGemmPoolBuffer_t;
+
+/* Streams, events and pinned host buffers created on first use and kept
+ * across the calls of a context (see phigemm_pool.c), and the staging
+ * buffers a worker holds during a call (see phigemm_pack.c) */
+typedef struct phiGemmPool
+{
+	cudaStream_t stream[ NSTREAMS * MAX_GPUS ][ __PHIGEMM_POOL_STREAMS ];
+	cudaEvent_t event[ NSTREAMS * MAX_GPUS ][ __PHIGEMM_POOL_EVENTS ];
+	phiGemmPoolBuffer_t buffer[ __PHIGEMM_POOL_BUFFERS ];
+	int idle[ __PHIGEMM_POOL_CLASSES ];
+	int streams, events;
+	size_t pinned, pinned_busy, pinned_peak;
+	void *stage[ NSTREAMS * MAX_GPUS ][ 2 ];
+	int stage_next[ NSTREAMS * MAX_GPUS ], stage_busy[ NSTREAMS * MAX_GPUS ][ 2 ];
+} phiGemmPool_t;
+
 typedef struct phiGemmHandler
 {
 	phiGemmMemDevPtr pmem;
@@ -136,6 +283,9 @@ typedef struct phiGemmHandler
 	phiGemmDeviceIds devId;
 	cudaStream_t  stream[ NSTREAMS * MAX_GPUS ];
 	cublasHandle_t handle[ NSTREAMS * MAX_GPUS ];
+#if defined(__PHIGEMM_OPERAND_CACHE)
+	phiGemmCache_t cache;
+#endif
 } phiGemmHandler_t;
 
 #endif
@@ -154,6 +304,176 @@ typedef struct phiGemmTuning
 	int UPPER_LIMIT_K;
 } phiGemmTuning_t;
 
+/* Self-tuned split factor of a class of GEMM calls (see phigemm_shape.c).
+ * The key packs precision, transa, transb, beta==0 and the log-buckets
+ * of m, n and k; key 0 marks an empty slot */
+typedef struct phiGemmShapeEntry
+{
+	unsigned int key;
+	float split;
+	float prevSplit;
+	float lpSplit;
+	float unbalance[__PHIGEMM_SHAPE_HISTORY];
+	int calls;
+} phiGemmShapeEntry_t;
+
+/* Partition of a Special-K product, fixed at the first call of its exact
+ * shape so that the summation order is the same at every call (see
+ * phigemm_shape.c); m == 0 marks an empty slot */
+typedef struct phiGemmSpecialKPlan
+{
+	char type, transa, transb;
+	int m, n, k;
+	int k_gpu, nDev;
+	int k_share[MAX_GPUS];
+	int local_split[MAX_GPUS];
+	int depth[MAX_GPUS];
+	int accumulate[MAX_GPUS];
+	unsigned long used;
+} phiGemmSpecialKPlan_t;
+
+/* Machine rates used by the analytic cost model (see phigemm_model.c).
+ * Index 0:SGEMM, 1:DGEMM, 2:CGEMM, 3:ZGEMM; GFlops are peak values
+ * (before the small-size efficiency penalty) */
+typedef struct phiGemmModel
+{
+	double cpu_gflops[4];
+	double gpu_gflops[4][MAX_GPUS];
+	double h2d_gbs[MAX_GPUS];
+	double d2h_gbs[MAX_GPUS];
+	double latency;
+	double cpu_nhalf;
+	double gpu_nhalf;
+	double trans_eff;
+	double reduce_gbs;
+	double pack_gbs;
+} phiGemmModel_t;
+
+/* Output of the cost model for a given call and split factor (seconds) */
+typedef struct phiGemmPrediction
+{
+	float split;
+	double cpu_time;
+	double h2d_time;
+	double gpu_time;
+	double d2h_time;
+	double makespan;
+} phiGemmPrediction_t;
+
+/* Tiles of the device share of a call (see phigemm_tiling.c): a pr x pc
+ * grid of C tiles, each one split in pk slices along k, computed by the
+ * first workers = pr*pc*pk workers. Worker w (device w % numDevices)
+ * computes the m[w] x n[w] x k[w] block at (m0, n0, k0);
+ * the slices but the first (slice > 0) return a partial C stored at poff
+ * in a host buffer of partial elements. footprint is the largest tile (in
+ * elements), fits tells if every tile fits the memory of its worker */
+typedef struct phiGemmTilePlan
+{
+	int pr, pc, pk, workers;
+	int m[ NSTREAMS * MAX_GPUS ], n[ NSTREAMS * MAX_GPUS ], k[ NSTREAMS * MAX_GPUS ];
+	int m0[ NSTREAMS * MAX_GPUS ], n0[ NSTREAMS * MAX_GPUS ], k0[ NSTREAMS * MAX_GPUS ];
+	int slice[ NSTREAMS * MAX_GPUS ];
+	size_t poff[ NSTREAMS * MAX_GPUS ];
+	size_t partial;
+	size_t footprint;
+	int fits;
+} phiGemmTilePlan_t;
+
+/* A product of a grouped GEMM (see phigemm_grouped.c):
+ * C = alpha * op(A) * op(B) + beta * C, the scalars and the matrices of
+ * the precision of the call */
+typedef struct phiGemmProblem
+{
+	char transa, transb;
+	int m, n, k;
+	const void *alpha;
+	const void *A;
+	int lda;
+	const void *B;
+	int ldb;
+	const void *beta;
+	void *C;
+	int ldc;
+} phiGemmProblem_t;
+
+/* A right-hand side of a shared-A GEMM (see phigemm_shared.c):
+ * C = alpha * op(A) * op(B) + beta * C with C of m x n and op(B) of k x n,
+ * the scalar and the matrices of the precision of the call */
+typedef struct phiGemmRhs
+{
+	int n;
+	const void *B;
+	int ldb;
+	const void *beta;
+	void *C;
+	int ldc;
+} phiGemmRhs_t;
+
+/* A phiGEMM instance: devices, scratch memory, streams and tuning state.
+ * The phi?gemm_ entry points use a default context, phiGemmCreate returns
+ * independent ones for the phi?gemmEx entry points. GEMMs issued on the
+ * same context are serialized by its lock, and wait for the phi?gemmAsync
+ * requests whose device share is still in flight */
+typedef struct phiGemmContext
+{
+	phiGemmEnv_t env;
+	phiGemmTuning_t tng;
+#if !defined(__PHIGEMM_CPUONLY)
+	phiGemmHandler_t hdl;
+	phiGemmModel_t mdl;
+	phiGemmShapeEntry_t shape[ __PHIGEMM_SHAPE_CACHE_SIZE ];
+	phiGemmSpecialKPlan_t specialk[ __PHIGEMM_SPECIALK_PLANS ];
+	unsigned long specialk_clock;
+	phiGemmPool_t pool;
+#endif
+	int is_init;
+	int is_external_memory_alloc;
+	int is_internal_memory_alloc;
+	int is_internal_memory_probed;
+	pthread_mutex_t lock;
+	/* phi?gemmAsync requests left to the worker thread of the context, in
+	 * the order they were issued (see phigemm_async.c) */
+	pthread_mutex_t async_lock;
+	pthread_cond_t async_cond;
+	struct phiGemmRequest *async_head, *async_tail;
+	pthread_t async_worker;
+	int async_running, async_stop;
+	/* requests with a device share in flight and requests run whole by the
+	 * worker (with lock); async_idle is signalled as requests complete */
+	pthread_cond_t async_idle;
+	int async_pending, async_exclusive;
+	unsigned long async_sequence;
+} phiGemmContext_t;
+
+/* A GEMM started by phi?gemmAsync (see phigemm_async.c): a copy of the
+ * call (alpha and beta by value, the matrices by reference), the CPU share
+ * and the device tiles enqueued by the calling thread, or whole if the
+ * worker runs the whole call */
+typedef struct phiGemmRequest
+{
+	char type;
+	phiGemmContext_t *ctx;
+	char transa, transb;
+	int m, n, k, lda, ldb, ldc;
+	double alpha[2], beta[2];
+	const void *A, *B;
+	void *C;
+	const char *file, *line;
+	int whole;
+	int m_cpu, n_cpu;
+	size_t a_offset, b_offset, c_offset;
+	phiGemmTilePlan_t plan;
+#if !defined(__PHIGEMM_CPUONLY)
+	cudaEvent_t done_event[ NSTREAMS * MAX_GPUS ];
+#endif
+	char *partial;
+	int partial_pageable;
+	struct phiGemmRequest *next;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int done;
+} phiGemmRequest_t;
+
 /* ------------------------------------------------------------------------- */
 
 
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+/*
+ * Host-emulated device backend (enabled by -D__PHIGEMM_EMULATE)
+ *
+ * It provides the subset of the CUDA runtime and CUBLAS v2 API used by
+ * phiGEMM, implemented on the host:
+ * - every "device" is a host buffer budget plus three engines (H2D copy,
+ *   D2H copy, compute) that serialize the work of all its streams
+ * - every stream is a worker thread consuming an in-order queue of
+ *   transfers, GEMMs and event records
+ * - device GEMMs are computed by the host BLAS
+ *
+ * Transfers and computation can be throttled to model a given PCIe
+ * bandwidth and device throughput (see phigemm_emulator.c for the
+ * PHI_EMU_* environment variables).
+ */
+
+#ifndef __PHIGEMM_EMULATOR_H__
+#define __PHIGEMM_EMULATOR_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* ------------------------------- TYPES ----------------------------------- */
+
+typedef enum cudaError
+{
+	cudaSuccess = 0,
+	cudaErrorMemoryAllocation = 2,
+	cudaErrorInvalidDevice = 10,
+	cudaErrorInvalidValue = 11,
+	cudaErrorNotReady = 600
+} cudaError_t;
+
+typedef enum
+{
+	CUBLAS_STATUS_SUCCESS = 0,
+	CUBLAS_STATUS_NOT_INITIALIZED = 1,
+	CUBLAS_STATUS_ALLOC_FAILED = 3,
+	CUBLAS_STATUS_INVALID_VALUE = 7,
+	CUBLAS_STATUS_EXECUTION_FAILED = 13
+} cublasStatus_t;
+
+typedef enum
+{
+	CUBLAS_OP_N = 0,
+	CUBLAS_OP_T = 1,
+	CUBLAS_OP_C = 2
+} cublasOperation_t;
+
+typedef struct { float x, y; } cuComplex;
+typedef struct { double x, y; } cuDoubleComplex;
+
+typedef struct phiEmuStream * cudaStream_t;
+typedef struct phiEmuEvent * cudaEvent_t;
+typedef struct phiEmuBlasHandle * cublasHandle_t;
+
+struct cudaDeviceProp
+{
+	char name[256];
+	size_t totalGlobalMem;
+	int multiProcessorCount;
+};
+
+#define cudaHostAllocDefault  0x00
+#define cudaHostAllocPortable 0x01
+
+/* --------------------------- CUDA RUNTIME -------------------------------- */
+
+cudaError_t cudaGetDeviceCount( int *count );
+cudaError_t cudaSetDevice( int device );
+cudaError_t cudaGetDevice( int *device );
+cudaError_t cudaGetDeviceProperties( struct cudaDeviceProp *prop, int device );
+cudaError_t cudaDeviceSynchronize( void );
+
+cudaError_t cudaMalloc( void **devPtr, size_t size );
+cudaError_t cudaFree( void *devPtr );
+cudaError_t cudaMemGetInfo( size_t *free, size_t *total );
+cudaError_t cudaMemset( void *devPtr, int value, size_t count );
+
+cudaError_t cudaHostAlloc( void **pHost, size_t size, unsigned int flags );
+cudaError_t cudaMallocHost( void **pHost, size_t size );
+cudaError_t cudaFreeHost( void *ptr );
+
+cudaError_t cudaStreamCreate( cudaStream_t *pStream );
+cudaError_t cudaStreamDestroy( cudaStream_t stream );
+cudaError_t cudaStreamSynchronize( cudaStream_t stream );
+cudaError_t cudaStreamQuery( cudaStream_t stream );
+cudaError_t cudaStreamWaitEvent( cudaStream_t stream, cudaEvent_t event, unsigned int flags );
+
+cudaError_t cudaEventCreate( cudaEvent_t *event );
+cudaError_t cudaEventDestroy( cudaEvent_t event );
+cudaError_t cudaEventRecord( cudaEvent_t event, cudaStream_t stream );
+cudaError_t cudaEventSynchronize( cudaEvent_t event );
+cudaError_t cudaEventQuery( cudaEvent_t event );
+cudaError_t cudaEventElapsedTime( float *ms, cudaEvent_t start, cudaEvent_t end );
+
+/* ------------------------------ CUBLAS ----------------------------------- */
+
+cublasStatus_t cublasCreate( cublasHandle_t *handle );
+cublasStatus_t cublasDestroy( cublasHandle_t handle );
+cublasStatus_t cublasSetStream( cublasHandle_t handle, cudaStream_t streamId );
+cublasStatus_t cublasGetStream( cublasHandle_t handle, cudaStream_t *streamId );
+
+cublasStatus_t cublasSetMatrix( int rows, int cols, int elemSize,
+		const void *A, int lda, void *B, int ldb );
+cublasStatus_t cublasGetMatrix( int rows, int cols, int elemSize,
+		const void *A, int lda, void *B, int ldb );
+cublasStatus_t cublasSetMatrixAsync( int rows, int cols, int elemSize,
+		const void *A, int lda, void *B, int ldb, cudaStream_t stream );
+cublasStatus_t cublasGetMatrixAsync( int rows, int cols, int elemSize,
+		const void *A, int lda, void *B, int ldb, cudaStream_t stream );
+
+cublasStatus_t cublasSgemm( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const float *alpha,
+		const float *A, int lda, const float *B, int ldb, const float *beta,
+		float *C, int ldc );
+cublasStatus_t cublasDgemm( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const double *alpha,
+		const double *A, int lda, const double *B, int ldb, const double *beta,
+		double *C, int ldc );
+cublasStatus_t cublasCgemm( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const cuComplex *alpha,
+		const cuComplex *A, int lda, const cuComplex *B, int ldb,
+		const cuComplex *beta, cuComplex *C, int ldc );
+cublasStatus_t cublasZgemm( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const cuDoubleComplex *alpha,
+		const cuDoubleComplex *A, int lda, const cuDoubleComplex *B, int ldb,
+		const cuDoubleComplex *beta, cuDoubleComplex *C, int ldc );
+
+cublasStatus_t cublasSgemmStridedBatched( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const float *alpha,
+		const float *A, int lda, long long strideA, const float *B, int ldb,
+		long long strideB, const float *beta, float *C, int ldc, long long strideC,
+		int batchCount );
+cublasStatus_t cublasDgemmStridedBatched( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const double *alpha,
+		const double *A, int lda, long long strideA, const double *B, int ldb,
+		long long strideB, const double *beta, double *C, int ldc, long long strideC,
+		int batchCount );
+cublasStatus_t cublasCgemmStridedBatched( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const cuComplex *alpha,
+		const cuComplex *A, int lda, long long strideA, const cuComplex *B, int ldb,
+		long long strideB, const cuComplex *beta, cuComplex *C, int ldc, long long strideC,
+		int batchCount );
+cublasStatus_t cublasZgemmStridedBatched( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const cuDoubleComplex *alpha,
+		const cuDoubleComplex *A, int lda, long long strideA, const cuDoubleComplex *B, int ldb,
+		long long strideB, const cuDoubleComplex *beta, cuDoubleComplex *C, int ldc, long long strideC,
+		int batchCount );
+
+/* ------------------------- EMULATOR CONTROLS ----------------------------- */
+
+/* Override the emulated rates of a device (GB/s and GFlops, <= 0 means
+ * "not throttled"). Mainly useful to test and tune heterogeneous setups */
+void phiEmuSetDeviceRates( int device, double h2d_gbs, double d2h_gbs, double gflops );
+
+void phiEmuGetDeviceRates( int device, double *h2d_gbs, double *d2h_gbs, double *gflops );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __PHIGEMM_EMULATOR_H__
@@ -176,4 +176,204 @@ module phigemm
 
 #endif
 
+  !---- Fortran interfaces to the non-blocking phiGEMM functions ----
+  ! ctx is a context of phiGemmCreate (c_null_ptr: the default one); the
+  ! request returned is completed by phiGemmWait or phiGemmTest, C must
+  ! not be accessed before. With __PHIGEMM_PROFILE, file and line are C
+  ! strings (terminated by c_null_char)
+  interface
+
+#if defined(__PHIGEMM_PROFILE)
+     function phiSgemmAsync( ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line ) &
+          bind(C, name='phiSgemmAsync')
+       use iso_c_binding
+       type(c_ptr)               :: phiSgemmAsync
+       type(c_ptr), value        :: ctx
+       character(kind=c_char)    :: transa
+       character(kind=c_char)    :: transb
+       integer(c_int)            :: m
+       integer(c_int)            :: n
+       integer(c_int)            :: k
+       real(c_float)             :: alpha
+       real(c_float)             :: A(*)
+       integer(c_int)            :: lda
+       real(c_float)             :: B(*)
+       integer(c_int)            :: ldb
+       real(c_float)             :: beta
+       real(c_float)             :: C(*)
+       integer(c_int)            :: ldc
+       character(kind=c_char)    :: file(*)
+       character(kind=c_char)    :: line(*)
+     end function phiSgemmAsync
+#else
+     function phiSgemmAsync( ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ) &
+          bind(C, name='phiSgemmAsync')
+       use iso_c_binding
+       type(c_ptr)               :: phiSgemmAsync
+       type(c_ptr), value        :: ctx
+       character(kind=c_char)    :: transa
+       character(kind=c_char)    :: transb
+       integer(c_int)            :: m
+       integer(c_int)            :: n
+       integer(c_int)            :: k
+       real(c_float)             :: alpha
+       real(c_float)             :: A(*)
+       integer(c_int)            :: lda
+       real(c_float)             :: B(*)
+       integer(c_int)            :: ldb
+       real(c_float)             :: beta
+       real(c_float)             :: C(*)
+       integer(c_int)            :: ldc
+     end function phiSgemmAsync
+#endif
+
+
+#if defined(__PHIGEMM_PROFILE)
+     function phiCgemmAsync( ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line ) &
+          bind(C, name='phiCgemmAsync')
+       use iso_c_binding
+       type(c_ptr)               :: phiCgemmAsync
+       type(c_ptr), value        :: ctx
+       character(kind=c_char)    :: transa
+       character(kind=c_char)    :: transb
+       integer(c_int)            :: m
+       integer(c_int)            :: n
+       integer(c_int)            :: k
+       complex(c_float_complex)  :: alpha
+       complex(c_float_complex)  :: A(*)
+       integer(c_int)            :: lda
+       complex(c_float_complex)  :: B(*)
+       integer(c_int)            :: ldb
+       complex(c_float_complex)  :: beta
+       complex(c_float_complex)  :: C(*)
+       integer(c_int)            :: ldc
+       character(kind=c_char)    :: file(*)
+       character(kind=c_char)    :: line(*)
+     end function phiCgemmAsync
+#else
+     function phiCgemmAsync( ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ) &
+          bind(C, name='phiCgemmAsync')
+       use iso_c_binding
+       type(c_ptr)               :: phiCgemmAsync
+       type(c_ptr), value        :: ctx
+       character(kind=c_char)    :: transa
+       character(kind=c_char)    :: transb
+       integer(c_int)            :: m
+       integer(c_int)            :: n
+       integer(c_int)            :: k
+       complex(c_float_complex)  :: alpha
+       complex(c_float_complex)  :: A(*)
+       integer(c_int)            :: lda
+       complex(c_float_complex)  :: B(*)
+       integer(c_int)            :: ldb
+       complex(c_float_complex)  :: beta
+       complex(c_float_complex)  :: C(*)
+       integer(c_int)            :: ldc
+     end function phiCgemmAsync
+#endif
+
+
+#if defined(__PHIGEMM_PROFILE)
+     function phiDgemmAsync( ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line ) &
+          bind(C, name='phiDgemmAsync')
+       use iso_c_binding
+       type(c_ptr)               :: phiDgemmAsync
+       type(c_ptr), value        :: ctx
+       character(kind=c_char)    :: transa
+       character(kind=c_char)    :: transb
+       integer(c_int)            :: m
+       integer(c_int)            :: n
+       integer(c_int)            :: k
+       real(c_double)            :: alpha
+       real(c_double)            :: A(*)
+       integer(c_int)            :: lda
+       real(c_double)            :: B(*)
+       integer(c_int)            :: ldb
+       real(c_double)            :: beta
+       real(c_double)            :: C(*)
+       integer(c_int)            :: ldc
+       character(kind=c_char)    :: file(*)
+       character(kind=c_char)    :: line(*)
+     end function phiDgemmAsync
+#else
+     function phiDgemmAsync( ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ) &
+          bind(C, name='phiDgemmAsync')
+       use iso_c_binding
+       type(c_ptr)               :: phiDgemmAsync
+       type(c_ptr), value        :: ctx
+       character(kind=c_char)    :: transa
+       character(kind=c_char)    :: transb
+       integer(c_int)            :: m
+       integer(c_int)            :: n
+       integer(c_int)            :: k
+       real(c_double)            :: alpha
+       real(c_double)            :: A(*)
+       integer(c_int)            :: lda
+       real(c_double)            :: B(*)
+       integer(c_int)            :: ldb
+       real(c_double)            :: beta
+       real(c_double)            :: C(*)
+       integer(c_int)            :: ldc
+     end function phiDgemmAsync
+#endif
+
+
+#if defined(__PHIGEMM_PROFILE)
+     function phiZgemmAsync( ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line ) &
+          bind(C, name='phiZgemmAsync')
+       use iso_c_binding
+       type(c_ptr)               :: phiZgemmAsync
+       type(c_ptr), value        :: ctx
+       character(kind=c_char)    :: transa
+       character(kind=c_char)    :: transb
+       integer(c_int)            :: m
+       integer(c_int)            :: n
+       integer(c_int)            :: k
+       complex(c_double_complex) :: alpha
+       complex(c_double_complex) :: A(*)
+       integer(c_int)            :: lda
+       complex(c_double_complex) :: B(*)
+       integer(c_int)            :: ldb
+       complex(c_double_complex) :: beta
+       complex(c_double_complex) :: C(*)
+       integer(c_int)            :: ldc
+       character(kind=c_char)    :: file(*)
+       character(kind=c_char)    :: line(*)
+     end function phiZgemmAsync
+#else
+     function phiZgemmAsync( ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ) &
+          bind(C, name='phiZgemmAsync')
+       use iso_c_binding
+       type(c_ptr)               :: phiZgemmAsync
+       type(c_ptr), value        :: ctx
+       character(kind=c_char)    :: transa
+       character(kind=c_char)    :: transb
+       integer(c_int)            :: m
+       integer(c_int)            :: n
+       integer(c_int)            :: k
+       complex(c_double_complex) :: alpha
+       complex(c_double_complex) :: A(*)
+       integer(c_int)            :: lda
+       complex(c_double_complex) :: B(*)
+       integer(c_int)            :: ldb
+       complex(c_double_complex) :: beta
+       complex(c_double_complex) :: C(*)
+       integer(c_int)            :: ldc
+     end function phiZgemmAsync
+#endif
+
+
+     subroutine phiGemmWait( req ) bind(C, name='phiGemmWait')
+       use iso_c_binding
+       type(c_ptr), value        :: req
+     end subroutine phiGemmWait
+
+     function phiGemmTest( req ) bind(C, name='phiGemmTest')
+       use iso_c_binding
+       integer(c_int)            :: phiGemmTest
+       type(c_ptr), value        :: req
+     end function phiGemmTest
+
+  end interface
+
 end module phigemm
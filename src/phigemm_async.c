@@ -0,0 +1,719 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+/*
+ * Non-blocking GEMMs (phi?gemmAsync).
+ *
+ * The calling thread splits the call as phi?gemmEx does and enqueues the
+ * device share before returning: every tile is uploaded, computed and
+ * downloaded on the stream of its worker, followed by an event. The CPU
+ * share and the completion (waiting for the events, adding the partial
+ * products of the k slices to C, releasing the buffers) are left to the
+ * worker thread of the context, started by the first request and kept
+ * until the context is shut down; it serves the requests in the order
+ * they were issued. Calls the heuristic gives to the CPU are computed by
+ * the worker thread as a whole.
+ *
+ * A device share not fitting the scratch memory cannot be enqueued at
+ * once: the worker thread runs such a call whole, streamed as phi?gemmEx
+ * does, and the next requests are enqueued once it has completed. So is a
+ * request reading or writing the C of a request not completed yet. The
+ * requests do not refine the split factors of the self-tuning.
+ *
+ * The enqueue is simpler than the one of PHIGEMM_?GEMM_MF and does not
+ * share its code: the split comes from the same model, self-tuning or
+ * static factors and the tiles from the same tile plan, but every tile is
+ * one upload, one GEMM and one download. So a request neither looks up
+ * nor fills the operand cache (phigemm_cache.c), never merges C on the
+ * host instead of uploading it, is not cut in pipelined panels
+ * (phigemm_pipeline.c), uploads its operands unpacked (phigemm_pack.c)
+ * and is not scheduled on the work-stealing queue (phigemm_schedule.c).
+ * The calls run whole by the worker thread go through phi?gemmEx, and
+ * so through all of them.
+ *
+ * The tiles in flight own the scratch memory and the streams: the other
+ * GEMMs of the context wait for them (see phiGemmContextEnter). Until
+ * phiGemmWait returns, or phiGemmTest returns 1, C must be neither read
+ * nor written and A and B must not be modified. The request is released
+ * by the call that completes it.
+ */
+
+/* run the whole call as phi?gemmEx */
+static void asyncWhole(phiGemmRequest_t *req)
+{
+	phiGemmContext_t *ctx = req->ctx;
+
+	switch (req->type)
+	{
+	case 's':
+#if defined(__PHIGEMM_PROFILE)
+		phiSgemmEx(ctx, &req->transa, &req->transb, &req->m, &req->n, &req->k,
+				(const float *) req->alpha, (const float *) req->A, &req->lda,
+				(const float *) req->B, &req->ldb, (const float *) req->beta,
+				(float *) req->C, &req->ldc, req->file, req->line);
+#else
+		phiSgemmEx(ctx, &req->transa, &req->transb, &req->m, &req->n, &req->k,
+				(const float *) req->alpha, (const float *) req->A, &req->lda,
+				(const float *) req->B, &req->ldb, (const float *) req->beta,
+				(float *) req->C, &req->ldc);
+#endif
+		break;
+
+	case 'd':
+#if defined(__PHIGEMM_PROFILE)
+		phiDgemmEx(ctx, &req->transa, &req->transb, &req->m, &req->n, &req->k,
+				(const double *) req->alpha, (const double *) req->A, &req->lda,
+				(const double *) req->B, &req->ldb, (const double *) req->beta,
+				(double *) req->C, &req->ldc, req->file, req->line);
+#else
+		phiDgemmEx(ctx, &req->transa, &req->transb, &req->m, &req->n, &req->k,
+				(const double *) req->alpha, (const double *) req->A, &req->lda,
+				(const double *) req->B, &req->ldb, (const double *) req->beta,
+				(double *) req->C, &req->ldc);
+#endif
+		break;
+
+	case 'c':
+#if defined(__PHIGEMM_PROFILE)
+		phiCgemmEx(ctx, &req->transa, &req->transb, &req->m, &req->n, &req->k,
+				(const phiComplex *) req->alpha, (const phiComplex *) req->A, &req->lda,
+				(const phiComplex *) req->B, &req->ldb, (const phiComplex *) req->beta,
+				(phiComplex *) req->C, &req->ldc, req->file, req->line);
+#else
+		phiCgemmEx(ctx, &req->transa, &req->transb, &req->m, &req->n, &req->k,
+				(const phiComplex *) req->alpha, (const phiComplex *) req->A, &req->lda,
+				(const phiComplex *) req->B, &req->ldb, (const phiComplex *) req->beta,
+				(phiComplex *) req->C, &req->ldc);
+#endif
+		break;
+
+	case 'z':
+#if defined(__PHIGEMM_PROFILE)
+		phiZgemmEx(ctx, &req->transa, &req->transb, &req->m, &req->n, &req->k,
+				(const phiDoubleComplex *) req->alpha, (const phiDoubleComplex *) req->A, &req->lda,
+				(const phiDoubleComplex *) req->B, &req->ldb, (const phiDoubleComplex *) req->beta,
+				(phiDoubleComplex *) req->C, &req->ldc, req->file, req->line);
+#else
+		phiZgemmEx(ctx, &req->transa, &req->transb, &req->m, &req->n, &req->k,
+				(const phiDoubleComplex *) req->alpha, (const phiDoubleComplex *) req->A, &req->lda,
+				(const phiDoubleComplex *) req->B, &req->ldb, (const phiDoubleComplex *) req->beta,
+				(phiDoubleComplex *) req->C, &req->ldc);
+#endif
+		break;
+	}
+
+	return;
+}
+
+#if !defined(__PHIGEMM_CPUONLY)
+/* the split factor phi?gemmEx would use for the call */
+static float asyncSplit(const phiGemmRequest_t *req, int beta_is_zero)
+{
+	float split;
+
+#if defined(__PHIGEMM_GPUONLY)
+	split = 1.0;
+#elif defined(__PHIGEMM_SPLIT_MODEL)
+	split = phiGemmModelBestSplit(req->type, &req->transa, &req->transb, req->m, req->n, req->k, beta_is_zero);
+	/* keep a non-empty share for the devices */
+	if (split < 0.05f) split = 0.05f;
+#elif defined(__PHIGEMM_SELFTUNE)
+	split = phiGemmShapeLookup(req->type, &req->transa, &req->transb, req->m, req->n, req->k, beta_is_zero)->split;
+#else
+	switch (req->type)
+	{
+	case 's': split = myPhiGemmTng.split[0]; break;
+	case 'd': split = myPhiGemmTng.split[1]; break;
+	case 'c': split = myPhiGemmTng.split[2]; break;
+	default : split = myPhiGemmTng.split[3]; break;
+	}
+#endif
+
+	return split;
+}
+#endif
+
+/* enqueue the device share of the request on the streams of its context,
+ * which the calling thread holds */
+static void asyncEnqueue(phiGemmRequest_t *req)
+{
+#if !defined(__PHIGEMM_CPUONLY)
+	static const double zero[2] = { 0.0, 0.0 };
+	size_t ts = phiGemmTypeSize(req->type);
+	const char *A = (const char *) req->A, *B = (const char *) req->B;
+	char *C = (char *) req->C, *devA, *devB, *devC, *dst;
+	int is_transa = ( req->transa != 'n' ) && ( req->transa != 'N' );
+	int is_transb = ( req->transb != 'n' ) && ( req->transb != 'N' );
+	int beta_is_zero = !memcmp(req->beta, zero, ts);
+	int select_case = 0, is_splitA, tmp, w, mw, nw, kw, ldd;
+	size_t a_off, b_off, c_off;
+	const void *betaPtr;
+	cublasStatus_t status;
+	float split;
+#endif
+
+	/* unless the devices take a share, the worker computes the whole call */
+	req->m_cpu = req->m;
+	req->n_cpu = req->n;
+	req->plan.workers = 0;
+
+#if !defined(__PHIGEMM_CPUONLY)
+	if ( phiGemmIsInit() && req->m > 0 && req->n > 0 && req->k > 0 ) {
+		if ( !phiGemmIsInternalMemAlloc() && !phiGemmIsExternalMemAlloc() )
+			phiGemmInitMemory(NULL);
+
+#if defined(__PHIGEMM_GPUONLY)
+		select_case = 2;
+#else
+		select_case = cpuGPUheuristic(req->m, req->n, req->k, req->type);
+#endif
+	}
+
+	if ( select_case == 0 ) return;
+
+	/* a Special-K call is cut along k by the tile plan as well */
+	split = asyncSplit(req, beta_is_zero);
+	is_splitA = (req->n > req->m) ? 0:1;
+
+	phiGemmTilePlan(req->type, is_splitA, split, req->m, req->n, req->k, &req->plan);
+
+	if ( !req->plan.fits ) {
+		/* the device share must be streamed: the worker runs the whole call */
+		req->plan.workers = 0;
+		req->whole = 1;
+		return;
+	}
+
+	if ( is_splitA ) {
+		tmp = req->m * split;
+		req->m_cpu = req->m - tmp;
+		req->a_offset = is_transa ? (size_t) tmp * req->lda : tmp;
+		req->c_offset = tmp;
+	} else {
+		tmp = req->n * split;
+		req->n_cpu = req->n - tmp;
+		req->b_offset = is_transb ? tmp : (size_t) tmp * req->ldb;
+		req->c_offset = (size_t) tmp * req->ldc;
+	}
+
+	if ( req->plan.partial > 0 ) {
+		req->partial = (char *) phiGemmPoolHostAlloc( req->plan.partial * ts );
+		if ( req->partial == NULL ) {
+			req->partial = (char *) malloc( req->plan.partial * ts );
+			req->partial_pageable = 1;
+		}
+		if ( req->partial == NULL ) {
+			printf("*** phiGEMM *** ERROR *** allocation of the partial products failed!\n");
+			fflush(stdout);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (w = 0; w < req->plan.workers; w++) {
+
+		mw = req->plan.m[w];
+		nw = req->plan.n[w];
+		kw = req->plan.k[w];
+
+		cudaSetDevice(myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+
+		/* tiles are recycled among the requests in flight (see phigemm_pool.c) */
+		req->done_event[w] = phiGemmPoolEvent(w, __PHIGEMM_EVENT_DONE +
+				req->ctx->async_sequence % __PHIGEMM_POOL_STREAMS);
+
+		if ( mw > 0 && nw > 0 ) {
+
+			a_off = is_transa ? req->plan.m0[w] * (size_t) req->lda + req->plan.k0[w] :
+					req->plan.m0[w] + req->plan.k0[w] * (size_t) req->lda;
+			b_off = is_transb ? req->plan.n0[w] + req->plan.k0[w] * (size_t) req->ldb :
+					req->plan.k0[w] + req->plan.n0[w] * (size_t) req->ldb;
+			c_off = req->plan.m0[w] + req->plan.n0[w] * (size_t) req->ldc;
+
+			devA = (char *) myPhiGemmHdl.pmem[w];
+			devB = devA + (size_t) mw * kw * ts;
+			devC = devB + (size_t) kw * nw * ts;
+
+			if ( is_transa )
+				status = cublasSetMatrixAsync(kw, mw, ts, A + a_off * ts, req->lda, devA, kw, myPhiGemmHdl.stream[w]);
+			else
+				status = cublasSetMatrixAsync(mw, kw, ts, A + a_off * ts, req->lda, devA, mw, myPhiGemmHdl.stream[w]);
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: device access error (H2D A) %d\n", w, status); fflush(stderr);
+			}
+
+			if ( is_transb )
+				status = cublasSetMatrixAsync(nw, kw, ts, B + b_off * ts, req->ldb, devB, nw, myPhiGemmHdl.stream[w]);
+			else
+				status = cublasSetMatrixAsync(kw, nw, ts, B + b_off * ts, req->ldb, devB, kw, myPhiGemmHdl.stream[w]);
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: device access error (H2D B) %d\n", w, status); fflush(stderr);
+			}
+
+			/* the first k slice of a tile owns C, the others return a partial product */
+			if ( req->plan.slice[w] == 0 ) {
+				dst = C + c_off * ts;
+				ldd = req->ldc;
+				betaPtr = req->beta;
+
+				if ( !beta_is_zero ) {
+					status = cublasSetMatrixAsync(mw, nw, ts, dst, ldd, devC, mw, myPhiGemmHdl.stream[w]);
+					if (status != CUBLAS_STATUS_SUCCESS) {
+						fprintf (stderr, "!!!! GPU %d: device access error (H2D C) %d\n", w, status); fflush(stderr);
+					}
+				}
+			} else {
+				dst = req->partial + req->plan.poff[w] * ts;
+				ldd = mw;
+				betaPtr = zero;
+			}
+
+			phiGemmGpuGemm(req->type, myPhiGemmHdl.handle[w], phiGemmCublasOp(req->transa),
+					phiGemmCublasOp(req->transb), mw, nw, kw, req->alpha, devA, is_transa ? kw : mw,
+					devB, is_transb ? nw : kw, betaPtr, devC, mw);
+
+			status = cublasGetMatrixAsync(mw, nw, ts, devC, mw, dst, ldd, myPhiGemmHdl.stream[w]);
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: device access error (D2H C) %d\n", w, status); fflush(stderr);
+			}
+		}
+
+		cudaEventRecord(req->done_event[w], myPhiGemmHdl.stream[w]);
+	}
+
+	req->ctx->async_sequence++;
+
+	cudaSetDevice(myPhiGemmHdl.devId[0]);
+
+#if defined(__PHIGEMM_DEBUG_4)
+	printf("[PHIGEMM_DEBUG][4] async %c %d x %d x %d: split %.3f, %d tiles enqueued\n",
+			req->type, req->m, req->n, req->k, split, req->plan.workers); fflush(stdout);
+#endif
+#endif
+
+	return;
+}
+
+/* the bytes spanned by a rows x cols matrix */
+static int asyncSpan(const void *base, int ld, int rows, int cols, size_t ts,
+		const char **lo, const char **hi)
+{
+	if ( rows <= 0 || cols <= 0 ) return 0;
+
+	*lo = (const char *) base;
+	*hi = *lo + ( (size_t) (cols - 1) * ld + rows ) * ts;
+
+	return 1;
+}
+
+/* tell if the request uses the C of a request of the context not completed
+ * yet (with the context held) */
+static int asyncConflict(phiGemmContext_t *ctx, const phiGemmRequest_t *req)
+{
+	size_t ts = phiGemmTypeSize(req->type);
+	int is_transa = ( req->transa != 'n' ) && ( req->transa != 'N' );
+	int is_transb = ( req->transb != 'n' ) && ( req->transb != 'N' );
+	const char *lo[3], *hi[3], *clo, *chi;
+	const phiGemmRequest_t *p;
+	int used[3], i, conflict = 0;
+
+	used[0] = asyncSpan(req->A, req->lda, is_transa ? req->k : req->m, is_transa ? req->m : req->k, ts, &lo[0], &hi[0]);
+	used[1] = asyncSpan(req->B, req->ldb, is_transb ? req->n : req->k, is_transb ? req->k : req->n, ts, &lo[1], &hi[1]);
+	used[2] = asyncSpan(req->C, req->ldc, req->m, req->n, ts, &lo[2], &hi[2]);
+
+	pthread_mutex_lock(&ctx->async_lock);
+
+	for (p = ctx->async_head; p != NULL && !conflict; p = p->next) {
+		if ( !asyncSpan(p->C, p->ldc, p->m, p->n, phiGemmTypeSize(p->type), &clo, &chi) ) continue;
+
+		for (i = 0; i < 3; i++)
+			if ( used[i] && lo[i] < chi && clo < hi[i] ) conflict = 1;
+	}
+
+	pthread_mutex_unlock(&ctx->async_lock);
+
+	return conflict;
+}
+
+/* remove the completed request, the first of the queue of its context
+ * (with the context held) */
+static void asyncRetire(phiGemmContext_t *ctx, phiGemmRequest_t *req)
+{
+	pthread_mutex_lock(&ctx->async_lock);
+	ctx->async_head = req->next;
+	if ( ctx->async_head == NULL ) ctx->async_tail = NULL;
+	pthread_mutex_unlock(&ctx->async_lock);
+
+	pthread_cond_broadcast(&ctx->async_idle);
+
+	return;
+}
+
+/* compute the CPU share of the request and wait for its device share */
+static void asyncComplete(phiGemmRequest_t *req)
+{
+	phiGemmContext_t *ctx = req->ctx, *caller;
+	size_t ts = phiGemmTypeSize(req->type);
+	char *C = (char *) req->C;
+#if !defined(__PHIGEMM_CPUONLY)
+	int w;
+#endif
+
+	if ( req->whole ) {
+		asyncWhole(req);
+
+		caller = phiGemmContextLock(ctx);
+		ctx->async_exclusive--;
+		asyncRetire(ctx, req);
+		phiGemmContextLeave(ctx, caller);
+
+		return;
+	}
+
+	phiGemmCpuGemm(req->type, &req->transa, &req->transb, req->m_cpu, req->n_cpu, req->k,
+			req->alpha, (const char *) req->A + req->a_offset * ts, req->lda,
+			(const char *) req->B + req->b_offset * ts, req->ldb, req->beta,
+			C + req->c_offset * ts, req->ldc);
+
+#if !defined(__PHIGEMM_CPUONLY)
+	for (w = 0; w < req->plan.workers; w++) {
+		cudaSetDevice(ctx->hdl.devId[w % ctx->env.numDevices]);
+		cudaEventSynchronize(req->done_event[w]);
+	}
+
+	for (w = 0; w < req->plan.workers; w++)
+		if ( req->plan.slice[w] > 0 )
+			phiGemmTileAccumulate(req->type, req->plan.m[w], req->plan.n[w],
+					req->partial + req->plan.poff[w] * ts, req->plan.m[w],
+					C + ( req->plan.m0[w] + req->plan.n0[w] * (size_t) req->ldc ) * ts, req->ldc);
+#endif
+
+	caller = phiGemmContextLock(ctx);
+
+#if !defined(__PHIGEMM_CPUONLY)
+	if ( req->partial_pageable )
+		free(req->partial);
+	else if ( req->partial != NULL )
+		phiGemmPoolHostFree(req->partial);
+	req->partial = NULL;
+
+	if ( req->plan.workers > 0 ) {
+		ctx->async_pending--;
+
+		/* as phi?gemmEx, the memory allocated internally lasts one call
+		 * (the operand cache keeps it until phiGemmShutdown) */
+#if !defined(__PHIGEMM_OPERAND_CACHE)
+		if ( ctx->async_pending == 0 && phiGemmIsInternalMemAlloc() )
+			phiGemmReleaseMemory();
+#endif
+	}
+#endif
+
+	asyncRetire(ctx, req);
+
+	phiGemmContextLeave(ctx, caller);
+
+	return;
+}
+
+/* serve the requests of the context in the order they were issued */
+static void * asyncWorker(void *arg)
+{
+	phiGemmContext_t *ctx = (phiGemmContext_t *) arg;
+	phiGemmRequest_t *req;
+
+	pthread_mutex_lock(&ctx->async_lock);
+
+	for (;;) {
+		while ( ctx->async_head == NULL && !ctx->async_stop )
+			pthread_cond_wait(&ctx->async_cond, &ctx->async_lock);
+
+		/* the request stays in the queue until it has completed */
+		if ( ( req = ctx->async_head ) == NULL ) break;
+		pthread_mutex_unlock(&ctx->async_lock);
+
+		asyncComplete(req);
+
+		/* the request belongs to its owner from now on */
+		pthread_mutex_lock(&req->lock);
+		req->done = 1;
+		pthread_cond_broadcast(&req->cond);
+		pthread_mutex_unlock(&req->lock);
+
+		pthread_mutex_lock(&ctx->async_lock);
+	}
+
+	pthread_mutex_unlock(&ctx->async_lock);
+
+	return NULL;
+}
+
+/* copy the call in a new request, enqueue its device share and hand it
+ * to the worker thread of the context */
+static phiGemmRequest_t * asyncIssue(char type, size_t size, phiGemmContext_t *ctx,
+		const char *transa, const char *transb, const int *m, const int *n, const int *k,
+		const void *alpha, const void *A, const int *lda, const void *B, const int *ldb,
+		const void *beta, void *C, const int *ldc, const char *file, const char *line)
+{
+	phiGemmContext_t *caller;
+	phiGemmRequest_t *req;
+
+	req = (phiGemmRequest_t *) calloc(1, sizeof(phiGemmRequest_t));
+	if ( req == NULL ) {
+		printf("*** phiGEMM *** ERROR *** cannot allocate a new request!\n");
+		fflush(stdout);
+		exit(EXIT_FAILURE);
+	}
+
+	req->type = type;
+	req->ctx = ( ctx == NULL ) ? &phiGemmDefaultCtx : ctx;
+	req->transa = *transa;
+	req->transb = *transb;
+	req->m = *m;
+	req->n = *n;
+	req->k = *k;
+	req->lda = *lda;
+	req->ldb = *ldb;
+	req->ldc = *ldc;
+	memcpy(req->alpha, alpha, size);
+	memcpy(req->beta, beta, size);
+	req->A = A;
+	req->B = B;
+	req->C = C;
+	req->file = file;
+	req->line = line;
+	pthread_mutex_init(&req->lock, NULL);
+	pthread_cond_init(&req->cond, NULL);
+
+	ctx = req->ctx;
+	caller = phiGemmContextLock(ctx);
+
+	/* a call run whole by the worker owns the devices until it completes,
+	 * the C of a request is not ready before it completes */
+	while ( ctx->async_exclusive > 0 || asyncConflict(ctx, req) )
+		pthread_cond_wait(&ctx->async_idle, &ctx->lock);
+
+	asyncEnqueue(req);
+
+	if ( req->whole )
+		ctx->async_exclusive++;
+	else if ( req->plan.workers > 0 )
+		ctx->async_pending++;
+
+	/* still holding the context, so that the worker sees the requests in order */
+	pthread_mutex_lock(&ctx->async_lock);
+
+	if ( !ctx->async_running ) {
+		if ( pthread_create(&ctx->async_worker, NULL, asyncWorker, ctx) != 0 ) {
+			printf("*** phiGEMM *** ERROR *** cannot start the asynchronous GEMM worker!\n");
+			fflush(stdout);
+			exit(EXIT_FAILURE);
+		}
+		ctx->async_running = 1;
+	}
+
+	if ( ctx->async_tail != NULL )
+		ctx->async_tail->next = req;
+	else
+		ctx->async_head = req;
+	ctx->async_tail = req;
+
+	pthread_cond_signal(&ctx->async_cond);
+	pthread_mutex_unlock(&ctx->async_lock);
+
+	phiGemmContextLeave(ctx, caller);
+
+	return req;
+}
+
+/*
+ * Name			: phiGemmAsyncStop
+ * Description	: the method waits for the requests issued on the context
+ * 				  and stops its worker thread
+ * Visibility	: phiGEMM only
+ */
+void phiGemmAsyncStop(phiGemmContext_t *ctx)
+{
+	pthread_mutex_lock(&ctx->async_lock);
+
+	if ( !ctx->async_running ) {
+		pthread_mutex_unlock(&ctx->async_lock);
+		return;
+	}
+
+	ctx->async_stop = 1;
+	pthread_cond_broadcast(&ctx->async_cond);
+	pthread_mutex_unlock(&ctx->async_lock);
+
+	pthread_join(ctx->async_worker, NULL);
+
+	pthread_mutex_lock(&ctx->async_lock);
+	ctx->async_running = 0;
+	ctx->async_stop = 0;
+	pthread_mutex_unlock(&ctx->async_lock);
+
+	return;
+}
+
+/*
+ * Name			: phiSgemmAsync
+ * Description	: the method starts the SGEMM on the given context (the
+ * 				  default one if ctx is NULL) and returns without waiting
+ * 				  for it; C is off-limits until the request completes
+ * Visibility	: public
+ */
+#if defined(__PHIGEMM_PROFILE)
+phiGemmRequest_t * phiSgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const float *alpha,
+		const float *A, const int *lda, const float *B,
+		const int *ldb, const float *beta, float *C, const int *ldc,
+		const char *file, const char * line)
+{
+	return asyncIssue('s', sizeof(float), ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line);
+}
+#else
+phiGemmRequest_t * phiSgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const float *alpha,
+		const float *A, const int *lda, const float *B,
+		const int *ldb, const float *beta, float *C, const int *ldc)
+{
+	return asyncIssue('s', sizeof(float), ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, NULL, NULL);
+}
+#endif
+
+/*
+ * Name			: phiDgemmAsync
+ * Description	: the method starts the DGEMM on the given context (the
+ * 				  default one if ctx is NULL) and returns without waiting
+ * 				  for it; C is off-limits until the request completes
+ * Visibility	: public
+ */
+#if defined(__PHIGEMM_PROFILE)
+phiGemmRequest_t * phiDgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *A, const int *lda, const double *B,
+		const int *ldb, const double *beta, double *C, const int *ldc,
+		const char *file, const char * line)
+{
+	return asyncIssue('d', sizeof(double), ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line);
+}
+#else
+phiGemmRequest_t * phiDgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *A, const int *lda, const double *B,
+		const int *ldb, const double *beta, double *C, const int *ldc)
+{
+	return asyncIssue('d', sizeof(double), ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, NULL, NULL);
+}
+#endif
+
+/*
+ * Name			: phiCgemmAsync
+ * Description	: the method starts the CGEMM on the given context (the
+ * 				  default one if ctx is NULL) and returns without waiting
+ * 				  for it; C is off-limits until the request completes
+ * Visibility	: public
+ */
+#if defined(__PHIGEMM_PROFILE)
+phiGemmRequest_t * phiCgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiComplex *alpha,
+		const phiComplex *A, const int *lda, const phiComplex *B,
+		const int *ldb, const phiComplex *beta, phiComplex *C,
+		const int *ldc, const char *file, const char * line)
+{
+	return asyncIssue('c', sizeof(phiComplex), ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line);
+}
+#else
+phiGemmRequest_t * phiCgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiComplex *alpha,
+		const phiComplex *A, const int *lda, const phiComplex *B,
+		const int *ldb, const phiComplex *beta, phiComplex *C,
+		const int *ldc)
+{
+	return asyncIssue('c', sizeof(phiComplex), ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, NULL, NULL);
+}
+#endif
+
+/*
+ * Name			: phiZgemmAsync
+ * Description	: the method starts the ZGEMM on the given context (the
+ * 				  default one if ctx is NULL) and returns without waiting
+ * 				  for it; C is off-limits until the request completes
+ * Visibility	: public
+ */
+#if defined(__PHIGEMM_PROFILE)
+phiGemmRequest_t * phiZgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C,
+		const int *ldc, const char *file, const char * line)
+{
+	return asyncIssue('z', sizeof(phiDoubleComplex), ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line);
+}
+#else
+phiGemmRequest_t * phiZgemmAsync (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C,
+		const int *ldc)
+{
+	return asyncIssue('z', sizeof(phiDoubleComplex), ctx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, NULL, NULL);
+}
+#endif
+
+/*
+ * Name			: phiGemmWait
+ * Description	: the method blocks until the request has completed and
+ * 				  releases it
+ * Visibility	: public
+ */
+void phiGemmWait( phiGemmRequest_t *req )
+{
+	if ( req == NULL ) return;
+
+	pthread_mutex_lock(&req->lock);
+	while ( !req->done )
+		pthread_cond_wait(&req->cond, &req->lock);
+	pthread_mutex_unlock(&req->lock);
+
+	pthread_cond_destroy(&req->cond);
+	pthread_mutex_destroy(&req->lock);
+	free(req);
+
+	return;
+}
+
+/*
+ * Name			: phiGemmTest
+ * Description	: the method returns 1 (and releases the request) if the
+ * 				  request has completed, 0 otherwise
+ * Visibility	: public
+ */
+int phiGemmTest( phiGemmRequest_t *req )
+{
+	int done;
+
+	if ( req == NULL ) return 1;
+
+	pthread_mutex_lock(&req->lock);
+	done = req->done;
+	pthread_mutex_unlock(&req->lock);
+
+	if ( done ) phiGemmWait(req);
+
+	return done;
+}
@@ -30,28 +30,29 @@ extern "C"
 {
 #endif
 
-static int is_phigemm_init = 0;
-static int is_external_memory_alloc = 0;
-static int is_internal_memory_alloc = 0;
-static int is_internal_memory_probed = 0;
+// C99-compatible initialization
+#define PHIGEMM_TUNING_DEFAULTS { \
+		.SPLITK_FACTOR  = __SPLITK_FACTOR, \
+		.THRESHOLD      = (int) __SPLITK_FACTOR*1.5, \
+		.SPLITK_DGEMM   = __SPLITK_DGEMM, \
+		.SPLITK_ZGEMM   = __SPLITK_ZGEMM, \
+		.LOWER_LIMIT    = __LOWER_LIMIT, \
+		.UPPER_LIMIT_NM = __UPPER_LIMIT_NM, \
+		.UPPER_LIMIT_K  = __UPPER_LIMIT_K \
+}
 
-struct phiGemmEnv myPhiGemmEnv;
+static const struct phiGemmTuning defaultTng = PHIGEMM_TUNING_DEFAULTS;
 
-#if !defined(__PHIGEMM_CPUONLY)
-struct phiGemmHandler myPhiGemmHdl;
-#endif
-
-// C99-compatible initialization
-struct phiGemmTuning myPhiGemmTng = {
-		.SPLITK_FACTOR  = __SPLITK_FACTOR,
-		.THRESHOLD      = (int) __SPLITK_FACTOR*1.5,
-		.SPLITK_DGEMM   = __SPLITK_DGEMM,
-		.SPLITK_ZGEMM   = __SPLITK_ZGEMM,
-		.LOWER_LIMIT    = __LOWER_LIMIT,
-		.UPPER_LIMIT_NM = __UPPER_LIMIT_NM,
-		.UPPER_LIMIT_K  = __UPPER_LIMIT_K
+phiGemmContext_t phiGemmDefaultCtx = {
+		.tng  = PHIGEMM_TUNING_DEFAULTS,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.async_lock = PTHREAD_MUTEX_INITIALIZER,
+		.async_cond = PTHREAD_COND_INITIALIZER,
+		.async_idle = PTHREAD_COND_INITIALIZER
 };
 
+__thread phiGemmContext_t *phiGemmCtx = &phiGemmDefaultCtx;
+
 
 /* auxiliary */
 int stringCmp( const void *a, const void *b)
@@ -59,95 +60,6 @@ int stringCmp( const void *a, const void *b)
 	return strcmp((const char*)a,(const char*)b);
 }
 
-#if !defined(__PHIGEMM_CPUONLY)
-/* This routine computes the memory required to store the considered matrices */
-size_t memOccupancy(int is_splitA, float split, int m_in, int n_in, int k_in) {
-
-#if defined(__PHIGEMM_GPUONLY)
-	return ( m_in*k_in + k_in*n_in + m_in*n_in );
-#else
-	int m_split, n_split, tmp;
-
-	if (is_splitA) {
-		tmp = (m_in) * split;
-		//		if (m_in < 128)
-		m_split = tmp;
-		//		else
-		//			m_split = floor(tmp/64.0)*64;
-
-		return ( m_split*k_in/myPhiGemmEnv.numDevices + k_in*n_in + m_split*n_in/myPhiGemmEnv.numDevices );
-
-	} else {
-		tmp = (n_in) * split;
-		//		if (n_in < 128)
-		n_split = tmp;
-		//		else
-		//			n_split = floor(tmp/64.0)*64;
-
-		return( m_in*k_in + k_in*n_split/myPhiGemmEnv.numDevices + m_in*n_split/myPhiGemmEnv.numDevices );
-	}
-#endif
-}
-#endif
-
-#if !defined(__PHIGEMM_CPUONLY)
-/* This routine computes the recursive split */
-void bestFit(int is_splitA, float split, int m, int n, int k, int type_size, int *p1, int *p2) {
-
-	size_t memsize_gpu = myPhiGemmHdl.smem[0] * myPhiGemmEnv.numDevices;
-	size_t mem_gpu = memOccupancy(is_splitA, split, m, n, k) * type_size;
-
-#if 0
-	int tmp_m = m;
-	int tmp_n = n;
-
-	// This is ok, much better if we consider  padded matrices...
-	const int step = 64;
-
-	/* repeat until the "new" matrices fit the GPU memory */
-	while (mem_gpu > memsize_gpu) {
-		if (is_splitA) {
-			/* I can assume (to check!!!) that tmp_m is never too small ... */
-			tmp_m = tmp_m - step;
-
-			*p1 = tmp_m;
-			*p2 = m - (*p1);
-
-			/* A:(p1*split x k), B:(k x n), C: (p1*split x n)
-			 * ---> do they fit the GPU memory?
-			 */
-			mem_gpu = memOccupancy(is_splitA, split, *p1, n, k) * type_size;
-		} else {
-			/* I can assume (to check!!!) that tmp_n is never too small ... */
-			tmp_n = tmp_n - step;
-
-			*p1 = tmp_n;
-			*p2 = n - (*p1);
-
-			/* A:(m x k), B:(k x p1*split), C: (m x p1*split)
-			 * ---> do they fit the GPU memory?
-			 */
-			mem_gpu = memOccupancy(is_splitA, split, m, *p1, k) * type_size;
-		}
-#if defined(__PHIGEMM_DEBUG_4)
-		fprintf( stdout,"[PHIGEMM_DEBUG][4] SPLITTING > p1: %d\tp2: %d\tsize (byte):%lu\n", *p1, *p2, mem_gpu); fflush(stdout);
-#endif
-	}
-#else
-	/* ORIGINAL */
-	if (is_splitA) {
-		*p1 = m/2;
-		*p2 = m - (*p1);
-	} else {
-		*p1 = n/2;
-		*p2 = n - (*p1);
-	}
-#endif
-
-	return;
-}
-#endif
-
 #if !defined(__PHIGEMM_CPUONLY)
 /* This routine returns the selected strategy for CPU-GPU splitting */
 int cpuGPUheuristic(int m, int n, int k, char type)
@@ -187,6 +99,93 @@ int cpuGPUheuristic(int m, int n, int k, char type)
 }
 #endif
 
+/*
+ * Name			: phiGemmTypeSize
+ * Description	: size of an element (type is one of 's', 'd', 'c', 'z')
+ * Visibility	: phiGEMM only
+ */
+size_t phiGemmTypeSize(char type)
+{
+	switch (type)
+	{
+	case 's': return sizeof(float);
+	case 'd': return sizeof(double);
+	case 'c': return sizeof(phiComplex);
+	default: return sizeof(phiDoubleComplex);
+	}
+}
+
+#if !defined(__PHIGEMM_CPUONLY)
+/*
+ * Name			: phiGemmCublasOp
+ * Description	: CUBLAS operation of a BLAS transpose character
+ * Visibility	: phiGEMM only
+ */
+cublasOperation_t phiGemmCublasOp(char trans)
+{
+	if ( (trans == 'c') || (trans == 'C') ) return CUBLAS_OP_C;
+	if ( (trans == 't') || (trans == 'T') ) return CUBLAS_OP_T;
+	return CUBLAS_OP_N;
+}
+
+/*
+ * Name			: phiGemmGpuGemm
+ * Description	: the method enqueues a device GEMM of the given precision
+ * 				  on the stream of the handle
+ * Visibility	: phiGEMM only
+ */
+cublasStatus_t phiGemmGpuGemm(char type, cublasHandle_t handle,
+		cublasOperation_t transa, cublasOperation_t transb, int m, int n, int k,
+		const void *alpha, const void *A, int lda, const void *B, int ldb,
+		const void *beta, void *C, int ldc)
+{
+	switch (type)
+	{
+	case 's':
+		return cublasSgemm(handle, transa, transb, m, n, k, (const float *) alpha,
+				(const float *) A, lda, (const float *) B, ldb, (const float *) beta, (float *) C, ldc);
+	case 'd':
+		return cublasDgemm(handle, transa, transb, m, n, k, (const double *) alpha,
+				(const double *) A, lda, (const double *) B, ldb, (const double *) beta, (double *) C, ldc);
+	case 'c':
+		return cublasCgemm(handle, transa, transb, m, n, k, (const phiComplex *) alpha,
+				(const phiComplex *) A, lda, (const phiComplex *) B, ldb, (const phiComplex *) beta, (phiComplex *) C, ldc);
+	default:
+		return cublasZgemm(handle, transa, transb, m, n, k, (const phiDoubleComplex *) alpha,
+				(const phiDoubleComplex *) A, lda, (const phiDoubleComplex *) B, ldb, (const phiDoubleComplex *) beta, (phiDoubleComplex *) C, ldc);
+	}
+}
+#endif
+
+/*
+ * Name			: phiGemmCpuGemm
+ * Description	: the method performs a host GEMM of the given precision
+ * 				  (empty products are skipped)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmCpuGemm(char type, const char *transa, const char *transb, int m, int n, int k,
+		const void *alpha, const void *A, int lda, const void *B, int ldb,
+		const void *beta, void *C, int ldc)
+{
+	if (m <= 0 || n <= 0) return;
+
+	switch (type)
+	{
+	case 's':
+		sgemm_(transa, transb, &m, &n, &k, alpha, A, &lda, B, &ldb, beta, C, &ldc);
+		break;
+	case 'd':
+		dgemm_(transa, transb, &m, &n, &k, alpha, A, &lda, B, &ldb, beta, C, &ldc);
+		break;
+	case 'c':
+		cgemm_(transa, transb, &m, &n, &k, alpha, A, &lda, B, &ldb, beta, C, &ldc);
+		break;
+	default:
+		zgemm_(transa, transb, &m, &n, &k, alpha, A, &lda, B, &ldb, beta, C, &ldc);
+		break;
+	}
+}
+
 // ----
 
 
@@ -198,7 +197,7 @@ int cpuGPUheuristic(int m, int n, int k, char type)
  */
 int phiGemmIsInit()
 {
-	return is_phigemm_init;
+	return phiGemmCtx->is_init;
 }
 #endif
 
@@ -210,7 +209,7 @@ int phiGemmIsInit()
  */
 int phiGemmIsInternalMemAlloc()
 {
-	return is_internal_memory_alloc;
+	return phiGemmCtx->is_internal_memory_alloc;
 }
 #endif
 
@@ -222,7 +221,7 @@ int phiGemmIsInternalMemAlloc()
  */
 int phiGemmIsExternalMemAlloc()
 {
-	return is_external_memory_alloc;
+	return phiGemmCtx->is_external_memory_alloc;
 }
 #endif
 
@@ -310,7 +309,7 @@ void phiGemmInitMemory( phiGemmMemSizes* dev_memsize )
 				// Detect how much memory is available
 				// Assuming a process has exclusive access to the GPU
 
-				is_internal_memory_probed = 1;
+				phiGemmCtx->is_internal_memory_probed = 1;
 
 				/* query the real free memory, taking into account the "stack" */
 				if ( cudaSetDevice( myPhiGemmHdl.devId[i % myPhiGemmEnv.numDevices]) != cudaSuccess) {
@@ -327,7 +326,8 @@ void phiGemmInitMemory( phiGemmMemSizes* dev_memsize )
 
 				cudaMemGetInfo((size_t*)&free, (size_t*)&total);
 
-				myPhiGemmHdl.smem[i] = (size_t) (((free * __SCALING_INIT_MEM ) * 16.0) / 16.0);
+				/* the streams of a device share its memory */
+				myPhiGemmHdl.smem[i] = (size_t) (((free * __SCALING_INIT_MEM ) * 16.0) / 16.0) / NSTREAMS;
 
 			} else {
 
@@ -345,7 +345,7 @@ void phiGemmInitMemory( phiGemmMemSizes* dev_memsize )
 			exit(EXIT_FAILURE);
 		}
 
-		ierr = cudaMalloc ( (void**) &(myPhiGemmHdl.pmem[i % myPhiGemmEnv.numDevices]), (size_t) myPhiGemmHdl.smem[ i ] );
+		ierr = cudaMalloc ( (void**) &(myPhiGemmHdl.pmem[i]), (size_t) myPhiGemmHdl.smem[ i ] );
 		if ( ierr != cudaSuccess) {
 			fprintf( stderr, "\nError in memory allocation, program will be terminated (%d)!!! Bye...\n\n", ierr );
 			exit(EXIT_FAILURE);
@@ -356,6 +356,9 @@ void phiGemmInitMemory( phiGemmMemSizes* dev_memsize )
 		fflush(stdout);
 #endif
 
+		/* the handles and the streams survive phiGemmReleaseMemory */
+		if ( myPhiGemmHdl.handle[ i ] != NULL ) continue;
+
 		/* Attempt to initialize CUBLAS */
 		if ( cublasCreate( &(myPhiGemmHdl.handle[ i ]) ) != CUBLAS_STATUS_SUCCESS ) {
 			printf("*** phiGEMM *** ERROR *** cublasInit() for device %d failed!\n",i);
@@ -376,19 +379,17 @@ void phiGemmInitMemory( phiGemmMemSizes* dev_memsize )
 	myPhiGemmEnv.profileFile = fopen (myPhiGemmEnv.filename, "a");
 #endif
 
-	is_internal_memory_alloc = 1;
+#if defined(__PHIGEMM_OPERAND_CACHE)
+	phiGemmCacheInit();
+#endif
+
+	phiGemmCtx->is_internal_memory_alloc = 1;
 	return;
 }
 #endif
 
-/*
- * Name			: phiGemmInit
- * Description	: the method initialize the library, both GPU binding and
- * 				  memory allocation according to the parameters
- * 				  *** EXPECTED TO CALL ONLY ONCE ***
- * Visibility	: public
- */
-void phiGemmInit( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_memsize, int * deviceToBond, int tag )
+/* the initialization of the context in use (see phiGemmInit) */
+static void contextInit( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_memsize, int * deviceToBond, int tag )
 {
 	unsigned int i;
 
@@ -426,7 +427,7 @@ void phiGemmInit( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_mems
 	 * to capture all the GEMM call and profile them */
 #if !defined(__PHIGEMM_CPUONLY)
 
-	if ( is_phigemm_init == 1 )
+	if ( phiGemmCtx->is_init == 1 )
 		return;
 
 	cudaGetDeviceCount(&deviceCount);
@@ -445,7 +446,7 @@ void phiGemmInit( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_mems
 
 	myPhiGemmEnv.numDevices = nGPU;
 
-	is_internal_memory_probed = 0;
+	phiGemmCtx->is_internal_memory_probed = 0;
 
 	/* Initialize internal phiGEMM data structures */
 	for( i = 0; i < myPhiGemmEnv.numDevices * NSTREAMS; i++ )
@@ -464,7 +465,7 @@ void phiGemmInit( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_mems
 	/* No memory pointer is provided -> Initialize the memory */
 	if(dev_memsize != NULL) {
 
-		// is_internal_memory_probed = 0;
+		// phiGemmCtx->is_internal_memory_probed = 0;
 
 		for (i = 0; i < myPhiGemmEnv.numDevices * NSTREAMS; i++) {
 
@@ -521,11 +522,17 @@ void phiGemmInit( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_mems
 		// printf("\n\n*** phiGEMM *** open the file \n\n");fflush(stdout);
 		myPhiGemmEnv.profileFile = fopen (myPhiGemmEnv.filename, "a");
 #endif
-		is_external_memory_alloc = 1;
+#if defined(__PHIGEMM_OPERAND_CACHE)
+		phiGemmCacheInit();
+#endif
+		phiGemmCtx->is_external_memory_alloc = 1;
 	}
 
+	/* restore the tuning state of previous runs (if PHI_TUNING_DB is set) */
+	phiGemmTuningDBLoad();
+
 	/* set the initialization flag */
-	is_phigemm_init = 1;
+	phiGemmCtx->is_init = 1;
 
 	return;
 
@@ -543,11 +550,49 @@ void phiGemmInit( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_mems
 
 
 /*
- * Name			: phiGemmInitMemory
- * Description	: the method performs the memory allocation on the GPU card
- * Visibility	: public
+ * Name			: phiGemmReleaseMemory
+ * Description	: the method frees the scratch memory allocated internally,
+ * 				  keeping the CUBLAS handles, the streams and the resource
+ * 				  pool for the next call
+ * Visibility	: phiGEMM only
  */
-void phiGemmShutdown()
+void phiGemmReleaseMemory()
+{
+#if !defined(__PHIGEMM_CPUONLY)
+	int i;
+
+	if ( !phiGemmIsInternalMemAlloc() )
+		return;
+
+#if defined(__PHIGEMM_OPERAND_CACHE)
+	phiGemmCacheRelease();
+#endif
+
+	for ( i = 0; i < myPhiGemmEnv.numDevices * NSTREAMS; i++ ){
+
+		/* Attempt to establish a runtime API context */
+		if ( cudaSetDevice( myPhiGemmHdl.devId[i % myPhiGemmEnv.numDevices] ) != cudaSuccess) {
+			printf("*** phiGEMM: *** ERROR *** cudaSetDevice(%d) failed!\n",i);
+			exit(EXIT_FAILURE);
+		}
+
+		if (  cudaFree(myPhiGemmHdl.pmem[i]) != cudaSuccess) {
+			printf("*** phiGEMM: *** ERROR *** cudaFree(%d) failed!\n",i);
+			// exit(EXIT_FAILURE);
+		}
+
+		myPhiGemmHdl.pmem[ i ] = NULL;
+		if (phiGemmCtx->is_internal_memory_probed) {
+			myPhiGemmHdl.smem[ i ] = 0;
+		}
+	}
+
+	phiGemmCtx->is_internal_memory_alloc = 0;
+#endif
+}
+
+/* the shutdown of the context in use, its requests completed (see phiGemmShutdown) */
+static void contextShutdown()
 {
 	int i;
 
@@ -556,66 +601,60 @@ void phiGemmShutdown()
 #if !defined(__PHIGEMM_CPUONLY)
 
 #if defined(__PHIGEMM_DEBUG)
-	printf("[PHIGEMM_DEBUG] *** shutdown *** is_phigemm_init:%d, is_external_memory_alloc:%d, is_internal_memory_alloc:%d, devices: %d\n",is_phigemm_init, is_external_memory_alloc, is_internal_memory_alloc, myPhiGemmEnv.numDevices);
+	printf("[PHIGEMM_DEBUG] *** shutdown *** is_phigemm_init:%d, is_external_memory_alloc:%d, is_internal_memory_alloc:%d, devices: %d\n",phiGemmCtx->is_init, phiGemmCtx->is_external_memory_alloc, phiGemmCtx->is_internal_memory_alloc, myPhiGemmEnv.numDevices);
 	fflush(stdout);
 #endif
 
-	if ( !is_phigemm_init )
+	if ( !phiGemmCtx->is_init )
 		return;
 
-	if ( phiGemmIsExternalMemAlloc() ){
+	phiGemmTuningDBStore();
+	phiGemmShapeReset();
 
-		for (i = 0; i < myPhiGemmEnv.numDevices ; i++) {
+	phiGemmPoolRelease();
 
-			/* Attempt to establish a runtime API context */
-			if ( cudaSetDevice( myPhiGemmHdl.devId[i % myPhiGemmEnv.numDevices] ) != cudaSuccess) {
-				printf("*** phiGEMM: *** ERROR *** cudaSetDevice(%d) failed!\n",i);
-				exit(EXIT_FAILURE);
-			}
+#if defined(__PHIGEMM_PROFILE) && defined(__PHIGEMM_OPERAND_CACHE)
+	/* the profile file is open as long as the memory allocated internally */
+	if ( phiGemmIsInternalMemAlloc() )
+		fclose (myPhiGemmEnv.profileFile);
+#endif
 
-			cudaStreamDestroy( myPhiGemmHdl.stream[ i ] );
-			cublasDestroy( myPhiGemmHdl.handle[ i ]);
+	phiGemmReleaseMemory();
 
-			is_external_memory_alloc = 0;
-			is_phigemm_init = 0;
+	for (i = 0; i < myPhiGemmEnv.numDevices * NSTREAMS; i++) {
 
-#if defined(__PHIGEMM_PROFILE)
-			// printf("\n\n*** phiGEMM *** close the file \n\n");fflush(stdout);
-			fclose (myPhiGemmEnv.profileFile);
-#endif
+		if ( myPhiGemmHdl.handle[ i ] == NULL ) continue;
 
+		/* Attempt to establish a runtime API context */
+		if ( cudaSetDevice( myPhiGemmHdl.devId[i % myPhiGemmEnv.numDevices] ) != cudaSuccess) {
+			printf("*** phiGEMM: *** ERROR *** cudaSetDevice(%d) failed!\n",i);
+			exit(EXIT_FAILURE);
 		}
-	}
 
-	if ( phiGemmIsInternalMemAlloc() ){
+		cudaStreamDestroy( myPhiGemmHdl.stream[ i ] );
+		cublasDestroy( myPhiGemmHdl.handle[ i ]);
 
-		for ( i = 0; i < myPhiGemmEnv.numDevices; i++ ){
-
-			/* Attempt to establish a runtime API context */
-			if ( cudaSetDevice( myPhiGemmHdl.devId[i % myPhiGemmEnv.numDevices] ) != cudaSuccess) {
-				printf("*** phiGEMM: *** ERROR *** cudaSetDevice(%d) failed!\n",i);
-				exit(EXIT_FAILURE);
-			}
+		myPhiGemmHdl.handle[ i ] = NULL;
+		myPhiGemmHdl.stream[ i ] = NULL;
+	}
 
-			if (  cudaFree(myPhiGemmHdl.pmem[i]) != cudaSuccess) {
-				printf("*** phiGEMM: *** ERROR *** cudaFree(%d) failed!\n",i);
-				// exit(EXIT_FAILURE);
-			}
+	if ( phiGemmIsExternalMemAlloc() ){
 
-			cudaStreamDestroy( myPhiGemmHdl.stream[ i ] );
-			cublasDestroy( myPhiGemmHdl.handle[ i ]);
+#if defined(__PHIGEMM_OPERAND_CACHE)
+		phiGemmCacheRelease();
+#endif
 
-			myPhiGemmHdl.pmem[ i ] = NULL;
-			if (is_internal_memory_probed) {
-				myPhiGemmHdl.smem[ i ] = 0;
-			}
-			myPhiGemmHdl.handle[ i ] = NULL;
-			myPhiGemmHdl.stream[ i ] = NULL;
-		}
+		phiGemmCtx->is_external_memory_alloc = 0;
 
-		is_internal_memory_alloc = 0;
+#if defined(__PHIGEMM_PROFILE)
+		// printf("\n\n*** phiGEMM *** close the file \n\n");fflush(stdout);
+		fclose (myPhiGemmEnv.profileFile);
+#endif
 	}
 
+	/* a later phiGemmInit() starts over (and reloads the tuning database) */
+	phiGemmCtx->is_init = 0;
+
 	return;
 
 #else
@@ -630,6 +669,47 @@ void phiGemmShutdown()
 
 }
 
+/*
+ * Name			: phiGemmInit
+ * Description	: the method initialize the library, both GPU binding and
+ * 				  memory allocation according to the parameters, on the
+ * 				  default context
+ * 				  *** EXPECTED TO CALL ONLY ONCE ***
+ * Visibility	: public
+ */
+void phiGemmInit( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_memsize, int * deviceToBond, int tag )
+{
+	phiGemmContext_t *caller = phiGemmContextEnter(&phiGemmDefaultCtx);
+
+	contextInit( nGPU, dev_ptr, dev_memsize, deviceToBond, tag );
+
+	phiGemmContextLeave(&phiGemmDefaultCtx, caller);
+
+	return;
+}
+
+/*
+ * Name			: phiGemmShutdown
+ * Description	: the method releases the devices, the scratch memory and
+ * 				  the resources of the default context
+ * Visibility	: public
+ */
+void phiGemmShutdown()
+{
+	phiGemmContext_t *caller;
+
+	/* the phi?gemmAsync requests complete first (their worker takes the lock) */
+	phiGemmAsyncStop(&phiGemmDefaultCtx);
+
+	caller = phiGemmContextEnter(&phiGemmDefaultCtx);
+
+	contextShutdown();
+
+	phiGemmContextLeave(&phiGemmDefaultCtx, caller);
+
+	return;
+}
+
 #if !defined(__PHIGEMM_CPUONLY)
 void phiGemmSetAvaiableScratchSpace(int gpu_id, size_t new_dev_memsize) {
 	myPhiGemmHdl.smem[ myPhiGemmHdl.devId[gpu_id] ] = (size_t) new_dev_memsize;
@@ -641,6 +721,119 @@ void phiGemmSetAvaiableScratchSpace(int gpu_id, size_t new_dev_memsize) {
 }
 #endif
 
+/*
+ * Name			: phiGemmCreate
+ * Description	: the method returns a new phiGEMM context, initialized as
+ * 				  phiGemmInit does with the same parameters. The context
+ * 				  has its own devices, scratch memory, streams and tuning
+ * Visibility	: public
+ */
+phiGemmContext_t * phiGemmCreate( int nGPU, phiGemmMemDevPtr* dev_ptr, phiGemmMemSizes* dev_memsize, int * deviceToBond, int tag )
+{
+	phiGemmContext_t *ctx, *caller;
+
+	ctx = (phiGemmContext_t *) calloc(1, sizeof(phiGemmContext_t));
+	if ( ctx == NULL ) {
+		printf("*** phiGEMM *** ERROR *** cannot allocate a new context!\n");
+		fflush(stdout);
+		exit(EXIT_FAILURE);
+	}
+
+	ctx->tng = defaultTng;
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_mutex_init(&ctx->async_lock, NULL);
+	pthread_cond_init(&ctx->async_cond, NULL);
+	pthread_cond_init(&ctx->async_idle, NULL);
+
+	caller = phiGemmContextEnter(ctx);
+	contextInit( nGPU, dev_ptr, dev_memsize, deviceToBond, tag );
+	phiGemmContextLeave(ctx, caller);
+
+	return ctx;
+}
+
+/*
+ * Name			: phiGemmDestroy
+ * Description	: the method shuts down and releases a context returned by
+ * 				  phiGemmCreate (no GEMM can be running on it, its
+ * 				  phi?gemmAsync requests complete first)
+ * Visibility	: public
+ */
+void phiGemmDestroy( phiGemmContext_t *ctx )
+{
+	phiGemmContext_t *caller;
+
+	if ( ctx == NULL || ctx == &phiGemmDefaultCtx )
+		return;
+
+	phiGemmAsyncStop(ctx);
+
+	caller = phiGemmContextEnter(ctx);
+	contextShutdown();
+	phiGemmContextLeave(ctx, caller);
+
+	pthread_mutex_destroy(&ctx->lock);
+	pthread_mutex_destroy(&ctx->async_lock);
+	pthread_cond_destroy(&ctx->async_cond);
+	pthread_cond_destroy(&ctx->async_idle);
+	free(ctx);
+
+	return;
+}
+
+/*
+ * Name			: phiGemmContextEnter
+ * Description	: the method acquires the context, once the phi?gemmAsync
+ * 				  requests in flight on it have completed, and makes it the
+ * 				  one of the calling thread, returning the previous one
+ * Visibility	: phiGEMM only
+ */
+phiGemmContext_t * phiGemmContextEnter(phiGemmContext_t *ctx)
+{
+	phiGemmContext_t *caller = phiGemmCtx;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	/* their tiles still use the scratch memory and the streams */
+	while ( ctx->async_pending > 0 )
+		pthread_cond_wait(&ctx->async_idle, &ctx->lock);
+
+	phiGemmCtx = ctx;
+
+	return caller;
+}
+
+/*
+ * Name			: phiGemmContextLock
+ * Description	: the method acquires the context as phiGemmContextEnter
+ * 				  does, without waiting for the phi?gemmAsync requests in
+ * 				  flight (see phigemm_async.c)
+ * Visibility	: phiGEMM only
+ */
+phiGemmContext_t * phiGemmContextLock(phiGemmContext_t *ctx)
+{
+	phiGemmContext_t *caller = phiGemmCtx;
+
+	pthread_mutex_lock(&ctx->lock);
+	phiGemmCtx = ctx;
+
+	return caller;
+}
+
+/*
+ * Name			: phiGemmContextLeave
+ * Description	: the method releases the context and restores the one the
+ * 				  calling thread was using before phiGemmContextEnter
+ * Visibility	: phiGEMM only
+ */
+void phiGemmContextLeave(phiGemmContext_t *ctx, phiGemmContext_t *caller)
+{
+	phiGemmCtx = caller;
+	pthread_mutex_unlock(&ctx->lock);
+
+	return;
+}
+
 /* ------------ FORTRAN INTERFACES FOR PHIGEMM PUBLIC METHODS -------------- */
 void phigemminit_(int nGPU, phiGemmMemDevPtr* ptr, phiGemmMemSizes* dev_memsize, int * deviceToBond, int tag ){ phiGemmInit( nGPU, ptr, dev_memsize, deviceToBond, tag); }
 
@@ -0,0 +1,504 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+/*
+ * Batched GEMMs (phi?gemmBatched, phi?gemmStridedBatched).
+ *
+ * Many products of the same shape, each one too small to be worth a
+ * split. The batch as a whole is split instead: the first batch * split
+ * entries go to the devices, the others to the CPU, split being the
+ * share the cost model predicts for the entries (phiGemmModelBatchSplit).
+ *
+ * Every worker (device, stream) takes a contiguous range of the device
+ * entries. The entries of a round, as many as fit its scratch memory, are
+ * packed on the host one after the other (A, B and C of an entry next to
+ * each other) in a pinned buffer of the pool, uploaded with one transfer,
+ * computed with one strided batched launch and downloaded with one
+ * transfer.
+ *
+ * The CPU entries are spread over myPhiGemmEnv.cores OpenMP threads, one
+ * entry per BLAS call. Every thread sets its own team size to one, so a
+ * BLAS threaded with OpenMP runs each entry on the calling thread only.
+ * The thread driving the devices joins them once its rounds are done.
+ */
+
+typedef struct phiGemmBatch
+{
+	char type;
+	const char *transa, *transb;
+	int m, n, k, lda, ldb, ldc;
+	int is_transa, is_transb;
+	size_t ts;
+	const void *alpha, *beta;
+
+	/* pointer-array form (Ap != NULL) or strided form */
+	const void *const *Ap, *const *Bp;
+	void *const *Cp;
+	const char *A, *B;
+	char *C;
+	long long strideA, strideB, strideC;
+} phiGemmBatch_t;
+
+/* operands of entry i */
+static void batchEntry(const phiGemmBatch_t *b, int i, const char **A, const char **B, char **C)
+{
+	if ( b->Ap != NULL ) {
+		*A = (const char *) b->Ap[i];
+		*B = (const char *) b->Bp[i];
+		*C = (char *) b->Cp[i];
+	} else {
+		*A = b->A + i * b->strideA * b->ts;
+		*B = b->B + i * b->strideB * b->ts;
+		*C = b->C + i * b->strideC * b->ts;
+	}
+}
+
+/* copy a rows x cols column-major block */
+static void batchCopy(char *dst, int ldd, const char *src, int lds, int rows, int cols, size_t ts)
+{
+	int j;
+
+	for (j = 0; j < cols; j++)
+		memcpy(dst + (size_t) j * ldd * ts, src + (size_t) j * lds * ts, rows * ts);
+}
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+static cublasStatus_t batchGpuGemm(char type, cublasHandle_t handle,
+		cublasOperation_t transa, cublasOperation_t transb, int m, int n, int k,
+		const void *alpha, const void *A, int lda, long long strideA,
+		const void *B, int ldb, long long strideB, const void *beta,
+		void *C, int ldc, long long strideC, int batch)
+{
+	switch (type)
+	{
+	case 's':
+		return cublasSgemmStridedBatched(handle, transa, transb, m, n, k, (const float *) alpha,
+				(const float *) A, lda, strideA, (const float *) B, ldb, strideB,
+				(const float *) beta, (float *) C, ldc, strideC, batch);
+	case 'd':
+		return cublasDgemmStridedBatched(handle, transa, transb, m, n, k, (const double *) alpha,
+				(const double *) A, lda, strideA, (const double *) B, ldb, strideB,
+				(const double *) beta, (double *) C, ldc, strideC, batch);
+	case 'c':
+		return cublasCgemmStridedBatched(handle, transa, transb, m, n, k, (const phiComplex *) alpha,
+				(const phiComplex *) A, lda, strideA, (const phiComplex *) B, ldb, strideB,
+				(const phiComplex *) beta, (phiComplex *) C, ldc, strideC, batch);
+	default:
+		return cublasZgemmStridedBatched(handle, transa, transb, m, n, k, (const phiDoubleComplex *) alpha,
+				(const phiDoubleComplex *) A, lda, strideA, (const phiDoubleComplex *) B, ldb, strideB,
+				(const phiDoubleComplex *) beta, (phiDoubleComplex *) C, ldc, strideC, batch);
+	}
+}
+
+/* entries [first, first + count) on the devices */
+static void batchDevices(const phiGemmBatch_t *b, int first, int count, int beta_is_zero)
+{
+	int workers = myPhiGemmEnv.numDevices * NSTREAMS;
+	int w, i, j, busy, lo[ NSTREAMS * MAX_GPUS ], hi[ NSTREAMS * MAX_GPUS ], round[ NSTREAMS * MAX_GPUS ];
+	int rowsA, colsA, rowsB, colsB, up;
+	size_t sizeA, sizeB, sizeC, entry, room;
+	char *staging[ NSTREAMS * MAX_GPUS ], *slot, *devPtr;
+	int pageable[ NSTREAMS * MAX_GPUS ];
+	const char *A, *B;
+	char *C;
+	cublasStatus_t status;
+
+	rowsA = b->is_transa ? b->k : b->m;
+	colsA = b->is_transa ? b->m : b->k;
+	rowsB = b->is_transb ? b->n : b->k;
+	colsB = b->is_transb ? b->k : b->n;
+
+	sizeA = (size_t) b->m * b->k;
+	sizeB = (size_t) b->k * b->n;
+	sizeC = (size_t) b->m * b->n;
+	entry = sizeA + sizeB + sizeC;
+
+	/* C is uploaded only if it is read */
+	up = (int) ( beta_is_zero ? sizeA + sizeB : entry );
+
+	for (w = 0; w < workers; w++) {
+		lo[w] = first + (int) ( (long long) count * w / workers );
+		hi[w] = first + (int) ( (long long) count * (w + 1) / workers );
+
+		room = myPhiGemmHdl.smem[w] / (entry * b->ts);
+		round[w] = (int) imin( (size_t) (hi[w] - lo[w]), room );
+
+		staging[w] = NULL;
+		pageable[w] = 0;
+		if ( round[w] > 0 ) {
+			/* pinned, so that the transfers of the workers overlap; pageable if the pool is full */
+			staging[w] = (char *) phiGemmPoolHostAlloc( round[w] * entry * b->ts );
+			if ( staging[w] == NULL ) {
+				staging[w] = (char *) malloc( round[w] * entry * b->ts );
+				pageable[w] = 1;
+			}
+			if ( staging[w] == NULL ) {
+				printf("*** phiGEMM *** ERROR *** allocation of the batch staging buffer failed!\n");
+				fflush(stdout);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	do {
+		busy = 0;
+
+		for (w = 0; w < workers; w++) {
+
+			round[w] = imin(round[w], hi[w] - lo[w]);
+			if ( round[w] <= 0 ) continue;
+
+			cudaSetDevice(myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+
+			for (i = 0; i < round[w]; i++) {
+				batchEntry(b, lo[w] + i, &A, &B, &C);
+				slot = staging[w] + i * entry * b->ts;
+				batchCopy(slot, rowsA, A, b->lda, rowsA, colsA, b->ts);
+				batchCopy(slot + sizeA * b->ts, rowsB, B, b->ldb, rowsB, colsB, b->ts);
+				if ( !beta_is_zero )
+					batchCopy(slot + (sizeA + sizeB) * b->ts, b->m, C, b->ldc, b->m, b->n, b->ts);
+			}
+
+			devPtr = (char *) myPhiGemmHdl.pmem[w];
+
+			status = cublasSetMatrixAsync(up, round[w], b->ts, staging[w], (int) entry,
+					devPtr, (int) entry, myPhiGemmHdl.stream[w]);
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: device access error (H2D batch) %d\n", w, status); fflush(stderr);
+			}
+
+			status = batchGpuGemm(b->type, myPhiGemmHdl.handle[w],
+					phiGemmCublasOp(*b->transa), phiGemmCublasOp(*b->transb), b->m, b->n, b->k,
+					b->alpha, devPtr, rowsA, entry, devPtr + sizeA * b->ts, rowsB, entry,
+					b->beta, devPtr + (sizeA + sizeB) * b->ts, b->m, entry, round[w]);
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: batched GEMM error %d\n", w, status); fflush(stderr);
+			}
+
+			status = cublasGetMatrixAsync((int) sizeC, round[w], b->ts, devPtr + (sizeA + sizeB) * b->ts, (int) entry,
+					staging[w] + (sizeA + sizeB) * b->ts, (int) entry, myPhiGemmHdl.stream[w]);
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: device access error (D2H batch) %d\n", w, status); fflush(stderr);
+			}
+
+			busy = 1;
+		}
+
+		for (w = 0; w < workers; w++) {
+
+			if ( round[w] <= 0 || lo[w] >= hi[w] ) continue;
+
+			cudaSetDevice(myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+			cudaStreamSynchronize(myPhiGemmHdl.stream[w]);
+
+			for (j = 0; j < round[w]; j++) {
+				batchEntry(b, lo[w] + j, &A, &B, &C);
+				batchCopy(C, b->ldc, staging[w] + ( j * entry + sizeA + sizeB ) * b->ts, b->m, b->m, b->n, b->ts);
+			}
+
+			lo[w] += round[w];
+		}
+
+	} while (busy);
+
+	for (w = 0; w < workers; w++) {
+		if ( staging[w] == NULL ) continue;
+		if ( pageable[w] )
+			free(staging[w]);
+		else
+			phiGemmPoolHostFree(staging[w]);
+	}
+}
+#endif
+
+/* the batch split between the devices and the CPU threads of the context */
+static void batchRun(phiGemmContext_t *ctx, phiGemmBatch_t *b, int batch)
+{
+	phiGemmContext_t *caller = phiGemmContextEnter(ctx);
+	int i, ndev = 0, nthreads, beta_is_zero;
+	const char *A, *B;
+	char *C;
+
+	/* all-zero bytes are a zero of every precision */
+	static const double zero[2] = { 0.0, 0.0 };
+
+#if defined(__PHIGEMM_DEBUG_4)
+	double start = phigemm_cclock();
+#endif
+
+	b->ts = phiGemmTypeSize(b->type);
+	b->is_transa = (*b->transa != 'n') && (*b->transa != 'N');
+	b->is_transb = (*b->transb != 'n') && (*b->transb != 'N');
+	beta_is_zero = !memcmp(b->beta, zero, b->ts);
+
+#if !defined(__PHIGEMM_CPUONLY)
+	if ( phiGemmIsInit() && batch > 0 && b->m > 0 && b->n > 0 ) {
+		float split;
+		size_t entry = ( (size_t) b->m * b->k + (size_t) b->k * b->n + (size_t) b->m * b->n ) * b->ts;
+		int w;
+
+		if ( !phiGemmIsInternalMemAlloc() && !phiGemmIsExternalMemAlloc() )
+			phiGemmInitMemory(NULL);
+
+#if defined(__PHIGEMM_GPUONLY)
+		split = 1.0;
+#else
+		split = phiGemmModelBatchSplit(b->type, b->transa, b->transb, b->m, b->n, b->k, beta_is_zero);
+#endif
+		ndev = (int) (batch * split);
+
+		/* every worker must hold at least one entry */
+		for (w = 0; w < myPhiGemmEnv.numDevices * NSTREAMS; w++)
+			if ( myPhiGemmHdl.smem[w] < entry ) ndev = 0;
+	}
+#endif
+
+	nthreads = imax(1, myPhiGemmEnv.cores);
+
+#pragma omp parallel num_threads(nthreads) private(i, A, B, C)
+	{
+#if !defined(__PHIGEMM_CPUONLY)
+#pragma omp master
+		{
+			if ( ndev > 0 ) batchDevices(b, 0, ndev, beta_is_zero);
+		}
+#endif
+
+#if defined(_OPENMP)
+		/* the team of a parallel region opened by the BLAS: this thread only */
+		omp_set_num_threads(1);
+#endif
+
+#pragma omp for schedule(dynamic)
+		for (i = ndev; i < batch; i++) {
+			batchEntry(b, i, &A, &B, &C);
+			phiGemmCpuGemm(b->type, b->transa, b->transb, b->m, b->n, b->k,
+					b->alpha, A, b->lda, B, b->ldb, b->beta, C, b->ldc);
+		}
+	}
+
+#if !defined(__PHIGEMM_CPUONLY)
+	if ( ndev > 0 ) cudaSetDevice(myPhiGemmHdl.devId[0]);
+#endif
+
+#if defined(__PHIGEMM_DEBUG_4)
+	printf("[PHIGEMM_DEBUG][4] batched %d x (%d x %d x %d): %d to the devices, %d to the CPU (%d threads), %10.6f s\n",
+			batch, b->m, b->n, b->k, ndev, batch - ndev, nthreads, phigemm_cclock() - start);
+	fflush(stdout);
+#endif
+
+	phiGemmContextLeave(ctx, caller);
+}
+
+static void batchPointers(phiGemmBatch_t *b, char type, const char *transa, const char *transb,
+		const int *m, const int *n, const int *k, const void *alpha,
+		const void *const *A, const int *lda, const void *const *B, const int *ldb,
+		const void *beta, void *const *C, const int *ldc)
+{
+	memset(b, 0, sizeof(phiGemmBatch_t));
+
+	b->type = type;
+	b->transa = transa;
+	b->transb = transb;
+	b->m = *m;
+	b->n = *n;
+	b->k = *k;
+	b->lda = *lda;
+	b->ldb = *ldb;
+	b->ldc = *ldc;
+	b->alpha = alpha;
+	b->beta = beta;
+	b->Ap = A;
+	b->Bp = B;
+	b->Cp = C;
+}
+
+static void batchStrided(phiGemmBatch_t *b, char type, const char *transa, const char *transb,
+		const int *m, const int *n, const int *k, const void *alpha,
+		const void *A, const int *lda, const long long *strideA,
+		const void *B, const int *ldb, const long long *strideB,
+		const void *beta, void *C, const int *ldc, const long long *strideC)
+{
+	memset(b, 0, sizeof(phiGemmBatch_t));
+
+	b->type = type;
+	b->transa = transa;
+	b->transb = transb;
+	b->m = *m;
+	b->n = *n;
+	b->k = *k;
+	b->lda = *lda;
+	b->ldb = *ldb;
+	b->ldc = *ldc;
+	b->alpha = alpha;
+	b->beta = beta;
+	b->A = (const char *) A;
+	b->B = (const char *) B;
+	b->C = (char *) C;
+	b->strideA = *strideA;
+	b->strideB = *strideB;
+	b->strideC = *strideC;
+}
+
+
+/*
+ * Name			: phiDgemmBatchedEx
+ * Description	: the method performs batchCount DGEMMs of the same shape,
+ * 				  C[i] = alpha * op(A[i]) * op(B[i]) + beta * C[i]
+ * 				  on the given context (serialized with the other calls on it)
+ * Visibility	: public
+ */
+void phiDgemmBatchedEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *const A[], const int *lda, const double *const B[],
+		const int *ldb, const double *beta, double *const C[], const int *ldc,
+		const int *batchCount)
+{
+	phiGemmBatch_t b;
+
+	batchPointers(&b, 'd', transa, transb, m, n, k, alpha, (const void *const *) A, lda,
+			(const void *const *) B, ldb, beta, (void *const *) C, ldc);
+	batchRun(ctx, &b, *batchCount);
+}
+
+/*
+ * Name			: phiDgemmBatched
+ * Description	: the method performs phiDgemmBatchedEx on the default context
+ * Visibility	: public
+ */
+void phiDgemmBatched (const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *const A[], const int *lda, const double *const B[],
+		const int *ldb, const double *beta, double *const C[], const int *ldc,
+		const int *batchCount)
+{
+	phiDgemmBatchedEx(&phiGemmDefaultCtx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, batchCount);
+}
+
+/*
+ * Name			: phiDgemmStridedBatchedEx
+ * Description	: the method performs batchCount DGEMMs of the same shape,
+ * 				  the operands of entry i at A + i * strideA, B + i * strideB
+ * 				  and C + i * strideC
+ * 				  on the given context (serialized with the other calls on it)
+ * Visibility	: public
+ */
+void phiDgemmStridedBatchedEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *A, const int *lda, const long long *strideA,
+		const double *B, const int *ldb, const long long *strideB,
+		const double *beta, double *C, const int *ldc, const long long *strideC,
+		const int *batchCount)
+{
+	phiGemmBatch_t b;
+
+	batchStrided(&b, 'd', transa, transb, m, n, k, alpha, A, lda, strideA,
+			B, ldb, strideB, beta, C, ldc, strideC);
+	batchRun(ctx, &b, *batchCount);
+}
+
+/*
+ * Name			: phiDgemmStridedBatched
+ * Description	: the method performs phiDgemmStridedBatchedEx on the default context
+ * Visibility	: public
+ */
+void phiDgemmStridedBatched (const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const double *alpha,
+		const double *A, const int *lda, const long long *strideA,
+		const double *B, const int *ldb, const long long *strideB,
+		const double *beta, double *C, const int *ldc, const long long *strideC,
+		const int *batchCount)
+{
+	phiDgemmStridedBatchedEx(&phiGemmDefaultCtx, transa, transb, m, n, k, alpha, A, lda, strideA, B, ldb, strideB, beta, C, ldc, strideC, batchCount);
+}
+
+/*
+ * Name			: phiZgemmBatchedEx
+ * Description	: the method performs batchCount ZGEMMs of the same shape,
+ * 				  C[i] = alpha * op(A[i]) * op(B[i]) + beta * C[i]
+ * 				  on the given context (serialized with the other calls on it)
+ * Visibility	: public
+ */
+void phiZgemmBatchedEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *const A[], const int *lda, const phiDoubleComplex *const B[],
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *const C[],
+		const int *ldc, const int *batchCount)
+{
+	phiGemmBatch_t b;
+
+	batchPointers(&b, 'z', transa, transb, m, n, k, alpha, (const void *const *) A, lda,
+			(const void *const *) B, ldb, beta, (void *const *) C, ldc);
+	batchRun(ctx, &b, *batchCount);
+}
+
+/*
+ * Name			: phiZgemmBatched
+ * Description	: the method performs phiZgemmBatchedEx on the default context
+ * Visibility	: public
+ */
+void phiZgemmBatched (const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *const A[], const int *lda, const phiDoubleComplex *const B[],
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *const C[],
+		const int *ldc, const int *batchCount)
+{
+	phiZgemmBatchedEx(&phiGemmDefaultCtx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, batchCount);
+}
+
+/*
+ * Name			: phiZgemmStridedBatchedEx
+ * Description	: the method performs batchCount ZGEMMs of the same shape,
+ * 				  the operands of entry i at A + i * strideA, B + i * strideB
+ * 				  and C + i * strideC
+ * 				  on the given context (serialized with the other calls on it)
+ * Visibility	: public
+ */
+void phiZgemmStridedBatchedEx (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const long long *strideA,
+		const phiDoubleComplex *B, const int *ldb, const long long *strideB,
+		const phiDoubleComplex *beta, phiDoubleComplex *C, const int *ldc,
+		const long long *strideC, const int *batchCount)
+{
+	phiGemmBatch_t b;
+
+	batchStrided(&b, 'z', transa, transb, m, n, k, alpha, A, lda, strideA,
+			B, ldb, strideB, beta, C, ldc, strideC);
+	batchRun(ctx, &b, *batchCount);
+}
+
+/*
+ * Name			: phiZgemmStridedBatched
+ * Description	: the method performs phiZgemmStridedBatchedEx on the default context
+ * Visibility	: public
+ */
+void phiZgemmStridedBatched (const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const long long *strideA,
+		const phiDoubleComplex *B, const int *ldb, const long long *strideB,
+		const phiDoubleComplex *beta, phiDoubleComplex *C, const int *ldc,
+		const long long *strideC, const int *batchCount)
+{
+	phiZgemmStridedBatchedEx(&phiGemmDefaultCtx, transa, transb, m, n, k, alpha, A, lda, strideA, B, ldb, strideB, beta, C, ldc, strideC, batchCount);
+}
@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY) && defined(__PHIGEMM_OPERAND_CACHE)
+
+/*
+ * Device operand cache (__PHIGEMM_OPERAND_CACHE).
+ *
+ * Applications calling GEMM in a loop often pass the same A (or B) again
+ * and again. Every worker keeps the last tiles of A and B it uploaded in
+ * the top of its scratch memory (PHI_OPERAND_CACHE_MB, a quarter of the
+ * scratch memory by default) and a later call uploading the same block
+ * skips the H2D transfer.
+ *
+ * A block is identified by its host address, leading dimension, extents
+ * and a key: the generation the caller assigned to the buffer with
+ * phiGemmCacheSetGeneration (to be bumped at every update of the buffer)
+ * or, otherwise, a fingerprint of 64 elements sampled over the block. The
+ * fingerprint is cheap but does not see a change to a few elements only:
+ * such buffers must be given a generation.
+ *
+ * The blocks are placed first-fit; when there is no room the least
+ * recently used one is evicted, except the ones used by the call in
+ * progress.
+ *
+ * For the cache to outlive a call, the scratch memory allocated
+ * internally (phiGemmInit without device pointers) is not given back at
+ * the end of every call as usual: it is kept, with the cached blocks,
+ * until phiGemmShutdown.
+ */
+
+// Elements sampled by the fingerprint
+#define CACHE_SAMPLES 64
+
+// Alignment of the cached blocks
+#define CACHE_ALIGN 256
+
+// Every context owns its cache
+#define operandCache (myPhiGemmHdl.cache)
+
+static unsigned long cacheFingerprint(const char *host, int ld, int rows, int cols, size_t ts)
+{
+	unsigned long h = 14695981039346656037UL;
+	size_t b, e, count = (size_t) rows * cols;
+	const unsigned char *p;
+	int s, r, c;
+
+	for (s = 0; s < CACHE_SAMPLES; s++) {
+		e = ( s == CACHE_SAMPLES - 1 ) ? count - 1 : (count * s) / CACHE_SAMPLES;
+		r = e % rows;
+		c = e / rows;
+
+		p = (const unsigned char *) ( host + ( (size_t) c * ld + r ) * ts );
+		for (b = 0; b < ts; b++) {
+			h ^= p[b];
+			h *= 1099511628211UL;
+		}
+	}
+
+	return h;
+}
+
+/* the generation assigned to host (0 if none) */
+static unsigned long cacheGeneration(const void *host)
+{
+	int i;
+
+	for (i = 0; i < __PHIGEMM_CACHE_ENTRIES; i++)
+		if ( operandCache.gen_host[i] == host ) return operandCache.gen_value[i];
+
+	return 0;
+}
+
+/* first offset of a free gap of bytes in the cache of w (-1 if none) */
+static long cacheFit(int w, size_t bytes)
+{
+	phiGemmCacheEntry_t *entry = operandCache.entry[w];
+	size_t start = 0, end;
+	int i, next;
+
+	for (;;) {
+
+		/* the block starting first at or after start */
+		next = -1;
+		for (i = 0; i < __PHIGEMM_CACHE_ENTRIES; i++)
+			if ( entry[i].used && entry[i].offset + entry[i].bytes > start &&
+					( next < 0 || entry[i].offset < entry[next].offset ) )
+				next = i;
+
+		end = ( next < 0 ) ? operandCache.size[w] : entry[next].offset;
+
+		if ( end >= start && end - start >= bytes ) return (long) start;
+		if ( next < 0 ) return -1;
+
+		start = entry[next].offset + entry[next].bytes;
+	}
+}
+
+/*
+ * Name			: phiGemmCacheInit
+ * Description	: the method reserves the top of the scratch memory of every
+ * 				  worker to the operand cache
+ * Visibility	: phiGEMM only
+ */
+void phiGemmCacheInit()
+{
+	int w;
+	size_t size;
+
+	for (w = 0; w < myPhiGemmEnv.numDevices * NSTREAMS; w++) {
+
+		if ( operandCache.base[w] != NULL || myPhiGemmHdl.pmem[w] == NULL ) continue;
+
+		if ( myPhiGemmEnv.cache_bytes > 0 )
+			size = imin(myPhiGemmEnv.cache_bytes, myPhiGemmHdl.smem[w] / 2);
+		else
+			size = myPhiGemmHdl.smem[w] / 4;
+		size -= size % CACHE_ALIGN;
+
+		myPhiGemmHdl.smem[w] -= size;
+		operandCache.size[w] = size;
+		operandCache.base[w] = (char *) myPhiGemmHdl.pmem[w] + myPhiGemmHdl.smem[w];
+		memset(operandCache.entry[w], 0, sizeof(operandCache.entry[w]));
+
+#if defined(__PHIGEMM_DEBUG)
+		printf("[PHIGEMM_DEBUG] %lu Bytes of operand cache on stream %d of GPU %d\n",
+				(unsigned long) size, w / myPhiGemmEnv.numDevices, myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+		fflush(stdout);
+#endif
+	}
+}
+
+/*
+ * Name			: phiGemmCacheRelease
+ * Description	: the method drops the cached operands and gives the cache
+ * 				  back to the scratch memory (the statistics are kept)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmCacheRelease()
+{
+	int w;
+
+#if defined(__PHIGEMM_DEBUG)
+	printf("[PHIGEMM_DEBUG] operand cache: %lu hits, %lu misses, %lu Bytes not transferred\n",
+			operandCache.hits, operandCache.misses, (unsigned long) operandCache.saved);
+	fflush(stdout);
+#endif
+
+	for (w = 0; w < myPhiGemmEnv.numDevices * NSTREAMS; w++) {
+
+		if ( operandCache.base[w] == NULL ) continue;
+
+		myPhiGemmHdl.smem[w] += operandCache.size[w];
+		operandCache.size[w] = 0;
+		operandCache.base[w] = NULL;
+		memset(operandCache.entry[w], 0, sizeof(operandCache.entry[w]));
+	}
+}
+
+/*
+ * Name			: phiGemmCacheBegin
+ * Description	: the method starts a new GEMM call: the blocks it looks up
+ * 				  cannot be evicted before the next call
+ * Visibility	: phiGEMM only
+ */
+void phiGemmCacheBegin()
+{
+	operandCache.clock++;
+}
+
+/*
+ * Name			: phiGemmCacheLookup
+ * Description	: the method returns the device copy of the rows x cols
+ * 				  block at host (leading dimension ld, inside the buffer
+ * 				  base) in the cache of worker w. *hit tells whether the
+ * 				  copy is already there; if not the caller uploads it. NULL
+ * 				  means the block is not cached
+ * Visibility	: phiGEMM only
+ */
+void * phiGemmCacheLookup(int w, const void *base, const void *host, int ld, int rows, int cols, size_t ts, int *hit)
+{
+	phiGemmCacheEntry_t *entry = operandCache.entry[w];
+	size_t bytes = (size_t) rows * cols * ts;
+	unsigned long key;
+	long offset;
+	int i, slot, lru;
+
+	*hit = 0;
+
+	if ( operandCache.base[w] == NULL || rows <= 0 || cols <= 0 ) return NULL;
+
+	key = cacheGeneration(base);
+	if ( key == 0 ) key = cacheFingerprint((const char *) host, ld, rows, cols, ts);
+
+	slot = -1;
+	for (i = 0; i < __PHIGEMM_CACHE_ENTRIES; i++) {
+
+		if ( entry[i].used && entry[i].host == host && entry[i].ld == ld &&
+				entry[i].rows == rows && entry[i].cols == cols && entry[i].ts == ts ) {
+
+			if ( entry[i].key == key ) {
+				entry[i].used = operandCache.clock;
+				operandCache.hits++;
+				operandCache.saved += bytes;
+				*hit = 1;
+				return operandCache.base[w] + entry[i].offset;
+			}
+
+			/* stale copy of the same block */
+			entry[i].used = 0;
+		}
+
+		if ( !entry[i].used && slot < 0 ) slot = i;
+	}
+
+	operandCache.misses++;
+
+	bytes += CACHE_ALIGN - 1;
+	bytes -= bytes % CACHE_ALIGN;
+	if ( bytes > operandCache.size[w] ) return NULL;
+
+	/* evict the least recently used blocks not needed by this call */
+	while ( slot < 0 || ( offset = cacheFit(w, bytes) ) < 0 ) {
+
+		lru = -1;
+		for (i = 0; i < __PHIGEMM_CACHE_ENTRIES; i++)
+			if ( entry[i].used && entry[i].used < operandCache.clock &&
+					( lru < 0 || entry[i].used < entry[lru].used ) )
+				lru = i;
+
+		if ( lru < 0 ) return NULL;
+
+		entry[lru].used = 0;
+		if ( slot < 0 ) slot = lru;
+	}
+
+	entry[slot].host = host;
+	entry[slot].ld = ld;
+	entry[slot].rows = rows;
+	entry[slot].cols = cols;
+	entry[slot].ts = ts;
+	entry[slot].key = key;
+	entry[slot].offset = (size_t) offset;
+	entry[slot].bytes = bytes;
+	entry[slot].used = operandCache.clock;
+
+	return operandCache.base[w] + offset;
+}
+
+/*
+ * Name			: phiGemmCacheFlushEx
+ * Description	: the method drops every operand cached by the context, e.g.
+ * 				  after the host buffers were updated behind phiGEMM
+ * Visibility	: public
+ */
+void phiGemmCacheFlushEx(phiGemmContext_t *ctx)
+{
+	phiGemmContext_t *caller = phiGemmContextEnter(ctx);
+	int w;
+
+	for (w = 0; w < myPhiGemmEnv.numDevices * NSTREAMS; w++)
+		memset(operandCache.entry[w], 0, sizeof(operandCache.entry[w]));
+
+	phiGemmContextLeave(ctx, caller);
+}
+
+/*
+ * Name			: phiGemmCacheFlush
+ * Description	: the method drops every operand cached by the default
+ * 				  context (see phiGemmCacheFlushEx)
+ * Visibility	: public
+ */
+void phiGemmCacheFlush()
+{
+	phiGemmCacheFlushEx(&phiGemmDefaultCtx);
+}
+
+/*
+ * Name			: phiGemmCacheSetGenerationEx
+ * Description	: the method assigns a generation to the host buffer in the
+ * 				  cache of the context: the cached copies of its blocks are
+ * 				  valid as long as the generation does not change (0
+ * 				  unregisters the buffer)
+ * Visibility	: public
+ */
+void phiGemmCacheSetGenerationEx(phiGemmContext_t *ctx, const void *host, unsigned long generation)
+{
+	phiGemmContext_t *caller = phiGemmContextEnter(ctx);
+	int i, slot = -1;
+
+	for (i = 0; i < __PHIGEMM_CACHE_ENTRIES; i++) {
+		if ( operandCache.gen_host[i] == host ) {
+			slot = i;
+			break;
+		}
+		if ( operandCache.gen_host[i] == NULL && slot < 0 ) slot = i;
+	}
+
+	if ( slot < 0 ) {
+		printf("*** phiGEMM *** WARNING *** no room for the generation of %p, fingerprint used\n", host);
+		fflush(stdout);
+	} else if ( generation == 0 ) {
+		operandCache.gen_host[slot] = NULL;
+		operandCache.gen_value[slot] = 0;
+	} else {
+		operandCache.gen_host[slot] = host;
+		operandCache.gen_value[slot] = generation;
+	}
+
+	phiGemmContextLeave(ctx, caller);
+}
+
+/*
+ * Name			: phiGemmCacheSetGeneration
+ * Description	: the method assigns a generation to the host buffer in the
+ * 				  cache of the default context (see phiGemmCacheSetGenerationEx)
+ * Visibility	: public
+ */
+void phiGemmCacheSetGeneration(const void *host, unsigned long generation)
+{
+	phiGemmCacheSetGenerationEx(&phiGemmDefaultCtx, host, generation);
+}
+
+/*
+ * Name			: phiGemmCacheStatsEx
+ * Description	: the method returns the lookups served by the operand cache
+ * 				  of the context, the ones that were not and the bytes not
+ * 				  transferred
+ * Visibility	: public
+ */
+void phiGemmCacheStatsEx(phiGemmContext_t *ctx, unsigned long *hits, unsigned long *misses,
+		size_t *bytes_saved)
+{
+	phiGemmContext_t *caller = phiGemmContextEnter(ctx);
+
+	if ( hits != NULL ) *hits = operandCache.hits;
+	if ( misses != NULL ) *misses = operandCache.misses;
+	if ( bytes_saved != NULL ) *bytes_saved = operandCache.saved;
+
+	phiGemmContextLeave(ctx, caller);
+}
+
+/*
+ * Name			: phiGemmCacheStats
+ * Description	: the method returns the statistics of the operand cache of
+ * 				  the default context (see phiGemmCacheStatsEx)
+ * Visibility	: public
+ */
+void phiGemmCacheStats(unsigned long *hits, unsigned long *misses, size_t *bytes_saved)
+{
+	phiGemmCacheStatsEx(&phiGemmDefaultCtx, hits, misses, bytes_saved);
+}
+
+#endif
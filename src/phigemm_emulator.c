@@ -0,0 +1,1009 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if defined(__PHIGEMM_EMULATE)
+
+#include <pthread.h>
+#include <errno.h>
+
+/*
+ * The emulated devices are configured from the environment:
+ *
+ * PHI_EMU_DEVICES      --> number of emulated devices (default: 1)
+ * PHI_EMU_MEMSIZE      --> memory per device, in MBytes (default: 1024)
+ * PHI_EMU_H2D_BW       --> pinned H2D bandwidth, in GB/s (default: 6.0)
+ * PHI_EMU_D2H_BW       --> pinned D2H bandwidth, in GB/s (default: 6.0)
+ * PHI_EMU_PAGEABLE_BW  --> pageable transfers bandwidth, in GB/s
+ *                          (default: half of the pinned bandwidth)
+ * PHI_EMU_GFLOPS       --> device GEMM throughput, in GFlops (default: 0,
+ *                          that is "as fast as the host BLAS")
+ *
+ * Every variable accepts a comma-separated list of per-device values (the
+ * last value is repeated for the remaining devices), e.g.
+ * PHI_EMU_GFLOPS=1000,500 emulates a node with one fast and one slow card.
+ *
+ * NOTE: the device GEMM is really computed by the host BLAS, throttling only
+ *       stretches an operation up to its modeled duration. If the host is
+ *       slower than the modeled device, the host speed wins.
+ *
+ * NOTE: as on real hardware, an asynchronous transfer from/to a host buffer
+ *       not allocated by cudaHostAlloc blocks the caller until completed.
+ */
+
+#define EMU_ENGINE_H2D  0
+#define EMU_ENGINE_D2H  1
+#define EMU_ENGINE_EXEC 2
+
+#define EMU_OP_H2D    0
+#define EMU_OP_D2H    1
+#define EMU_OP_GEMM   2
+#define EMU_OP_RECORD 3
+#define EMU_OP_WAIT   4
+
+/* Fortran BLAS used to perform the device computation on the host */
+void sgemm_(const char *, const char *, const int *, const int *, const int *,
+		const float *, const float *, const int *, const float *, const int *,
+		const float *, float *, const int *);
+void dgemm_(const char *, const char *, const int *, const int *, const int *,
+		const double *, const double *, const int *, const double *, const int *,
+		const double *, double *, const int *);
+void cgemm_(const char *, const char *, const int *, const int *, const int *,
+		const cuComplex *, const cuComplex *, const int *, const cuComplex *,
+		const int *, const cuComplex *, cuComplex *, const int *);
+void zgemm_(const char *, const char *, const int *, const int *, const int *,
+		const cuDoubleComplex *, const cuDoubleComplex *, const int *,
+		const cuDoubleComplex *, const int *, const cuDoubleComplex *,
+		cuDoubleComplex *, const int *);
+
+struct phiEmuOp
+{
+	int kind;
+
+	/* transfers (column-major, as CUBLAS) */
+	int rows, cols, elemSize, lds, ldd, pageable;
+	const void *src;
+	void *dst;
+
+	/* GEMM (batch products, the operands strideA/B/C elements apart) */
+	char type, opa, opb;
+	int m, n, k, lda, ldb, ldc, batch;
+	long long strideA, strideB, strideC;
+	unsigned char alpha[16], beta[16];
+	const void *A, *B;
+	void *C;
+
+	/* events */
+	struct phiEmuEvent *event;
+	unsigned long ticket;
+
+	struct phiEmuOp *next;
+};
+
+struct phiEmuStream
+{
+	int device;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond_work, cond_idle;
+	struct phiEmuOp *head, *tail;
+	int busy, shutdown;
+	struct phiEmuStream *next;
+};
+
+struct phiEmuEvent
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long issued, completed;
+	double stamp;
+};
+
+struct phiEmuBlasHandle
+{
+	int device;
+	cudaStream_t stream;
+};
+
+struct phiEmuDevice
+{
+	size_t memsize, allocated;
+	double h2d_gbs, d2h_gbs, pageable_gbs, gflops;
+	pthread_mutex_t engine[3];
+	struct phiEmuStream *streams;
+	cudaStream_t null_stream;
+};
+
+struct phiEmuPinned
+{
+	void *ptr;
+	size_t size;
+	struct phiEmuPinned *next;
+};
+
+static struct phiEmuDevice emuDevices[MAX_GPUS];
+static int emuNumDevices = 0;
+static pthread_once_t emuOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t emuLock = PTHREAD_MUTEX_INITIALIZER;
+static struct phiEmuPinned *emuPinned = NULL;
+static __thread int emuCurrentDevice = 0;
+
+
+/* ------------------------------ HELPERS ---------------------------------- */
+
+/* read the i-th value of a comma-separated list, repeating the last one */
+static double emuEnvList(const char *name, int i, double def)
+{
+	char *value = getenv(name), *next;
+	double v = def;
+	int j;
+
+	if (value == NULL) return def;
+
+	for (j = 0; j <= i; j++) {
+		v = strtod(value, &next);
+		if (next == value) return def;
+		if (*next != ',') break;
+		value = next + 1;
+	}
+	return v;
+}
+
+static void emuInit(void)
+{
+	int i, j;
+	char *value = getenv("PHI_EMU_DEVICES");
+
+	emuNumDevices = (value != NULL) ? atoi(value) : 1;
+	if (emuNumDevices < 0) emuNumDevices = 0;
+	if (emuNumDevices > MAX_GPUS) emuNumDevices = MAX_GPUS;
+
+	for (i = 0; i < emuNumDevices; i++) {
+		emuDevices[i].memsize = (size_t) (emuEnvList("PHI_EMU_MEMSIZE", i, 1024.0) * 1024 * 1024);
+		emuDevices[i].allocated = 0;
+		emuDevices[i].h2d_gbs = emuEnvList("PHI_EMU_H2D_BW", i, 6.0);
+		emuDevices[i].d2h_gbs = emuEnvList("PHI_EMU_D2H_BW", i, 6.0);
+		emuDevices[i].pageable_gbs = emuEnvList("PHI_EMU_PAGEABLE_BW", i, emuDevices[i].h2d_gbs / 2);
+		emuDevices[i].gflops = emuEnvList("PHI_EMU_GFLOPS", i, 0.0);
+		for (j = 0; j < 3; j++)
+			pthread_mutex_init(&emuDevices[i].engine[j], NULL);
+		emuDevices[i].streams = NULL;
+		emuDevices[i].null_stream = NULL;
+
+#if defined(__PHIGEMM_DEBUG)
+		printf("[PHIGEMM_DEBUG] emulated device %d: %lu MBytes, H2D %.2f GB/s, D2H %.2f GB/s, pageable %.2f GB/s, %.1f GFlops\n",
+				i, (unsigned long) (emuDevices[i].memsize >> 20), emuDevices[i].h2d_gbs,
+				emuDevices[i].d2h_gbs, emuDevices[i].pageable_gbs, emuDevices[i].gflops);
+		fflush(stdout);
+#endif
+	}
+}
+
+static struct phiEmuDevice * emuDevice(int device)
+{
+	pthread_once(&emuOnce, emuInit);
+	if (device < 0 || device >= emuNumDevices) return NULL;
+	return &emuDevices[device];
+}
+
+static int emuIsPinned(const void *ptr)
+{
+	struct phiEmuPinned *p;
+	int found = 0;
+
+	pthread_mutex_lock(&emuLock);
+	for (p = emuPinned; p != NULL && !found; p = p->next)
+		found = ((const char *) ptr >= (char *) p->ptr && (const char *) ptr < (char *) p->ptr + p->size);
+	pthread_mutex_unlock(&emuLock);
+
+	return found;
+}
+
+/* stretch an operation started at t0 up to its modeled duration */
+static void emuThrottle(double t0, double seconds)
+{
+	struct timespec ts;
+	double left = t0 + seconds - phigemm_cclock();
+
+	if (left <= 0.0) return;
+
+	ts.tv_sec = (time_t) left;
+	ts.tv_nsec = (long) ((left - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+static void emuCopy2D(const struct phiEmuOp *op)
+{
+	int j;
+
+	if (op->lds == op->rows && op->ldd == op->rows) {
+		memcpy(op->dst, op->src, (size_t) op->rows * op->cols * op->elemSize);
+		return;
+	}
+
+	for (j = 0; j < op->cols; j++)
+		memcpy((char *) op->dst + (size_t) j * op->ldd * op->elemSize,
+				(const char *) op->src + (size_t) j * op->lds * op->elemSize,
+				(size_t) op->rows * op->elemSize);
+}
+
+static void emuGemmEntry(const struct phiEmuOp *op)
+{
+	switch (op->type)
+	{
+	case 's':
+		sgemm_(&op->opa, &op->opb, &op->m, &op->n, &op->k, (const float *) op->alpha,
+				(const float *) op->A, &op->lda, (const float *) op->B, &op->ldb,
+				(const float *) op->beta, (float *) op->C, &op->ldc);
+		break;
+	case 'd':
+		dgemm_(&op->opa, &op->opb, &op->m, &op->n, &op->k, (const double *) op->alpha,
+				(const double *) op->A, &op->lda, (const double *) op->B, &op->ldb,
+				(const double *) op->beta, (double *) op->C, &op->ldc);
+		break;
+	case 'c':
+		cgemm_(&op->opa, &op->opb, &op->m, &op->n, &op->k, (const cuComplex *) op->alpha,
+				(const cuComplex *) op->A, &op->lda, (const cuComplex *) op->B, &op->ldb,
+				(const cuComplex *) op->beta, (cuComplex *) op->C, &op->ldc);
+		break;
+	case 'z':
+		zgemm_(&op->opa, &op->opb, &op->m, &op->n, &op->k, (const cuDoubleComplex *) op->alpha,
+				(const cuDoubleComplex *) op->A, &op->lda, (const cuDoubleComplex *) op->B, &op->ldb,
+				(const cuDoubleComplex *) op->beta, (cuDoubleComplex *) op->C, &op->ldc);
+		break;
+	}
+}
+
+static void emuGemm(const struct phiEmuOp *op)
+{
+	struct phiEmuOp entry = *op;
+	size_t size;
+	int i;
+
+	size = (op->type == 's') ? sizeof(float) : (op->type == 'z') ? sizeof(cuDoubleComplex) : sizeof(double);
+
+	for (i = 0; i < op->batch; i++) {
+		entry.A = (const char *) op->A + i * op->strideA * size;
+		entry.B = (const char *) op->B + i * op->strideB * size;
+		entry.C = (char *) op->C + i * op->strideC * size;
+		emuGemmEntry(&entry);
+	}
+}
+
+static void emuExecute(struct phiEmuStream *s, struct phiEmuOp *op)
+{
+	struct phiEmuDevice *dev = &emuDevices[s->device];
+	double t0, bytes, flops, rate;
+	int engine;
+
+	switch (op->kind)
+	{
+	case EMU_OP_H2D:
+	case EMU_OP_D2H:
+		engine = (op->kind == EMU_OP_H2D) ? EMU_ENGINE_H2D : EMU_ENGINE_D2H;
+		rate = (op->kind == EMU_OP_H2D) ? dev->h2d_gbs : dev->d2h_gbs;
+		if (op->pageable) rate = dev->pageable_gbs;
+		bytes = (double) op->rows * op->cols * op->elemSize;
+
+		pthread_mutex_lock(&dev->engine[engine]);
+		t0 = phigemm_cclock();
+		emuCopy2D(op);
+		if (rate > 0.0) emuThrottle(t0, bytes / (rate * 1.e9));
+		pthread_mutex_unlock(&dev->engine[engine]);
+		break;
+
+	case EMU_OP_GEMM:
+		flops = 2.0 * op->m * op->n * op->k * op->batch;
+		if (op->type == 'c' || op->type == 'z') flops *= 4.0;
+
+		pthread_mutex_lock(&dev->engine[EMU_ENGINE_EXEC]);
+		t0 = phigemm_cclock();
+		if (op->m > 0 && op->n > 0) emuGemm(op);
+		if (dev->gflops > 0.0) emuThrottle(t0, flops / (dev->gflops * 1.e9));
+		pthread_mutex_unlock(&dev->engine[EMU_ENGINE_EXEC]);
+		break;
+
+	case EMU_OP_RECORD:
+		pthread_mutex_lock(&op->event->lock);
+		op->event->stamp = phigemm_cclock();
+		if (op->ticket > op->event->completed) op->event->completed = op->ticket;
+		pthread_cond_broadcast(&op->event->cond);
+		pthread_mutex_unlock(&op->event->lock);
+		break;
+
+	case EMU_OP_WAIT:
+		pthread_mutex_lock(&op->event->lock);
+		while (op->event->completed < op->ticket)
+			pthread_cond_wait(&op->event->cond, &op->event->lock);
+		pthread_mutex_unlock(&op->event->lock);
+		break;
+	}
+}
+
+static void * emuWorker(void *arg)
+{
+	struct phiEmuStream *s = (struct phiEmuStream *) arg;
+	struct phiEmuOp *op;
+
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (s->head == NULL && !s->shutdown)
+			pthread_cond_wait(&s->cond_work, &s->lock);
+
+		if (s->head == NULL && s->shutdown) break;
+
+		op = s->head;
+		s->busy = 1;
+		pthread_mutex_unlock(&s->lock);
+
+		emuExecute(s, op);
+
+		pthread_mutex_lock(&s->lock);
+		s->head = op->next;
+		if (s->head == NULL) s->tail = NULL;
+		s->busy = 0;
+		free(op);
+		if (s->head == NULL) pthread_cond_broadcast(&s->cond_idle);
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return NULL;
+}
+
+static struct phiEmuStream * emuStreamNew(int device)
+{
+	struct phiEmuStream *s = (struct phiEmuStream *) calloc(1, sizeof(struct phiEmuStream));
+
+	if (s == NULL) return NULL;
+
+	s->device = device;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond_work, NULL);
+	pthread_cond_init(&s->cond_idle, NULL);
+
+	if (pthread_create(&s->thread, NULL, emuWorker, s) != 0) {
+		free(s);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&emuLock);
+	s->next = emuDevices[device].streams;
+	emuDevices[device].streams = s;
+	pthread_mutex_unlock(&emuLock);
+
+	return s;
+}
+
+/* NULL stream --> per-device default stream, created on demand */
+static cudaStream_t emuResolve(cudaStream_t stream)
+{
+	struct phiEmuDevice *dev;
+
+	if (stream != NULL) return stream;
+
+	if ((dev = emuDevice(emuCurrentDevice)) == NULL) return NULL;
+
+	pthread_mutex_lock(&emuLock);
+	if (dev->null_stream == NULL) {
+		pthread_mutex_unlock(&emuLock);
+		stream = emuStreamNew(emuCurrentDevice);
+		pthread_mutex_lock(&emuLock);
+		if (dev->null_stream == NULL) dev->null_stream = stream;
+	}
+	stream = dev->null_stream;
+	pthread_mutex_unlock(&emuLock);
+
+	return stream;
+}
+
+static void emuEnqueue(cudaStream_t stream, struct phiEmuOp *op)
+{
+	op->next = NULL;
+
+	pthread_mutex_lock(&stream->lock);
+	if (stream->tail == NULL) stream->head = op;
+	else stream->tail->next = op;
+	stream->tail = op;
+	pthread_cond_signal(&stream->cond_work);
+	pthread_mutex_unlock(&stream->lock);
+}
+
+static cublasStatus_t emuTransfer(int kind, int rows, int cols, int elemSize,
+		const void *A, int lda, void *B, int ldb, cudaStream_t stream)
+{
+	struct phiEmuOp *op;
+	const void *host = (kind == EMU_OP_H2D) ? A : (const void *) B;
+
+	if (rows < 0 || cols < 0 || elemSize <= 0 || lda < rows || ldb < rows)
+		return CUBLAS_STATUS_INVALID_VALUE;
+
+	if ((stream = emuResolve(stream)) == NULL) return CUBLAS_STATUS_NOT_INITIALIZED;
+
+	if (rows == 0 || cols == 0) return CUBLAS_STATUS_SUCCESS;
+
+	if ((op = (struct phiEmuOp *) calloc(1, sizeof(struct phiEmuOp))) == NULL)
+		return CUBLAS_STATUS_ALLOC_FAILED;
+
+	op->kind = kind;
+	op->rows = rows;
+	op->cols = cols;
+	op->elemSize = elemSize;
+	op->src = A;
+	op->lds = lda;
+	op->dst = B;
+	op->ldd = ldb;
+	op->pageable = !emuIsPinned(host);
+
+	emuEnqueue(stream, op);
+
+	/* staging of pageable memory is synchronous for the host */
+	if (op->pageable) cudaStreamSynchronize(stream);
+
+	return CUBLAS_STATUS_SUCCESS;
+}
+
+static cublasStatus_t emuGemmEnqueue(char type, size_t size, cublasHandle_t handle,
+		cublasOperation_t transa, cublasOperation_t transb, int m, int n, int k,
+		const void *alpha, const void *A, int lda, long long strideA,
+		const void *B, int ldb, long long strideB, const void *beta,
+		void *C, int ldc, long long strideC, int batch)
+{
+	static const char ops[3] = { 'N', 'T', 'C' };
+	struct phiEmuOp *op;
+	cudaStream_t stream;
+
+	if (handle == NULL) return CUBLAS_STATUS_NOT_INITIALIZED;
+	if (m < 0 || n < 0 || k < 0 || batch < 0) return CUBLAS_STATUS_INVALID_VALUE;
+
+	if ((stream = handle->stream) == NULL) {
+		int current = emuCurrentDevice;
+		emuCurrentDevice = handle->device;
+		stream = emuResolve(NULL);
+		emuCurrentDevice = current;
+	}
+	if (stream == NULL) return CUBLAS_STATUS_NOT_INITIALIZED;
+
+	if ((op = (struct phiEmuOp *) calloc(1, sizeof(struct phiEmuOp))) == NULL)
+		return CUBLAS_STATUS_ALLOC_FAILED;
+
+	op->kind = EMU_OP_GEMM;
+	op->type = type;
+	op->opa = ops[transa];
+	op->opb = ops[transb];
+	op->m = m;
+	op->n = n;
+	op->k = k;
+	memcpy(op->alpha, alpha, size);
+	memcpy(op->beta, beta, size);
+	op->A = A;
+	op->lda = lda;
+	op->B = B;
+	op->ldb = ldb;
+	op->C = C;
+	op->ldc = ldc;
+	op->batch = batch;
+	op->strideA = strideA;
+	op->strideB = strideB;
+	op->strideC = strideC;
+
+	emuEnqueue(stream, op);
+
+	return CUBLAS_STATUS_SUCCESS;
+}
+
+
+/* --------------------------- CUDA RUNTIME -------------------------------- */
+
+cudaError_t cudaGetDeviceCount( int *count )
+{
+	pthread_once(&emuOnce, emuInit);
+	*count = emuNumDevices;
+	return cudaSuccess;
+}
+
+cudaError_t cudaSetDevice( int device )
+{
+	if (emuDevice(device) == NULL) return cudaErrorInvalidDevice;
+	emuCurrentDevice = device;
+	return cudaSuccess;
+}
+
+cudaError_t cudaGetDevice( int *device )
+{
+	*device = emuCurrentDevice;
+	return cudaSuccess;
+}
+
+cudaError_t cudaGetDeviceProperties( struct cudaDeviceProp *prop, int device )
+{
+	struct phiEmuDevice *dev = emuDevice(device);
+
+	if (dev == NULL) return cudaErrorInvalidDevice;
+
+	snprintf(prop->name, sizeof(prop->name), "phiGEMM emulated device (%.0f GFlops)", dev->gflops);
+	prop->totalGlobalMem = dev->memsize;
+	prop->multiProcessorCount = 1;
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaDeviceSynchronize( void )
+{
+	struct phiEmuDevice *dev = emuDevice(emuCurrentDevice);
+	struct phiEmuStream *s;
+
+	if (dev == NULL) return cudaErrorInvalidDevice;
+
+	pthread_mutex_lock(&emuLock);
+	for (s = dev->streams; s != NULL; s = s->next) {
+		pthread_mutex_lock(&s->lock);
+		while (s->head != NULL)
+			pthread_cond_wait(&s->cond_idle, &s->lock);
+		pthread_mutex_unlock(&s->lock);
+	}
+	pthread_mutex_unlock(&emuLock);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaMalloc( void **devPtr, size_t size )
+{
+	struct phiEmuDevice *dev = emuDevice(emuCurrentDevice);
+	size_t *block;
+
+	if (dev == NULL) return cudaErrorInvalidDevice;
+
+	if (size == 0) {
+		*devPtr = NULL;
+		return cudaSuccess;
+	}
+
+	pthread_mutex_lock(&emuLock);
+	if (dev->allocated + size > dev->memsize) {
+		pthread_mutex_unlock(&emuLock);
+		return cudaErrorMemoryAllocation;
+	}
+	dev->allocated += size;
+	pthread_mutex_unlock(&emuLock);
+
+	/* 256-byte aligned payload, the header keeps size and owner */
+	if (posix_memalign((void **) &block, 256, size + 256) != 0) {
+		pthread_mutex_lock(&emuLock);
+		dev->allocated -= size;
+		pthread_mutex_unlock(&emuLock);
+		return cudaErrorMemoryAllocation;
+	}
+
+	block[0] = size;
+	block[1] = (size_t) emuCurrentDevice;
+	*devPtr = (char *) block + 256;
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaFree( void *devPtr )
+{
+	size_t *block;
+
+	if (devPtr == NULL) return cudaSuccess;
+
+	block = (size_t *) ((char *) devPtr - 256);
+
+	pthread_mutex_lock(&emuLock);
+	emuDevices[block[1]].allocated -= block[0];
+	pthread_mutex_unlock(&emuLock);
+
+	free(block);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaMemGetInfo( size_t *free, size_t *total )
+{
+	struct phiEmuDevice *dev = emuDevice(emuCurrentDevice);
+
+	if (dev == NULL) return cudaErrorInvalidDevice;
+
+	pthread_mutex_lock(&emuLock);
+	*free = dev->memsize - dev->allocated;
+	*total = dev->memsize;
+	pthread_mutex_unlock(&emuLock);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaMemset( void *devPtr, int value, size_t count )
+{
+	cudaDeviceSynchronize();
+	memset(devPtr, value, count);
+	return cudaSuccess;
+}
+
+cudaError_t cudaHostAlloc( void **pHost, size_t size, unsigned int flags )
+{
+	struct phiEmuPinned *p = (struct phiEmuPinned *) malloc(sizeof(struct phiEmuPinned));
+
+	if (p == NULL || posix_memalign(pHost, 4096, size > 0 ? size : 1) != 0) {
+		free(p);
+		return cudaErrorMemoryAllocation;
+	}
+
+	p->ptr = *pHost;
+	p->size = size;
+
+	pthread_mutex_lock(&emuLock);
+	p->next = emuPinned;
+	emuPinned = p;
+	pthread_mutex_unlock(&emuLock);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaMallocHost( void **pHost, size_t size )
+{
+	return cudaHostAlloc(pHost, size, cudaHostAllocDefault);
+}
+
+cudaError_t cudaFreeHost( void *ptr )
+{
+	struct phiEmuPinned **p, *tmp;
+
+	pthread_mutex_lock(&emuLock);
+	for (p = &emuPinned; *p != NULL; p = &(*p)->next) {
+		if ((*p)->ptr == ptr) {
+			tmp = *p;
+			*p = tmp->next;
+			free(tmp);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&emuLock);
+
+	free(ptr);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaStreamCreate( cudaStream_t *pStream )
+{
+	if (emuDevice(emuCurrentDevice) == NULL) return cudaErrorInvalidDevice;
+
+	*pStream = emuStreamNew(emuCurrentDevice);
+
+	return (*pStream != NULL) ? cudaSuccess : cudaErrorMemoryAllocation;
+}
+
+cudaError_t cudaStreamDestroy( cudaStream_t stream )
+{
+	struct phiEmuStream **p;
+
+	if (stream == NULL) return cudaErrorInvalidValue;
+
+	pthread_mutex_lock(&stream->lock);
+	stream->shutdown = 1;
+	pthread_cond_signal(&stream->cond_work);
+	pthread_mutex_unlock(&stream->lock);
+
+	pthread_join(stream->thread, NULL);
+
+	pthread_mutex_lock(&emuLock);
+	for (p = &emuDevices[stream->device].streams; *p != NULL; p = &(*p)->next) {
+		if (*p == stream) {
+			*p = stream->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&emuLock);
+
+	pthread_mutex_destroy(&stream->lock);
+	pthread_cond_destroy(&stream->cond_work);
+	pthread_cond_destroy(&stream->cond_idle);
+	free(stream);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaStreamSynchronize( cudaStream_t stream )
+{
+	if ((stream = emuResolve(stream)) == NULL) return cudaErrorInvalidValue;
+
+	pthread_mutex_lock(&stream->lock);
+	while (stream->head != NULL)
+		pthread_cond_wait(&stream->cond_idle, &stream->lock);
+	pthread_mutex_unlock(&stream->lock);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaStreamQuery( cudaStream_t stream )
+{
+	int done;
+
+	if ((stream = emuResolve(stream)) == NULL) return cudaErrorInvalidValue;
+
+	pthread_mutex_lock(&stream->lock);
+	done = (stream->head == NULL);
+	pthread_mutex_unlock(&stream->lock);
+
+	return done ? cudaSuccess : cudaErrorNotReady;
+}
+
+cudaError_t cudaStreamWaitEvent( cudaStream_t stream, cudaEvent_t event, unsigned int flags )
+{
+	struct phiEmuOp *op;
+
+	if (event == NULL || (stream = emuResolve(stream)) == NULL) return cudaErrorInvalidValue;
+
+	if ((op = (struct phiEmuOp *) calloc(1, sizeof(struct phiEmuOp))) == NULL)
+		return cudaErrorMemoryAllocation;
+
+	op->kind = EMU_OP_WAIT;
+	op->event = event;
+	pthread_mutex_lock(&event->lock);
+	op->ticket = event->issued;
+	pthread_mutex_unlock(&event->lock);
+
+	emuEnqueue(stream, op);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaEventCreate( cudaEvent_t *event )
+{
+	*event = (cudaEvent_t) calloc(1, sizeof(struct phiEmuEvent));
+	if (*event == NULL) return cudaErrorMemoryAllocation;
+
+	pthread_mutex_init(&(*event)->lock, NULL);
+	pthread_cond_init(&(*event)->cond, NULL);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaEventDestroy( cudaEvent_t event )
+{
+	if (event == NULL) return cudaErrorInvalidValue;
+
+	/* as CUDA, resources are released once the pending record completes */
+	cudaEventSynchronize(event);
+
+	pthread_mutex_destroy(&event->lock);
+	pthread_cond_destroy(&event->cond);
+	free(event);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaEventRecord( cudaEvent_t event, cudaStream_t stream )
+{
+	struct phiEmuOp *op;
+
+	if (event == NULL || (stream = emuResolve(stream)) == NULL) return cudaErrorInvalidValue;
+
+	if ((op = (struct phiEmuOp *) calloc(1, sizeof(struct phiEmuOp))) == NULL)
+		return cudaErrorMemoryAllocation;
+
+	op->kind = EMU_OP_RECORD;
+	op->event = event;
+	pthread_mutex_lock(&event->lock);
+	op->ticket = ++(event->issued);
+	pthread_mutex_unlock(&event->lock);
+
+	emuEnqueue(stream, op);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaEventSynchronize( cudaEvent_t event )
+{
+	if (event == NULL) return cudaErrorInvalidValue;
+
+	pthread_mutex_lock(&event->lock);
+	while (event->completed < event->issued)
+		pthread_cond_wait(&event->cond, &event->lock);
+	pthread_mutex_unlock(&event->lock);
+
+	return cudaSuccess;
+}
+
+cudaError_t cudaEventQuery( cudaEvent_t event )
+{
+	int done;
+
+	if (event == NULL) return cudaErrorInvalidValue;
+
+	pthread_mutex_lock(&event->lock);
+	done = (event->completed >= event->issued);
+	pthread_mutex_unlock(&event->lock);
+
+	return done ? cudaSuccess : cudaErrorNotReady;
+}
+
+cudaError_t cudaEventElapsedTime( float *ms, cudaEvent_t start, cudaEvent_t end )
+{
+	if (start == NULL || end == NULL) return cudaErrorInvalidValue;
+
+	cudaEventSynchronize(start);
+	cudaEventSynchronize(end);
+
+	if (start->completed == 0 || end->completed == 0) return cudaErrorInvalidValue;
+
+	*ms = (float) ((end->stamp - start->stamp) * 1000.0);
+
+	return cudaSuccess;
+}
+
+
+/* ------------------------------ CUBLAS ----------------------------------- */
+
+cublasStatus_t cublasCreate( cublasHandle_t *handle )
+{
+	if (emuDevice(emuCurrentDevice) == NULL) return CUBLAS_STATUS_NOT_INITIALIZED;
+
+	*handle = (cublasHandle_t) calloc(1, sizeof(struct phiEmuBlasHandle));
+	if (*handle == NULL) return CUBLAS_STATUS_ALLOC_FAILED;
+
+	(*handle)->device = emuCurrentDevice;
+
+	return CUBLAS_STATUS_SUCCESS;
+}
+
+cublasStatus_t cublasDestroy( cublasHandle_t handle )
+{
+	free(handle);
+	return CUBLAS_STATUS_SUCCESS;
+}
+
+cublasStatus_t cublasSetStream( cublasHandle_t handle, cudaStream_t streamId )
+{
+	if (handle == NULL) return CUBLAS_STATUS_NOT_INITIALIZED;
+	handle->stream = streamId;
+	return CUBLAS_STATUS_SUCCESS;
+}
+
+cublasStatus_t cublasGetStream( cublasHandle_t handle, cudaStream_t *streamId )
+{
+	if (handle == NULL) return CUBLAS_STATUS_NOT_INITIALIZED;
+	*streamId = handle->stream;
+	return CUBLAS_STATUS_SUCCESS;
+}
+
+cublasStatus_t cublasSetMatrix( int rows, int cols, int elemSize,
+		const void *A, int lda, void *B, int ldb )
+{
+	cublasStatus_t status = emuTransfer(EMU_OP_H2D, rows, cols, elemSize, A, lda, B, ldb, NULL);
+	cudaStreamSynchronize(NULL);
+	return status;
+}
+
+cublasStatus_t cublasGetMatrix( int rows, int cols, int elemSize,
+		const void *A, int lda, void *B, int ldb )
+{
+	cublasStatus_t status = emuTransfer(EMU_OP_D2H, rows, cols, elemSize, A, lda, B, ldb, NULL);
+	cudaStreamSynchronize(NULL);
+	return status;
+}
+
+cublasStatus_t cublasSetMatrixAsync( int rows, int cols, int elemSize,
+		const void *A, int lda, void *B, int ldb, cudaStream_t stream )
+{
+	return emuTransfer(EMU_OP_H2D, rows, cols, elemSize, A, lda, B, ldb, stream);
+}
+
+cublasStatus_t cublasGetMatrixAsync( int rows, int cols, int elemSize,
+		const void *A, int lda, void *B, int ldb, cudaStream_t stream )
+{
+	return emuTransfer(EMU_OP_D2H, rows, cols, elemSize, A, lda, B, ldb, stream);
+}
+
+cublasStatus_t cublasSgemm( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const float *alpha,
+		const float *A, int lda, const float *B, int ldb, const float *beta,
+		float *C, int ldc )
+{
+	return emuGemmEnqueue('s', sizeof(float), handle, transa, transb, m, n, k,
+			alpha, A, lda, 0, B, ldb, 0, beta, C, ldc, 0, 1);
+}
+
+cublasStatus_t cublasDgemm( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const double *alpha,
+		const double *A, int lda, const double *B, int ldb, const double *beta,
+		double *C, int ldc )
+{
+	return emuGemmEnqueue('d', sizeof(double), handle, transa, transb, m, n, k,
+			alpha, A, lda, 0, B, ldb, 0, beta, C, ldc, 0, 1);
+}
+
+cublasStatus_t cublasCgemm( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const cuComplex *alpha,
+		const cuComplex *A, int lda, const cuComplex *B, int ldb,
+		const cuComplex *beta, cuComplex *C, int ldc )
+{
+	return emuGemmEnqueue('c', sizeof(cuComplex), handle, transa, transb, m, n, k,
+			alpha, A, lda, 0, B, ldb, 0, beta, C, ldc, 0, 1);
+}
+
+cublasStatus_t cublasZgemm( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const cuDoubleComplex *alpha,
+		const cuDoubleComplex *A, int lda, const cuDoubleComplex *B, int ldb,
+		const cuDoubleComplex *beta, cuDoubleComplex *C, int ldc )
+{
+	return emuGemmEnqueue('z', sizeof(cuDoubleComplex), handle, transa, transb, m, n, k,
+			alpha, A, lda, 0, B, ldb, 0, beta, C, ldc, 0, 1);
+}
+
+cublasStatus_t cublasSgemmStridedBatched( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const float *alpha,
+		const float *A, int lda, long long strideA, const float *B, int ldb,
+		long long strideB, const float *beta, float *C, int ldc, long long strideC,
+		int batchCount )
+{
+	return emuGemmEnqueue('s', sizeof(float), handle, transa, transb, m, n, k,
+			alpha, A, lda, strideA, B, ldb, strideB, beta, C, ldc, strideC, batchCount);
+}
+
+cublasStatus_t cublasDgemmStridedBatched( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const double *alpha,
+		const double *A, int lda, long long strideA, const double *B, int ldb,
+		long long strideB, const double *beta, double *C, int ldc, long long strideC,
+		int batchCount )
+{
+	return emuGemmEnqueue('d', sizeof(double), handle, transa, transb, m, n, k,
+			alpha, A, lda, strideA, B, ldb, strideB, beta, C, ldc, strideC, batchCount);
+}
+
+cublasStatus_t cublasCgemmStridedBatched( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const cuComplex *alpha,
+		const cuComplex *A, int lda, long long strideA, const cuComplex *B, int ldb,
+		long long strideB, const cuComplex *beta, cuComplex *C, int ldc, long long strideC,
+		int batchCount )
+{
+	return emuGemmEnqueue('c', sizeof(cuComplex), handle, transa, transb, m, n, k,
+			alpha, A, lda, strideA, B, ldb, strideB, beta, C, ldc, strideC, batchCount);
+}
+
+cublasStatus_t cublasZgemmStridedBatched( cublasHandle_t handle, cublasOperation_t transa,
+		cublasOperation_t transb, int m, int n, int k, const cuDoubleComplex *alpha,
+		const cuDoubleComplex *A, int lda, long long strideA, const cuDoubleComplex *B, int ldb,
+		long long strideB, const cuDoubleComplex *beta, cuDoubleComplex *C, int ldc, long long strideC,
+		int batchCount )
+{
+	return emuGemmEnqueue('z', sizeof(cuDoubleComplex), handle, transa, transb, m, n, k,
+			alpha, A, lda, strideA, B, ldb, strideB, beta, C, ldc, strideC, batchCount);
+}
+
+
+/* ------------------------- EMULATOR CONTROLS ----------------------------- */
+
+void phiEmuSetDeviceRates( int device, double h2d_gbs, double d2h_gbs, double gflops )
+{
+	struct phiEmuDevice *dev = emuDevice(device);
+
+	if (dev == NULL) return;
+
+	dev->h2d_gbs = h2d_gbs;
+	dev->d2h_gbs = d2h_gbs;
+	dev->gflops = gflops;
+}
+
+void phiEmuGetDeviceRates( int device, double *h2d_gbs, double *d2h_gbs, double *gflops )
+{
+	struct phiEmuDevice *dev = emuDevice(device);
+
+	if (dev == NULL) return;
+
+	*h2d_gbs = dev->h2d_gbs;
+	*d2h_gbs = dev->d2h_gbs;
+	*gflops = dev->gflops;
+}
+
+#endif
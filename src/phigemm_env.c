@@ -50,6 +50,16 @@ void readEnv()
 	 * myPhiGemmTng.UPPER_LIMIT_K             --> PHI_UPPER_LIMIT_K
 	 *
 	 * myPhiGemmEnv.cores                     --> OMP_NUM_THREADS
+	 *
+	 * myPhiGemmMdl.cpu_gflops (DGEMM)        --> PHI_MODEL_CPU_GFLOPS
+	 * myPhiGemmMdl.gpu_gflops (DGEMM)        --> PHI_MODEL_GPU_GFLOPS
+	 * myPhiGemmMdl.h2d_gbs                   --> PHI_MODEL_H2D_BW
+	 * myPhiGemmMdl.d2h_gbs                   --> PHI_MODEL_D2H_BW
+	 *
+	 * myPhiGemmEnv.tuningdb                  --> PHI_TUNING_DB
+	 * myPhiGemmEnv.cpu_workers               --> PHI_CPU_WORKERS
+	 * myPhiGemmEnv.cache_bytes               --> PHI_OPERAND_CACHE_MB
+	 * myPhiGemmEnv.pipeline_streams          --> PHI_PIPELINE_STREAMS
 	 */
 
 	float envar;
@@ -276,5 +286,141 @@ void readEnv()
 #endif
 	}
 
+#if !defined(__PHIGEMM_CPUONLY)
+	/* Cost model rates (DGEMM), refined by phiGemmModelCalibrate() and,
+	 * if self-tuning is enabled, by every CPU+GPU call */
+	double cpu_gflops, gpu_gflops, h2d_gbs, d2h_gbs;
+
+	value = getenv("PHI_MODEL_CPU_GFLOPS");
+	if (value != NULL)
+	{
+		cpu_gflops = atof(value);
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] MODEL_CPU_GFLOPS from environment variable: %f \n", cpu_gflops);
+#endif
+	} else {
+		/* Default if no env variable is specified */
+		cpu_gflops = 8.0 * myPhiGemmEnv.cores;
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] MODEL_CPU_GFLOPS default: %f \n", cpu_gflops);
+#endif
+	}
+
+	value = getenv("PHI_MODEL_GPU_GFLOPS");
+	if (value != NULL)
+	{
+		gpu_gflops = atof(value);
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] MODEL_GPU_GFLOPS from environment variable: %f \n", gpu_gflops);
+#endif
+	} else {
+		/* Default if no env variable is specified */
+		gpu_gflops = 300.0;
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] MODEL_GPU_GFLOPS default: %f \n", gpu_gflops);
+#endif
+	}
+
+	value = getenv("PHI_MODEL_H2D_BW");
+	if (value != NULL)
+	{
+		h2d_gbs = atof(value);
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] MODEL_H2D_BW from environment variable: %f \n", h2d_gbs);
+#endif
+	} else {
+		/* Default if no env variable is specified */
+		h2d_gbs = 6.0;
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] MODEL_H2D_BW default: %f \n", h2d_gbs);
+#endif
+	}
+
+	value = getenv("PHI_MODEL_D2H_BW");
+	if (value != NULL)
+	{
+		d2h_gbs = atof(value);
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] MODEL_D2H_BW from environment variable: %f \n", d2h_gbs);
+#endif
+	} else {
+		/* Default if no env variable is specified */
+		d2h_gbs = 6.0;
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] MODEL_D2H_BW default: %f \n", d2h_gbs);
+#endif
+	}
+
+	phiGemmModelSetDefaults(cpu_gflops, gpu_gflops, h2d_gbs, d2h_gbs);
+
+	/* Tuning database (base name, the host/device signature is appended) */
+	value = getenv("PHI_TUNING_DB");
+	if (value != NULL)
+	{
+		strncpy(myPhiGemmEnv.tuningdb, value, FILENAME_MAX - 1);
+		myPhiGemmEnv.tuningdb[FILENAME_MAX - 1] = '\0';
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] TUNING_DB from environment variable: %s \n", myPhiGemmEnv.tuningdb);
+#endif
+	} else {
+		/* Default: no persistent tuning */
+		myPhiGemmEnv.tuningdb[0] = '\0';
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] TUNING_DB default: disabled \n");
+#endif
+	}
+
+	/* CPU threads pulling tiles with __PHIGEMM_WORK_STEALING, each one
+	 * calling the (possibly multi-threaded) CPU GEMM */
+	value = getenv("PHI_CPU_WORKERS");
+	if (value != NULL)
+	{
+		myPhiGemmEnv.cpu_workers = atoi(value);
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] CPU_WORKERS from environment variable: %d \n", myPhiGemmEnv.cpu_workers);
+#endif
+	} else {
+		/* Default: one thread, the CPU GEMM uses the cores */
+		myPhiGemmEnv.cpu_workers = 1;
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] CPU_WORKERS default: %d \n", myPhiGemmEnv.cpu_workers);
+#endif
+	}
+
+	/* Device operand cache of every worker with __PHIGEMM_OPERAND_CACHE
+	 * (0: a quarter of the scratch memory of the worker) */
+	value = getenv("PHI_OPERAND_CACHE_MB");
+	if (value != NULL)
+	{
+		myPhiGemmEnv.cache_bytes = (size_t) atoi(value) * 1024 * 1024;
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] OPERAND_CACHE_MB from environment variable: %s \n", value);
+#endif
+	} else {
+		/* Default: sized on the scratch memory */
+		myPhiGemmEnv.cache_bytes = 0;
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] OPERAND_CACHE_MB default: 1/4 of the scratch memory \n");
+#endif
+	}
+
+	/* Streams of every device share in the standard path, taking its
+	 * panels round-robin (1: no pipeline) */
+	value = getenv("PHI_PIPELINE_STREAMS");
+	if (value != NULL)
+	{
+		myPhiGemmEnv.pipeline_streams = imax( 1, imin( atoi(value), __PHIGEMM_POOL_STREAMS ) );
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] PIPELINE_STREAMS from environment variable: %d \n", myPhiGemmEnv.pipeline_streams);
+#endif
+	} else {
+		/* Default: the upload of a panel overlaps the GEMM of the previous one */
+		myPhiGemmEnv.pipeline_streams = 2;
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] PIPELINE_STREAMS default: %d \n", myPhiGemmEnv.pipeline_streams);
+#endif
+	}
+#endif
+
 
 }
@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+/*
+ * Grouped GEMMs (phi?gemmGrouped): independent products of any shape
+ * submitted together.
+ *
+ * No product is split. The group is bin-packed instead: the bins are the
+ * CPU and every device, the cost of a product in a bin is the time the
+ * cost model predicts for it (transfers included on a device) and,
+ * largest products first, every product goes to the bin where it would
+ * finish first. The combined makespan is balanced, not the single calls.
+ *
+ * The products of a device are enqueued round-robin on its streams, the
+ * ones of the CPU run one after the other with the (multi-threaded) BLAS
+ * meanwhile, and the group ends with a single synchronization of every
+ * stream. The empty products (m, n or k zero) only scale C, on the CPU.
+ * The products too large for the memory of every device go to the CPU
+ * if it finishes them first, else they are split between the CPU and
+ * the devices through the streaming path (see phigemm_stream.c), after
+ * the group, at the split factor phi?gemm would use for them: the one
+ * their time is predicted with.
+ */
+
+typedef struct phiGemmGroupOrder
+{
+	int entry;
+	double flops;
+} phiGemmGroupOrder_t;
+
+static int groupCompare(const void *a, const void *b)
+{
+	double fa = ((const phiGemmGroupOrder_t *) a)->flops;
+	double fb = ((const phiGemmGroupOrder_t *) b)->flops;
+
+	return (fa < fb) ? 1 : (fa > fb) ? -1 : 0;
+}
+
+static void groupCpu(char type, const phiGemmProblem_t *p)
+{
+	phiGemmCpuGemm(type, &p->transa, &p->transb, p->m, p->n, p->k,
+			p->alpha, p->A, p->lda, p->B, p->ldb, p->beta, p->C, p->ldc);
+}
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/* the split factor phi?gemm would use for the product, streamed */
+static float groupSplit(char type, const phiGemmProblem_t *p, int beta_is_zero)
+{
+	float split;
+
+#if defined(__PHIGEMM_GPUONLY)
+	split = 1.0;
+#elif defined(__PHIGEMM_SPLIT_MODEL)
+	split = phiGemmModelBestSplit(type, &p->transa, &p->transb, p->m, p->n, p->k, beta_is_zero);
+	/* keep a non-empty share for the devices */
+	if (split < 0.05f) split = 0.05f;
+#elif defined(__PHIGEMM_SELFTUNE)
+	split = phiGemmShapeLookup(type, &p->transa, &p->transb, p->m, p->n, p->k, beta_is_zero)->split;
+#else
+	split = myPhiGemmTng.split[ (type == 's') ? 0 : (type == 'd') ? 1 : (type == 'c') ? 2 : 3 ];
+#endif
+
+	return split;
+}
+
+/* enqueue the product on worker w */
+static void groupDevice(char type, size_t ts, const phiGemmProblem_t *p, int beta_is_zero, int w)
+{
+	int is_transa = (p->transa != 'n') && (p->transa != 'N');
+	int is_transb = (p->transb != 'n') && (p->transb != 'N');
+	int rowsA = imax(1, is_transa ? p->k : p->m), colsA = is_transa ? p->m : p->k;
+	int rowsB = imax(1, is_transb ? p->n : p->k), colsB = is_transb ? p->k : p->n;
+	char *devA, *devB, *devC;
+	cublasStatus_t status;
+
+	/* the stream is in order: the scratch memory of w is reused safely */
+	devA = (char *) myPhiGemmHdl.pmem[w];
+	devB = devA + (size_t) p->m * p->k * ts;
+	devC = devB + (size_t) p->k * p->n * ts;
+
+	cudaSetDevice(myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+
+	status = cublasSetMatrixAsync(rowsA, colsA, ts, p->A, p->lda, devA, rowsA, myPhiGemmHdl.stream[w]);
+	if (status != CUBLAS_STATUS_SUCCESS) {
+		fprintf (stderr, "!!!! GPU %d: device access error (H2D A) %d\n", w, status); fflush(stderr);
+	}
+
+	status = cublasSetMatrixAsync(rowsB, colsB, ts, p->B, p->ldb, devB, rowsB, myPhiGemmHdl.stream[w]);
+	if (status != CUBLAS_STATUS_SUCCESS) {
+		fprintf (stderr, "!!!! GPU %d: device access error (H2D B) %d\n", w, status); fflush(stderr);
+	}
+
+	if ( !beta_is_zero ) {
+		status = cublasSetMatrixAsync(p->m, p->n, ts, p->C, p->ldc, devC, imax(1, p->m), myPhiGemmHdl.stream[w]);
+		if (status != CUBLAS_STATUS_SUCCESS) {
+			fprintf (stderr, "!!!! GPU %d: device access error (H2D C) %d\n", w, status); fflush(stderr);
+		}
+	}
+
+	phiGemmGpuGemm(type, myPhiGemmHdl.handle[w], phiGemmCublasOp(p->transa), phiGemmCublasOp(p->transb),
+			p->m, p->n, p->k, p->alpha, devA, rowsA, devB, rowsB, p->beta, devC, imax(1, p->m));
+
+	status = cublasGetMatrixAsync(p->m, p->n, ts, devC, imax(1, p->m), p->C, p->ldc, myPhiGemmHdl.stream[w]);
+	if (status != CUBLAS_STATUS_SUCCESS) {
+		fprintf (stderr, "!!!! GPU %d: device access error (D2H C) %d\n", w, status); fflush(stderr);
+	}
+}
+#endif
+
+static void groupRun(phiGemmContext_t *ctx, char type, const phiGemmProblem_t *group, int count)
+{
+	phiGemmContext_t *caller = phiGemmContextEnter(ctx);
+	size_t ts = phiGemmTypeSize(type);
+	int i;
+
+	/* all-zero bytes are a zero of every precision */
+	static const double zero[2] = { 0.0, 0.0 };
+
+#if !defined(__PHIGEMM_CPUONLY)
+	const phiGemmProblem_t *p;
+	phiGemmGroupOrder_t *order;
+	int *bin, d, w, b, best, beta_is_zero, bins = myPhiGemmEnv.numDevices + 1;
+	int next[MAX_GPUS], ncount[MAX_GPUS + 1];
+	double load[MAX_GPUS + 1], cost, finish, busiest;
+	float split;
+	phiGemmPrediction_t pred;
+	size_t footprint, room;
+
+#if defined(__PHIGEMM_DEBUG_4)
+	double start = phigemm_cclock();
+#endif
+
+	if ( count <= 0 ) {
+		phiGemmContextLeave(ctx, caller);
+		return;
+	}
+
+	if ( !phiGemmIsInit() ) {
+		for (i = 0; i < count; i++) groupCpu(type, &group[i]);
+		phiGemmContextLeave(ctx, caller);
+		return;
+	}
+
+	if ( !phiGemmIsInternalMemAlloc() && !phiGemmIsExternalMemAlloc() )
+		phiGemmInitMemory(NULL);
+
+	order = (phiGemmGroupOrder_t *) malloc( count * sizeof(phiGemmGroupOrder_t) );
+	bin = (int *) malloc( count * sizeof(int) );
+	if ( order == NULL || bin == NULL ) {
+		printf("*** phiGEMM *** ERROR *** allocation of the group schedule failed!\n");
+		fflush(stdout);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < count; i++) {
+		order[i].entry = i;
+		order[i].flops = (double) group[i].m * group[i].n * group[i].k;
+	}
+	qsort(order, count, sizeof(phiGemmGroupOrder_t), groupCompare);
+
+	/* bin 0 is the CPU, bin d + 1 the device d */
+	for (b = 0; b < bins; b++) {
+		load[b] = 0.0;
+		ncount[b] = 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		p = &group[ order[i].entry ];
+		beta_is_zero = !memcmp(p->beta, zero, ts);
+		footprint = ( (size_t) p->m * p->k + (size_t) p->k * p->n + (size_t) p->m * p->n ) * ts;
+
+		best = -1;
+		finish = 0.0;
+
+		/* nothing to multiply: C is only scaled by beta */
+		if ( p->m <= 0 || p->n <= 0 || p->k <= 0 ) {
+			bin[ order[i].entry ] = 0;
+			ncount[0]++;
+			continue;
+		}
+
+		for (d = 0; d < myPhiGemmEnv.numDevices; d++) {
+
+			/* every stream of the device must hold the product */
+			for (w = d, room = myPhiGemmHdl.smem[d]; w < myPhiGemmEnv.numDevices * NSTREAMS; w += myPhiGemmEnv.numDevices)
+				room = imin(room, myPhiGemmHdl.smem[w]);
+			if ( footprint > room ) continue;
+
+			cost = phiGemmModelTime(type, &p->transa, &p->transb, p->m, p->n, p->k, beta_is_zero, d);
+			if ( best < 0 || load[d + 1] + cost < finish ) {
+				best = d + 1;
+				finish = load[d + 1] + cost;
+			}
+		}
+
+#if !defined(__PHIGEMM_GPUONLY)
+		cost = phiGemmModelTime(type, &p->transa, &p->transb, p->m, p->n, p->k, beta_is_zero, -1);
+
+		if ( best < 0 ) {
+			/* too large for every device: streamed once every bin is done */
+			for (b = 0, busiest = 0.0; b < bins; b++)
+				busiest = (load[b] > busiest) ? load[b] : busiest;
+			phiGemmModelPredict(type, &p->transa, &p->transb, p->m, p->n, p->k, beta_is_zero,
+					groupSplit(type, p, beta_is_zero), &pred);
+			finish = busiest + pred.makespan;
+		}
+
+		if ( best < 0 ? load[0] + cost <= finish : load[0] + cost < finish ) {
+			best = 0;
+			finish = load[0] + cost;
+		}
+#endif
+
+		/* -1: too large for every device, split and streamed instead */
+		bin[ order[i].entry ] = best;
+		if ( best >= 0 ) {
+			load[best] = finish;
+			ncount[best]++;
+		}
+	}
+
+	/* the devices first, so that they run while the CPU computes */
+	for (d = 0; d < myPhiGemmEnv.numDevices; d++) next[d] = d;
+
+	for (i = 0; i < count; i++) {
+		p = &group[ order[i].entry ];
+		b = bin[ order[i].entry ];
+		if ( b <= 0 ) continue;
+
+		d = b - 1;
+		groupDevice(type, ts, p, !memcmp(p->beta, zero, ts), next[d]);
+		next[d] = ( next[d] + myPhiGemmEnv.numDevices ) % ( myPhiGemmEnv.numDevices * NSTREAMS );
+	}
+
+	for (i = 0; i < count; i++)
+		if ( bin[ order[i].entry ] == 0 ) groupCpu(type, &group[ order[i].entry ]);
+
+	/* one synchronization for the whole group */
+	for (w = 0; w < myPhiGemmEnv.numDevices * NSTREAMS; w++) {
+		cudaSetDevice(myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+		if ( cudaStreamSynchronize(myPhiGemmHdl.stream[w]) != cudaSuccess ) {
+			printf ( "!!!! cudaStreamSynchronize error (grouped GEMM, stream %d)\n", w); fflush(stdout);
+		}
+	}
+
+	/* at the split their time was predicted with */
+	for (i = 0; i < count; i++) {
+		p = &group[ order[i].entry ];
+		if ( bin[ order[i].entry ] >= 0 ) continue;
+
+		split = groupSplit(type, p, !memcmp(p->beta, zero, ts));
+		phiGemmStream(type, &p->transa, &p->transb, p->m, p->n, p->k, p->alpha, p->A, p->lda,
+				p->B, p->ldb, p->beta, p->C, p->ldc, (p->n > p->m) ? 0 : 1, split);
+	}
+
+	cudaSetDevice(myPhiGemmHdl.devId[0]);
+
+#if defined(__PHIGEMM_DEBUG_4)
+	printf("[PHIGEMM_DEBUG][4] grouped %d products: CPU %d (%.6f s predicted)", count, ncount[0], load[0]);
+	for (d = 0; d < myPhiGemmEnv.numDevices; d++)
+		printf(", GPU %d %d (%.6f s)", d, ncount[d + 1], load[d + 1]);
+	printf(", %10.6f s\n", phigemm_cclock() - start);
+	fflush(stdout);
+#endif
+
+	free(order);
+	free(bin);
+#else
+	for (i = 0; i < count; i++) groupCpu(type, &group[i]);
+#endif
+
+	phiGemmContextLeave(ctx, caller);
+}
+
+
+/*
+ * Name			: phiSgemmGroupedEx
+ * Description	: the method performs count independent SGEMMs of any shape
+ * 				  as a single scheduled submission on the given context
+ * Visibility	: public
+ */
+void phiSgemmGroupedEx( phiGemmContext_t *ctx, const phiGemmProblem_t *group, int count )
+{
+	groupRun(ctx, 's', group, count);
+}
+
+/*
+ * Name			: phiSgemmGrouped
+ * Description	: the method performs phiSgemmGroupedEx on the default context
+ * Visibility	: public
+ */
+void phiSgemmGrouped( const phiGemmProblem_t *group, int count )
+{
+	phiSgemmGroupedEx(&phiGemmDefaultCtx, group, count);
+}
+
+/*
+ * Name			: phiDgemmGroupedEx
+ * Description	: the method performs count independent DGEMMs of any shape
+ * 				  as a single scheduled submission on the given context
+ * Visibility	: public
+ */
+void phiDgemmGroupedEx( phiGemmContext_t *ctx, const phiGemmProblem_t *group, int count )
+{
+	groupRun(ctx, 'd', group, count);
+}
+
+/*
+ * Name			: phiDgemmGrouped
+ * Description	: the method performs phiDgemmGroupedEx on the default context
+ * Visibility	: public
+ */
+void phiDgemmGrouped( const phiGemmProblem_t *group, int count )
+{
+	phiDgemmGroupedEx(&phiGemmDefaultCtx, group, count);
+}
+
+/*
+ * Name			: phiCgemmGroupedEx
+ * Description	: the method performs count independent CGEMMs of any shape
+ * 				  as a single scheduled submission on the given context
+ * Visibility	: public
+ */
+void phiCgemmGroupedEx( phiGemmContext_t *ctx, const phiGemmProblem_t *group, int count )
+{
+	groupRun(ctx, 'c', group, count);
+}
+
+/*
+ * Name			: phiCgemmGrouped
+ * Description	: the method performs phiCgemmGroupedEx on the default context
+ * Visibility	: public
+ */
+void phiCgemmGrouped( const phiGemmProblem_t *group, int count )
+{
+	phiCgemmGroupedEx(&phiGemmDefaultCtx, group, count);
+}
+
+/*
+ * Name			: phiZgemmGroupedEx
+ * Description	: the method performs count independent ZGEMMs of any shape
+ * 				  as a single scheduled submission on the given context
+ * Visibility	: public
+ */
+void phiZgemmGroupedEx( phiGemmContext_t *ctx, const phiGemmProblem_t *group, int count )
+{
+	groupRun(ctx, 'z', group, count);
+}
+
+/*
+ * Name			: phiZgemmGrouped
+ * Description	: the method performs phiZgemmGroupedEx on the default context
+ * Visibility	: public
+ */
+void phiZgemmGrouped( const phiGemmProblem_t *group, int count )
+{
+	phiZgemmGroupedEx(&phiGemmDefaultCtx, group, count);
+}
@@ -0,0 +1,724 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/*
+ * Analytic cost model of a CPU+GPU GEMM.
+ *
+ * For a split factor s the call is decomposed exactly as PHIGEMM_xGEMM_MF
+ * does (split A if m >= n, split B otherwise, equal share per device plus
+ * the residual on device 0) and for every device
+ *
+ *   T_h2d = latency * #transfers + (A, B and, if beta != 0, C bytes) / BW_h2d
+ *   T_gpu = latency + flops / (R_gpu * eff_gpu * trans_eff)
+ *   T_d2h = latency + (C bytes) / BW_d2h
+ *
+ * (if merging C on the host is cheaper than uploading it, see
+ * phiGemmModelMergeC, C is not uploaded and T_d2h adds the merge)
+ *
+ * while the CPU takes T_cpu = flops / (R_cpu * eff_cpu). The efficiency
+ * eff = d / (d + nhalf), d the smallest GEMM dimension, models the lower
+ * throughput of thin products. The makespan is
+ *
+ *   __PHIGEMM_PINNED : max( T_cpu, max_dev(T_h2d + T_gpu + T_d2h) )
+ *   otherwise        : sum(T_h2d) + max( T_cpu, max_dev(T_gpu) ) + sum(T_d2h)
+ *
+ * because uploads from pageable memory block the host.
+ */
+
+// Weight of a new measurement in the online update of the rates
+#define MODEL_EMA_WEIGHT 0.25
+
+// Measurements shorter than this are too noisy to be used
+#define MODEL_MIN_TIME 1.e-4
+
+// Initial bandwidth of the host reduction of a partial product (GB/s, C
+// is read and written, the partial read), refined online
+#define MODEL_REDUCE_GBS 10.0
+
+// Initial bandwidth of the host packing of an operand into a staging
+// buffer (GB/s, the operand is read and written), refined online
+#define MODEL_PACK_GBS 10.0
+
+static int modelTypeIndex(char type)
+{
+	switch (type)
+	{
+	case 's': return 0;
+	case 'd': return 1;
+	case 'c': return 2;
+	default : return 3;
+	}
+}
+
+static size_t modelTypeSize(int t)
+{
+	static const size_t sizes[4] = { 4, 8, 8, 16 };
+	return sizes[t];
+}
+
+static double modelFlops(int t, double m, double n, double k)
+{
+	/* complex GEMM: 6 MUL + 2 ADD, see PHIGEMM_FLOPS */
+	return ( (t == 0 || t == 1) ? 2.0 : 8.0 ) * m * n * k;
+}
+
+static double modelEff(double nhalf, int m, int n, int k)
+{
+	double d = (double) imin(imin(m, n), k);
+	return (d <= 0.0) ? 1.0 : d / (d + nhalf);
+}
+
+static void modelEval(int t, int is_trans, int m, int n, int k,
+		int beta_is_zero, float split, phiGemmPrediction_t *pred)
+{
+	int iDev, w, tmp, m_dev, n_dev, k_dev, m_cpu, n_cpu, merge;
+	int is_splitA = (n > m) ? 0 : 1;
+	size_t ts = modelTypeSize(t);
+	double bytes, t_h2d, t_gpu, t_d2h, max_dev = 0.0, max_gpu = 0.0;
+	double dev_h2d[MAX_GPUS], dev_gpu[MAX_GPUS], dev_d2h[MAX_GPUS];
+	double sum_h2d = 0.0, sum_d2h = 0.0;
+	double trans = is_trans ? myPhiGemmMdl.trans_eff : 1.0;
+	phiGemmTilePlan_t plan;
+
+	if (is_splitA) {
+		tmp = m * split;
+		m_cpu = m - tmp;
+		n_cpu = n;
+	} else {
+		tmp = n * split;
+		m_cpu = m;
+		n_cpu = n - tmp;
+	}
+
+	pred->split = split;
+	pred->h2d_time = pred->gpu_time = pred->d2h_time = 0.0;
+
+	if (m_cpu > 0 && n_cpu > 0 && k > 0)
+		pred->cpu_time = modelFlops(t, m_cpu, n_cpu, k) /
+			(myPhiGemmMdl.cpu_gflops[t] * 1.e9 * modelEff(myPhiGemmMdl.cpu_nhalf, m_cpu, n_cpu, k));
+	else
+		pred->cpu_time = 0.0;
+
+	/* same decomposition of PHIGEMM_xGEMM_MF, the streams of a device add up */
+	phiGemmTilePlan("sdcz"[t], is_splitA, split, m, n, k, &plan);
+
+	for (iDev = 0; iDev < myPhiGemmEnv.numDevices; iDev++)
+		dev_h2d[iDev] = dev_gpu[iDev] = dev_d2h[iDev] = 0.0;
+
+	for (w = 0; w < myPhiGemmEnv.numDevices * NSTREAMS; w++) {
+
+		m_dev = plan.m[w];
+		n_dev = plan.n[w];
+		k_dev = plan.k[w];
+		if (m_dev <= 0 || n_dev <= 0 || k_dev <= 0) continue;
+
+		iDev = w % myPhiGemmEnv.numDevices;
+
+		/* only the first k slice of a tile uploads C, unless the host merges it */
+		merge = !beta_is_zero && !plan.slice[w] && phiGemmModelMergeC("sdcz"[t], m_dev, n_dev, iDev);
+		bytes = (double) ( (size_t) m_dev * k_dev + (size_t) k_dev * n_dev +
+				(beta_is_zero || plan.slice[w] || merge ? 0 : (size_t) m_dev * n_dev) ) * ts;
+		dev_h2d[iDev] += myPhiGemmMdl.latency * (beta_is_zero || merge ? 2 : 3) +
+				bytes / (myPhiGemmMdl.h2d_gbs[iDev] * 1.e9);
+
+		dev_gpu[iDev] += myPhiGemmMdl.latency + modelFlops(t, m_dev, n_dev, k_dev) /
+				(myPhiGemmMdl.gpu_gflops[t][iDev] * 1.e9 * trans *
+						modelEff(myPhiGemmMdl.gpu_nhalf, m_dev, n_dev, k_dev));
+
+		dev_d2h[iDev] += myPhiGemmMdl.latency +
+				(double) m_dev * n_dev * ts / (myPhiGemmMdl.d2h_gbs[iDev] * 1.e9);
+		if (merge)
+			dev_d2h[iDev] += 3.0 * m_dev * n_dev * ts / (myPhiGemmMdl.reduce_gbs * 1.e9);
+	}
+
+	for (iDev = 0; iDev < myPhiGemmEnv.numDevices; iDev++) {
+
+		t_h2d = dev_h2d[iDev];
+		t_gpu = dev_gpu[iDev];
+		t_d2h = dev_d2h[iDev];
+
+		/* report the critical device */
+		if (t_h2d + t_gpu + t_d2h > max_dev) {
+			max_dev = t_h2d + t_gpu + t_d2h;
+			pred->h2d_time = t_h2d;
+			pred->gpu_time = t_gpu;
+			pred->d2h_time = t_d2h;
+		}
+
+		max_gpu = imax(max_gpu, t_gpu);
+		sum_h2d += t_h2d;
+		sum_d2h += t_d2h;
+	}
+
+#if defined(__PHIGEMM_PINNED)
+	pred->makespan = imax(pred->cpu_time, max_dev);
+#else
+	pred->makespan = sum_h2d + imax(pred->cpu_time, max_gpu) + sum_d2h;
+#endif
+}
+
+/*
+ * Name			: phiGemmModelSetDefaults
+ * Description	: initialize the rates of every precision and device from the
+ * 				  DGEMM values (SGEMM/CGEMM are assumed twice as fast)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmModelSetDefaults(double cpu_gflops, double gpu_gflops, double h2d_gbs, double d2h_gbs)
+{
+	static const double ratio[4] = { 2.0, 1.0, 2.0, 1.0 };
+	int t, iDev;
+
+	for (t = 0; t < 4; t++) {
+		myPhiGemmMdl.cpu_gflops[t] = cpu_gflops * ratio[t];
+		for (iDev = 0; iDev < MAX_GPUS; iDev++)
+			myPhiGemmMdl.gpu_gflops[t][iDev] = gpu_gflops * ratio[t];
+	}
+
+	for (iDev = 0; iDev < MAX_GPUS; iDev++) {
+		myPhiGemmMdl.h2d_gbs[iDev] = h2d_gbs;
+		myPhiGemmMdl.d2h_gbs[iDev] = d2h_gbs;
+	}
+
+	myPhiGemmMdl.latency = 2.e-5;
+	myPhiGemmMdl.cpu_nhalf = 32.0;
+	myPhiGemmMdl.gpu_nhalf = 256.0;
+	myPhiGemmMdl.trans_eff = 0.95;
+	myPhiGemmMdl.reduce_gbs = MODEL_REDUCE_GBS;
+	myPhiGemmMdl.pack_gbs = MODEL_PACK_GBS;
+}
+
+/*
+ * Name			: phiGemmModelPredict
+ * Description	: predict CPU, transfers and device times of a GEMM call for
+ * 				  a given split factor (or the best one if split < 0) with
+ * 				  the model of the context in use
+ * Visibility	: phiGEMM only
+ */
+void phiGemmModelPredict(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero, float split,
+		phiGemmPrediction_t *pred)
+{
+	int is_trans = ( (*transa != 'n') && (*transa != 'N') ) ||
+			( (*transb != 'n') && (*transb != 'N') );
+
+	if (split < 0)
+		split = phiGemmModelBestSplit(type, transa, transb, m, n, k, beta_is_zero);
+
+	modelEval(modelTypeIndex(type), is_trans, m, n, k, beta_is_zero, split, pred);
+}
+
+/*
+ * Name			: phiGemmModelBestSplit
+ * Description	: return the split factor minimizing the predicted makespan
+ * 				  (coarse scan with step 0.01, then refined with step 0.001)
+ * 				  with the model of the context in use
+ * Visibility	: phiGEMM only
+ */
+float phiGemmModelBestSplit(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero)
+{
+	phiGemmPrediction_t pred;
+	int t = modelTypeIndex(type), i;
+	int is_trans = ( (*transa != 'n') && (*transa != 'N') ) ||
+			( (*transb != 'n') && (*transb != 'N') );
+	float s, best = 1.0f, lo;
+	double best_time = -1.0;
+
+	for (i = 0; i <= 100; i++) {
+		s = i * 0.01f;
+		modelEval(t, is_trans, m, n, k, beta_is_zero, s, &pred);
+		if (best_time < 0 || pred.makespan < best_time) {
+			best_time = pred.makespan;
+			best = s;
+		}
+	}
+
+	lo = best - 0.01f;
+	for (i = 0; i <= 20; i++) {
+		s = lo + i * 0.001f;
+		if (s < 0.0f || s > 1.0f) continue;
+		modelEval(t, is_trans, m, n, k, beta_is_zero, s, &pred);
+		if (pred.makespan < best_time) {
+			best_time = pred.makespan;
+			best = s;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Name			: phiGemmPredictEx
+ * Description	: phiGemmModelPredict with the model of the given context
+ * Visibility	: public
+ */
+void phiGemmPredictEx(phiGemmContext_t *ctx, char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero, float split,
+		phiGemmPrediction_t *pred)
+{
+	/* the model only: the requests in flight are not waited for */
+	phiGemmContext_t *caller = phiGemmContextLock(ctx);
+
+	phiGemmModelPredict(type, transa, transb, m, n, k, beta_is_zero, split, pred);
+
+	phiGemmContextLeave(ctx, caller);
+}
+
+/*
+ * Name			: phiGemmPredict
+ * Description	: phiGemmPredictEx on the default context
+ * Visibility	: public
+ */
+void phiGemmPredict(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero, float split,
+		phiGemmPrediction_t *pred)
+{
+	phiGemmPredictEx(&phiGemmDefaultCtx, type, transa, transb, m, n, k, beta_is_zero, split, pred);
+}
+
+/*
+ * Name			: phiGemmModelSplitEx
+ * Description	: phiGemmModelBestSplit with the model of the given context
+ * Visibility	: public
+ */
+float phiGemmModelSplitEx(phiGemmContext_t *ctx, char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero)
+{
+	phiGemmContext_t *caller = phiGemmContextLock(ctx);
+	float split;
+
+	split = phiGemmModelBestSplit(type, transa, transb, m, n, k, beta_is_zero);
+
+	phiGemmContextLeave(ctx, caller);
+
+	return split;
+}
+
+/*
+ * Name			: phiGemmModelSplit
+ * Description	: phiGemmModelSplitEx on the default context
+ * Visibility	: public
+ */
+float phiGemmModelSplit(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero)
+{
+	return phiGemmModelSplitEx(&phiGemmDefaultCtx, type, transa, transb, m, n, k, beta_is_zero);
+}
+
+/*
+ * Name			: phiGemmModelTime
+ * Description	: predicted time of a whole GEMM on the CPU (iDev < 0) or on
+ * 				  device iDev, transfers included
+ * Visibility	: phiGEMM only
+ */
+double phiGemmModelTime(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero, int iDev)
+{
+	int t = modelTypeIndex(type);
+	size_t ts = modelTypeSize(t);
+	int is_trans = ( (*transa != 'n') && (*transa != 'N') ) ||
+			( (*transb != 'n') && (*transb != 'N') );
+	double bytes;
+
+	if (m <= 0 || n <= 0 || k <= 0) return 0.0;
+
+	if (iDev < 0)
+		return modelFlops(t, m, n, k) /
+				(myPhiGemmMdl.cpu_gflops[t] * 1.e9 * modelEff(myPhiGemmMdl.cpu_nhalf, m, n, k));
+
+	bytes = (double) ( (size_t) m * k + (size_t) k * n + (beta_is_zero ? 0 : (size_t) m * n) ) * ts;
+
+	return myPhiGemmMdl.latency * (beta_is_zero ? 4 : 5) +
+			bytes / (myPhiGemmMdl.h2d_gbs[iDev] * 1.e9) +
+			modelFlops(t, m, n, k) / (myPhiGemmMdl.gpu_gflops[t][iDev] * 1.e9 *
+					(is_trans ? myPhiGemmMdl.trans_eff : 1.0) * modelEff(myPhiGemmMdl.gpu_nhalf, m, n, k)) +
+			(double) m * n * ts / (myPhiGemmMdl.d2h_gbs[iDev] * 1.e9);
+}
+
+/*
+ * Name			: phiGemmModelBatchSplit
+ * Description	: share of a batch of m x n x k products the devices should
+ * 				  take: the entries are not split, so the batch is divided
+ * 				  in proportion to the entries per second of the CPU and of
+ * 				  every device
+ * Visibility	: phiGEMM only
+ */
+float phiGemmModelBatchSplit(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero)
+{
+	double cpu_rate, gpu_rate = 0.0, time;
+	int iDev;
+
+	time = phiGemmModelTime(type, transa, transb, m, n, k, beta_is_zero, -1);
+	if (time <= 0.0) return 0.0f;
+	cpu_rate = 1.0 / time;
+
+	for (iDev = 0; iDev < myPhiGemmEnv.numDevices; iDev++) {
+		time = phiGemmModelTime(type, transa, transb, m, n, k, beta_is_zero, iDev);
+		if (time > 0.0) gpu_rate += 1.0 / time;
+	}
+
+	return (float) ( gpu_rate / (gpu_rate + cpu_rate) );
+}
+
+/*
+ * Name			: phiGemmModelSpecialK
+ * Description	: predicted time of the Special-K pipeline of a device, with
+ * 				  chunks chunks of m x n x chunk and depth buffers: the
+ * 				  m x n result is copied back and reduced on the host after
+ * 				  every chunk or, if accumulate, accumulated on the device
+ * 				  and copied back once. The stages of the chunks overlap:
+ * 				  the slowest one sets the pace, unless the buffers are too
+ * 				  few to keep every stage busy
+ * Visibility	: phiGEMM only
+ */
+double phiGemmModelSpecialK(char type, const char *transa, const char *transb,
+		int m, int n, int chunk, int chunks, int depth, int accumulate, int iDev)
+{
+	int t = modelTypeIndex(type);
+	size_t ts = modelTypeSize(t);
+	int is_trans = ( (*transa != 'n') && (*transa != 'N') ) ||
+			( (*transb != 'n') && (*transb != 'N') );
+	double t_h2d, t_gpu, t_d2h, t_red, pace, cycle;
+
+	if (m <= 0 || n <= 0 || chunk <= 0 || chunks <= 0) return 0.0;
+
+	t_h2d = myPhiGemmMdl.latency * 2 +
+			(double) ( (size_t) m + n ) * chunk * ts / (myPhiGemmMdl.h2d_gbs[iDev] * 1.e9);
+	t_gpu = myPhiGemmMdl.latency + modelFlops(t, m, n, chunk) / (myPhiGemmMdl.gpu_gflops[t][iDev] * 1.e9 *
+			(is_trans ? myPhiGemmMdl.trans_eff : 1.0) * modelEff(myPhiGemmMdl.gpu_nhalf, m, n, chunk));
+	t_d2h = myPhiGemmMdl.latency + (double) m * n * ts / (myPhiGemmMdl.d2h_gbs[iDev] * 1.e9);
+	t_red = 3.0 * m * n * ts / (myPhiGemmMdl.reduce_gbs * 1.e9);
+
+	/* the GEMMs accumulating on the device are chained: one more latency */
+	pace = accumulate ? t_gpu + myPhiGemmMdl.latency : t_gpu;
+	if (t_h2d > pace) pace = t_h2d;
+	if (!accumulate && t_d2h > pace) pace = t_d2h;
+	if (!accumulate && t_red > pace) pace = t_red;
+
+	/* a buffer is busy for all the stages of its chunk */
+	cycle = accumulate ? t_h2d + t_gpu : t_h2d + t_gpu + t_d2h + t_red;
+	if (cycle / depth > pace) pace = cycle / depth;
+
+	return t_h2d + chunks * pace + t_d2h + t_red;
+}
+
+/*
+ * Name			: phiGemmModelSpecialKPlan
+ * Description	: pick the K chunk (4 x splitk, or the whole k if smaller,
+ * 				  halved down to __PHIGEMM_SPECIALK_MIN_SPLIT), the
+ * 				  buffers (2 to __PHIGEMM_SPECIALK_MAX_DEPTH) and the
+ * 				  accumulation mode of the Special-K pipeline of a device
+ * 				  over a k share: the fastest predicted within room bytes
+ * 				  of scratch memory and buffers pinned host buffers of C
+ * 				  (if none fits, the smallest chunk accumulated on board)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmModelSpecialKPlan(char type, const char *transa, const char *transb,
+		int m, int n, int k, int splitk, size_t room, int buffers, int iDev,
+		int *chunk, int *depth, int *accumulate)
+{
+	size_t ts = modelTypeSize(modelTypeIndex(type)), bytes;
+	int c, d, a, max_chunk;
+	double time, best = -1.0;
+
+	*chunk = imin(__PHIGEMM_SPECIALK_MIN_SPLIT, k);
+	*depth = 2;
+	*accumulate = 1;
+
+	for (c = imin(4 * splitk, k); c > 0 && c >= imin(__PHIGEMM_SPECIALK_MIN_SPLIT, k); c /= 2) {
+
+		/* the last chunk takes the remainder */
+		max_chunk = (k % c == 0) ? c : c + k % c;
+
+		for (d = 2; d <= __PHIGEMM_SPECIALK_MAX_DEPTH; d++) {
+			for (a = 1; a >= 0; a--) {
+
+				bytes = ( ( (size_t) m + n ) * max_chunk * d + (size_t) m * n * (a ? 1 : d) ) * ts;
+				if (bytes > room || (a ? 1 : d) > imax(buffers, 1)) continue;
+
+				time = phiGemmModelSpecialK(type, transa, transb, m, n, c, k / c, d, a, iDev);
+				if (best < 0.0 || time < best) {
+					best = time;
+					*chunk = c;
+					*depth = d;
+					*accumulate = a;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Name			: phiGemmModelMergeC
+ * Description	: whether, with beta != 0, the m x n C of device iDev is
+ * 				  better merged by the host (C = beta * C + the product
+ * 				  computed with beta = 0 as it comes back) than uploaded
+ * 				  for the device to apply beta
+ * Visibility	: phiGEMM only
+ */
+int phiGemmModelMergeC(char type, int m, int n, int iDev)
+{
+	double bytes = (double) m * n * modelTypeSize(modelTypeIndex(type));
+
+	if (m <= 0 || n <= 0) return 0;
+
+	/* the merge reads C and the product and writes C */
+	return 3.0 * bytes / (myPhiGemmMdl.reduce_gbs * 1.e9) <
+			myPhiGemmMdl.latency + bytes / (myPhiGemmMdl.h2d_gbs[iDev] * 1.e9);
+}
+
+/*
+ * Name			: phiGemmModelPack
+ * Description	: whether A and B of an m x n x k product on device iDev are
+ * 				  better packed by the host into pinned staging buffers
+ * 				  (see phigemm_pack.c) than uploaded as they are: from
+ * 				  pageable memory the blocking upload is traded for a copy
+ * 				  at host bandwidth, from pinned memory the transposed
+ * 				  operands are packed transposed if the 'N' GEMM saves
+ * 				  more than the packing costs
+ * Visibility	: phiGEMM only
+ */
+void phiGemmModelPack(char type, const char *transa, const char *transb, int m, int n, int k,
+		int pageable, int iDev, int *pack_a, int *pack_b)
+{
+	int t = modelTypeIndex(type);
+	size_t ts = modelTypeSize(t);
+	int trans_a = phiGemmPackTransposes(type, *transa), trans_b = phiGemmPackTransposes(type, *transb);
+	double host_bw = myPhiGemmMdl.pack_gbs * 1.e9, bytes, t_gpu;
+
+	*pack_a = *pack_b = 0;
+
+	if (m <= 0 || n <= 0 || k <= 0) return;
+
+	/* the packing reads and writes the operand */
+	if (pageable) {
+		*pack_a = *pack_b = ( 2.0 / host_bw < 1.0 / (myPhiGemmMdl.h2d_gbs[iDev] * 1.e9) );
+		return;
+	}
+
+	if (!trans_a && !trans_b) return;
+
+	bytes = (double) ( (trans_a ? (size_t) m * k : 0) + (trans_b ? (size_t) k * n : 0) ) * ts;
+	t_gpu = modelFlops(t, m, n, k) / (myPhiGemmMdl.gpu_gflops[t][iDev] * 1.e9 *
+			modelEff(myPhiGemmMdl.gpu_nhalf, m, n, k));
+
+	if (2.0 * bytes / host_bw < t_gpu * (1.0 / myPhiGemmMdl.trans_eff - 1.0)) {
+		*pack_a = trans_a;
+		*pack_b = trans_b;
+	}
+}
+
+/*
+ * Name			: phiGemmModelUpdateReduce
+ * Description	: refine the bandwidth of the host reduction with the time
+ * 				  measured reducing bytes (exponential moving average)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmModelUpdateReduce(size_t bytes, double time)
+{
+	double rate;
+
+	if (time > MODEL_MIN_TIME && bytes > 0) {
+		rate = bytes / (time * 1.e9);
+		myPhiGemmMdl.reduce_gbs += MODEL_EMA_WEIGHT * (rate - myPhiGemmMdl.reduce_gbs);
+	}
+}
+
+/*
+ * Name			: phiGemmModelUpdatePack
+ * Description	: refine the bandwidth of the host packing with the time
+ * 				  measured packing bytes (exponential moving average)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmModelUpdatePack(size_t bytes, double time)
+{
+	double rate;
+
+	if (time > MODEL_MIN_TIME && bytes > 0) {
+		rate = bytes / (time * 1.e9);
+		myPhiGemmMdl.pack_gbs += MODEL_EMA_WEIGHT * (rate - myPhiGemmMdl.pack_gbs);
+	}
+}
+
+/*
+ * Name			: phiGemmModelUpdate
+ * Description	: refine the rates with the timings measured by a CPU+GPU
+ * 				  call (exponential moving average)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmModelUpdate(char type, int iDev, int m_cpu, int n_cpu, int k,
+		double time_cpu, int m_gpu, int n_gpu, int k_gpu, double time_h2d, size_t bytes_h2d,
+		double time_gpu, double time_d2h, size_t bytes_d2h)
+{
+	int t = modelTypeIndex(type);
+	int d = iDev % myPhiGemmEnv.numDevices;
+	double rate;
+
+	if (time_cpu > MODEL_MIN_TIME && m_cpu > 0 && n_cpu > 0) {
+		rate = modelFlops(t, m_cpu, n_cpu, k) /
+				(time_cpu * 1.e9 * modelEff(myPhiGemmMdl.cpu_nhalf, m_cpu, n_cpu, k));
+		myPhiGemmMdl.cpu_gflops[t] += MODEL_EMA_WEIGHT * (rate - myPhiGemmMdl.cpu_gflops[t]);
+	}
+
+	if (time_gpu > MODEL_MIN_TIME && m_gpu > 0 && n_gpu > 0 && k_gpu > 0) {
+		rate = modelFlops(t, m_gpu, n_gpu, k_gpu) /
+				(time_gpu * 1.e9 * modelEff(myPhiGemmMdl.gpu_nhalf, m_gpu, n_gpu, k_gpu));
+		myPhiGemmMdl.gpu_gflops[t][d] += MODEL_EMA_WEIGHT * (rate - myPhiGemmMdl.gpu_gflops[t][d]);
+	}
+
+	if (time_h2d > MODEL_MIN_TIME && bytes_h2d > 0) {
+		rate = bytes_h2d / (time_h2d * 1.e9);
+		myPhiGemmMdl.h2d_gbs[d] += MODEL_EMA_WEIGHT * (rate - myPhiGemmMdl.h2d_gbs[d]);
+	}
+
+	if (time_d2h > MODEL_MIN_TIME && bytes_d2h > 0) {
+		rate = bytes_d2h / (time_d2h * 1.e9);
+		myPhiGemmMdl.d2h_gbs[d] += MODEL_EMA_WEIGHT * (rate - myPhiGemmMdl.d2h_gbs[d]);
+	}
+
+#if defined(__PHIGEMM_DEBUG_4)
+	printf("[PHIGEMM_DEBUG][4] model update (%c, GPU %d): CPU %.2f GFlops, GPU %.2f GFlops, H2D %.2f GB/s, D2H %.2f GB/s\n",
+			type, d, myPhiGemmMdl.cpu_gflops[t], myPhiGemmMdl.gpu_gflops[t][d],
+			myPhiGemmMdl.h2d_gbs[d], myPhiGemmMdl.d2h_gbs[d]); fflush(stdout);
+#endif
+}
+
+/* the calibration of the context in use */
+static void modelCalibrate()
+{
+	int iDev, t, i, sz = 512, nd;
+	double *hA, *hbuf, *devA, *devB, *devC;
+	double one = 1.0, zero = 0.0, start, time, rate, ratio;
+	float ms_h2d, ms_gemm, ms_d2h;
+	size_t bytes;
+	cudaEvent_t ev[4];
+
+	if ( !phiGemmIsInit() ) {
+		fprintf(stderr, "*** phiGEMM *** ERROR *** Missing initialization. Model not calibrated.\n"); fflush(stderr);
+		return;
+	}
+
+	if ( !phiGemmIsInternalMemAlloc() && !phiGemmIsExternalMemAlloc() )
+		phiGemmInitMemory(NULL);
+
+	/* CPU: DGEMM sz x sz x sz, the first call is a warm-up */
+	hA = (double *) malloc( 3 * sz * sz * sizeof(double) );
+	for (i = 0; i < 3 * sz * sz; i++) hA[i] = (double) (i % 13) / 13.0;
+
+	for (i = 0; i < 2; i++) {
+		start = phigemm_cclock();
+		dgemm_("N", "N", &sz, &sz, &sz, &one, hA, &sz, hA + sz * sz, &sz, &zero, hA + 2 * sz * sz, &sz);
+		time = phigemm_cclock() - start;
+	}
+
+	rate = modelFlops(1, sz, sz, sz) / (time * 1.e9 * modelEff(myPhiGemmMdl.cpu_nhalf, sz, sz, sz));
+	ratio = rate / myPhiGemmMdl.cpu_gflops[1];
+	for (t = 0; t < 4; t++) myPhiGemmMdl.cpu_gflops[t] *= ratio;
+
+	free(hA);
+
+	/* devices: H2D, DGEMM and D2H of nd x nd matrices fitting the scratch */
+	for (iDev = 0; iDev < myPhiGemmEnv.numDevices; iDev++) {
+
+		for (nd = 1024; nd > 64 && 3 * (size_t) nd * nd * sizeof(double) > myPhiGemmHdl.smem[iDev]; nd /= 2);
+
+		bytes = (size_t) nd * nd * sizeof(double);
+
+		cudaSetDevice(myPhiGemmHdl.devId[iDev]);
+
+		if ( cudaHostAlloc( (void **) &hbuf, bytes, cudaHostAllocPortable) != cudaSuccess ) {
+			printf( "*** ERROR allocating PINNED MEMORY on CPU\n" );
+			exit( EXIT_FAILURE );
+		}
+		for (i = 0; i < nd * nd; i++) hbuf[i] = (double) (i % 7) / 7.0;
+
+		devA = (double *) myPhiGemmHdl.pmem[iDev];
+		devB = devA + (size_t) nd * nd;
+		devC = devB + (size_t) nd * nd;
+
+		for (i = 0; i < 4; i++) cudaEventCreate(&ev[i]);
+
+		for (i = 0; i < 2; i++) {
+			cudaEventRecord(ev[0], myPhiGemmHdl.stream[iDev]);
+			cublasSetMatrixAsync(nd, nd, sizeof(double), hbuf, nd, devA, nd, myPhiGemmHdl.stream[iDev]);
+			cudaEventRecord(ev[1], myPhiGemmHdl.stream[iDev]);
+			cublasDgemm(myPhiGemmHdl.handle[iDev], CUBLAS_OP_N, CUBLAS_OP_N, nd, nd, nd,
+					&one, devA, nd, devA, nd, &zero, devC, nd);
+			cudaEventRecord(ev[2], myPhiGemmHdl.stream[iDev]);
+			cublasGetMatrixAsync(nd, nd, sizeof(double), devC, nd, hbuf, nd, myPhiGemmHdl.stream[iDev]);
+			cudaEventRecord(ev[3], myPhiGemmHdl.stream[iDev]);
+			cudaStreamSynchronize(myPhiGemmHdl.stream[iDev]);
+		}
+
+		cudaEventElapsedTime(&ms_h2d, ev[0], ev[1]);
+		cudaEventElapsedTime(&ms_gemm, ev[1], ev[2]);
+		cudaEventElapsedTime(&ms_d2h, ev[2], ev[3]);
+
+		if (ms_h2d > 0) myPhiGemmMdl.h2d_gbs[iDev] = bytes / (ms_h2d * 1.e6);
+		if (ms_d2h > 0) myPhiGemmMdl.d2h_gbs[iDev] = bytes / (ms_d2h * 1.e6);
+		if (ms_gemm > 0) {
+			rate = modelFlops(1, nd, nd, nd) / (ms_gemm * 1.e6 * modelEff(myPhiGemmMdl.gpu_nhalf, nd, nd, nd));
+			ratio = rate / myPhiGemmMdl.gpu_gflops[1][iDev];
+			for (t = 0; t < 4; t++) myPhiGemmMdl.gpu_gflops[t][iDev] *= ratio;
+		}
+
+		for (i = 0; i < 4; i++) cudaEventDestroy(ev[i]);
+		cudaFreeHost(hbuf);
+
+#if defined(__PHIGEMM_DEBUG)
+		printf("[PHIGEMM_DEBUG] model calibration GPU %d: CPU %.2f GFlops, GPU %.2f GFlops, H2D %.2f GB/s, D2H %.2f GB/s\n",
+				iDev, myPhiGemmMdl.cpu_gflops[1], myPhiGemmMdl.gpu_gflops[1][iDev],
+				myPhiGemmMdl.h2d_gbs[iDev], myPhiGemmMdl.d2h_gbs[iDev]); fflush(stdout);
+#endif
+	}
+
+	cudaSetDevice(myPhiGemmHdl.devId[0]);
+}
+
+/*
+ * Name			: phiGemmModelCalibrateEx
+ * Description	: measure the DGEMM rates of the CPU and of every device of
+ * 				  the given context, plus the H2D/D2H bandwidths, and rescale
+ * 				  its cost model (it requires the context initialized)
+ * Visibility	: public
+ */
+void phiGemmModelCalibrateEx(phiGemmContext_t *ctx)
+{
+	/* it runs on the scratch memory and the streams of the context */
+	phiGemmContext_t *caller = phiGemmContextEnter(ctx);
+
+	modelCalibrate();
+
+	phiGemmContextLeave(ctx, caller);
+}
+
+/*
+ * Name			: phiGemmModelCalibrate
+ * Description	: phiGemmModelCalibrateEx on the default context
+ * Visibility	: public
+ */
+void phiGemmModelCalibrate()
+{
+	phiGemmModelCalibrateEx(&phiGemmDefaultCtx);
+}
+
+#endif
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/*
+ * Host packing of the operands into pinned staging buffers.
+ *
+ * cublasSetMatrixAsync reads an operand where the caller keeps it, strided
+ * by its leading dimension: from pageable memory the copy runs at pageable
+ * speed and blocks the host, and a transposed operand makes the device run
+ * the 'T' variant of the GEMM. An operand can go instead through the two
+ * pinned buffers of __PHIGEMM_PACK_BYTES of its worker: a block of the
+ * device matrix is packed (contiguous, transposed if asked) by
+ * myPhiGemmEnv.cores OpenMP threads in one buffer while the block packed
+ * in the other one is uploaded. The host waits for a buffer only if its
+ * previous upload is still in flight.
+ *
+ * The transposition goes by tiles of PACK_TILE x PACK_TILE elements, small
+ * enough for the lines read to stay in cache while the tile is written,
+ * the inner loop storing contiguous elements of the element type.
+ *
+ * phiGemmModelPack decides per call whether an operand is packed, the
+ * staging buffers are taken from the resource pool by phiGemmPackReserve
+ * and given back by phiGemmPackRelease once the call synchronized its
+ * uploads.
+ */
+
+// Side of the tiles of the transposition (elements)
+#define PACK_TILE 32
+
+// Below these bytes a block is packed by a single thread
+#define PACK_MIN_PARALLEL ( 1 << 18 )
+
+// Every context owns its pool
+#define resourcePool (phiGemmCtx->pool)
+
+typedef struct { uint64_t re, im; } packZ_t;
+
+/* dst (cols x rows) = transpose of src (rows x cols), tile (r0, c0) */
+#define PACK_TRANSPOSE_TILE(T) \
+	for (r = r0; r < r1; r++) \
+		for (c = c0; c < c1; c++) \
+			( (T *) dst )[ c + (size_t) r * ldd ] = ( (const T *) src )[ r + (size_t) c * lds ];
+
+static void packTranspose(size_t ts, int rows, int cols, const char *src, int lds,
+		char *dst, int ldd, int nthreads)
+{
+	int tiles = ( rows + PACK_TILE - 1 ) / PACK_TILE, tile, r, c, r0, r1, c0, c1;
+
+#pragma omp parallel for num_threads(nthreads) schedule(static) private(r, c, r0, r1, c0, c1)
+	for (tile = 0; tile < tiles; tile++) {
+
+		r0 = tile * PACK_TILE;
+		r1 = imin( rows, r0 + PACK_TILE );
+
+		for (c0 = 0; c0 < cols; c0 += PACK_TILE) {
+
+			c1 = imin( cols, c0 + PACK_TILE );
+
+			if ( ts == 4 ) {
+				PACK_TRANSPOSE_TILE(uint32_t)
+			} else if ( ts == 8 ) {
+				PACK_TRANSPOSE_TILE(uint64_t)
+			} else {
+				PACK_TRANSPOSE_TILE(packZ_t)
+			}
+		}
+	}
+}
+
+/* dst (rows x cols, ldd) = src (rows x cols, lds) */
+static void packCopy(size_t ts, int rows, int cols, const char *src, int lds,
+		char *dst, int ldd, int nthreads)
+{
+	int c;
+
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+	for (c = 0; c < cols; c++)
+		memcpy( dst + (size_t) c * ldd * ts, src + (size_t) c * lds * ts, (size_t) rows * ts );
+}
+
+/*
+ * Name			: phiGemmPackTransposes
+ * Description	: the method returns whether the op of an operand is a
+ * 				  transposition the packing can take over (the conjugate
+ * 				  transposition of a complex operand is not)
+ * Visibility	: phiGEMM only
+ */
+int phiGemmPackTransposes(char type, char op)
+{
+	if ( op == 't' || op == 'T' ) return 1;
+
+	return ( op == 'c' || op == 'C' ) && ( type == 's' || type == 'd' );
+}
+
+/*
+ * Name			: phiGemmPackReserve
+ * Description	: the method takes the staging buffers of worker w from the
+ * 				  resource pool, it returns 0 if they cannot be allocated
+ * Visibility	: phiGEMM only
+ */
+int phiGemmPackReserve(int w)
+{
+	if ( resourcePool.stage[w][0] != NULL ) return 1;
+
+	resourcePool.stage[w][0] = phiGemmPoolHostAlloc( __PHIGEMM_PACK_BYTES );
+	resourcePool.stage[w][1] = phiGemmPoolHostAlloc( __PHIGEMM_PACK_BYTES );
+
+	if ( resourcePool.stage[w][0] == NULL || resourcePool.stage[w][1] == NULL ) {
+		if ( resourcePool.stage[w][0] != NULL ) phiGemmPoolHostFree( resourcePool.stage[w][0] );
+		if ( resourcePool.stage[w][1] != NULL ) phiGemmPoolHostFree( resourcePool.stage[w][1] );
+		resourcePool.stage[w][0] = resourcePool.stage[w][1] = NULL;
+		return 0;
+	}
+
+	resourcePool.stage_next[w] = 0;
+	resourcePool.stage_busy[w][0] = resourcePool.stage_busy[w][1] = 0;
+
+	return 1;
+}
+
+/*
+ * Name			: phiGemmPackRelease
+ * Description	: the method gives the staging buffers of every worker back
+ * 				  to the resource pool (the uploads must be complete)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmPackRelease()
+{
+	int w;
+
+	for (w = 0; w < myPhiGemmEnv.numDevices * NSTREAMS; w++) {
+		if ( resourcePool.stage[w][0] == NULL ) continue;
+
+		phiGemmPoolHostFree( resourcePool.stage[w][0] );
+		phiGemmPoolHostFree( resourcePool.stage[w][1] );
+		resourcePool.stage[w][0] = resourcePool.stage[w][1] = NULL;
+	}
+}
+
+/*
+ * Name			: phiGemmPackUpload
+ * Description	: the method uploads on stream the rows x cols host matrix
+ * 				  (or its transpose if transpose) to dev, leading dimension
+ * 				  ldd, packing it through the staging buffers of worker w
+ * 				  (uploaded as it is if w holds none and not transpose)
+ * Visibility	: phiGEMM only
+ */
+cublasStatus_t phiGemmPackUpload(char type, int w, int rows, int cols, const void *host, int ld,
+		int transpose, void *dev, int ldd, cudaStream_t stream)
+{
+	size_t ts = phiGemmTypeSize(type), bytes = 0;
+	int drows = transpose ? cols : rows, dcols = transpose ? rows : cols;
+	int rblock, cblock, r0, c0, rlen, clen, b, nthreads;
+	const char *src;
+	char *buf;
+	double start, time = 0.0;
+	cudaEvent_t uploaded;
+	cublasStatus_t status = CUBLAS_STATUS_SUCCESS;
+
+	if ( resourcePool.stage[w][0] == NULL )
+		return cublasSetMatrixAsync(rows, cols, ts, host, ld, dev, ldd, stream);
+
+	if ( drows <= 0 || dcols <= 0 ) return status;
+
+	/* whole columns of the device matrix if they fit a buffer */
+	rblock = (int) imin( (size_t) drows, __PHIGEMM_PACK_BYTES / ts );
+	cblock = (int) imin( (size_t) dcols, __PHIGEMM_PACK_BYTES / ( (size_t) rblock * ts ) );
+
+	for (c0 = 0; c0 < dcols; c0 += cblock) {
+		for (r0 = 0; r0 < drows; r0 += rblock) {
+
+			rlen = imin( rblock, drows - r0 );
+			clen = imin( cblock, dcols - c0 );
+
+			b = resourcePool.stage_next[w];
+			resourcePool.stage_next[w] = 1 - b;
+			buf = (char *) resourcePool.stage[w][b];
+			uploaded = phiGemmPoolEvent(w, __PHIGEMM_EVENT_PACK + b);
+
+			/* the previous block of the buffer is still being uploaded */
+			if ( resourcePool.stage_busy[w][b] ) cudaEventSynchronize( uploaded );
+
+			nthreads = ( (size_t) rlen * clen * ts < PACK_MIN_PARALLEL ) ? 1 : imax(1, myPhiGemmEnv.cores);
+			start = phigemm_cclock();
+
+			if ( transpose ) {
+				src = (const char *) host + ( (size_t) c0 + (size_t) r0 * ld ) * ts;
+				packTranspose(ts, clen, rlen, src, ld, buf, rlen, nthreads);
+			} else {
+				src = (const char *) host + ( (size_t) r0 + (size_t) c0 * ld ) * ts;
+				packCopy(ts, rlen, clen, src, ld, buf, rlen, nthreads);
+			}
+			time += phigemm_cclock() - start;
+			bytes += (size_t) rlen * clen * ts;
+
+			status = cublasSetMatrixAsync(rlen, clen, ts, buf, rlen,
+					(char *) dev + ( (size_t) r0 + (size_t) c0 * ldd ) * ts, ldd, stream);
+			if ( status != CUBLAS_STATUS_SUCCESS ) return status;
+
+			cudaEventRecord(uploaded, stream);
+			resourcePool.stage_busy[w][b] = 1;
+		}
+	}
+
+	/* the packing reads and writes every element */
+	phiGemmModelUpdatePack( 2 * bytes, time );
+
+	return status;
+}
+
+#endif
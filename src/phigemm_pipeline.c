@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/*
+ * Pipeline of the device share of a worker in the standard path.
+ *
+ * The m x n tile of C of a worker (see phigemm_tiling.c) is cut in panels
+ * along its longer side. The operand shared by every panel (A for panels
+ * of columns, B for panels of rows) is uploaded once, then every panel
+ * uploads its slice of the other operand and of C, runs its GEMM and
+ * downloads its C, on the myPhiGemmEnv.pipeline_streams streams of the
+ * worker taken round-robin: the upload of a panel overlaps the GEMM of
+ * the previous one and the download of the one before.
+ *
+ * The panels are views of the usual layout of the scratch memory (A, B
+ * and C of the whole tile), so no device memory is added. The streams are
+ * ordered with events only: the panels wait for the shared operand and,
+ * at the end, the stream of the worker waits for the others, so that the
+ * caller tracks the worker on its own stream.
+ *
+ * When phiGemmModelPack says so, A and B go through the staging buffers
+ * of the worker (see phigemm_pack.c), transposed on the way: the device
+ * stores them as 'N' operands and runs the 'N' GEMM. An operand of the
+ * device cache (__PHIGEMM_OPERAND_CACHE) keeps the layout of the caller,
+ * the next calls finding it there expect it.
+ */
+
+/*
+ * Name			: phiGemmPipelinePanels
+ * Description	: the method returns the panels the m x n tile of a worker
+ * 				  is cut in (1: no pipeline)
+ * Visibility	: phiGEMM only
+ */
+int phiGemmPipelinePanels(int m, int n)
+{
+	if ( myPhiGemmEnv.pipeline_streams <= 1 ) return 1;
+
+	/* two panels per stream, to keep every stage busy */
+	return imax( 1, imin( 2 * myPhiGemmEnv.pipeline_streams, imax(m, n) / __PHIGEMM_PIPELINE_MIN_PANEL ) );
+}
+
+/* upload the rows x cols host block, through the staging buffers if pack */
+static cublasStatus_t pipelineUpload(char type, int w, int pack, int transpose, int rows, int cols,
+		const void *host, int ld, void *dev, int ldd, cudaStream_t stream)
+{
+	if ( pack ) return phiGemmPackUpload(type, w, rows, cols, host, ld, transpose, dev, ldd, stream);
+
+	return cublasSetMatrixAsync(rows, cols, phiGemmTypeSize(type), host, ld, dev, ldd, stream);
+}
+
+/*
+ * Name			: phiGemmPipeline
+ * Description	: the method enqueues the m x n x k GEMM of worker w in
+ * 				  panels (C is uploaded if upload_c; skip_a, skip_b: the
+ * 				  operand is already on the device). The timing events, if
+ * 				  any, are recorded on the stream of the worker as the
+ * 				  standard path does for the first panel, then the rest of
+ * 				  the pipeline is accounted as GEMM. It returns the bytes
+ * 				  uploaded before the first GEMM
+ * Visibility	: phiGEMM only
+ */
+size_t phiGemmPipeline(char type, int w, const char *transa, const char *transb,
+		int m, int n, int k, const void *alpha, const void *A, int lda,
+		const void *B, int ldb, const void *beta, int upload_c, void *C, int ldc,
+		void *devA, void *devB, void *devC, int skip_a, int skip_b, cudaEvent_t *timing)
+{
+	int is_transa = (*transa != 'n') && (*transa != 'N');
+	int is_transb = (*transb != 'n') && (*transb != 'N');
+	int pack_a, pack_b, pack_transa = 0, pack_transb = 0, dev_transa, dev_transb, gpu_lda, gpu_ldb;
+	int cut_n = (n >= m), panels = phiGemmPipelinePanels(m, n);
+	int streams = imin( myPhiGemmEnv.pipeline_streams, panels );
+	int dim = cut_n ? n : m, width = ( dim + panels - 1 ) / panels;
+	int p, s, off, len;
+	size_t ts = phiGemmTypeSize(type), exposed = 0;
+	const char *hostA = (const char *) A, *hostB = (const char *) B, *panelA, *panelB;
+	char *hostC = (char *) C, *panelC;
+	cudaStream_t stream[__PHIGEMM_POOL_STREAMS];
+	cudaEvent_t ready = phiGemmPoolEvent(w, __PHIGEMM_EVENT_READY);
+	cublasStatus_t status;
+
+	stream[0] = myPhiGemmHdl.stream[w];
+	for (s = 1; s < streams; s++) stream[s] = phiGemmPoolStream(w, s);
+
+#if defined(__PHIGEMM_PINNED)
+	phiGemmModelPack(type, transa, transb, m, n, k, 0, w % myPhiGemmEnv.numDevices, &pack_a, &pack_b);
+#else
+	phiGemmModelPack(type, transa, transb, m, n, k, 1, w % myPhiGemmEnv.numDevices, &pack_a, &pack_b);
+#endif
+	if ( skip_a ) pack_a = 0;
+	if ( skip_b ) pack_b = 0;
+
+#if !defined(__PHIGEMM_OPERAND_CACHE)
+	pack_transa = pack_a && phiGemmPackTransposes(type, *transa);
+	pack_transb = pack_b && phiGemmPackTransposes(type, *transb);
+#elif defined(__PHIGEMM_PINNED)
+	/* not transposed, a pinned operand gains nothing from the packing */
+	pack_a = pack_b = 0;
+#endif
+	if ( ( pack_a || pack_b ) && !phiGemmPackReserve(w) ) pack_a = pack_b = pack_transa = pack_transb = 0;
+
+	dev_transa = is_transa && !pack_transa;
+	dev_transb = is_transb && !pack_transb;
+	gpu_lda = dev_transa ? k : m;
+	gpu_ldb = dev_transb ? n : k;
+
+	/* the operand shared by every panel */
+	if ( cut_n && !skip_a ) {
+		status = pipelineUpload(type, w, pack_a, pack_transa, is_transa ? k : m, is_transa ? m : k,
+				hostA, lda, devA, gpu_lda, stream[0]);
+		if (status != CUBLAS_STATUS_SUCCESS) {
+			fprintf (stderr, "!!!! GPU %d: device access error (H2D A) %d\n", w, status); fflush(stderr);
+		}
+		exposed += (size_t) m * k * ts;
+	}
+
+	if ( !cut_n && !skip_b ) {
+		status = pipelineUpload(type, w, pack_b, pack_transb, is_transb ? n : k, is_transb ? k : n,
+				hostB, ldb, devB, gpu_ldb, stream[0]);
+		if (status != CUBLAS_STATUS_SUCCESS) {
+			fprintf (stderr, "!!!! GPU %d: device access error (H2D B) %d\n", w, status); fflush(stderr);
+		}
+		exposed += (size_t) k * n * ts;
+	}
+
+	if ( timing != NULL ) cudaEventRecord(timing[1], stream[0]);
+	cudaEventRecord(ready, stream[0]);
+
+	for (p = 0; p < panels; p++) {
+
+		s = p % streams;
+		off = p * width;
+		len = imin( width, dim - off );
+		if ( len <= 0 ) break;
+
+		if ( s > 0 && p < streams ) cudaStreamWaitEvent(stream[s], ready, 0);
+
+		if ( cut_n ) {
+			/* columns off .. off + len of B and C */
+			panelA = (const char *) devA;
+			panelB = (const char *) devB + ( dev_transb ? (size_t) off : (size_t) off * gpu_ldb ) * ts;
+			panelC = (char *) devC + (size_t) off * m * ts;
+
+			if ( !skip_b ) {
+				status = pipelineUpload(type, w, pack_b, pack_transb, is_transb ? len : k, is_transb ? k : len,
+						hostB + ( is_transb ? (size_t) off : (size_t) off * ldb ) * ts, ldb,
+						(void *) panelB, gpu_ldb, stream[s]);
+				if (status != CUBLAS_STATUS_SUCCESS) {
+					fprintf (stderr, "!!!! GPU %d: device access error (H2D B) %d\n", w, status); fflush(stderr);
+				}
+				if ( p == 0 ) exposed += (size_t) k * len * ts;
+			}
+		} else {
+			/* rows off .. off + len of A and C */
+			panelA = (const char *) devA + ( dev_transa ? (size_t) off * gpu_lda : (size_t) off ) * ts;
+			panelB = (const char *) devB;
+			panelC = (char *) devC + (size_t) off * ts;
+
+			if ( !skip_a ) {
+				status = pipelineUpload(type, w, pack_a, pack_transa, is_transa ? k : len, is_transa ? len : k,
+						hostA + ( is_transa ? (size_t) off * lda : (size_t) off ) * ts, lda,
+						(void *) panelA, gpu_lda, stream[s]);
+				if (status != CUBLAS_STATUS_SUCCESS) {
+					fprintf (stderr, "!!!! GPU %d: device access error (H2D A) %d\n", w, status); fflush(stderr);
+				}
+				if ( p == 0 ) exposed += (size_t) len * k * ts;
+			}
+		}
+
+		if ( p == 0 && timing != NULL ) cudaEventRecord(timing[2], stream[0]);
+
+		if ( upload_c ) {
+			status = cublasSetMatrixAsync(cut_n ? m : len, cut_n ? len : n, ts,
+					hostC + ( cut_n ? (size_t) off * ldc : (size_t) off ) * ts, ldc,
+					panelC, m, stream[s]);
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: device access error (H2D C) %d\n", w, status); fflush(stderr);
+			}
+			if ( p == 0 ) exposed += (size_t) ( cut_n ? m : n ) * len * ts;
+		}
+
+		if ( p == 0 && timing != NULL ) cudaEventRecord(timing[3], stream[0]);
+
+		cublasSetStream(myPhiGemmHdl.handle[w], stream[s]);
+		phiGemmGpuGemm(type, myPhiGemmHdl.handle[w], phiGemmCublasOp(dev_transa ? *transa : 'N'),
+				phiGemmCublasOp(dev_transb ? *transb : 'N'),
+				cut_n ? m : len, cut_n ? len : n, k, alpha, panelA, gpu_lda, panelB, gpu_ldb,
+				beta, panelC, m);
+
+		status = cublasGetMatrixAsync(cut_n ? m : len, cut_n ? len : n, ts, panelC, m,
+				hostC + ( cut_n ? (size_t) off * ldc : (size_t) off ) * ts, ldc, stream[s]);
+		if (status != CUBLAS_STATUS_SUCCESS) {
+			fprintf (stderr, "!!!! GPU %d: device access error (D2H C) %d\n", w, status); fflush(stderr);
+		}
+	}
+
+	/* the stream of the worker waits for the others */
+	for (s = 1; s < streams; s++) {
+		cudaEventRecord(phiGemmPoolEvent(w, __PHIGEMM_EVENT_DONE + s), stream[s]);
+		cudaStreamWaitEvent(stream[0], phiGemmPoolEvent(w, __PHIGEMM_EVENT_DONE + s), 0);
+	}
+
+	cublasSetStream(myPhiGemmHdl.handle[w], stream[0]);
+
+	if ( timing != NULL ) {
+		cudaEventRecord(timing[4], stream[0]);
+		cudaEventRecord(timing[5], stream[0]);
+	}
+
+	return exposed;
+}
+
+#endif
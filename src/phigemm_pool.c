@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/*
+ * Resource pool of a context.
+ *
+ * Creating CUDA streams and events and allocating pinned host memory are
+ * system calls, too slow to be repeated at every GEMM. The streams (per
+ * worker), the events (per worker) and the pinned buffers of a context
+ * are created on first use and kept until phiGemmShutdown.
+ *
+ * Pinned buffers are rounded up to a power of two size class: a released
+ * buffer goes on the idle list of its class and serves the next request
+ * of the same class. When every slot holds a buffer, an idle buffer of
+ * another class is freed to make room. The pinned bytes in use are
+ * tracked together with their high-water mark.
+ *
+ * Every blocking call on a context runs under its lock, once the
+ * phi?gemmAsync requests of the context have completed (see
+ * phiGemmContextEnter), and synchronizes what it enqueued before
+ * returning, so no two of them use a stream or event of the pool at the
+ * same time. The requests return with their tiles still enqueued: a
+ * request records its completion on the event __PHIGEMM_EVENT_DONE +
+ * async_sequence % __PHIGEMM_POOL_STREAMS of each of its workers, the
+ * sequence counting the requests of the context, and uses no other event
+ * of the pool. A DONE slot is recorded again, while an earlier request
+ * may still wait on it, only by a later request on the same stream of the
+ * same worker: the stream is in order, so the event still completes after
+ * the earlier request (its wait only lasts longer). The pinned buffers of
+ * the requests (the partial products) stay taken until their completion.
+ */
+
+// Every context owns its pool
+#define resourcePool (phiGemmCtx->pool)
+
+static int poolClass(size_t bytes)
+{
+	int c = 0;
+
+	while ( c < __PHIGEMM_POOL_CLASSES - 1 && ( (size_t) __PHIGEMM_POOL_MIN_BYTES << c ) < bytes ) c++;
+
+	return c;
+}
+
+/* remove the idle buffer i from the list of its class */
+static void poolUnlink(int i)
+{
+	int c = poolClass(resourcePool.buffer[i].bytes), *link = &resourcePool.idle[c];
+
+	while ( *link != 0 && *link != i + 1 ) link = &resourcePool.buffer[*link - 1].next;
+
+	if ( *link != 0 ) *link = resourcePool.buffer[i].next;
+}
+
+/*
+ * Name			: phiGemmPoolStream
+ * Description	: the method returns the stream s (s < __PHIGEMM_POOL_STREAMS)
+ * 				  of worker w, on the device of the worker
+ * Visibility	: phiGEMM only
+ */
+cudaStream_t phiGemmPoolStream(int w, int s)
+{
+	int device;
+
+	if ( resourcePool.stream[w][s] == NULL ) {
+
+		cudaGetDevice(&device);
+		cudaSetDevice(myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+
+		if ( cudaStreamCreate( &(resourcePool.stream[w][s]) ) != cudaSuccess ) {
+			printf("*** phiGEMM *** ERROR *** creating stream %d for device %d failed!\n",
+					w * __PHIGEMM_POOL_STREAMS + s, w % myPhiGemmEnv.numDevices);
+			fflush(stdout);
+			exit(EXIT_FAILURE);
+		}
+
+		cudaSetDevice(device);
+		resourcePool.streams++;
+	}
+
+	return resourcePool.stream[w][s];
+}
+
+/*
+ * Name			: phiGemmPoolEvent
+ * Description	: the method returns the event e (e < __PHIGEMM_POOL_EVENTS) of
+ * 				  worker w, on the device of the worker
+ * Visibility	: phiGEMM only
+ */
+cudaEvent_t phiGemmPoolEvent(int w, int e)
+{
+	int device;
+
+	if ( resourcePool.event[w][e] == NULL ) {
+
+		cudaGetDevice(&device);
+		cudaSetDevice(myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+
+		if ( cudaEventCreate( &(resourcePool.event[w][e]) ) != cudaSuccess ) {
+			printf("*** phiGEMM *** ERROR *** creating event %d for device %d failed!\n",
+					w * __PHIGEMM_POOL_EVENTS + e, w % myPhiGemmEnv.numDevices);
+			fflush(stdout);
+			exit(EXIT_FAILURE);
+		}
+
+		cudaSetDevice(device);
+		resourcePool.events++;
+	}
+
+	return resourcePool.event[w][e];
+}
+
+/*
+ * Name			: phiGemmPoolHostAlloc
+ * Description	: the method returns a pinned host buffer of at least bytes
+ * 				  bytes (NULL if it cannot be allocated)
+ * Visibility	: phiGEMM only
+ */
+void * phiGemmPoolHostAlloc(size_t bytes)
+{
+	int i, slot = -1, c = poolClass(bytes);
+	size_t size = (size_t) __PHIGEMM_POOL_MIN_BYTES << c;
+	phiGemmPoolBuffer_t *b;
+
+	if ( size < bytes ) size = bytes;
+
+	if ( resourcePool.idle[c] != 0 ) {
+
+		/* an idle buffer of the same class */
+		slot = resourcePool.idle[c] - 1;
+		resourcePool.idle[c] = resourcePool.buffer[slot].next;
+
+	} else {
+
+		for (i = 0; i < __PHIGEMM_POOL_BUFFERS && slot < 0; i++)
+			if ( resourcePool.buffer[i].ptr == NULL ) slot = i;
+
+		/* make room freeing an idle buffer of another class */
+		for (i = 0; i < __PHIGEMM_POOL_BUFFERS && slot < 0; i++) {
+			if ( !resourcePool.buffer[i].busy ) {
+				poolUnlink(i);
+				cudaFreeHost(resourcePool.buffer[i].ptr);
+				resourcePool.pinned -= resourcePool.buffer[i].bytes;
+				resourcePool.buffer[i].ptr = NULL;
+				slot = i;
+			}
+		}
+
+		if ( slot < 0 ) return NULL;
+
+		b = &resourcePool.buffer[slot];
+		if ( cudaHostAlloc( &b->ptr, size, cudaHostAllocPortable ) != cudaSuccess ) {
+			b->ptr = NULL;
+			return NULL;
+		}
+		b->bytes = size;
+		resourcePool.pinned += size;
+	}
+
+	b = &resourcePool.buffer[slot];
+	b->busy = 1;
+	b->next = 0;
+
+	resourcePool.pinned_busy += b->bytes;
+	if ( resourcePool.pinned_busy > resourcePool.pinned_peak ) resourcePool.pinned_peak = resourcePool.pinned_busy;
+
+	return b->ptr;
+}
+
+/*
+ * Name			: phiGemmPoolHostFree
+ * Description	: the method gives a buffer of phiGemmPoolHostAlloc back to
+ * 				  the pool
+ * Visibility	: phiGEMM only
+ */
+void phiGemmPoolHostFree(void *ptr)
+{
+	int i, c;
+
+	for (i = 0; i < __PHIGEMM_POOL_BUFFERS; i++) {
+		if ( resourcePool.buffer[i].ptr == ptr && resourcePool.buffer[i].busy ) {
+			c = poolClass(resourcePool.buffer[i].bytes);
+			resourcePool.buffer[i].busy = 0;
+			resourcePool.buffer[i].next = resourcePool.idle[c];
+			resourcePool.idle[c] = i + 1;
+			resourcePool.pinned_busy -= resourcePool.buffer[i].bytes;
+			return;
+		}
+	}
+}
+
+/*
+ * Name			: phiGemmPoolHostAvailable
+ * Description	: the method returns how many more buffers phiGemmPoolHostAlloc
+ * 				  can hand out (the slots not in use)
+ * Visibility	: phiGEMM only
+ */
+int phiGemmPoolHostAvailable()
+{
+	int i, available = 0;
+
+	for (i = 0; i < __PHIGEMM_POOL_BUFFERS; i++)
+		if ( !resourcePool.buffer[i].busy ) available++;
+
+	return available;
+}
+
+/*
+ * Name			: phiGemmPoolRelease
+ * Description	: the method destroys the streams, the events and the
+ * 				  pinned buffers of the pool (the high-water mark is kept)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmPoolRelease()
+{
+	int w, j;
+
+#if defined(__PHIGEMM_DEBUG)
+	printf("[PHIGEMM_DEBUG] pool: %d streams, %d events, %lu Bytes pinned (high-water mark %lu Bytes)\n",
+			resourcePool.streams, resourcePool.events, (unsigned long) resourcePool.pinned, (unsigned long) resourcePool.pinned_peak);
+	fflush(stdout);
+#endif
+
+	for (w = 0; w < myPhiGemmEnv.numDevices * NSTREAMS; w++) {
+
+		cudaSetDevice(myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+
+		for (j = 0; j < __PHIGEMM_POOL_STREAMS; j++) {
+			if ( resourcePool.stream[w][j] != NULL ) cudaStreamDestroy( resourcePool.stream[w][j] );
+			resourcePool.stream[w][j] = NULL;
+		}
+
+		for (j = 0; j < __PHIGEMM_POOL_EVENTS; j++) {
+			if ( resourcePool.event[w][j] != NULL ) cudaEventDestroy( resourcePool.event[w][j] );
+			resourcePool.event[w][j] = NULL;
+		}
+	}
+
+	for (j = 0; j < __PHIGEMM_POOL_BUFFERS; j++) {
+		if ( resourcePool.buffer[j].ptr != NULL ) cudaFreeHost( resourcePool.buffer[j].ptr );
+		resourcePool.buffer[j].ptr = NULL;
+		resourcePool.buffer[j].busy = 0;
+		resourcePool.buffer[j].next = 0;
+	}
+
+	memset(resourcePool.idle, 0, sizeof(resourcePool.idle));
+	memset(resourcePool.stage, 0, sizeof(resourcePool.stage));
+	resourcePool.streams = resourcePool.events = 0;
+	resourcePool.pinned = resourcePool.pinned_busy = 0;
+}
+
+/*
+ * Name			: phiGemmPoolStatsEx
+ * Description	: the method returns the pinned bytes held by the pool of the
+ * 				  context, their high-water mark in use and the streams and
+ * 				  events created
+ * Visibility	: public
+ */
+void phiGemmPoolStatsEx(phiGemmContext_t *ctx, size_t *pinned_bytes, size_t *pinned_high_water,
+		int *streams, int *events)
+{
+	phiGemmContext_t *caller = phiGemmContextEnter(ctx);
+
+	if ( pinned_bytes != NULL ) *pinned_bytes = resourcePool.pinned;
+	if ( pinned_high_water != NULL ) *pinned_high_water = resourcePool.pinned_peak;
+	if ( streams != NULL ) *streams = resourcePool.streams;
+	if ( events != NULL ) *events = resourcePool.events;
+
+	phiGemmContextLeave(ctx, caller);
+}
+
+/*
+ * Name			: phiGemmPoolStats
+ * Description	: the method returns the statistics of the pool of the
+ * 				  default context (see phiGemmPoolStatsEx)
+ * Visibility	: public
+ */
+void phiGemmPoolStats(size_t *pinned_bytes, size_t *pinned_high_water, int *streams, int *events)
+{
+	phiGemmPoolStatsEx(&phiGemmDefaultCtx, pinned_bytes, pinned_high_water, streams, events);
+}
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/*
+ * Reduction of partial products into C: C = scale * C + partial.
+ *
+ * The partial products come back from the devices into pinned buffers
+ * and are read once: the x86 kernels (AVX2 or AVX-512, picked at run time
+ * from what the CPU supports) read them with non-temporal loads
+ * (VMOVNTDQA). The pool buffers are write-back memory (cudaHostAllocPortable)
+ * where these are ordinary cached loads: the hint only bypasses the cache
+ * on write-combined memory, which the scalar and complex paths could not
+ * read at speed. The columns of C, cut in row blocks when they are fewer
+ * than the threads, are spread over myPhiGemmEnv.cores OpenMP threads.
+ *
+ * A scale folds the beta scaling of C into the first accumulation, so
+ * that C is read and written once instead of twice. A zero scale means
+ * C = partial: C is not read (it may hold NaNs, as in BLAS).
+ */
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__PHIGEMM_NO_SIMD)
+#define REDUCE_X86
+#include <immintrin.h>
+#endif
+
+// Below these elements the reduction runs on a single thread
+#define REDUCE_MIN_PARALLEL 65536
+
+// Row blocks are multiple of these elements (a cache line of doubles)
+#define REDUCE_ROW_ALIGN 64
+
+typedef void (*reduceKernelD_t)(int len, double s, const double *x, double *y);
+typedef void (*reduceKernelS_t)(int len, float s, const float *x, float *y);
+
+/* y = s * y + x (y = x if s == 0) */
+static void reduceColumnD(int len, double s, const double *x, double *y)
+{
+	int i;
+
+	if ( s == 0.0 )
+		for (i = 0; i < len; i++) y[i] = x[i];
+	else if ( s == 1.0 )
+		for (i = 0; i < len; i++) y[i] += x[i];
+	else
+		for (i = 0; i < len; i++) y[i] = s * y[i] + x[i];
+}
+
+static void reduceColumnS(int len, float s, const float *x, float *y)
+{
+	int i;
+
+	if ( s == 0.0f )
+		for (i = 0; i < len; i++) y[i] = x[i];
+	else if ( s == 1.0f )
+		for (i = 0; i < len; i++) y[i] += x[i];
+	else
+		for (i = 0; i < len; i++) y[i] = s * y[i] + x[i];
+}
+
+#if defined(REDUCE_X86)
+
+/* The head runs scalar up to the alignment of x required by the
+ * non-temporal loads, the tail is left to the scalar kernel */
+
+__attribute__((target("avx2,fma")))
+static void reduceColumnD_avx2(int len, double s, const double *x, double *y)
+{
+	__m256d vs = _mm256_set1_pd(s), vx;
+	int i = 0;
+
+	while ( i < len && ( (size_t) (x + i) & 31 ) ) {
+		reduceColumnD(1, s, x + i, y + i);
+		i++;
+	}
+
+	for (; i + 4 <= len; i += 4) {
+		vx = _mm256_castsi256_pd( _mm256_stream_load_si256( (__m256i *) (x + i) ) );
+		if ( s == 0.0 )
+			_mm256_storeu_pd( y + i, vx );
+		else if ( s == 1.0 )
+			_mm256_storeu_pd( y + i, _mm256_add_pd( _mm256_loadu_pd(y + i), vx ) );
+		else
+			_mm256_storeu_pd( y + i, _mm256_fmadd_pd( vs, _mm256_loadu_pd(y + i), vx ) );
+	}
+
+	reduceColumnD(len - i, s, x + i, y + i);
+}
+
+__attribute__((target("avx2,fma")))
+static void reduceColumnS_avx2(int len, float s, const float *x, float *y)
+{
+	__m256 vs = _mm256_set1_ps(s), vx;
+	int i = 0;
+
+	while ( i < len && ( (size_t) (x + i) & 31 ) ) {
+		reduceColumnS(1, s, x + i, y + i);
+		i++;
+	}
+
+	for (; i + 8 <= len; i += 8) {
+		vx = _mm256_castsi256_ps( _mm256_stream_load_si256( (__m256i *) (x + i) ) );
+		if ( s == 0.0f )
+			_mm256_storeu_ps( y + i, vx );
+		else if ( s == 1.0f )
+			_mm256_storeu_ps( y + i, _mm256_add_ps( _mm256_loadu_ps(y + i), vx ) );
+		else
+			_mm256_storeu_ps( y + i, _mm256_fmadd_ps( vs, _mm256_loadu_ps(y + i), vx ) );
+	}
+
+	reduceColumnS(len - i, s, x + i, y + i);
+}
+
+__attribute__((target("avx512f")))
+static void reduceColumnD_avx512(int len, double s, const double *x, double *y)
+{
+	__m512d vs = _mm512_set1_pd(s), vx;
+	int i = 0;
+
+	while ( i < len && ( (size_t) (x + i) & 63 ) ) {
+		reduceColumnD(1, s, x + i, y + i);
+		i++;
+	}
+
+	for (; i + 8 <= len; i += 8) {
+		vx = _mm512_castsi512_pd( _mm512_stream_load_si512( (void *) (x + i) ) );
+		if ( s == 0.0 )
+			_mm512_storeu_pd( y + i, vx );
+		else if ( s == 1.0 )
+			_mm512_storeu_pd( y + i, _mm512_add_pd( _mm512_loadu_pd(y + i), vx ) );
+		else
+			_mm512_storeu_pd( y + i, _mm512_fmadd_pd( vs, _mm512_loadu_pd(y + i), vx ) );
+	}
+
+	reduceColumnD(len - i, s, x + i, y + i);
+}
+
+__attribute__((target("avx512f")))
+static void reduceColumnS_avx512(int len, float s, const float *x, float *y)
+{
+	__m512 vs = _mm512_set1_ps(s), vx;
+	int i = 0;
+
+	while ( i < len && ( (size_t) (x + i) & 63 ) ) {
+		reduceColumnS(1, s, x + i, y + i);
+		i++;
+	}
+
+	for (; i + 16 <= len; i += 16) {
+		vx = _mm512_castsi512_ps( _mm512_stream_load_si512( (void *) (x + i) ) );
+		if ( s == 0.0f )
+			_mm512_storeu_ps( y + i, vx );
+		else if ( s == 1.0f )
+			_mm512_storeu_ps( y + i, _mm512_add_ps( _mm512_loadu_ps(y + i), vx ) );
+		else
+			_mm512_storeu_ps( y + i, _mm512_fmadd_ps( vs, _mm512_loadu_ps(y + i), vx ) );
+	}
+
+	reduceColumnS(len - i, s, x + i, y + i);
+}
+#endif
+
+/* the widest kernels the CPU runs, picked once */
+static reduceKernelD_t reduceKernelD = NULL;
+static reduceKernelS_t reduceKernelS = NULL;
+static pthread_once_t reduceOnce = PTHREAD_ONCE_INIT;
+
+static void reduceDispatch()
+{
+	reduceKernelD_t kd = reduceColumnD;
+	reduceKernelS_t ks = reduceColumnS;
+
+#if defined(REDUCE_X86)
+	__builtin_cpu_init();
+
+	if ( __builtin_cpu_supports("avx512f") ) {
+		kd = reduceColumnD_avx512;
+		ks = reduceColumnS_avx512;
+	} else if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ) {
+		kd = reduceColumnD_avx2;
+		ks = reduceColumnS_avx2;
+	}
+#endif
+
+	reduceKernelS = ks;
+	reduceKernelD = kd;
+}
+
+/* complex y = s * y + x, for a scale with an imaginary part */
+static void reduceColumnComplex(char type, int len, const void *scale, const void *x, void *y)
+{
+	int i;
+
+	if ( type == 'c' ) {
+		const float *s = (const float *) scale, *xc = (const float *) x;
+		float *yc = (float *) y, re;
+
+		for (i = 0; i < 2 * len; i += 2) {
+			re = s[0] * yc[i] - s[1] * yc[i + 1] + xc[i];
+			yc[i + 1] = s[0] * yc[i + 1] + s[1] * yc[i] + xc[i + 1];
+			yc[i] = re;
+		}
+	} else {
+		const double *s = (const double *) scale, *xz = (const double *) x;
+		double *yz = (double *) y, re;
+
+		for (i = 0; i < 2 * len; i += 2) {
+			re = s[0] * yz[i] - s[1] * yz[i + 1] + xz[i];
+			yz[i + 1] = s[0] * yz[i + 1] + s[1] * yz[i] + xz[i + 1];
+			yz[i] = re;
+		}
+	}
+}
+
+
+/*
+ * Name			: phiGemmReduce
+ * Description	: the method computes C = scale * C + partial for the m x n
+ * 				  partial product (type is one of 's', 'd', 'c', 'z';
+ * 				  scale is of the type, NULL means 1)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmReduce(char type, int m, int n, const void *scale, const void *partial, int ldp,
+		void *C, int ldc)
+{
+	int reals = (type == 'c' || type == 'z') ? 2 : 1;
+	int is_complex_scale = 0, nthreads, blocks, rows, item, j, r0, r1;
+	size_t ts = phiGemmTypeSize(type) / reals;
+	double d_scale = 1.0;
+	float s_scale = 1.0f;
+	const char *x;
+	char *y;
+
+	if ( m <= 0 || n <= 0 ) return;
+
+	pthread_once(&reduceOnce, reduceDispatch);
+
+	if ( scale != NULL ) {
+		if ( type == 's' || type == 'c' ) {
+			s_scale = ( (const float *) scale )[0];
+			is_complex_scale = ( type == 'c' && ( (const float *) scale )[1] != 0.0f );
+		} else {
+			d_scale = ( (const double *) scale )[0];
+			is_complex_scale = ( type == 'z' && ( (const double *) scale )[1] != 0.0 );
+		}
+	}
+
+	nthreads = ( (size_t) m * n < REDUCE_MIN_PARALLEL ) ? 1 : imax(1, myPhiGemmEnv.cores);
+
+	/* with few columns every column is cut in row blocks */
+	blocks = ( n >= nthreads ) ? 1 : ( nthreads + n - 1 ) / n;
+	rows = ( reals * m + blocks - 1 ) / blocks;
+	rows = ( ( rows + REDUCE_ROW_ALIGN - 1 ) / REDUCE_ROW_ALIGN ) * REDUCE_ROW_ALIGN;
+
+#pragma omp parallel for num_threads(nthreads) schedule(static) private(j, r0, r1, x, y)
+	for (item = 0; item < n * blocks; item++) {
+
+		j = item / blocks;
+		r0 = ( item % blocks ) * rows;
+		r1 = imin( reals * m, r0 + rows );
+
+		if ( r0 >= r1 ) continue;
+
+		x = (const char *) partial + ( (size_t) j * ldp * reals + r0 ) * ts;
+		y = (char *) C + ( (size_t) j * ldc * reals + r0 ) * ts;
+
+		if ( is_complex_scale )
+			reduceColumnComplex(type, (r1 - r0) / 2, scale, x, y);
+		else if ( ts == sizeof(float) )
+			reduceKernelS(r1 - r0, s_scale, (const float *) x, (float *) y);
+		else
+			reduceKernelD(r1 - r0, d_scale, (const double *) x, (double *) y);
+	}
+}
+
+#endif
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/*
+ * Dynamic scheduling of a GEMM between the CPU and the devices
+ * (__PHIGEMM_WORK_STEALING).
+ *
+ * C is cut in panels of nb columns and every panel in blocks of mb rows;
+ * the blocks, panel after panel, form a shared queue. Every worker
+ * (device, stream) takes from the front runs of up to SCHED_GRAIN blocks
+ * of a panel, i.e. tiles of SCHED_GRAIN*mb x nb, and keeps up to
+ * __PHIGEMM_STREAM_DEPTH of them in flight. A pool of CPU threads takes
+ * single blocks from the back. The devices start with large tiles, the
+ * CPU fills the end with small ones and whoever is faster takes more:
+ * the balance comes from the schedule instead of the split factor.
+ *
+ * The calling thread drives the devices: it refills every buffer whose
+ * tile is downloaded and, when every buffer is in flight, sleeps on the
+ * event recorded after the download of the oldest tile.
+ */
+
+// Blocks in a device tile
+#define SCHED_GRAIN 4
+
+// Thinner device tiles are not worth a transfer: use the static split
+#define SCHED_MIN_TILE 64
+
+// Device tiles per worker (the CPU counts as one) the queue holds at least
+#define SCHED_MIN_TILES 8
+
+typedef struct phiGemmSched
+{
+	pthread_mutex_t lock;
+	int front, back;
+	int blocks, mb, nb;
+	int cpu_blocks;
+
+	char type;
+	const char *transa, *transb;
+	int m, n, k, lda, ldb, ldc;
+	int is_transa, is_transb;
+	size_t ts;
+	const void *alpha, *beta;
+	const char *A, *B;
+	char *C;
+} phiGemmSched_t;
+
+/* rows [r0, r1) and columns [c0, c1) of C made of count blocks from i */
+static void schedTile(const phiGemmSched_t *s, int i, int count, int *r0, int *r1, int *c0, int *c1)
+{
+	*r0 = (i % s->blocks) * s->mb;
+	*r1 = imin(s->m, *r0 + count * s->mb);
+	*c0 = (i / s->blocks) * s->nb;
+	*c1 = imin(s->n, *c0 + s->nb);
+}
+
+/* pop a device tile from the front: up to SCHED_GRAIN blocks of a panel */
+static int schedPopFront(phiGemmSched_t *s, int *i, int *count)
+{
+	int end;
+
+	pthread_mutex_lock(&s->lock);
+
+	if (s->front >= s->back) {
+		pthread_mutex_unlock(&s->lock);
+		return 0;
+	}
+
+	end = imin(s->back, imin(s->front + SCHED_GRAIN, (s->front / s->blocks + 1) * s->blocks));
+	*i = s->front;
+	*count = end - s->front;
+	s->front = end;
+
+	pthread_mutex_unlock(&s->lock);
+
+	return 1;
+}
+
+static void * schedCpuWorker(void *arg)
+{
+	phiGemmSched_t *s = (phiGemmSched_t *) arg;
+	int i, r0, r1, c0, c1;
+
+	for (;;) {
+		pthread_mutex_lock(&s->lock);
+		if (s->back <= s->front) {
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		i = --s->back;
+		s->cpu_blocks++;
+		pthread_mutex_unlock(&s->lock);
+
+		schedTile(s, i, 1, &r0, &r1, &c0, &c1);
+
+		phiGemmCpuGemm(s->type, s->transa, s->transb, r1 - r0, c1 - c0, s->k, s->alpha,
+				s->A + ( s->is_transa ? (size_t) r0 * s->lda : (size_t) r0 ) * s->ts, s->lda,
+				s->B + ( s->is_transb ? (size_t) c0 : (size_t) c0 * s->ldb ) * s->ts, s->ldb,
+				s->beta, s->C + ( r0 + (size_t) c0 * s->ldc ) * s->ts, s->ldc);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Name			: phiGemmSchedule
+ * Description	: the method performs a CPU+GPU GEMM pulling tiles of C
+ * 				  from a shared queue (type is one of 's', 'd', 'c', 'z');
+ * 				  it returns the share of C computed by the devices or -1
+ * 				  if the call is left to the static split (k too large)
+ * Visibility	: phiGEMM only
+ */
+float phiGemmSchedule(char type, const char *transa, const char *transb,
+		int m, int n, int k, const void *alpha, const void *A, int lda,
+		const void *B, int ldb, const void *beta, void *C, int ldc)
+{
+	int workers = myPhiGemmEnv.numDevices * NSTREAMS;
+	int nthreads, w, b, slot, busy, progress, oldest, tick, i, count, r0, r1, c0, c1, beta_is_zero;
+	int inflight[ NSTREAMS * MAX_GPUS * __PHIGEMM_STREAM_DEPTH ];
+	int issued[ NSTREAMS * MAX_GPUS * __PHIGEMM_STREAM_DEPTH ];
+	size_t limit, elems;
+	double room, tile;
+	char *devA, *devB, *devC;
+	cudaStream_t streams[ NSTREAMS * MAX_GPUS * __PHIGEMM_STREAM_DEPTH ];
+	cudaEvent_t done[ NSTREAMS * MAX_GPUS * __PHIGEMM_STREAM_DEPTH ];
+	pthread_t threads[ __PHIGEMM_MAX_CPU_WORKERS ];
+	phiGemmSched_t s;
+	cublasStatus_t status;
+
+	/* all-zero bytes are a zero of every precision */
+	static const double zero[2] = { 0.0, 0.0 };
+
+#if defined(__PHIGEMM_DEBUG_4)
+	double start = phigemm_cclock();
+#endif
+
+	s.ts = phiGemmTypeSize(type);
+
+	for (w = 0, limit = 0; w < workers; w++)
+		if (w == 0 || myPhiGemmHdl.smem[w] < limit)
+			limit = myPhiGemmHdl.smem[w];
+
+	/* square device tile holding the whole k: 2*b*k + b*b <= room */
+	room = (double) (limit / s.ts) / __PHIGEMM_STREAM_DEPTH;
+	tile = sqrt( (double) k * k + room ) - k;
+
+	if ( tile < imin(SCHED_MIN_TILE, imin(m, n)) ) return -1.0f;
+
+	/* enough tiles to balance the load, whatever the memory */
+	tile = imin(tile, imax(SCHED_MIN_TILE, sqrt( (double) m * n / ( SCHED_MIN_TILES * (workers + 1) ) )));
+
+	s.nb = imin(n, (int) tile);
+	s.mb = imax(1, ( imin(m, (int) tile) + SCHED_GRAIN - 1 ) / SCHED_GRAIN);
+	if ( s.mb * SCHED_GRAIN > (int) tile ) s.mb = imax(1, (int) tile / SCHED_GRAIN);
+
+	s.blocks = (m + s.mb - 1) / s.mb;
+	s.front = 0;
+	s.back = s.blocks * ( (n + s.nb - 1) / s.nb );
+	s.cpu_blocks = 0;
+
+	s.type = type;
+	s.transa = transa;
+	s.transb = transb;
+	s.m = m;
+	s.n = n;
+	s.k = k;
+	s.lda = lda;
+	s.ldb = ldb;
+	s.ldc = ldc;
+	s.is_transa = (*transa != 'n') && (*transa != 'N');
+	s.is_transb = (*transb != 'n') && (*transb != 'N');
+	s.alpha = alpha;
+	s.beta = beta;
+	s.A = (const char *) A;
+	s.B = (const char *) B;
+	s.C = (char *) C;
+
+	beta_is_zero = !memcmp(beta, zero, s.ts);
+	elems = (size_t) SCHED_GRAIN * s.mb * k + (size_t) k * s.nb + (size_t) SCHED_GRAIN * s.mb * s.nb;
+
+	pthread_mutex_init(&s.lock, NULL);
+
+	for (slot = 0; slot < workers * __PHIGEMM_STREAM_DEPTH; slot++) {
+		streams[slot] = phiGemmPoolStream(slot / __PHIGEMM_STREAM_DEPTH, slot % __PHIGEMM_STREAM_DEPTH);
+		done[slot] = phiGemmPoolEvent(slot / __PHIGEMM_STREAM_DEPTH, __PHIGEMM_EVENT_DONE + slot % __PHIGEMM_STREAM_DEPTH);
+		inflight[slot] = 0;
+		issued[slot] = 0;
+	}
+	tick = 0;
+
+#if defined(__PHIGEMM_GPUONLY)
+	nthreads = 0;
+#else
+	nthreads = imin(myPhiGemmEnv.cpu_workers, __PHIGEMM_MAX_CPU_WORKERS);
+#endif
+
+	for (i = 0; i < nthreads; i++) {
+		if ( pthread_create(&threads[i], NULL, schedCpuWorker, &s) != 0 ) {
+			printf("*** phiGEMM *** ERROR *** creating CPU worker %d failed!\n", i);
+			fflush(stdout);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* the calling thread drives the devices: refill every free buffer */
+	do {
+		busy = 0;
+		progress = 0;
+
+		for (b = 0; b < __PHIGEMM_STREAM_DEPTH; b++) {
+			for (w = 0; w < workers; w++) {
+
+				slot = w * __PHIGEMM_STREAM_DEPTH + b;
+
+				cudaSetDevice(myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+
+				if ( inflight[slot] && cudaEventQuery( done[slot] ) == cudaSuccess ) {
+					inflight[slot] = 0;
+					progress = 1;
+				}
+
+				if ( !inflight[slot] && schedPopFront(&s, &i, &count) ) {
+
+					schedTile(&s, i, count, &r0, &r1, &c0, &c1);
+
+					devA = (char *) myPhiGemmHdl.pmem[w] + b * elems * s.ts;
+					devB = devA + (size_t) (r1 - r0) * k * s.ts;
+					devC = devB + (size_t) k * (c1 - c0) * s.ts;
+
+					if ( s.is_transa )
+						status = cublasSetMatrixAsync (k, r1 - r0, s.ts, s.A + (size_t) r0 * lda * s.ts, lda,
+								devA, k, streams[slot]);
+					else
+						status = cublasSetMatrixAsync (r1 - r0, k, s.ts, s.A + (size_t) r0 * s.ts, lda,
+								devA, r1 - r0, streams[slot]);
+
+					if ( status == CUBLAS_STATUS_SUCCESS ) {
+						if ( s.is_transb )
+							status = cublasSetMatrixAsync (c1 - c0, k, s.ts, s.B + (size_t) c0 * s.ts, ldb,
+									devB, c1 - c0, streams[slot]);
+						else
+							status = cublasSetMatrixAsync (k, c1 - c0, s.ts, s.B + (size_t) c0 * ldb * s.ts, ldb,
+									devB, k, streams[slot]);
+					}
+
+					if ( status == CUBLAS_STATUS_SUCCESS && !beta_is_zero )
+						status = cublasSetMatrixAsync (r1 - r0, c1 - c0, s.ts,
+								s.C + ( r0 + (size_t) c0 * ldc ) * s.ts, ldc,
+								devC, r1 - r0, streams[slot]);
+
+					if (status != CUBLAS_STATUS_SUCCESS) {
+						fprintf (stderr, "!!!! GPU %d: device access error (H2D tile %d) %d\n", w, i, status); fflush(stderr);
+					}
+
+					cublasSetStream( myPhiGemmHdl.handle[w], streams[slot] );
+
+					phiGemmGpuGemm(type, myPhiGemmHdl.handle[w], phiGemmCublasOp(*transa), phiGemmCublasOp(*transb),
+							r1 - r0, c1 - c0, k, alpha, devA, s.is_transa ? k : r1 - r0,
+							devB, s.is_transb ? c1 - c0 : k, beta, devC, r1 - r0);
+
+					cublasSetStream( myPhiGemmHdl.handle[w], myPhiGemmHdl.stream[w] );
+
+					status = cublasGetMatrixAsync (r1 - r0, c1 - c0, s.ts, devC, r1 - r0,
+							s.C + ( r0 + (size_t) c0 * ldc ) * s.ts, ldc, streams[slot]);
+
+					if (status != CUBLAS_STATUS_SUCCESS) {
+						fprintf (stderr, "!!!! GPU %d: device access error (D2H tile %d) %d\n", w, i, status); fflush(stderr);
+					}
+
+					cudaEventRecord( done[slot], streams[slot] );
+
+					inflight[slot] = 1;
+					issued[slot] = tick++;
+					progress = 1;
+				}
+
+				busy |= inflight[slot];
+			}
+		}
+
+		/* nothing to retire nor to start: wait for the oldest tile */
+		if (busy && !progress) {
+			for (slot = 0, oldest = -1; slot < workers * __PHIGEMM_STREAM_DEPTH; slot++)
+				if ( inflight[slot] && ( oldest < 0 || issued[slot] < issued[oldest] ) )
+					oldest = slot;
+
+			cudaSetDevice(myPhiGemmHdl.devId[ (oldest / __PHIGEMM_STREAM_DEPTH) % myPhiGemmEnv.numDevices ]);
+			cudaEventSynchronize( done[oldest] );
+		}
+
+	} while (busy);
+
+	/* with no CPU worker the devices have emptied the queue */
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&s.lock);
+
+#if defined(__PHIGEMM_DEBUG_4)
+	printf("[PHIGEMM_DEBUG][4] schedule %d x %d x %d: blocks of %d x %d, %d to the CPU (%d threads), %d to the devices, %10.6f s\n",
+			m, n, k, s.mb, s.nb, s.cpu_blocks, nthreads, s.blocks * ( (n + s.nb - 1) / s.nb ) - s.cpu_blocks,
+			phigemm_cclock() - start); fflush(stdout);
+#endif
+
+	/* blocks are equal but for the last row and column: a good estimate */
+	return 1.0f - (float) s.cpu_blocks / ( s.blocks * ( (n + s.nb - 1) / s.nb ) );
+}
+
+#endif
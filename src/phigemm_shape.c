@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/*
+ * Per-shape split-factor cache.
+ *
+ * A single self-tuned split per precision swings back and forth when the
+ * application alternates GEMMs of different shapes. Under __PHIGEMM_SELFTUNE
+ * every class of calls owns its split factor instead: calls are classified
+ * by precision, transa, transb, beta==0 and the half-octave bucket of m, n
+ * and k (sizes within ~1.5x share the same entry).
+ *
+ * The table is open addressing with a short linear probe; when all the
+ * probed slots are taken the least used entry is recycled.
+ *
+ * Special-K keeps, next to it, the partition of every exact shape it ran
+ * (host share, K range, chunk and depth of every device): the cost model
+ * and the split factor move from call to call, a partition taken at the
+ * first call does not, and with it the order in which the partial
+ * products are summed. The __PHIGEMM_SPECIALK_PLANS partitions are
+ * searched linearly, the least recently used one being recycled.
+ */
+
+// Number of slots probed before recycling an entry
+#define SHAPE_PROBES 8
+
+#define SHAPE_VALID 0x80000000u
+
+// Every context owns its cache
+#define shapeCache (phiGemmCtx->shape)
+
+static int shapeTypeIndex(char type)
+{
+	switch (type)
+	{
+	case 's': return 0;
+	case 'd': return 1;
+	case 'c': return 2;
+	default : return 3;
+	}
+}
+
+static int shapeTransIndex(const char *trans)
+{
+	switch (*trans)
+	{
+	case 't': case 'T': return 1;
+	case 'c': case 'C': return 2;
+	default : return 0;
+	}
+}
+
+/* floor( 2*log2(x) ), i.e. two buckets per power of two */
+static unsigned int shapeBucket(int x)
+{
+	unsigned int v, l = 0;
+
+	if (x < 2) return 0;
+
+	v = (unsigned int) x;
+	while ( v >> (l + 1) ) l++;
+
+	v = 2*l + ( (x >> (l - 1)) & 1 );
+
+	return (v > 63) ? 63 : v;
+}
+
+static unsigned int shapeKey(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero)
+{
+	return SHAPE_VALID |
+			( shapeTypeIndex(type) << 23 ) |
+			( shapeTransIndex(transb) << 21 ) |
+			( shapeTransIndex(transa) << 19 ) |
+			( (beta_is_zero ? 1 : 0) << 18 ) |
+			( shapeBucket(k) << 12 ) |
+			( shapeBucket(n) << 6 ) |
+			shapeBucket(m);
+}
+
+static unsigned int shapeHash(unsigned int key)
+{
+	key ^= key >> 16;
+	key *= 0x45d9f3bu;
+	key ^= key >> 16;
+
+	return key & ( __PHIGEMM_SHAPE_CACHE_SIZE - 1 );
+}
+
+
+/*
+ * Name			: phiGemmShapeLookup
+ * Description	: the method returns the cache entry of the class of the
+ * 				  given GEMM call, creating it (seeded with the current
+ * 				  split factor of the precision) if needed
+ * Visibility	: phiGEMM only
+ */
+phiGemmShapeEntry_t * phiGemmShapeLookup(char type, const char *transa, const char *transb,
+		int m, int n, int k, int beta_is_zero)
+{
+	unsigned int key, slot, i;
+	phiGemmShapeEntry_t *entry, *victim = NULL;
+	float split;
+
+	key = shapeKey(type, transa, transb, m, n, k, beta_is_zero);
+	slot = shapeHash(key);
+
+	for (i = 0; i < SHAPE_PROBES; i++) {
+		entry = &shapeCache[ (slot + i) & ( __PHIGEMM_SHAPE_CACHE_SIZE - 1 ) ];
+
+		if (entry->key == key)
+			return entry;
+
+		if (entry->key == 0) {
+			victim = entry;
+			break;
+		}
+
+		if (victim == NULL || entry->calls < victim->calls)
+			victim = entry;
+	}
+
+#if defined(__PHIGEMM_DEBUG_4)
+	if (victim->key != 0) {
+		printf("[PHIGEMM_DEBUG][4] shape cache: recycling entry %08x (%d calls)\n", victim->key, victim->calls); fflush(stdout);
+	}
+#endif
+
+	split = myPhiGemmTng.split[ shapeTypeIndex(type) ];
+
+	memset(victim, 0, sizeof(phiGemmShapeEntry_t));
+	victim->key = key;
+	victim->split = split;
+	victim->prevSplit = split;
+	victim->lpSplit = split;
+
+	return victim;
+}
+
+
+/*
+ * Name			: phiGemmShapeRecord
+ * Description	: the method appends the measured CPU/GPU unbalance of a
+ * 				  call to the history of its class
+ * Visibility	: phiGEMM only
+ */
+void phiGemmShapeRecord(phiGemmShapeEntry_t *entry, double unbalance)
+{
+	entry->unbalance[ entry->calls % __PHIGEMM_SHAPE_HISTORY ] = (float) unbalance;
+	entry->calls++;
+
+	return;
+}
+
+
+/*
+ * Name			: phiGemmShapeExport
+ * Description	: the method copies up to max used entries of the cache
+ * 				  into out and returns how many were copied
+ * Visibility	: phiGEMM only
+ */
+int phiGemmShapeExport(phiGemmShapeEntry_t *out, int max)
+{
+	int i, count = 0;
+
+	for (i = 0; i < __PHIGEMM_SHAPE_CACHE_SIZE && count < max; i++) {
+		if (shapeCache[i].key != 0)
+			out[count++] = shapeCache[i];
+	}
+
+	return count;
+}
+
+
+/*
+ * Name			: phiGemmShapeImport
+ * Description	: the method stores a (previously exported) entry in the
+ * 				  cache, replacing the one of the same class if present
+ * Visibility	: phiGEMM only
+ */
+void phiGemmShapeImport(const phiGemmShapeEntry_t *entry)
+{
+	unsigned int slot, i;
+	phiGemmShapeEntry_t *target, *victim = NULL;
+
+	if ( !(entry->key & SHAPE_VALID) )
+		return;
+
+	slot = shapeHash(entry->key);
+
+	for (i = 0; i < SHAPE_PROBES; i++) {
+		target = &shapeCache[ (slot + i) & ( __PHIGEMM_SHAPE_CACHE_SIZE - 1 ) ];
+
+		if (target->key == entry->key || target->key == 0) {
+			victim = target;
+			break;
+		}
+
+		if (victim == NULL || target->calls < victim->calls)
+			victim = target;
+	}
+
+	*victim = *entry;
+
+	return;
+}
+
+
+/*
+ * Name			: phiGemmShapeReset
+ * Description	: the method empties the cache (printing its content if
+ * 				  __PHIGEMM_DEBUG is defined)
+ * Visibility	: phiGEMM only
+ */
+void phiGemmShapeReset()
+{
+#if defined(__PHIGEMM_DEBUG)
+	const char types[] = { 'S', 'D', 'C', 'Z' };
+	const char trans[] = { 'N', 'T', 'C', '?' };
+	phiGemmShapeEntry_t *entry;
+	double mean;
+	int i, j, len;
+
+	for (i = 0; i < __PHIGEMM_SHAPE_CACHE_SIZE; i++) {
+		entry = &shapeCache[i];
+
+		if (entry->key == 0 || entry->calls == 0)
+			continue;
+
+		len = imin(entry->calls, __PHIGEMM_SHAPE_HISTORY);
+		for (j = 0, mean = 0.0; j < len; j++)
+			mean += entry->unbalance[j];
+		mean /= len;
+
+		printf("[PHIGEMM_DEBUG] %cGEMM %c%c m~2^%-4.1f n~2^%-4.1f k~2^%-4.1f beta%s0 : split %5.4f, calls %d, mean balance %9.6fs\n",
+				types[ (entry->key >> 23) & 3 ],
+				trans[ (entry->key >> 19) & 3 ], trans[ (entry->key >> 21) & 3 ],
+				0.5 * (entry->key & 63), 0.5 * ((entry->key >> 6) & 63), 0.5 * ((entry->key >> 12) & 63),
+				((entry->key >> 18) & 1) ? "==" : "!=",
+				entry->split, entry->calls, mean);
+	}
+	fflush(stdout);
+#endif
+
+	memset(shapeCache, 0, sizeof(shapeCache));
+	memset(phiGemmCtx->specialk, 0, sizeof(phiGemmCtx->specialk));
+
+	return;
+}
+
+
+/*
+ * Name			: phiGemmSpecialKPlanLookup
+ * Description	: the method returns the Special-K partition of the given
+ * 				  shape (found = 1) or an empty one for it, to be filled
+ * 				  by the caller (found = 0)
+ * Visibility	: phiGEMM only
+ */
+phiGemmSpecialKPlan_t * phiGemmSpecialKPlanLookup(char type, const char *transa, const char *transb,
+		int m, int n, int k, int *found)
+{
+	phiGemmSpecialKPlan_t *plan, *victim = NULL;
+	int i;
+
+	for (i = 0; i < __PHIGEMM_SPECIALK_PLANS; i++) {
+		plan = &phiGemmCtx->specialk[i];
+
+		if ( plan->m > 0 && plan->type == type && plan->m == m && plan->n == n && plan->k == k &&
+				shapeTransIndex(&plan->transa) == shapeTransIndex(transa) &&
+				shapeTransIndex(&plan->transb) == shapeTransIndex(transb) ) {
+			plan->used = ++phiGemmCtx->specialk_clock;
+			*found = 1;
+			return plan;
+		}
+
+		if (victim == NULL || plan->used < victim->used)
+			victim = plan;
+	}
+
+	memset(victim, 0, sizeof(phiGemmSpecialKPlan_t));
+	victim->type = type;
+	victim->transa = *transa;
+	victim->transb = *transb;
+	victim->m = m;
+	victim->n = n;
+	victim->k = k;
+	victim->used = ++phiGemmCtx->specialk_clock;
+	*found = 0;
+
+	return victim;
+}
+
+#endif
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+/*
+ * Shared-A GEMMs (phi?gemmSharedA): C_i = alpha * op(A) * op(B_i) + beta_i * C_i
+ * for a list of right-hand sides issued together.
+ *
+ * Issued one by one, these GEMMs transfer A once per call. Here A is
+ * uploaded once per device and only the B_i and C_i move: the device
+ * share of every right-hand side is cut in chunks of columns, dealt to
+ * the device predicted to finish them first, and streamed through
+ * __PHIGEMM_STREAM_DEPTH buffers (and CUDA streams) per device so that
+ * the transfers of a chunk overlap the computation of the previous one.
+ * The CPU computes the last columns of every right-hand side meanwhile.
+ *
+ * Right-hand sides laid out one after the other in memory (B_i+1 and
+ * C_i+1 following B_i and C_i with the same leading dimensions, and the
+ * same beta) are concatenated first into a single wider GEMM.
+ *
+ * When A leaves no room for the chunks on some device, every (merged)
+ * right-hand side goes through the streaming path instead (see
+ * phigemm_stream.c).
+ */
+
+// Chunks narrower than this are not worth a transfer
+#define SHARED_MIN_COLS 128
+
+static int sharedTransB(char transb)
+{
+	return (transb != 'n') && (transb != 'N');
+}
+
+/* concatenate the right-hand sides contiguous in memory, return the runs */
+static int sharedMerge(char transb, size_t ts, const phiGemmRhs_t *rhs, int count, phiGemmRhs_t *run)
+{
+	const phiGemmRhs_t *last;
+	int i, runs = 0;
+	size_t b_step;
+
+	for (i = 0; i < count; i++) {
+
+		if ( rhs[i].n <= 0 ) continue;
+
+		if ( runs > 0 ) {
+			last = &run[runs - 1];
+			b_step = sharedTransB(transb) ? (size_t) last->n : (size_t) last->n * last->ldb;
+
+			if ( rhs[i].ldb == last->ldb && rhs[i].ldc == last->ldc &&
+					!memcmp(rhs[i].beta, last->beta, ts) &&
+					(const char *) rhs[i].B == (const char *) last->B + b_step * ts &&
+					(char *) rhs[i].C == (char *) last->C + (size_t) last->n * last->ldc * ts ) {
+				run[runs - 1].n += rhs[i].n;
+				continue;
+			}
+		}
+
+		run[runs++] = rhs[i];
+	}
+
+	return runs;
+}
+
+static void sharedCpu(char type, char transa, char transb, int m, int k, const void *alpha,
+		const void *A, int lda, const phiGemmRhs_t *p, int j0, size_t ts)
+{
+	const char *B = (const char *) p->B + ( sharedTransB(transb) ? (size_t) j0 : (size_t) j0 * p->ldb ) * ts;
+	char *C = (char *) p->C + (size_t) j0 * p->ldc * ts;
+
+	if ( p->n - j0 <= 0 ) return;
+
+	phiGemmCpuGemm(type, &transa, &transb, m, p->n - j0, k, alpha, A, lda, B, p->ldb, p->beta, C, p->ldc);
+}
+
+static void sharedRun(phiGemmContext_t *ctx, char type, char transa, char transb, int m, int k,
+		const void *alpha, const void *A, int lda, const phiGemmRhs_t *rhs, int count)
+{
+	phiGemmContext_t *caller = phiGemmContextEnter(ctx);
+	size_t ts = phiGemmTypeSize(type);
+	phiGemmRhs_t *run;
+	int i, runs;
+
+#if !defined(__PHIGEMM_CPUONLY)
+	int is_transa = (transa != 'n') && (transa != 'N');
+	int is_transb = sharedTransB(transb);
+	int d, s, j, nt, cols, best, beta_is_zero, n_dev, n_total, nchunks = 0;
+	int next[MAX_GPUS], ndev[MAX_GPUS];
+	double load[MAX_GPUS], cost, finish;
+	size_t room, fit;
+	float split;
+	char *devA[MAX_GPUS], *devB, *devC;
+	cudaStream_t streams[ MAX_GPUS * __PHIGEMM_STREAM_DEPTH ];
+	cudaEvent_t uploaded[ MAX_GPUS ];
+	cublasStatus_t status;
+
+	/* all-zero bytes are a zero of every precision */
+	static const double zero[2] = { 0.0, 0.0 };
+
+#if defined(__PHIGEMM_DEBUG_4)
+	double start = phigemm_cclock();
+#endif
+#endif
+
+	if ( count <= 0 || m <= 0 ) {
+		phiGemmContextLeave(ctx, caller);
+		return;
+	}
+
+	run = (phiGemmRhs_t *) malloc( count * sizeof(phiGemmRhs_t) );
+	if ( run == NULL ) {
+		printf("*** phiGEMM *** ERROR *** allocation of the shared-A GEMM failed!\n");
+		fflush(stdout);
+		exit(EXIT_FAILURE);
+	}
+
+	runs = sharedMerge(transb, ts, rhs, count, run);
+
+#if !defined(__PHIGEMM_CPUONLY)
+	if ( !phiGemmIsInit() || k <= 0 ) {
+		for (i = 0; i < runs; i++) sharedCpu(type, transa, transb, m, k, alpha, A, lda, &run[i], 0, ts);
+		free(run);
+		phiGemmContextLeave(ctx, caller);
+		return;
+	}
+
+	if ( !phiGemmIsInternalMemAlloc() && !phiGemmIsExternalMemAlloc() )
+		phiGemmInitMemory(NULL);
+
+#if defined(__PHIGEMM_GPUONLY)
+	split = 1.0;
+#else
+	split = myPhiGemmTng.split[ (type == 's') ? 0 : (type == 'd') ? 1 : (type == 'c') ? 2 : 3 ];
+#endif
+
+	/* A and __PHIGEMM_STREAM_DEPTH chunk buffers in the scratch memory of
+	 * the first stream of every device */
+	fit = 0;
+	for (d = 0; d < myPhiGemmEnv.numDevices; d++) {
+		room = myPhiGemmHdl.smem[d] / ts;
+		room = ( room > (size_t) m * k ) ? ( room - (size_t) m * k ) / __PHIGEMM_STREAM_DEPTH / ( k + m ) : 0;
+		if ( d == 0 || room < fit ) fit = room;
+	}
+
+	for (i = 0, n_total = 0; i < runs; i++) n_total += (int) ( run[i].n * split );
+
+	/* no device share: the CPU does it all */
+	if ( n_total == 0 ) {
+		for (i = 0; i < runs; i++) sharedCpu(type, transa, transb, m, k, alpha, A, lda, &run[i], 0, ts);
+		free(run);
+		phiGemmContextLeave(ctx, caller);
+		return;
+	}
+
+	if ( fit < 1 ) {
+		for (i = 0; i < runs; i++)
+			phiGemmStream(type, &transa, &transb, m, run[i].n, k, alpha, A, lda,
+					run[i].B, run[i].ldb, run[i].beta, run[i].C, run[i].ldc, 0, split);
+		cudaSetDevice(myPhiGemmHdl.devId[0]);
+		free(run);
+		phiGemmContextLeave(ctx, caller);
+		return;
+	}
+
+	/* enough chunks to keep every buffer of every device busy */
+	nt = ( n_total + myPhiGemmEnv.numDevices * __PHIGEMM_STREAM_DEPTH - 1 ) /
+			( myPhiGemmEnv.numDevices * __PHIGEMM_STREAM_DEPTH );
+	nt = imax(nt, SHARED_MIN_COLS);
+	if ( (size_t) nt > fit ) nt = (int) fit;
+
+	for (d = 0; d < myPhiGemmEnv.numDevices; d++) {
+
+		cudaSetDevice(myPhiGemmHdl.devId[d]);
+
+		for (s = 0; s < __PHIGEMM_STREAM_DEPTH; s++)
+			streams[d * __PHIGEMM_STREAM_DEPTH + s] = phiGemmPoolStream(d, s);
+		/* the slot of a shared operand, not a timing one */
+		uploaded[d] = phiGemmPoolEvent(d, __PHIGEMM_EVENT_READY);
+
+		/* A once per device, every buffer waits for it */
+		devA[d] = (char *) myPhiGemmHdl.pmem[d];
+
+		if ( is_transa )
+			status = cublasSetMatrixAsync(k, m, ts, A, lda, devA[d], k, streams[d * __PHIGEMM_STREAM_DEPTH]);
+		else
+			status = cublasSetMatrixAsync(m, k, ts, A, lda, devA[d], m, streams[d * __PHIGEMM_STREAM_DEPTH]);
+
+		if (status != CUBLAS_STATUS_SUCCESS) {
+			fprintf (stderr, "!!!! GPU %d: device access error (H2D A) %d\n", d, status); fflush(stderr);
+		}
+
+		cudaEventRecord(uploaded[d], streams[d * __PHIGEMM_STREAM_DEPTH]);
+		for (s = 1; s < __PHIGEMM_STREAM_DEPTH; s++)
+			cudaStreamWaitEvent(streams[d * __PHIGEMM_STREAM_DEPTH + s], uploaded[d], 0);
+
+		load[d] = 0.0;
+		next[d] = 0;
+		ndev[d] = 0;
+	}
+
+	for (i = 0; i < runs; i++) {
+
+		n_dev = (int) ( run[i].n * split );
+		beta_is_zero = !memcmp(run[i].beta, zero, ts);
+
+		for (j = 0; j < n_dev; j += nt) {
+
+			cols = imin(nt, n_dev - j);
+
+			/* the device predicted to finish the chunk first */
+			best = 0;
+			finish = 0.0;
+			for (d = 0; d < myPhiGemmEnv.numDevices; d++) {
+				cost = phiGemmModelTime(type, &transa, &transb, m, cols, k, beta_is_zero, d);
+				if ( d == 0 || load[d] + cost < finish ) {
+					best = d;
+					finish = load[d] + cost;
+				}
+			}
+			d = best;
+			load[d] = finish;
+
+			s = d * __PHIGEMM_STREAM_DEPTH + next[d];
+			next[d] = ( next[d] + 1 ) % __PHIGEMM_STREAM_DEPTH;
+			ndev[d]++;
+			nchunks++;
+
+			/* the stream is in order: its buffer is reused safely */
+			devB = devA[d] + ( (size_t) m * k + (size_t) ( s % __PHIGEMM_STREAM_DEPTH ) * ( k + m ) * nt ) * ts;
+			devC = devB + (size_t) k * nt * ts;
+
+			cudaSetDevice(myPhiGemmHdl.devId[d]);
+
+			if ( is_transb )
+				status = cublasSetMatrixAsync(cols, k, ts, (const char *) run[i].B + (size_t) j * ts, run[i].ldb,
+						devB, cols, streams[s]);
+			else
+				status = cublasSetMatrixAsync(k, cols, ts, (const char *) run[i].B + (size_t) j * run[i].ldb * ts, run[i].ldb,
+						devB, k, streams[s]);
+
+			if ( status == CUBLAS_STATUS_SUCCESS && !beta_is_zero )
+				status = cublasSetMatrixAsync(m, cols, ts, (char *) run[i].C + (size_t) j * run[i].ldc * ts, run[i].ldc,
+						devC, m, streams[s]);
+
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: device access error (H2D B/C) %d\n", d, status); fflush(stderr);
+			}
+
+			cublasSetStream( myPhiGemmHdl.handle[d], streams[s] );
+
+			phiGemmGpuGemm(type, myPhiGemmHdl.handle[d], phiGemmCublasOp(transa), phiGemmCublasOp(transb),
+					m, cols, k, alpha, devA[d], is_transa ? k : m, devB, is_transb ? cols : k,
+					run[i].beta, devC, m);
+
+			cublasSetStream( myPhiGemmHdl.handle[d], myPhiGemmHdl.stream[d] );
+
+			status = cublasGetMatrixAsync(m, cols, ts, devC, m,
+					(char *) run[i].C + (size_t) j * run[i].ldc * ts, run[i].ldc, streams[s]);
+
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: device access error (D2H C) %d\n", d, status); fflush(stderr);
+			}
+		}
+	}
+
+	/* the host computes the last columns while the chunks are in flight */
+	for (i = 0; i < runs; i++)
+		sharedCpu(type, transa, transb, m, k, alpha, A, lda, &run[i], (int) ( run[i].n * split ), ts);
+
+	for (d = 0; d < myPhiGemmEnv.numDevices; d++) {
+
+		cudaSetDevice(myPhiGemmHdl.devId[d]);
+
+		for (s = 0; s < __PHIGEMM_STREAM_DEPTH; s++) {
+			if ( cudaStreamSynchronize(streams[d * __PHIGEMM_STREAM_DEPTH + s]) != cudaSuccess ) {
+				printf ( "!!!! cudaStreamSynchronize error (shared-A GEMM, device %d)\n", d); fflush(stdout);
+			}
+		}
+	}
+
+	cudaSetDevice(myPhiGemmHdl.devId[0]);
+
+#if defined(__PHIGEMM_DEBUG_4)
+	printf("[PHIGEMM_DEBUG][4] shared-A %d x %d: %d right-hand sides in %d runs, %d chunks of %d columns",
+			m, k, count, runs, nchunks, nt);
+	for (d = 0; d < myPhiGemmEnv.numDevices; d++)
+		printf(", GPU %d %d (%.6f s predicted)", d, ndev[d], load[d]);
+	printf(", %10.6f s\n", phigemm_cclock() - start);
+	fflush(stdout);
+#endif
+
+#else
+	for (i = 0; i < runs; i++) sharedCpu(type, transa, transb, m, k, alpha, A, lda, &run[i], 0, ts);
+#endif
+
+	free(run);
+
+	phiGemmContextLeave(ctx, caller);
+}
+
+
+/*
+ * Name			: phiSgemmSharedAEx
+ * Description	: the method performs count SGEMMs sharing the same A,
+ * 				  uploaded once per device of the given context
+ * Visibility	: public
+ */
+void phiSgemmSharedAEx( phiGemmContext_t *ctx, char transa, char transb, int m, int k, const float *alpha,
+		const float *A, int lda, const phiGemmRhs_t *rhs, int count )
+{
+	sharedRun(ctx, 's', transa, transb, m, k, alpha, A, lda, rhs, count);
+}
+
+/*
+ * Name			: phiSgemmSharedA
+ * Description	: the method performs phiSgemmSharedAEx on the default context
+ * Visibility	: public
+ */
+void phiSgemmSharedA( char transa, char transb, int m, int k, const float *alpha,
+		const float *A, int lda, const phiGemmRhs_t *rhs, int count )
+{
+	phiSgemmSharedAEx(&phiGemmDefaultCtx, transa, transb, m, k, alpha, A, lda, rhs, count);
+}
+
+/*
+ * Name			: phiDgemmSharedAEx
+ * Description	: the method performs count DGEMMs sharing the same A,
+ * 				  uploaded once per device of the given context
+ * Visibility	: public
+ */
+void phiDgemmSharedAEx( phiGemmContext_t *ctx, char transa, char transb, int m, int k, const double *alpha,
+		const double *A, int lda, const phiGemmRhs_t *rhs, int count )
+{
+	sharedRun(ctx, 'd', transa, transb, m, k, alpha, A, lda, rhs, count);
+}
+
+/*
+ * Name			: phiDgemmSharedA
+ * Description	: the method performs phiDgemmSharedAEx on the default context
+ * Visibility	: public
+ */
+void phiDgemmSharedA( char transa, char transb, int m, int k, const double *alpha,
+		const double *A, int lda, const phiGemmRhs_t *rhs, int count )
+{
+	phiDgemmSharedAEx(&phiGemmDefaultCtx, transa, transb, m, k, alpha, A, lda, rhs, count);
+}
+
+/*
+ * Name			: phiCgemmSharedAEx
+ * Description	: the method performs count CGEMMs sharing the same A,
+ * 				  uploaded once per device of the given context
+ * Visibility	: public
+ */
+void phiCgemmSharedAEx( phiGemmContext_t *ctx, char transa, char transb, int m, int k, const phiComplex *alpha,
+		const phiComplex *A, int lda, const phiGemmRhs_t *rhs, int count )
+{
+	sharedRun(ctx, 'c', transa, transb, m, k, alpha, A, lda, rhs, count);
+}
+
+/*
+ * Name			: phiCgemmSharedA
+ * Description	: the method performs phiCgemmSharedAEx on the default context
+ * Visibility	: public
+ */
+void phiCgemmSharedA( char transa, char transb, int m, int k, const phiComplex *alpha,
+		const phiComplex *A, int lda, const phiGemmRhs_t *rhs, int count )
+{
+	phiCgemmSharedAEx(&phiGemmDefaultCtx, transa, transb, m, k, alpha, A, lda, rhs, count);
+}
+
+/*
+ * Name			: phiZgemmSharedAEx
+ * Description	: the method performs count ZGEMMs sharing the same A,
+ * 				  uploaded once per device of the given context
+ * Visibility	: public
+ */
+void phiZgemmSharedAEx( phiGemmContext_t *ctx, char transa, char transb, int m, int k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, int lda, const phiGemmRhs_t *rhs, int count )
+{
+	sharedRun(ctx, 'z', transa, transb, m, k, alpha, A, lda, rhs, count);
+}
+
+/*
+ * Name			: phiZgemmSharedA
+ * Description	: the method performs phiZgemmSharedAEx on the default context
+ * Visibility	: public
+ */
+void phiZgemmSharedA( char transa, char transb, int m, int k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, int lda, const phiGemmRhs_t *rhs, int count )
+{
+	phiZgemmSharedAEx(&phiGemmDefaultCtx, transa, transb, m, k, alpha, A, lda, rhs, count);
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/*
+ * Out-of-core execution of the device share of a GEMM.
+ *
+ * When the device share of a call does not fit the scratch memory, it is
+ * cut in mt x nt tiles of C (and in kt chunks of k if a tile holding the
+ * whole k would be too thin). Every worker (device, stream) splits its
+ * scratch memory in __PHIGEMM_STREAM_DEPTH buffers, each one with its own
+ * CUDA stream, so that the upload of a tile overlaps the computation of
+ * the previous one and the download of the one before.
+ *
+ * Tiles are dealt round-robin to the workers and retired in order: a
+ * buffer is reused only after its stream is synchronized and, for the k
+ * chunks but the first, after its partial C is added to the host C. The
+ * host computes its own slab of C piece by piece between two rounds.
+ */
+
+// Tiles thinner than this are not worth a transfer, split k instead
+#define STREAM_MIN_TILE 256
+
+typedef struct phiGemmStreamTask
+{
+	int m0, n0, k0;
+	int mt, nt, kt;
+} phiGemmStreamTask_t;
+
+/* largest mt x nt x kt tile whose depth buffers fit elems elements */
+static void streamTileSize(int m, int n, int k, size_t elems, int *mt, int *nt, int *kt)
+{
+	double room = (double) elems / __PHIGEMM_STREAM_DEPTH;
+	double b;
+
+	/* square tile of C holding the whole k: 2*b*k + b*b <= room */
+	b = sqrt( (double) k * k + room ) - k;
+
+	if ( b >= STREAM_MIN_TILE || b >= imin(m, n) ) {
+		*kt = k;
+	} else {
+		/* cubic tile: 3*b*b <= room */
+		b = sqrt( room / 3.0 );
+		*kt = imin(k, imax((int) b, 1));
+	}
+
+	*mt = imin(m, imax((int) b, 1));
+
+	/* give the room left by a short m to n */
+	b = ( room - (double) (*mt) * (*kt) ) / ( (double) (*kt) + (*mt) );
+	*nt = imin(n, imax((int) b, 1));
+}
+
+
+/* buffer (and stream) of worker t % workers holding the task t */
+static int streamSlot(int t, int workers)
+{
+	return (t % workers) * __PHIGEMM_STREAM_DEPTH + (t / workers) % __PHIGEMM_STREAM_DEPTH;
+}
+
+
+/*
+ * Name			: phiGemmStream
+ * Description	: the method performs a CPU+GPU GEMM whose device share
+ * 				  does not fit the scratch memory, streaming tiles through
+ * 				  multiple buffers (type is one of 's', 'd', 'c', 'z')
+ * Visibility	: phiGEMM only
+ */
+void phiGemmStream(char type, const char *transa, const char *transb,
+		int m, int n, int k, const void *alpha, const void *A, int lda,
+		const void *B, int ldb, const void *beta, void *C, int ldc,
+		int is_splitA, float split)
+{
+	int workers = myPhiGemmEnv.numDevices * NSTREAMS;
+	int is_transa = (*transa != 'n') && (*transa != 'N');
+	int is_transb = (*transb != 'n') && (*transb != 'N');
+	int beta_is_zero, tmp, m_dev, n_dev, m_cpu, n_cpu, mt, nt, kt;
+	int i, j, l, t, r, w, slot, ntasks, rounds, retired, piece0, piece1, partial_pageable = 0;
+	size_t ts = phiGemmTypeSize(type), limit, elems, a_offset, b_offset, c_offset, partial_bytes;
+	char *devA, *devB, *devC, *partial = NULL;
+	const char *hostA = (const char *) A, *hostB = (const char *) B;
+	char *hostC = (char *) C;
+	cudaStream_t streams[ NSTREAMS * MAX_GPUS * __PHIGEMM_STREAM_DEPTH ];
+	phiGemmStreamTask_t *tasks, *task;
+	cublasStatus_t status;
+
+	/* all-zero bytes are a zero of every precision */
+	static const double zero[2] = { 0.0, 0.0 };
+
+	beta_is_zero = !memcmp(beta, zero, ts);
+
+	/* the devices take the first rows (columns) of C, the CPU the others */
+	if (is_splitA) {
+		tmp = m * split;
+		m_dev = tmp;
+		n_dev = n;
+		m_cpu = m - tmp;
+		n_cpu = n;
+		a_offset = is_transa ? (size_t) tmp * lda : (size_t) tmp;
+		b_offset = 0;
+		c_offset = tmp;
+	} else {
+		tmp = n * split;
+		m_dev = m;
+		n_dev = tmp;
+		m_cpu = m;
+		n_cpu = n - tmp;
+		a_offset = 0;
+		b_offset = is_transb ? (size_t) tmp : (size_t) tmp * ldb;
+		c_offset = (size_t) ldc * tmp;
+	}
+
+	for (w = 0, limit = 0; w < workers; w++)
+		if (w == 0 || myPhiGemmHdl.smem[w] < limit)
+			limit = myPhiGemmHdl.smem[w];
+
+	streamTileSize(m_dev, n_dev, k, limit / ts, &mt, &nt, &kt);
+	elems = (size_t) mt * kt + (size_t) kt * nt + (size_t) mt * nt;
+
+	if ( elems * __PHIGEMM_STREAM_DEPTH > limit / ts ) {
+		printf("*** phiGEMM *** ERROR *** scratch memory too small to stream the GEMM!\n");
+		fflush(stdout);
+		exit(EXIT_FAILURE);
+	}
+
+	/* one task per tile of C and chunk of k, the chunks of a tile in a row */
+	ntasks = (m_dev > 0 && n_dev > 0) ?
+			( (m_dev + mt - 1) / mt ) * ( (n_dev + nt - 1) / nt ) * ( (k + kt - 1) / kt ) : 0;
+
+	tasks = (phiGemmStreamTask_t *) malloc( imax(ntasks, 1) * sizeof(phiGemmStreamTask_t) );
+	/* the partial products are downloaded asynchronously, pinned memory if the pool has it */
+	if ( kt < k ) {
+		partial_bytes = (size_t) workers * __PHIGEMM_STREAM_DEPTH * mt * nt * ts;
+		partial = (char *) phiGemmPoolHostAlloc( partial_bytes );
+		if ( partial == NULL ) {
+			partial = (char *) malloc( partial_bytes );
+			partial_pageable = 1;
+		}
+	}
+
+	if ( tasks == NULL || ( kt < k && partial == NULL ) ) {
+		printf("*** phiGEMM *** ERROR *** allocation of the streaming tasks failed!\n");
+		fflush(stdout);
+		exit(EXIT_FAILURE);
+	}
+
+	for (j = 0, t = 0; j < n_dev && ntasks > 0; j += nt) {
+		for (i = 0; i < m_dev; i += mt) {
+			for (l = 0; l < k; l += kt, t++) {
+				tasks[t].m0 = i;
+				tasks[t].n0 = j;
+				tasks[t].k0 = l;
+				tasks[t].mt = imin(mt, m_dev - i);
+				tasks[t].nt = imin(nt, n_dev - j);
+				tasks[t].kt = imin(kt, k - l);
+			}
+		}
+	}
+
+#if defined(__PHIGEMM_DEBUG_4)
+	printf("[PHIGEMM_DEBUG][4] streaming %d x %d x %d in %d tiles of %d x %d x %d (depth %d)\n",
+			m_dev, n_dev, k, ntasks, mt, nt, kt, __PHIGEMM_STREAM_DEPTH); fflush(stdout);
+#endif
+
+	for (slot = 0; slot < workers * __PHIGEMM_STREAM_DEPTH; slot++)
+		streams[slot] = phiGemmPoolStream(slot / __PHIGEMM_STREAM_DEPTH, slot % __PHIGEMM_STREAM_DEPTH);
+
+	rounds = (ntasks + workers - 1) / workers;
+	retired = 0;
+
+	for (r = 0; r <= rounds; r++) {
+
+		for (w = 0; w < workers && r < rounds; w++) {
+
+			t = r * workers + w;
+			if (t >= ntasks) break;
+
+			/* a buffer is free once the task it holds, and every older one, is retired */
+			for ( ; retired <= t - workers * __PHIGEMM_STREAM_DEPTH; retired++) {
+				task = &tasks[retired];
+				slot = streamSlot(retired, workers);
+
+				cudaSetDevice(myPhiGemmHdl.devId[ (retired % workers) % myPhiGemmEnv.numDevices ]);
+				cudaStreamSynchronize( streams[slot] );
+
+				if ( task->k0 > 0 )
+					phiGemmTileAccumulate(type, task->mt, task->nt, partial + (size_t) slot * mt * nt * ts, task->mt,
+							hostC + ( task->m0 + (size_t) task->n0 * ldc ) * ts, ldc);
+			}
+
+			task = &tasks[t];
+			slot = streamSlot(t, workers);
+
+			cudaSetDevice(myPhiGemmHdl.devId[w % myPhiGemmEnv.numDevices]);
+
+			devA = (char *) myPhiGemmHdl.pmem[w] + (slot % __PHIGEMM_STREAM_DEPTH) * elems * ts;
+			devB = devA + (size_t) task->mt * task->kt * ts;
+			devC = devB + (size_t) task->kt * task->nt * ts;
+
+			if ( is_transa )
+				status = cublasSetMatrixAsync (task->kt, task->mt, ts,
+						hostA + ( task->k0 + (size_t) task->m0 * lda ) * ts, lda,
+						devA, task->kt, streams[slot]);
+			else
+				status = cublasSetMatrixAsync (task->mt, task->kt, ts,
+						hostA + ( task->m0 + (size_t) task->k0 * lda ) * ts, lda,
+						devA, task->mt, streams[slot]);
+
+			if ( status == CUBLAS_STATUS_SUCCESS ) {
+				if ( is_transb )
+					status = cublasSetMatrixAsync (task->nt, task->kt, ts,
+							hostB + ( task->n0 + (size_t) task->k0 * ldb ) * ts, ldb,
+							devB, task->nt, streams[slot]);
+				else
+					status = cublasSetMatrixAsync (task->kt, task->nt, ts,
+							hostB + ( task->k0 + (size_t) task->n0 * ldb ) * ts, ldb,
+							devB, task->kt, streams[slot]);
+			}
+
+			/* the first chunk of k owns C, the others return a partial product */
+			if ( status == CUBLAS_STATUS_SUCCESS && task->k0 == 0 && !beta_is_zero )
+				status = cublasSetMatrixAsync (task->mt, task->nt, ts,
+						hostC + ( task->m0 + (size_t) task->n0 * ldc ) * ts, ldc,
+						devC, task->mt, streams[slot]);
+
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: device access error (H2D tile %d) %d\n", w, t, status); fflush(stderr);
+			}
+
+			cublasSetStream( myPhiGemmHdl.handle[w], streams[slot] );
+
+			phiGemmGpuGemm(type, myPhiGemmHdl.handle[w], phiGemmCublasOp(*transa), phiGemmCublasOp(*transb),
+					task->mt, task->nt, task->kt, alpha,
+					devA, is_transa ? task->kt : task->mt, devB, is_transb ? task->nt : task->kt,
+					( task->k0 == 0 ) ? beta : (const void *) zero, devC, task->mt);
+
+			cublasSetStream( myPhiGemmHdl.handle[w], myPhiGemmHdl.stream[w] );
+
+			if ( task->k0 == 0 )
+				status = cublasGetMatrixAsync (task->mt, task->nt, ts, devC, task->mt,
+						hostC + ( task->m0 + (size_t) task->n0 * ldc ) * ts, ldc, streams[slot]);
+			else
+				status = cublasGetMatrixAsync (task->mt, task->nt, ts, devC, task->mt,
+						partial + (size_t) slot * mt * nt * ts, task->mt, streams[slot]);
+
+			if (status != CUBLAS_STATUS_SUCCESS) {
+				fprintf (stderr, "!!!! GPU %d: device access error (D2H tile %d) %d\n", w, t, status); fflush(stderr);
+			}
+		}
+
+		if (r == rounds) break;
+
+		/* the host computes a piece of its slab while the round is in flight */
+		piece0 = (int) ( (long) n_cpu * r / rounds );
+		piece1 = (int) ( (long) n_cpu * (r + 1) / rounds );
+
+		phiGemmCpuGemm(type, transa, transb, m_cpu, piece1 - piece0, k, alpha,
+				hostA + a_offset * ts, lda,
+				hostB + ( b_offset + ( is_transb ? (size_t) piece0 : (size_t) piece0 * ldb ) ) * ts, ldb,
+				beta, hostC + ( c_offset + (size_t) piece0 * ldc ) * ts, ldc);
+	}
+
+	/* no device share: the CPU does it all */
+	if (rounds == 0)
+		phiGemmCpuGemm(type, transa, transb, m_cpu, n_cpu, k, alpha, hostA + a_offset * ts, lda,
+				hostB + b_offset * ts, ldb, beta, hostC + c_offset * ts, ldc);
+
+	for ( ; retired < ntasks; retired++) {
+		task = &tasks[retired];
+		slot = streamSlot(retired, workers);
+
+		cudaSetDevice(myPhiGemmHdl.devId[ (retired % workers) % myPhiGemmEnv.numDevices ]);
+		cudaStreamSynchronize( streams[slot] );
+
+		if ( task->k0 > 0 )
+			phiGemmTileAccumulate(type, task->mt, task->nt, partial + (size_t) slot * mt * nt * ts, task->mt,
+					hostC + ( task->m0 + (size_t) task->n0 * ldc ) * ts, ldc);
+	}
+
+	free(tasks);
+	if ( partial != NULL ) {
+		if ( partial_pageable )
+			free(partial);
+		else
+			phiGemmPoolHostFree(partial);
+	}
+
+	return;
+}
+
+#endif
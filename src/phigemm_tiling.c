@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/*
+ * Decomposition of the device share of a GEMM.
+ *
+ * PHIGEMM_xGEMM_MF gives the CPU a slab of rows (is_splitA) or columns of C
+ * and the devices the rest, an m_dev x n_dev x k product. Splitting that
+ * share again along the same dimension replicates the whole of B (or A) on
+ * every device. With __PHIGEMM_TILING the share is cut in a pr x pc grid of
+ * C tiles, each one possibly split in pk slices along k, pr*pc*pk being the
+ * number of devices times NSTREAMS:
+ *
+ * - the A block of a tile row goes to the pc tiles of the row,
+ * - the B block of a tile column goes to the pr tiles of the column,
+ * - the first k slice of a tile owns C, the other slices return a partial
+ *   product that the host adds to C.
+ *
+ * Among the grids whose tiles fit the scratch memory of their device, the
+ * planner picks the one moving the fewest bytes over the bus. Without
+ * __PHIGEMM_TILING the plan is the historical 1D split.
+ *
+ * The blocks are not equal: they follow the GEMM rate of every device
+ * (the cost model rates, refined by the measured calls) and a block too
+ * large for the scratch memory of its device gives the rest to the others,
+ * so that a node with cards of different generations is not bound to the
+ * slowest (or smallest) one.
+ *
+ * A share thinner than the grid leaves empty rows (columns) of tiles: they
+ * are dropped and the blocks sized again over the smaller grid, whose
+ * tiles go to the first plan->workers workers, the others staying idle.
+ */
+
+// A partial C is moved back and then read again by the host accumulation
+#define TILE_PARTIAL_COST 2
+
+/* size of the i-th of parts blocks, the first one takes the residual */
+static int tileBlock(int size, int parts, int i)
+{
+	int step = size / parts;
+
+	return (i == 0) ? step + (size - parts * step) : step;
+}
+
+static int tileOffset(int size, int parts, int i)
+{
+	int step = size / parts;
+
+	return (i == 0) ? 0 : step * i + (size - parts * step);
+}
+
+/* elements moved over the bus (the upload of C, the same for every grid, is left out) */
+static double tileTraffic(int m, int n, int k, int pr, int pc, int pk)
+{
+	return (double) pc * m * k + (double) pr * k * n +
+			(double) ( 1 + TILE_PARTIAL_COST * (pk - 1) ) * m * n;
+}
+
+/* largest block along a dimension such that the tile fits limit elements */
+static int tileCap(size_t limit, int other, int kt)
+{
+	double cap = ( (double) limit - (double) kt * other ) / ( (double) kt + other );
+
+	return (cap < 0.0) ? 0 : (int) imin(cap, 2147483647.0);
+}
+
+/*
+ * Blocks of size proportional to weight; a block larger than its cap (if
+ * cap is given) is cut to the cap and the rest goes to the other blocks.
+ * The rounding residual is spread over the blocks. Return 0 if the caps
+ * cannot hold size (the blocks then follow weight only)
+ */
+static int tileShares(int size, int parts, const double *weight, const int *cap,
+		int *len, int *off)
+{
+	int p, capped, done, fits = 1, fixed[ NSTREAMS * MAX_GPUS ];
+	double rest = size, total, acc;
+
+	for (p = 0; p < parts; p++)
+		fixed[p] = 0;
+
+	do {
+		capped = 0;
+		for (p = 0, total = 0.0; p < parts; p++)
+			if (!fixed[p]) total += weight[p];
+
+		if (total <= 0.0) break;
+
+		for (p = 0; p < parts && cap != NULL; p++) {
+			if (!fixed[p] && cap[p] < rest * weight[p] / total) {
+				fixed[p] = 1;
+				rest -= cap[p];
+				capped = 1;
+			}
+		}
+	} while (capped);
+
+	if (total <= 0.0) {
+		/* every block is capped: nothing fits */
+		fits = 0;
+		rest = size;
+		for (p = 0, total = 0.0; p < parts; p++) {
+			fixed[p] = 0;
+			total += weight[p];
+		}
+	}
+
+	for (p = 0, acc = 0.0, done = 0; p < parts; p++) {
+		if (fixed[p]) {
+			len[p] = cap[p];
+		} else {
+			acc += rest * weight[p] / total;
+			len[p] = (int) (acc + 0.5) - done;
+			done += len[p];
+		}
+		off[p] = (p == 0) ? 0 : off[p - 1] + len[p - 1];
+	}
+
+	return fits;
+}
+
+
+/*
+ * Tiles of a pr x pc x pk grid: the blocks along m and n follow the rates
+ * of the workers, the dimension cut in more blocks is also bounded by the
+ * scratch memory of every worker. Return 1 if every tile fits the memory
+ * of its worker
+ */
+static int tileLayout(int m, int n, int k, int pr, int pc, int pk,
+		const double *rate, const size_t *limit, phiGemmTilePlan_t *plan)
+{
+	int rows[ NSTREAMS * MAX_GPUS ], rows0[ NSTREAMS * MAX_GPUS ];
+	int cols[ NSTREAMS * MAX_GPUS ], cols0[ NSTREAMS * MAX_GPUS ];
+	int cap[ NSTREAMS * MAX_GPUS ];
+	double wr[ NSTREAMS * MAX_GPUS ], wc[ NSTREAMS * MAX_GPUS ];
+	int r, c, s, w, used_rows, used_cols, fits = 1, kt = tileBlock(k, pk, 0);
+	size_t footprint;
+
+	/* the empty rows and columns of tiles are dropped (one is kept if all
+	 * are) and the blocks sized again, so that every tile is sized with
+	 * the rate and the memory of the worker it goes to */
+	for (;;) {
+		for (w = 0; w < NSTREAMS * MAX_GPUS; w++) {
+			wr[w] = wc[w] = 0.0;
+			cap[w] = 0;
+		}
+
+		for (r = 0; r < pr; r++) {
+			for (c = 0; c < pc; c++) {
+				for (s = 0; s < pk; s++) {
+					w = (r * pc + c) * pk + s;
+					wr[r] += rate[w];
+					wc[c] += rate[w];
+				}
+			}
+		}
+
+		if (pr >= pc) {
+			tileShares(n, pc, wc, NULL, cols, cols0);
+			for (r = 0; r < pr; r++) {
+				cap[r] = m;
+				for (c = 0; c < pc; c++)
+					for (s = 0; s < pk; s++)
+						cap[r] = imin(cap[r], tileCap(limit[(r * pc + c) * pk + s], cols[c], kt));
+			}
+			tileShares(m, pr, wr, cap, rows, rows0);
+		} else {
+			tileShares(m, pr, wr, NULL, rows, rows0);
+			for (c = 0; c < pc; c++) {
+				cap[c] = n;
+				for (r = 0; r < pr; r++)
+					for (s = 0; s < pk; s++)
+						cap[c] = imin(cap[c], tileCap(limit[(r * pc + c) * pk + s], rows[r], kt));
+			}
+			tileShares(n, pc, wc, cap, cols, cols0);
+		}
+
+		for (r = 0, used_rows = 0; r < pr; r++)
+			if (rows[r] > 0) used_rows++;
+		for (c = 0, used_cols = 0; c < pc; c++)
+			if (cols[c] > 0) used_cols++;
+
+		used_rows = imax(used_rows, 1);
+		used_cols = imax(used_cols, 1);
+
+		if (used_rows == pr && used_cols == pc) break;
+
+		pr = used_rows;
+		pc = used_cols;
+	}
+
+	plan->pr = pr;
+	plan->pc = pc;
+	plan->pk = pk;
+	plan->workers = pr * pc * pk;
+	plan->footprint = 0;
+	plan->partial = 0;
+
+	for (w = plan->workers; w < NSTREAMS * MAX_GPUS; w++) {
+		plan->m[w] = plan->n[w] = plan->k[w] = 0;
+		plan->m0[w] = plan->n0[w] = plan->k0[w] = 0;
+		plan->slice[w] = 0;
+		plan->poff[w] = 0;
+	}
+
+	for (r = 0; r < pr; r++) {
+		for (c = 0; c < pc; c++) {
+			for (s = 0; s < pk; s++) {
+
+				w = (r * pc + c) * pk + s;
+
+				plan->m[w] = rows[r];
+				plan->n[w] = cols[c];
+				plan->k[w] = tileBlock(k, pk, s);
+				plan->m0[w] = rows0[r];
+				plan->n0[w] = cols0[c];
+				plan->k0[w] = tileOffset(k, pk, s);
+				plan->slice[w] = s;
+				plan->poff[w] = 0;
+
+				if (s > 0) {
+					plan->poff[w] = plan->partial;
+					plan->partial += (size_t) plan->m[w] * plan->n[w];
+				}
+
+				footprint = (size_t) plan->m[w] * plan->k[w] + (size_t) plan->k[w] * plan->n[w] +
+						(size_t) plan->m[w] * plan->n[w];
+				plan->footprint = imax(plan->footprint, footprint);
+				if (footprint > limit[w]) fits = 0;
+			}
+		}
+	}
+
+	plan->fits = fits;
+
+	return fits;
+}
+
+
+/*
+ * Name			: phiGemmTilePlan
+ * Description	: the method computes the tiles of the device share of a
+ * 				  call and the worker (device, stream) computing each one
+ * 				  (type is one of 's', 'd', 'c', 'z')
+ * Visibility	: phiGEMM only
+ */
+void phiGemmTilePlan(char type, int is_splitA, float split, int m, int n, int k,
+		phiGemmTilePlan_t *plan)
+{
+	int workers = myPhiGemmEnv.numDevices * NSTREAMS;
+	int t = (type == 's') ? 0 : (type == 'd') ? 1 : (type == 'c') ? 2 : 3;
+	int m_dev, n_dev, w;
+	double rate[ NSTREAMS * MAX_GPUS ];
+	size_t limit[ NSTREAMS * MAX_GPUS ];
+	size_t type_size = (t == 0) ? 4 : (t == 3) ? 16 : 8;
+
+#if defined(__PHIGEMM_TILING)
+	phiGemmTilePlan_t candidate;
+	double traffic, best_traffic;
+	int i, j, l;
+#endif
+
+	if (is_splitA) {
+		m_dev = m * split;
+		n_dev = n;
+	} else {
+		m_dev = m;
+		n_dev = n * split;
+	}
+
+	/* the streams of a device share its rate (measured or calibrated) */
+	for (w = 0; w < workers; w++) {
+		rate[w] = myPhiGemmMdl.gpu_gflops[t][w % myPhiGemmEnv.numDevices];
+		if (rate[w] <= 0.0) rate[w] = 1.0;
+		limit[w] = myPhiGemmHdl.smem[w] / type_size;
+	}
+
+	/* historical decomposition: split the share along m or n only */
+	tileLayout(m_dev, n_dev, k, is_splitA ? workers : 1, is_splitA ? 1 : workers, 1,
+			rate, limit, plan);
+
+#if defined(__PHIGEMM_TILING)
+	best_traffic = tileTraffic(m_dev, n_dev, k, plan->pr, plan->pc, plan->pk);
+
+	for (l = 1; l <= workers; l++) {
+
+		if (workers % l) continue;
+
+		/* thin k slices do not pay their partial C back */
+		if (l > 1 && k / l < myPhiGemmTng.LOWER_LIMIT) continue;
+
+		for (i = 1; i <= workers / l; i++) {
+
+			if ((workers / l) % i) continue;
+
+			j = workers / (l * i);
+
+			if (i > imax(m_dev, 1) || j > imax(n_dev, 1)) continue;
+
+			tileLayout(m_dev, n_dev, k, i, j, l, rate, limit, &candidate);
+			traffic = tileTraffic(m_dev, n_dev, k, i, j, l);
+
+			/* fitting grids first, then the least traffic (or the least memory if nothing fits) */
+			if ( (candidate.fits && !plan->fits) ||
+					(candidate.fits == plan->fits &&
+							( candidate.fits ? traffic < best_traffic : candidate.footprint < plan->footprint )) ) {
+				*plan = candidate;
+				best_traffic = traffic;
+			}
+		}
+	}
+#endif
+
+#if defined(__PHIGEMM_DEBUG_4)
+	printf("[PHIGEMM_DEBUG][4] tiles %d x %d x %d of %d x %d x %d: %lu elements on the largest, %.0f moved%s\n",
+			plan->pr, plan->pc, plan->pk, m_dev, n_dev, k, (unsigned long) plan->footprint,
+			tileTraffic(m_dev, n_dev, k, plan->pr, plan->pc, plan->pk), plan->fits ? "" : " (out of memory)");
+	for (w = 0; w < plan->workers; w++)
+		printf("[PHIGEMM_DEBUG][4]   worker %d (GPU %d, %.1f GFlops): %d x %d x %d at (%d, %d, %d)\n",
+				w, w % myPhiGemmEnv.numDevices, rate[w], plan->m[w], plan->n[w], plan->k[w],
+				plan->m0[w], plan->n0[w], plan->k0[w]);
+	fflush(stdout);
+#endif
+
+	return;
+}
+
+
+/*
+ * Name			: phiGemmTileAccumulate
+ * Description	: the method adds the m x n partial product of a k slice
+ * 				  to C (type is one of 's', 'd', 'c', 'z')
+ * Visibility	: phiGEMM only
+ */
+void phiGemmTileAccumulate(char type, int m, int n, const void *partial, int ldp, void *C, int ldc)
+{
+	phiGemmReduce(type, m, n, NULL, partial, ldp, C, ldc);
+
+	return;
+}
+
+#endif
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/*
+ * Persistent tuning database.
+ *
+ * If PHI_TUNING_DB is set, the converged tuning state (split factors of
+ * every shape class, SpecialK thresholds, CPU/GPU crossover limits and the
+ * cost model rates) is written at phiGemmShutdown() into
+ *
+ *     $PHI_TUNING_DB.<signature hash>.db
+ *
+ * and mapped back at phiGemmInit(). The signature describes host name,
+ * cores and bound devices, so different nodes or device setups sharing a
+ * file system do not pollute each other. Variables explicitly set in the
+ * environment (PHI_*_SPLIT, PHI_SPLITK_*, ...) win over the stored values.
+ *
+ * The file is a fixed header followed by the shape cache entries; any
+ * change of the layout must bump TUNINGDB_VERSION.
+ */
+
+#define TUNINGDB_MAGIC "PHIGEMM"
+#define TUNINGDB_VERSION 1
+#define TUNINGDB_SIGLEN 512
+
+typedef struct phiGemmTuningDBHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int header_size;
+	unsigned int entry_size;
+	unsigned int nshapes;
+	char signature[ TUNINGDB_SIGLEN ];
+	phiGemmTuning_t tng;
+	phiGemmModel_t mdl;
+} phiGemmTuningDBHeader_t;
+
+
+static void tuningDBSignature(char *sig)
+{
+	struct cudaDeviceProp deviceProp;
+	char host[128];
+	size_t len;
+	int i;
+
+	if ( gethostname(host, sizeof(host)) != 0 )
+		strcpy(host, "unknown");
+	host[ sizeof(host) - 1 ] = '\0';
+
+	len = snprintf(sig, TUNINGDB_SIGLEN, "%s|cores=%d|devices=%d", host, myPhiGemmEnv.cores, myPhiGemmEnv.numDevices);
+
+	for (i = 0; i < myPhiGemmEnv.numDevices && len < TUNINGDB_SIGLEN; i++) {
+		memset(&deviceProp, 0, sizeof(deviceProp));
+		cudaGetDeviceProperties(&deviceProp, myPhiGemmHdl.devId[i]);
+		len += snprintf(sig + len, TUNINGDB_SIGLEN - len, "|%s/%lu", deviceProp.name, (unsigned long) deviceProp.totalGlobalMem);
+	}
+
+	return;
+}
+
+
+static void tuningDBFilename(char *filename, const char *sig)
+{
+	/* FNV-1a */
+	unsigned long long hash = 14695981039346656037ULL;
+
+	for ( ; *sig != '\0'; sig++) {
+		hash ^= (unsigned char) *sig;
+		hash *= 1099511628211ULL;
+	}
+
+	snprintf(filename, FILENAME_MAX, "%.*s.%016llx.db", FILENAME_MAX - 32, myPhiGemmEnv.tuningdb, hash);
+
+	return;
+}
+
+
+/*
+ * Name			: phiGemmTuningDBLoad
+ * Description	: the method maps the tuning database of the current
+ * 				  host/devices (if any) and restores its content
+ * Visibility	: phiGEMM only
+ */
+void phiGemmTuningDBLoad()
+{
+	const char *splitVars[4] = { "PHI_SGEMM_SPLIT", "PHI_DGEMM_SPLIT", "PHI_CGEMM_SPLIT", "PHI_ZGEMM_SPLIT" };
+	char sig[ TUNINGDB_SIGLEN ], filename[ FILENAME_MAX ];
+	const phiGemmTuningDBHeader_t *hdr;
+	const phiGemmShapeEntry_t *entries;
+	struct stat st;
+	void *map;
+	int fd, i;
+
+	if ( myPhiGemmEnv.tuningdb[0] == '\0' )
+		return;
+
+	tuningDBSignature(sig);
+	tuningDBFilename(filename, sig);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+#if defined(__PHIGEMM_DEBUG)
+		printf("[PHIGEMM_DEBUG] tuning database %s not found, starting from defaults\n", filename); fflush(stdout);
+#endif
+		return;
+	}
+
+	if ( fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(phiGemmTuningDBHeader_t) ) {
+		printf("*** phiGEMM *** WARNING *** tuning database %s is truncated, ignored\n", filename); fflush(stdout);
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		printf("*** phiGEMM *** WARNING *** mmap of tuning database %s failed, ignored\n", filename); fflush(stdout);
+		return;
+	}
+
+	hdr = (const phiGemmTuningDBHeader_t *) map;
+	entries = (const phiGemmShapeEntry_t *) ( (const char *) map + sizeof(phiGemmTuningDBHeader_t) );
+
+	if ( strncmp(hdr->magic, TUNINGDB_MAGIC, sizeof(hdr->magic)) ||
+			hdr->version != TUNINGDB_VERSION ||
+			hdr->header_size != sizeof(phiGemmTuningDBHeader_t) ||
+			hdr->entry_size != sizeof(phiGemmShapeEntry_t) ||
+			st.st_size < (off_t) ( sizeof(phiGemmTuningDBHeader_t) + (size_t) hdr->nshapes * sizeof(phiGemmShapeEntry_t) ) ) {
+		printf("*** phiGEMM *** WARNING *** tuning database %s has an incompatible format, ignored\n", filename); fflush(stdout);
+		munmap(map, st.st_size);
+		return;
+	}
+
+	if ( strncmp(hdr->signature, sig, TUNINGDB_SIGLEN) ) {
+		/* Hash collision: it belongs to a different machine */
+		printf("*** phiGEMM *** WARNING *** tuning database %s was built on a different host/device setup, ignored\n", filename); fflush(stdout);
+		munmap(map, st.st_size);
+		return;
+	}
+
+	for (i = 0; i < 4; i++) {
+		if ( getenv(splitVars[i]) == NULL ) {
+			myPhiGemmTng.split[i] = hdr->tng.split[i];
+			myPhiGemmTng.prevSplit[i] = hdr->tng.split[i];
+		}
+	}
+
+	if ( getenv("PHI_SPLITK_FACTOR") == NULL ) myPhiGemmTng.SPLITK_FACTOR = hdr->tng.SPLITK_FACTOR;
+	if ( getenv("PHI_THRESHOLD") == NULL ) myPhiGemmTng.THRESHOLD = hdr->tng.THRESHOLD;
+	if ( getenv("PHI_SPLITK_DGEMM") == NULL ) myPhiGemmTng.SPLITK_DGEMM = hdr->tng.SPLITK_DGEMM;
+	if ( getenv("PHI_SPLITK_ZGEMM") == NULL ) myPhiGemmTng.SPLITK_ZGEMM = hdr->tng.SPLITK_ZGEMM;
+	if ( getenv("PHI_LOWER_LIMIT") == NULL ) myPhiGemmTng.LOWER_LIMIT = hdr->tng.LOWER_LIMIT;
+	if ( getenv("PHI_UPPER_LIMIT_NM") == NULL ) myPhiGemmTng.UPPER_LIMIT_NM = hdr->tng.UPPER_LIMIT_NM;
+	if ( getenv("PHI_UPPER_LIMIT_K") == NULL ) myPhiGemmTng.UPPER_LIMIT_K = hdr->tng.UPPER_LIMIT_K;
+
+	if ( getenv("PHI_MODEL_CPU_GFLOPS") == NULL && getenv("PHI_MODEL_GPU_GFLOPS") == NULL &&
+			getenv("PHI_MODEL_H2D_BW") == NULL && getenv("PHI_MODEL_D2H_BW") == NULL )
+		myPhiGemmMdl = hdr->mdl;
+
+	for (i = 0; i < hdr->nshapes; i++)
+		phiGemmShapeImport( &entries[i] );
+
+#if defined(__PHIGEMM_DEBUG)
+	printf("[PHIGEMM_DEBUG] tuning database %s loaded (%u shapes)\n", filename, hdr->nshapes); fflush(stdout);
+#endif
+
+	munmap(map, st.st_size);
+
+	return;
+}
+
+
+/*
+ * Name			: phiGemmTuningDBStore
+ * Description	: the method writes the current tuning state into the
+ * 				  database of the current host/devices
+ * Visibility	: phiGEMM only
+ */
+void phiGemmTuningDBStore()
+{
+	char filename[ FILENAME_MAX ], tmpname[ FILENAME_MAX + 32 ];
+	phiGemmTuningDBHeader_t hdr;
+	phiGemmShapeEntry_t *entries;
+	FILE *fp;
+	int nshapes, ok;
+
+	if ( myPhiGemmEnv.tuningdb[0] == '\0' )
+		return;
+
+	entries = (phiGemmShapeEntry_t *) malloc( __PHIGEMM_SHAPE_CACHE_SIZE * sizeof(phiGemmShapeEntry_t) );
+	if (entries == NULL) {
+		printf("*** phiGEMM *** WARNING *** out of memory, tuning database not written\n"); fflush(stdout);
+		return;
+	}
+	nshapes = phiGemmShapeExport(entries, __PHIGEMM_SHAPE_CACHE_SIZE);
+
+	memset(&hdr, 0, sizeof(hdr));
+	strncpy(hdr.magic, TUNINGDB_MAGIC, sizeof(hdr.magic));
+	hdr.version = TUNINGDB_VERSION;
+	hdr.header_size = sizeof(phiGemmTuningDBHeader_t);
+	hdr.entry_size = sizeof(phiGemmShapeEntry_t);
+	hdr.nshapes = nshapes;
+	hdr.tng = myPhiGemmTng;
+	hdr.mdl = myPhiGemmMdl;
+	tuningDBSignature(hdr.signature);
+	tuningDBFilename(filename, hdr.signature);
+
+	/* Write aside and rename, so concurrent processes (or contexts) never see a partial file */
+	snprintf(tmpname, sizeof(tmpname), "%s.%d.%lx.tmp", filename, (int) getpid(), (unsigned long) phiGemmCtx);
+
+	fp = fopen(tmpname, "wb");
+	if (fp == NULL) {
+		printf("*** phiGEMM *** WARNING *** cannot write tuning database %s\n", tmpname); fflush(stdout);
+		free(entries);
+		return;
+	}
+
+	ok = ( fwrite(&hdr, sizeof(hdr), 1, fp) == 1 );
+	if (nshapes > 0)
+		ok = ok && ( fwrite(entries, sizeof(phiGemmShapeEntry_t), nshapes, fp) == (size_t) nshapes );
+	ok = ( fclose(fp) == 0 ) && ok;
+
+	if ( !ok || rename(tmpname, filename) != 0 ) {
+		printf("*** phiGEMM *** WARNING *** cannot write tuning database %s\n", filename); fflush(stdout);
+		unlink(tmpname);
+	}
+#if defined(__PHIGEMM_DEBUG)
+	else {
+		printf("[PHIGEMM_DEBUG] tuning database %s written (%d shapes)\n", filename, nshapes); fflush(stdout);
+	}
+#endif
+
+	free(entries);
+
+	return;
+}
+
+
+/*
+ * Name			: phiGemmTuningDBSeedEx
+ * Description	: the method seeds the split factor of every shape class
+ * 				  of the given context found in a phigemm.profile*.csv file.
+ * 				  The profile does not record precision and beta, so all the
+ * 				  entries are assigned to the given precision and to both
+ * 				  beta classes; the last (i.e. most tuned) split of every
+ * 				  class wins. Returns the number of CPU+GPU calls used or -1
+ * 				  if the file is unreadable
+ * Visibility	: public
+ */
+int phiGemmTuningDBSeedEx(phiGemmContext_t *ctx, const char *csvfile, char type)
+{
+	char buffer[1024], file[512], line[64], ta, tb;
+	int devices, cores, m, n, k, count = 0;
+	float split;
+	double time, gflops;
+	phiGemmShapeEntry_t *entry;
+	phiGemmContext_t *caller;
+	FILE *fp;
+
+	fp = fopen(csvfile, "r");
+	if (fp == NULL) {
+		printf("*** phiGEMM *** WARNING *** cannot read profile file %s\n", csvfile); fflush(stdout);
+		return -1;
+	}
+
+	/* the shape table only: the requests in flight are not waited for */
+	caller = phiGemmContextLock(ctx);
+
+	while ( fgets(buffer, sizeof(buffer), fp) != NULL ) {
+
+		if ( sscanf(buffer, "%511[^,], %63[^,], %d, %d, %c, %c, %d, %d, %d, %f, %lf, %lf",
+				file, line, &devices, &cores, &ta, &tb, &m, &n, &k, &split, &time, &gflops) != 12 )
+			continue;
+
+		/* 0: CPU-only, -1: SpecialK */
+		if ( split <= 0.0f || split > 1.0f )
+			continue;
+
+		entry = phiGemmShapeLookup(type, &ta, &tb, m, n, k, 1);
+		entry->split = entry->prevSplit = entry->lpSplit = split;
+
+		entry = phiGemmShapeLookup(type, &ta, &tb, m, n, k, 0);
+		entry->split = entry->prevSplit = entry->lpSplit = split;
+
+		count++;
+	}
+
+	phiGemmContextLeave(ctx, caller);
+
+	fclose(fp);
+
+#if defined(__PHIGEMM_DEBUG)
+	printf("[PHIGEMM_DEBUG] %d calls seeded from %s\n", count, csvfile); fflush(stdout);
+#endif
+
+	return count;
+}
+
+/*
+ * Name			: phiGemmTuningDBSeed
+ * Description	: phiGemmTuningDBSeedEx on the default context
+ * Visibility	: public
+ */
+int phiGemmTuningDBSeed(const char *csvfile, char type)
+{
+	return phiGemmTuningDBSeedEx(&phiGemmDefaultCtx, csvfile, type);
+}
+
+#endif
@@ -27,6 +27,8 @@
 #define gemm_mkl zgemm_
 #define PHIGEMM_M phizgemm_
 #define phiZgemm PHIGEMM_M
+#define PHIGEMM_EX phiZgemmEx
+#define PHIGEMM_R phiZgemmRecursive
 
 
 #if defined(__PHIGEMM_PROFILE)
@@ -45,26 +47,22 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 #endif
 
 #if defined(__PHIGEMM_PROFILE)
-void PHIGEMM_M (const char *transa, const char *transb, const int *m,
+static void PHIGEMM_R (const char *transa, const char *transb, const int *m,
 		const int *n, const int *k, const phiDoubleComplex *alpha,
 		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
 		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C, const int *ldc,
 		const char *file, const char * line)
 #else
-void PHIGEMM_M (const char *transa, const char *transb, const int *m,
+static void PHIGEMM_R (const char *transa, const char *transb, const int *m,
 		const int *n, const int *k, const phiDoubleComplex *alpha,
 		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
 		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C, const int *ldc)
 #endif
 {
 	double time_call;
-	int tmp, p1, p2, select_case;
-	int a_offset, b_offset, c_offset;
-	size_t memsize_gpu, mem_gpu;
+	int select_case;
+	phiGemmTilePlan_t plan;
 	float split = -1;
-	static int ground_level = 1;
-	static int splitting_level = 0;
-	int first_call = 0;
 	int local_init = 0;
 
 	/* determine which matrix has to be split */
@@ -75,51 +73,45 @@ void PHIGEMM_M (const char *transa, const char *transb, const int *m,
 	double start, stop;
 #endif
 
-	if ( ground_level) {
-		first_call = 1;
-		splitting_level = 0;
 #if defined(__PHIGEMM_PROFILE)
-		start = phigemm_cclock();
+	start = phigemm_cclock();
 #endif
-	}
 
 #if defined(__PHIGEMM_CPUONLY)
 	select_case = 0;
-#elif defined(__PHIGEMM_GPUONLY)
-	select_case = 2;
 #else
 
-	if ( ground_level  ) {
-		if (!phiGemmIsInit() ) {
-			fprintf(stderr, "*** phiGEMM *** ERROR *** Missing initialization. Do CPU-only.\n"); fflush(stdout);
-			select_case = 0;
-		} else {
-			if ( !phiGemmIsInternalMemAlloc() && !phiGemmIsExternalMemAlloc()  )
-			{
-				// Memory has not been allocated even if phiGEMM has been initialized.
-				// Perform memory allocation before any operation!
-				phiGemmInitMemory(NULL);
-				//phiGemmInitScratchMemory();
-			}
-			select_case = cpuGPUheuristic( (*m), (*n), (*k), 'z');
+	if (!phiGemmIsInit() ) {
+		fprintf(stderr, "*** phiGEMM *** ERROR *** Missing initialization. Do CPU-only.\n"); fflush(stdout);
+		select_case = 0;
+	} else {
+		if ( !phiGemmIsInternalMemAlloc() && !phiGemmIsExternalMemAlloc()  )
+		{
+			// Memory has not been allocated even if phiGEMM has been initialized.
+			// Perform memory allocation before any operation!
+			phiGemmInitMemory(NULL);
+			//phiGemmInitScratchMemory();
 		}
+#if defined(__PHIGEMM_GPUONLY)
+		select_case = 2;
+#else
+		select_case = cpuGPUheuristic( (*m), (*n), (*k), 'z');
+#endif
 	}
 #endif
 
 	switch (select_case)
 	{
 	case 0:
-		ground_level = 0;
-
 #if defined(__PHIGEMM_DEBUG_3)
-		printf ("[PHIGEMM_DEBUG][3] COMPUTE IN splitting_level=%d [CPU-ONLY]\n", splitting_level);  fflush(stdout);
+		printf ("[PHIGEMM_DEBUG][3] COMPUTE IN [CPU-ONLY]\n");  fflush(stdout);
 #endif
 
 		// cpuGPUheuristic(...) = 0 >> CPU-only
 		gemm_mkl(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta,C, ldc);
 
 #if defined(__PHIGEMM_DEBUG_3)
-		printf ("[PHIGEMM_DEBUG][3] COMPUTE OUT splitting_level=%d [CPU-ONLY]\n", splitting_level);  fflush(stdout);
+		printf ("[PHIGEMM_DEBUG][3] COMPUTE OUT [CPU-ONLY]\n");  fflush(stdout);
 #endif
 
 		break;
@@ -127,17 +119,8 @@ void PHIGEMM_M (const char *transa, const char *transb, const int *m,
 #if !defined(__PHIGEMM_CPUONLY)
 
 	case 1:
-		ground_level = 0;
-
-		if ( ground_level && !phiGemmIsExternalMemAlloc() ) {
 #if defined(__PHIGEMM_DEBUG_3)
-			printf ("[PHIGEMM_DEBUG][3] Internal allocation of the GPU memory \n");  fflush(stdout);
-#endif
-			/* init the memory */
-		}
-
-#if defined(__PHIGEMM_DEBUG_3)
-		printf ("[PHIGEMM_DEBUG][3] COMPUTE IN splitting_level=%d [SPECIAL-K]\n", splitting_level);  fflush(stdout);
+		printf ("[PHIGEMM_DEBUG][3] COMPUTE IN [SPECIAL-K]\n");  fflush(stdout);
 #endif
 
 		// cpuGPUheuristic(...) = 0 >> SPECIAL-K
@@ -148,169 +131,182 @@ void PHIGEMM_M (const char *transa, const char *transb, const int *m,
 #endif
 
 #if defined(__PHIGEMM_DEBUG_3)
-		printf ("[PHIGEMM_DEBUG][3] COMPUTE OUT splitting_level=%d [SPECIAL-K]\n", splitting_level);  fflush(stdout);
-#endif
-
-		if ( ground_level && phiGemmIsInternalMemAlloc() ) {
-#if defined(__PHIGEMM_DEBUG_3)
-			printf ("[PHIGEMM_DEBUG][3] Free GPU memory internally allocated\n" );  fflush(stdout);
+		printf ("[PHIGEMM_DEBUG][3] COMPUTE OUT [SPECIAL-K]\n");  fflush(stdout);
 #endif
-			/* free the memory */
-		}
 		break;
 
 	case 2:
 		// cpuGPUheuristic(...) = 0 >> CPU+GPU
 		is_splitA = (*n > *m) ? 0:1;
 
+#if defined(__PHIGEMM_WORK_STEALING)
+		/* tiles on a shared queue: the split comes out of the schedule */
+		split = phiGemmSchedule('z', transa, transb, *m, *n, *k, alpha, A, *lda, B, *ldb, beta, C, *ldc);
+		if (split >= 0.0f) break;
+#endif
+
 		/* Assign the split factor for phiZgemm (3: ZGEMM) */
 #if !defined(__PHIGEMM_GPUONLY)
+#if defined(__PHIGEMM_SPLIT_MODEL)
+		split = phiGemmModelBestSplit('z', transa, transb, *m, *n, *k, (beta->x == 0.0 && beta->y == 0.0));
+		/* keep a non-empty share for the devices */
+		if (split < 0.05f) split = 0.05f;
+#elif defined(__PHIGEMM_SELFTUNE)
+		split = phiGemmShapeLookup('z', transa, transb, *m, *n, *k, (beta->x == 0.0 && beta->y == 0.0))->split;
+#else
 		split = myPhiGemmTng.split[3];
+#endif
 #else
 		split = 1.0;
 #endif
 
-		/* recursive splitting */
-		/* There is an assumption here: all the cards has the same amount of memory.
-		 * This can be not true at all! */
-		memsize_gpu = myPhiGemmHdl.smem[0] * myPhiGemmEnv.numDevices;
-
-		if ( is_splitA ) {
-			mem_gpu = memOccupancy(is_splitA, split, *m, *n, *k) * sizeof(phiDoubleComplex);
+		/* every device must hold its own tiles (see phigemm_tiling.c) */
+		phiGemmTilePlan('z', is_splitA, split, *m, *n, *k, &plan);
 
-			if ( mem_gpu * myPhiGemmEnv.numDevices > memsize_gpu )
-			{
-				ground_level = 0;
-
-				bestFit(is_splitA, split, *m, *n, *k, sizeof(phiDoubleComplex), &p1, &p2);
-
-				a_offset = ( *transa == 'n' || *transa == 'N' )? p1 : ((*lda)*p1);
-				c_offset = p1;
+		if ( !plan.fits )
+		{
+			/* the device share does not fit: stream it through the scratch memory */
+#if defined(__PHIGEMM_DEBUG_3)
+			printf ("[PHIGEMM_DEBUG][3] COMPUTE IN [CPU+GPU STREAMING]\n"); fflush(stdout);
+#endif
 
-				splitting_level++;
+			phiGemmStream('z', transa, transb, *m, *n, *k, alpha, A, *lda, B, *ldb, beta, C, *ldc, is_splitA, split);
 
-#if defined(__PHIGEMM_PROFILE)
-				PHIGEMM_M(transa, transb, &p1, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line);
-				PHIGEMM_M(transa, transb, &p2, n, k, alpha, A + a_offset, lda, B, ldb, beta, C + c_offset, ldc, file, line);
-#else
-				PHIGEMM_M(transa, transb, &p1, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
-				PHIGEMM_M(transa, transb, &p2, n, k, alpha, A + a_offset, lda, B, ldb, beta, C + c_offset, ldc);
+#if defined(__PHIGEMM_DEBUG_3)
+			printf ("[PHIGEMM_DEBUG][3] COMPUTE OUT [CPU+GPU STREAMING]\n"); fflush(stdout);
 #endif
-				splitting_level--;
-			} else {
+		} else {
 
 #if defined(__PHIGEMM_DEBUG_3)
-				printf ("[PHIGEMM_DEBUG][3] COMPUTE IN splitting_level=%d [CPU+GPU]\n", splitting_level); fflush(stdout);
+			printf ("[PHIGEMM_DEBUG][3] COMPUTE IN [CPU+GPU]\n"); fflush(stdout);
 #endif
 
 #if defined(__PHIGEMM_PROFILE)
-				PHIGEMM_ZGEMM_MF(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, is_splitA, split, file, line);
+			PHIGEMM_ZGEMM_MF(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, is_splitA, split, file, line);
 #else
-				PHIGEMM_ZGEMM_MF(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, is_splitA, split);
+			PHIGEMM_ZGEMM_MF(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, is_splitA, split);
 #endif
 
 #if defined(__PHIGEMM_DEBUG_3)
-				printf ("[PHIGEMM_DEBUG][3] COMPUTE OUT splitting_level=%d [CPU+GPU]\n", splitting_level); fflush(stdout);
+			printf ("[PHIGEMM_DEBUG][3] COMPUTE OUT [CPU+GPU]\n"); fflush(stdout);
 #endif
-			}
-		} else {
-			mem_gpu = memOccupancy(is_splitA, split, *m, *n, *k) * sizeof(phiDoubleComplex);
+		}
+		break;
 
-			if ( mem_gpu * myPhiGemmEnv.numDevices > memsize_gpu )
-			{
-				ground_level = 0;
-				splitting_level++;
+#endif
 
-				bestFit(is_splitA, split, *m, *n, *k, sizeof(phiDoubleComplex), &p1, &p2);
+	}
 
-				b_offset = ( *transb == 'n' || *transb == 'N' )? ((*ldb)*p1) : p1;
-				c_offset = (*ldc)*p1;
+#if !defined(__PHIGEMM_CPUONLY)
+	if ( cudaSetDevice(myPhiGemmHdl.devId[0]) != cudaSuccess) {
+		printf("*** phiGEMM *** ERROR *** cudaSetDevice failed!\n");
+		exit(EXIT_FAILURE);
+	}
+#endif
 
 #if defined(__PHIGEMM_PROFILE)
-				PHIGEMM_M(transa, transb, m, &p1, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line);
-				PHIGEMM_M(transa, transb, m, &p2, k, alpha, A, lda, B + b_offset, ldb, beta, C + c_offset, ldc, file, line);
-#else
-				PHIGEMM_M(transa, transb, m, &p1, k, alpha, A, lda, B, ldb, beta, C, ldc);
-				PHIGEMM_M(transa, transb, m, &p2, k, alpha, A, lda, B + b_offset, ldb, beta, C + c_offset, ldc);
-#endif
+	stop = phigemm_cclock() - start;
+	switch (select_case)
+	{
+	case 0:
+		/* Comma-Separated Value (csv) format:
+		 * file, line, nGPU = 0, nThreads, transA, transB, m, n, k, 0 (=CPU-ONLY), time, GFlops */
+		fprintf (myPhiGemmEnv.profileFile, "%s, %s, 0, %d, %c, %c, %d, %d, %d, 0, %10.6f, %10.4f\n", file, line, myPhiGemmEnv.cores, *transa, *transb, *m, *n, *k, stop, 1.e-6 * PHIGEMM_FLOPS( (double)(*m), (double)(*n), (double)(*k) )/(stop*1000));
+		break;
 
-				splitting_level--;
-			} else {
+	case 1:
+		/* Comma-Separated Value (csv) format:
+		 * file, line, nGPU, nThreads, transA, transB, m, n, k, -1 (=SPECIAL-K), time, GFlops */
+		fprintf (myPhiGemmEnv.profileFile, "%s, %s, %d, %d, %c, %c, %d, %d, %d, -1, %10.6f, %10.4f\n", file, line, myPhiGemmEnv.numDevices, myPhiGemmEnv.cores, *transa, *transb, *m, *n, *k, stop, 1.e-6 * PHIGEMM_FLOPS( (double)(*m), (double)(*n), (double)(*k) )/(stop*1000));
+		break;
 
-#if defined(__PHIGEMM_DEBUG_3)
-				printf ("[PHIGEMM_DEBUG][3] COMPUTE IN splitting_level=%d [CPU+GPU]\n", splitting_level); fflush(stdout);
+	case 2:
+		/* Comma-Separated Value (csv) format:
+		 * file, line, nGPU, nThreads, transA, transB, m, n, k, split_factor, time, GFlops */
+		fprintf (myPhiGemmEnv.profileFile, "%s, %s, %d, %d, %c, %c, %d, %d, %d, %.3f, %10.6f, %10.4f\n", file, line, myPhiGemmEnv.numDevices, myPhiGemmEnv.cores, *transa, *transb, *m, *n, *k, split, stop, 1.e-6 * PHIGEMM_FLOPS( (double)(*m), (double)(*n), (double)(*k) )/(stop*1000));
+		break;
+	}
 #endif
 
-#if defined(__PHIGEMM_PROFILE)
-				PHIGEMM_ZGEMM_MF(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, is_splitA, split, file, line);
-#else
-				PHIGEMM_ZGEMM_MF(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, is_splitA, split);
-#endif
 
-#if defined(__PHIGEMM_DEBUG_3)
-				printf ("[PHIGEMM_DEBUG][3] COMPUTE OUT splitting_level=%d [CPU+GPU]\n", splitting_level); fflush(stdout);
-#endif
-			}
-		}
-		break;
+	/* the operand cache keeps the memory allocated internally (and
+	 * the blocks it holds) until phiGemmShutdown */
+#if !defined(__PHIGEMM_CPUONLY) && !defined(__PHIGEMM_OPERAND_CACHE)
+	if ( phiGemmIsInternalMemAlloc() ){
+		/* Since phiGemmIsInternalMemAlloc() is True then phiGEMM
+		   is still in a initialized state, it means that GPU-process
+		   bindings are valid: give the scratch memory back, the
+		   handles, the streams and the resource pool are kept */
+		phiGemmReleaseMemory();
 
+#if defined(__PHIGEMM_PROFILE)
+		// printf("\n\n*** phiGEMM *** close the file \n\n");fflush(stdout);
+		fclose (myPhiGemmEnv.profileFile);
 #endif
 
 	}
+#endif
 
-	if ( first_call) {
-		ground_level = 1;
-		first_call = 0;
-		splitting_level = 0;
+	return;
+}
 
-#if !defined(__PHIGEMM_CPUONLY)
-		if ( cudaSetDevice(myPhiGemmHdl.devId[0]) != cudaSuccess) {
-			printf("*** phiGEMM *** ERROR *** cudaSetDevice failed!\n");
-			exit(EXIT_FAILURE);
-		}
+/*
+ * Name			: phiZgemmEx
+ * Description	: the method performs the ZGEMM on the given context; calls
+ * 				  on the same context are serialized, calls on different
+ * 				  contexts run concurrently
+ * Visibility	: public
+ */
+#if defined(__PHIGEMM_PROFILE)
+void PHIGEMM_EX (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C, const int *ldc,
+		const char *file, const char * line)
+#else
+void PHIGEMM_EX (phiGemmContext_t *ctx, const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C, const int *ldc)
 #endif
+{
+	phiGemmContext_t *caller = phiGemmContextEnter(ctx);
 
 #if defined(__PHIGEMM_PROFILE)
-		stop = phigemm_cclock() - start;
-		switch (select_case)
-		{
-		case 0:
-			/* Comma-Separated Value (csv) format:
-			 * file, line, nGPU = 0, nThreads, transA, transB, m, n, k, 0 (=CPU-ONLY), time, GFlops */
-			fprintf (myPhiGemmEnv.profileFile, "%s, %s, 0, %d, %c, %c, %d, %d, %d, 0, %10.6f, %10.4f\n", file, line, myPhiGemmEnv.cores, *transa, *transb, *m, *n, *k, stop, 1.e-6 * PHIGEMM_FLOPS( (double)(*m), (double)(*n), (double)(*k) )/(stop*1000));
-			break;
-
-		case 1:
-			/* Comma-Separated Value (csv) format:
-			 * file, line, nGPU, nThreads, transA, transB, m, n, k, -1 (=SPECIAL-K), time, GFlops */
-			fprintf (myPhiGemmEnv.profileFile, "%s, %s, %d, %d, %c, %c, %d, %d, %d, -1, %10.6f, %10.4f\n", file, line, myPhiGemmEnv.numDevices, myPhiGemmEnv.cores, *transa, *transb, *m, *n, *k, stop, 1.e-6 * PHIGEMM_FLOPS( (double)(*m), (double)(*n), (double)(*k) )/(stop*1000));
-			break;
-
-		case 2:
-			/* Comma-Separated Value (csv) format:
-			 * file, line, nGPU, nThreads, transA, transB, m, n, k, split_factor, time, GFlops */
-			fprintf (myPhiGemmEnv.profileFile, "%s, %s, %d, %d, %c, %c, %d, %d, %d, %.3f, %10.6f, %10.4f\n", file, line, myPhiGemmEnv.numDevices, myPhiGemmEnv.cores, *transa, *transb, *m, *n, *k, split, stop, 1.e-6 * PHIGEMM_FLOPS( (double)(*m), (double)(*n), (double)(*k) )/(stop*1000));
-			break;
-		}
+	PHIGEMM_R(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line);
+#else
+	PHIGEMM_R(transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
 #endif
 
+	phiGemmContextLeave(ctx, caller);
 
-#if !defined(__PHIGEMM_CPUONLY)
-		if ( phiGemmIsInternalMemAlloc() ){
-			/* Since phiGemmIsInternalMemAlloc() is True then phiGEMM
-			   is still in a initialized state, it means that GPU-process
-			   bindings are valid */
-			phiGemmShutdown();
+	return;
+}
 
+/*
+ * Name			: phiZgemm
+ * Description	: the method performs the ZGEMM on the default context
+ * Visibility	: public
+ */
 #if defined(__PHIGEMM_PROFILE)
-			// printf("\n\n*** phiGEMM *** close the file \n\n");fflush(stdout);
-			fclose (myPhiGemmEnv.profileFile);
+void PHIGEMM_M (const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C, const int *ldc,
+		const char *file, const char * line)
+#else
+void PHIGEMM_M (const char *transa, const char *transb, const int *m,
+		const int *n, const int *k, const phiDoubleComplex *alpha,
+		const phiDoubleComplex *A, const int *lda, const phiDoubleComplex *B,
+		const int *ldb, const phiDoubleComplex *beta, phiDoubleComplex *C, const int *ldc)
 #endif
-
-		}
+{
+#if defined(__PHIGEMM_PROFILE)
+	PHIGEMM_EX(&phiGemmDefaultCtx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, file, line);
+#else
+	PHIGEMM_EX(&phiGemmDefaultCtx, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
 #endif
 
-	}
 	return;
 }
 
@@ -331,19 +327,33 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 		int is_splitA, float split)
 #endif
 {
-	int iDev, i ,j, tmp, step, residual, gpu_lda, gpu_ldb;
+	int iDev, i ,j, tmp, gpu_lda, gpu_ldb;
 	int m_gpu[NSTREAMS *MAX_GPUS], n_gpu[NSTREAMS *MAX_GPUS], k_gpu[NSTREAMS *MAX_GPUS];
 	int m_cpu, n_cpu, k_cpu;
 	int m_h2d[NSTREAMS *MAX_GPUS], n_h2d[NSTREAMS *MAX_GPUS], k_h2d[NSTREAMS *MAX_GPUS];
 
 	size_t a_offset, b_offset, c_offset;
 	size_t a_offset_gpu[NSTREAMS *MAX_GPUS], b_offset_gpu[NSTREAMS *MAX_GPUS], c_offset_gpu[NSTREAMS *MAX_GPUS];
-	size_t shiftA, shiftB, shiftC;
+
+	phiGemmTilePlan_t plan;
+	phiDoubleComplex *partialC = NULL, *partialC_merge, *hostPtrC[NSTREAMS *MAX_GPUS];
+	int host_ldc[NSTREAMS *MAX_GPUS];
+	int panels[NSTREAMS *MAX_GPUS], skip_a = 0, skip_b = 0, pack_a = 0, pack_b = 0;
+	int merge_c[NSTREAMS *MAX_GPUS], partialC_pageable = 0;
+	double start_merge;
+	size_t exposed_h2d[NSTREAMS *MAX_GPUS];
+	const phiDoubleComplex *betaPtr[NSTREAMS *MAX_GPUS];
+	phiDoubleComplex beta_zero;
 
 	phiDoubleComplex *devPtrA[NSTREAMS *MAX_GPUS], *devPtrB[NSTREAMS *MAX_GPUS], *devPtrC[NSTREAMS *MAX_GPUS];
 	cublasStatus_t status;
 	cudaError_t cudaErr;
 
+#if defined(__PHIGEMM_OPERAND_CACHE)
+	void *cachePtr;
+	int cacheHitA[NSTREAMS *MAX_GPUS] = {0}, cacheHitB[NSTREAMS *MAX_GPUS] = {0};
+#endif
+
 #if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
 	/* timing using CUDA events */
 	cudaEvent_t events[myPhiGemmEnv.numDevices * NSTREAMS][__PHIGEMM_EVENTS];
@@ -374,24 +384,7 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 		tmp = (*m) * split;
 		//if (*m > 128) tmp = floor(tmp/64.0)*64;
 		m_cpu = *m - tmp;
-
-		for (iDev = 0; iDev < myPhiGemmEnv.numDevices * NSTREAMS; iDev++) {
-
-			step = (int) (tmp / ( myPhiGemmEnv.numDevices * NSTREAMS ) );
-			residual =  tmp - myPhiGemmEnv.numDevices * NSTREAMS *step;
-
-			n_h2d[iDev] = n_gpu[iDev] = n_cpu = *n;
-			k_h2d[iDev] = k_gpu[iDev] = k_cpu = *k;
-			m_h2d[iDev] = m_gpu[iDev] = (iDev==0) ? step + residual : step;
-
-			if ( is_transa )
-				a_offset_gpu[iDev] = m_gpu[iDev] * (*lda);
-			else
-				a_offset_gpu[iDev] = m_gpu[iDev] ;
-
-			b_offset_gpu[iDev] = 0;
-			c_offset_gpu[iDev] = m_gpu[iDev] ;
-		}
+		n_cpu = *n;
 
 		if ( is_transa )
 			a_offset = tmp * (*lda);
@@ -406,24 +399,7 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 		tmp = (*n) * split ;
 		//if (*n > 128) tmp = floor(tmp/64.0)*64;
 		n_cpu = *n - tmp;
-
-		for (iDev = 0; iDev < myPhiGemmEnv.numDevices * NSTREAMS; iDev++) {
-
-			step = tmp / myPhiGemmEnv.numDevices * NSTREAMS;
-			residual =  tmp - myPhiGemmEnv.numDevices * NSTREAMS * step;
-
-			k_h2d[iDev] = k_gpu[iDev] = k_cpu = *k;
-			m_h2d[iDev] = m_gpu[iDev] = m_cpu = *m;
-			n_h2d[iDev] = n_gpu[iDev] = (iDev==0) ? step + residual : step;
-
-			if ( is_transb )
-				b_offset_gpu[iDev] = n_gpu[iDev];
-			else
-				b_offset_gpu[iDev] = (*ldb) * n_gpu[iDev] ;
-
-			a_offset_gpu[iDev] = 0;
-			c_offset_gpu[iDev] = (*ldc) * n_gpu[iDev] ;
-		}
+		m_cpu = *m;
 
 		if ( is_transb )
 			b_offset = tmp;
@@ -433,12 +409,77 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 		a_offset = 0;
 		c_offset = (*ldc) * tmp ;
 	}
+	k_cpu = *k;
+
+	/* the devices share is cut in tiles (see phigemm_tiling.c) */
+	phiGemmTilePlan('z', is_splitA, split, *m, *n, *k, &plan);
+
+	/* the partial products come back asynchronously, pinned memory if the pool has it */
+	if ( plan.partial > 0 ) {
+		partialC = (phiDoubleComplex *) phiGemmPoolHostAlloc( plan.partial * sizeof(phiDoubleComplex) );
+		if ( partialC == NULL ) {
+			partialC = (phiDoubleComplex *) malloc( plan.partial * sizeof(phiDoubleComplex) );
+			partialC_pageable = 1;
+		}
+		if ( partialC == NULL ) {
+			printf("*** phiGEMM *** ERROR *** allocation of the partial products failed!\n");
+			fflush(stdout);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	phigemm_set_real_part(beta_zero, 0.0);
+	phigemm_set_img_part(beta_zero, 0.0);
+
+	for (iDev = 0; iDev < plan.workers; iDev++) {
+
+		m_h2d[iDev] = m_gpu[iDev] = plan.m[iDev];
+		n_h2d[iDev] = n_gpu[iDev] = plan.n[iDev];
+		k_h2d[iDev] = k_gpu[iDev] = plan.k[iDev];
+
+		if ( is_transa )
+			a_offset_gpu[iDev] = plan.m0[iDev] * (size_t) (*lda) + plan.k0[iDev];
+		else
+			a_offset_gpu[iDev] = plan.m0[iDev] + plan.k0[iDev] * (size_t) (*lda);
+
+		if ( is_transb )
+			b_offset_gpu[iDev] = plan.n0[iDev] + plan.k0[iDev] * (size_t) (*ldb);
+		else
+			b_offset_gpu[iDev] = plan.k0[iDev] + plan.n0[iDev] * (size_t) (*ldb);
+
+		c_offset_gpu[iDev] = plan.m0[iDev] + plan.n0[iDev] * (size_t) (*ldc);
+
+		merge_c[iDev] = 0;
+
+		/* the first k slice of a tile owns C, the others return a partial product */
+		if ( plan.slice[iDev] == 0 ) {
+			hostPtrC[iDev] = C + c_offset_gpu[iDev];
+			host_ldc[iDev] = *ldc;
+			betaPtr[iDev] = beta;
+
+			/* if cheaper, C is not uploaded: the device computes with beta = 0
+			 * into a staging buffer, merged into C by the host as it comes back */
+			if ( ( beta->x != 0.0 || beta->y != 0.0 ) && phiGemmModelMergeC('z', m_gpu[iDev], n_gpu[iDev], iDev % myPhiGemmEnv.numDevices) ) {
+				partialC_merge = (phiDoubleComplex *) phiGemmPoolHostAlloc( (size_t) m_gpu[iDev] * n_gpu[iDev] * sizeof(phiDoubleComplex) );
+				if ( partialC_merge != NULL ) {
+					hostPtrC[iDev] = partialC_merge;
+					host_ldc[iDev] = m_gpu[iDev];
+					betaPtr[iDev] = &beta_zero;
+					merge_c[iDev] = 1;
+				}
+			}
+		} else {
+			hostPtrC[iDev] = partialC + plan.poff[iDev];
+			host_ldc[iDev] = m_gpu[iDev];
+			betaPtr[iDev] = &beta_zero;
+		}
+	}
 
-	shiftA = 0;
-	shiftB = 0;
-	shiftC = 0;
+#if defined(__PHIGEMM_OPERAND_CACHE)
+	phiGemmCacheBegin();
+#endif
 
-	for (iDev = 0; iDev < myPhiGemmEnv.numDevices * NSTREAMS; iDev++) {
+	for (iDev = 0; iDev < plan.workers; iDev++) {
 
 		cudaSetDevice(myPhiGemmHdl.devId[iDev % myPhiGemmEnv.numDevices]);
 
@@ -446,21 +487,81 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 
 #if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
 		for (j = 0; j < __PHIGEMM_EVENTS; j++)
-			cudaEventCreate(&(events[iDev % myPhiGemmEnv.numDevices][j]));
+			events[iDev][j] = phiGemmPoolEvent(iDev, j);
 
 		cudaEventRecord(events[iDev][0], myPhiGemmHdl.stream[iDev] );
 #endif
 
-		if ( is_transa ) {
+		devPtrB[iDev] = (phiDoubleComplex *)(myPhiGemmHdl.pmem[iDev]) + m_gpu[iDev] * k_gpu[iDev];
+		devPtrC[iDev] = (phiDoubleComplex *)(myPhiGemmHdl.pmem[iDev]) + m_gpu[iDev] * k_gpu[iDev] + k_gpu[iDev] * n_gpu[iDev];
+
+#if defined(__PHIGEMM_OPERAND_CACHE)
+		/* a tile of A still on the device from a previous call is not uploaded again */
+		cachePtr = phiGemmCacheLookup(iDev, A, A+a_offset_gpu[iDev], *lda,
+				is_transa ? k_h2d[iDev] : m_h2d[iDev], is_transa ? m_h2d[iDev] : k_h2d[iDev],
+				sizeof(phiDoubleComplex), &cacheHitA[iDev]);
+		if ( cachePtr != NULL ) devPtrA[iDev] = cachePtr;
+
+		/* a tile of B still on the device from a previous call is not uploaded again */
+		cachePtr = phiGemmCacheLookup(iDev, B, B+b_offset_gpu[iDev], *ldb,
+				is_transb ? n_h2d[iDev] : k_h2d[iDev], is_transb ? k_h2d[iDev] : n_h2d[iDev],
+				sizeof(phiDoubleComplex), &cacheHitB[iDev]);
+		if ( cachePtr != NULL ) devPtrB[iDev] = cachePtr;
+
+		skip_a = cacheHitA[iDev];
+		skip_b = cacheHitB[iDev];
+#endif
+
+#if ( defined(__PHIGEMM_PINNED) || defined(__PHIGEMM_MULTI_GPU) ) && !defined(__PHIGEMM_MAGMABLAS)
+		/* the share is cut in panels overlapping their transfers and GEMMs (see phigemm_pipeline.c) */
+		panels[iDev] = phiGemmPipelinePanels(m_gpu[iDev], n_gpu[iDev]);
+
+		if ( panels[iDev] > 1 ) {
+			exposed_h2d[iDev] = phiGemmPipeline('z', iDev, transa, transb, m_gpu[iDev], n_gpu[iDev], k_gpu[iDev],
+					alpha, A+a_offset_gpu[iDev], *lda, B+b_offset_gpu[iDev], *ldb, betaPtr[iDev],
+					plan.slice[iDev] == 0 && !merge_c[iDev] && ( beta->x != 0.0 || beta->y != 0.0 ), hostPtrC[iDev], host_ldc[iDev],
+					devPtrA[iDev], devPtrB[iDev], devPtrC[iDev], skip_a, skip_b,
+#if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
+					events[iDev]
+#else
+					NULL
+#endif
+					);
+
+			cudaEventRecord(phiGemmPoolEvent(iDev, __PHIGEMM_EVENT_DONE), myPhiGemmHdl.stream[iDev] );
+			continue;
+		}
+#else
+		panels[iDev] = 1;
+#endif
+		exposed_h2d[iDev] = 0;
+
+#if !defined(__PHIGEMM_PINNED)
+		/* pageable A and B may be packed into pinned staging buffers (see phigemm_pack.c) */
+		phiGemmModelPack('z', transa, transb, m_gpu[iDev], n_gpu[iDev], k_gpu[iDev], 1,
+				iDev % myPhiGemmEnv.numDevices, &pack_a, &pack_b);
+		if ( skip_a ) pack_a = 0;
+		if ( skip_b ) pack_b = 0;
+		if ( ( pack_a || pack_b ) && !phiGemmPackReserve(iDev) ) pack_a = pack_b = 0;
+#endif
+
+#if defined(__PHIGEMM_OPERAND_CACHE)
+		if ( cacheHitA[iDev] )
+			status = CUBLAS_STATUS_SUCCESS;
+		else
+#endif
+		if ( pack_a ) {
+			status = phiGemmPackUpload('z', iDev, is_transa ? k_h2d[iDev] : m_h2d[iDev],
+					is_transa ? m_h2d[iDev] : k_h2d[iDev], A+a_offset_gpu[iDev], *lda, 0, devPtrA[iDev],
+					is_transa ? k_gpu[iDev] : m_gpu[iDev], myPhiGemmHdl.stream[iDev]);
+		} else if ( is_transa ) {
 			status = cublasSetMatrixAsync (k_h2d[iDev], m_h2d[iDev],
-					sizeof(phiDoubleComplex), A+shiftA, *lda, devPtrA[iDev],
+					sizeof(phiDoubleComplex), A+a_offset_gpu[iDev], *lda, devPtrA[iDev],
 					k_gpu[iDev], myPhiGemmHdl.stream[iDev]);
-			shiftA += m_h2d[iDev] * (*lda);
 		} else {
 			status = cublasSetMatrixAsync (m_h2d[iDev], k_h2d[iDev],
-					sizeof(phiDoubleComplex), A+shiftA, *lda, devPtrA[iDev],
+					sizeof(phiDoubleComplex), A+a_offset_gpu[iDev], *lda, devPtrA[iDev],
 					m_gpu[iDev], myPhiGemmHdl.stream[iDev]);
-			shiftA += m_h2d[iDev];
 		}
 
 #if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
@@ -471,27 +572,32 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 			fprintf (stderr, "!!!! GPU %d: device access error (H2D A) %d\n", iDev, status); fflush(stderr);
 		}
 
-		devPtrB[iDev] = devPtrA[iDev] + m_gpu[iDev] * k_gpu[iDev];
-		if ( is_transb ) {
+#if defined(__PHIGEMM_OPERAND_CACHE)
+		if ( cacheHitB[iDev] )
+			status = CUBLAS_STATUS_SUCCESS;
+		else
+#endif
+		if ( pack_b ) {
+			status = phiGemmPackUpload('z', iDev, is_transb ? n_h2d[iDev] : k_h2d[iDev],
+					is_transb ? k_h2d[iDev] : n_h2d[iDev], B+b_offset_gpu[iDev], *ldb, 0, devPtrB[iDev],
+					is_transb ? n_gpu[iDev] : k_gpu[iDev], myPhiGemmHdl.stream[iDev]);
+		} else if ( is_transb ) {
 			status = cublasSetMatrixAsync (n_h2d[iDev], k_h2d[iDev],
-					sizeof(phiDoubleComplex), B+shiftB, *ldb, devPtrB[iDev],
+					sizeof(phiDoubleComplex), B+b_offset_gpu[iDev], *ldb, devPtrB[iDev],
 					n_gpu[iDev], myPhiGemmHdl.stream[iDev]);
-			shiftB += n_h2d[iDev];
 		} else {
 			status = cublasSetMatrixAsync (k_h2d[iDev], n_h2d[iDev],
-					sizeof(phiDoubleComplex), B+shiftB, *ldb, devPtrB[iDev],
+					sizeof(phiDoubleComplex), B+b_offset_gpu[iDev], *ldb, devPtrB[iDev],
 					k_gpu[iDev], myPhiGemmHdl.stream[iDev]);
-			shiftB += n_h2d[iDev] * (*ldb);
 		}
 
 #if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
 		cudaEventRecord(events[iDev][2], myPhiGemmHdl.stream[iDev] );
 #endif
 
-		devPtrC[iDev] = devPtrB[iDev] + k_gpu[iDev] * n_gpu[iDev];
-		if ( beta->x != 0.0 || beta->y != 0.0 ){
+		if ( plan.slice[iDev] == 0 && !merge_c[iDev] && ( beta->x != 0.0 || beta->y != 0.0 ) ){
 			status = cublasSetMatrixAsync (m_h2d[iDev], n_h2d[iDev],
-					sizeof(phiDoubleComplex), C+shiftC, *ldc, devPtrC[iDev],
+					sizeof(phiDoubleComplex), hostPtrC[iDev], host_ldc[iDev], devPtrC[iDev],
 					m_gpu[iDev], myPhiGemmHdl.stream[iDev]);
 
 			if (status != CUBLAS_STATUS_SUCCESS) {
@@ -514,15 +620,15 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 		gpuGemm (myPhiGemmHdl.handle[ iDev ], cu_transa, cu_transb,
 				m_gpu[iDev], n_gpu[iDev], k_gpu[iDev],
 				alpha, devPtrA[iDev], gpu_lda, devPtrB[iDev], gpu_ldb,
-				beta, devPtrC[iDev], m_gpu[iDev]);
+				betaPtr[iDev], devPtrC[iDev], m_gpu[iDev]);
 
 #if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
 		cudaEventRecord(events[iDev][4], myPhiGemmHdl.stream[iDev] );
 #endif
 
 		status = cublasGetMatrixAsync (m_h2d[iDev], n_h2d[iDev],
-				sizeof(phiDoubleComplex), devPtrC[iDev], m_gpu[iDev], C+shiftC,
-				*ldc, myPhiGemmHdl.stream[iDev]);
+				sizeof(phiDoubleComplex), devPtrC[iDev], m_gpu[iDev], hostPtrC[iDev],
+				host_ldc[iDev], myPhiGemmHdl.stream[iDev]);
 		if (status != CUBLAS_STATUS_SUCCESS) {
 			fprintf (stderr, "!!!! GPU %d: device access error (D2H C) %d\n", iDev, status); fflush(stderr);
 		}
@@ -531,13 +637,7 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 		cudaEventRecord(events[iDev][5], myPhiGemmHdl.stream[iDev] );
 #endif
 
-		if (is_splitA) {
-			shiftB = 0;
-			shiftC += m_h2d[iDev];
-		} else {
-			shiftA = 0;
-			shiftC += n_h2d[iDev] * (*ldc);
-		}
+		cudaEventRecord(phiGemmPoolEvent(iDev, __PHIGEMM_EVENT_DONE), myPhiGemmHdl.stream[iDev] );
 	}
 
 #if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
@@ -551,16 +651,30 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 	stop_gemm_cpu= phigemm_cclock();
 #endif
 
-	// Sync stream by stream.... we can do better
-	for (iDev = 0; iDev < myPhiGemmEnv.numDevices * NSTREAMS; iDev++) {
+	/* the workers are retired in order, as they complete: the partial
+	 * product of a k slice is added to C while the next ones still run */
+	for (iDev = 0; iDev < plan.workers; iDev++) {
 
 		cudaSetDevice(myPhiGemmHdl.devId[iDev % myPhiGemmEnv.numDevices]);
 
-		cudaErr = (cudaError_t) cudaStreamSynchronize( myPhiGemmHdl.stream[ iDev ] );
+		cudaErr = (cudaError_t) cudaEventSynchronize( phiGemmPoolEvent(iDev, __PHIGEMM_EVENT_DONE) );
 
 		if (cudaErr != cudaSuccess) {
-			printf ( "!!!! 4 - cudaDeviceSynchronize error (C) %d\n", cudaErr); fflush(stdout);
+			printf ( "!!!! 4 - cudaEventSynchronize error (C) %d\n", cudaErr); fflush(stdout);
+		}
+
+		if ( merge_c[iDev] ) {
+			start_merge = phigemm_cclock();
+			phiGemmReduce('z', m_gpu[iDev], n_gpu[iDev], beta, hostPtrC[iDev], host_ldc[iDev],
+					C + c_offset_gpu[iDev], *ldc);
+			phiGemmModelUpdateReduce( (size_t) 3 * m_gpu[iDev] * n_gpu[iDev] * sizeof(phiDoubleComplex),
+					phigemm_cclock() - start_merge );
+			phiGemmPoolHostFree( hostPtrC[iDev] );
 		}
+
+		if ( plan.slice[iDev] > 0 )
+			phiGemmTileAccumulate('z', m_gpu[iDev], n_gpu[iDev], hostPtrC[iDev], host_ldc[iDev],
+					C + c_offset_gpu[iDev], *ldc);
 	}
 
 #else
@@ -573,20 +687,12 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 
 		gpuGemm (myPhiGemmHdl.handle[ iDev ], cu_transa, cu_transb, m_gpu[iDev],
 				n_gpu[iDev], k_gpu[iDev], alpha, devPtrA[iDev],
-				gpu_lda, devPtrB[iDev], gpu_ldb, beta, devPtrC[iDev],
+				gpu_lda, devPtrB[iDev], gpu_ldb, betaPtr[iDev], devPtrC[iDev],
 				m_gpu[iDev]);
 
 #if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
 		cudaEventRecord(events[iDev][4], myPhiGemmHdl.stream[iDev] );
 #endif
-
-		if (is_splitA) {
-			shiftB = 0;
-			shiftC += m_h2d[iDev];
-		} else {
-			shiftA = 0;
-			shiftC += n_h2d[iDev] * (*ldc);
-		}
 	}
 
 #if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
@@ -600,8 +706,7 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 	stop_gemm_cpu= phigemm_cclock();
 #endif
 
-	shiftC = 0;
-	for (iDev = 0; iDev < myPhiGemmEnv.numDevices * NSTREAMS; iDev++) {
+	for (iDev = 0; iDev < plan.workers; iDev++) {
 		cudaSetDevice(myPhiGemmHdl.devId[iDev % myPhiGemmEnv.numDevices]);
 
 #if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
@@ -609,8 +714,8 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 #endif
 
 		status = cublasGetMatrixAsync (m_h2d[iDev], n_h2d[iDev],
-				sizeof(phiDoubleComplex), devPtrC[iDev], m_gpu[iDev], C+shiftC,
-				*ldc, myPhiGemmHdl.stream[iDev]);
+				sizeof(phiDoubleComplex), devPtrC[iDev], m_gpu[iDev], hostPtrC[iDev],
+				host_ldc[iDev], myPhiGemmHdl.stream[iDev]);
 
 		if (status != CUBLAS_STATUS_SUCCESS) {
 			fprintf (stderr, "!!!! GPU %d: device access error (D2H C) %d\n", iDev, status); fflush(stderr);
@@ -620,22 +725,39 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 		cudaEventRecord(events[iDev][6], myPhiGemmHdl.stream[iDev] );
 #endif
 
-		if (is_splitA) {
-			shiftB = 0;
-			shiftC += m_h2d[iDev];
-		} else {
-			shiftA = 0;
-			shiftC += n_h2d[iDev] * (*ldc);
-		}
-
 		// Sync stream by stream.... we can do better
 		cudaErr = (cudaError_t) cudaStreamSynchronize( myPhiGemmHdl.stream[ iDev ] );
 		if (cudaErr != cudaSuccess) {
 			printf ( "!!!! 4 - cudaDeviceSynchronize error (C) %d\n", cudaErr); fflush(stdout);
 		}
 	}
+
+	/* merge C and add the partial products of the k slices to C */
+	for (iDev = 0; iDev < plan.workers; iDev++) {
+		if ( merge_c[iDev] ) {
+			start_merge = phigemm_cclock();
+			phiGemmReduce('z', m_gpu[iDev], n_gpu[iDev], beta, hostPtrC[iDev], host_ldc[iDev],
+					C + c_offset_gpu[iDev], *ldc);
+			phiGemmModelUpdateReduce( (size_t) 3 * m_gpu[iDev] * n_gpu[iDev] * sizeof(phiDoubleComplex),
+					phigemm_cclock() - start_merge );
+			phiGemmPoolHostFree( hostPtrC[iDev] );
+		}
+
+		if ( plan.slice[iDev] > 0 )
+			phiGemmTileAccumulate('z', m_gpu[iDev], n_gpu[iDev], hostPtrC[iDev], host_ldc[iDev],
+					C + c_offset_gpu[iDev], *ldc);
+	}
 #endif
 
+	phiGemmPackRelease();
+
+	if ( partialC != NULL ) {
+		if ( partialC_pageable )
+			free(partialC);
+		else
+			phiGemmPoolHostFree(partialC);
+	}
+
 #if defined(__PHIGEMM_DEBUG) || defined(__PHIGEMM_SELFTUNE)
 	stop_gemm_total = phigemm_cclock();
 #endif
@@ -647,7 +769,11 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 	double unbalance;
 	float new_split;
 
-	for (iDev = 0; iDev < myPhiGemmEnv.numDevices * NSTREAMS; iDev++) {
+#if defined(__PHIGEMM_SELFTUNE) && !defined(__PHIGEMM_SPLIT_MODEL)
+	phiGemmShapeEntry_t *shape = phiGemmShapeLookup('z', transa, transb, *m, *n, *k, (beta->x == 0.0 && beta->y == 0.0));
+#endif
+
+	for (iDev = 0; iDev < plan.workers; iDev++) {
 		cudaSetDevice(myPhiGemmHdl.devId[iDev % myPhiGemmEnv.numDevices]);
 
 		/* H2D */
@@ -675,6 +801,22 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 #endif
 		time_mem_d2h += (time_temp / 1000);
 
+#if defined(__PHIGEMM_SPLIT_MODEL) || defined(__PHIGEMM_SELFTUNE)
+		phiGemmModelUpdate('z', iDev, m_cpu, n_cpu, k_cpu, time_mkl,
+				m_gpu[iDev], n_gpu[iDev], k_gpu[iDev], time_mem_h2d,
+#if defined(__PHIGEMM_OPERAND_CACHE)
+				panels[iDev] > 1 ? exposed_h2d[iDev] :
+				( ( cacheHitA[iDev] ? 0 : (size_t) m_gpu[iDev] * k_gpu[iDev] ) + ( cacheHitB[iDev] ? 0 : (size_t) k_gpu[iDev] * n_gpu[iDev] ) +
+						( plan.slice[iDev] == 0 && !merge_c[iDev] && (beta->x != 0.0 || beta->y != 0.0) ? (size_t) m_gpu[iDev] * n_gpu[iDev] : 0 ) ) * sizeof(phiDoubleComplex),
+#else
+				panels[iDev] > 1 ? exposed_h2d[iDev] :
+				( (size_t) m_gpu[iDev] * k_gpu[iDev] + (size_t) k_gpu[iDev] * n_gpu[iDev] +
+						( plan.slice[iDev] == 0 && !merge_c[iDev] && (beta->x != 0.0 || beta->y != 0.0) ? (size_t) m_gpu[iDev] * n_gpu[iDev] : 0 ) ) * sizeof(phiDoubleComplex),
+#endif
+				time_gemm_cuda, time_mem_d2h,
+				panels[iDev] > 1 ? 0 : (size_t) m_gpu[iDev] * n_gpu[iDev] * sizeof(phiDoubleComplex));
+#endif
+
 		/* For best split, the time to asynchronously move data to device and compute the MxM should be equal
 		 * to the time that CPU spent to perform its portion of the GEMM.
 		 * NOTE: if (unbalance > 0) the CPU has too less work to do (and the GPU too much) -> decrease the split
@@ -688,7 +830,9 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 		unbalance = time_gemm_cuda - time_mkl;
 #endif
 
-#if defined(__PHIGEMM_SELFTUNE)
+#if defined(__PHIGEMM_SELFTUNE) && !defined(__PHIGEMM_SPLIT_MODEL)
+		phiGemmShapeRecord(shape, unbalance);
+
 		// Default tolerance: >0.0025
 		if ((unbalance > 0.0f) && (fabs(unbalance) > 0.0005f ) ) {
 			/* Decremento lo split, piu' lavoro alla CPU */
@@ -699,9 +843,10 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 			else
 				new_split = split - 0.001;
 
-			myPhiGemmTng.lpSplit[3] = split;
+			shape->lpSplit = split;
+			shape->prevSplit = split;
 			myPhiGemmTng.prevSplit[3] = split;
-			myPhiGemmTng.split[3] = new_split;
+			shape->split = new_split;
 
 #if defined(__PHIGEMM_DEBUG_2)
 #if defined(__PHIGEMM_PROFILE)
@@ -720,10 +865,11 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 			//			if (fabs(unbalance) > 0.05)
 			//					new_split = split + 0.0025;
 			//			else
-			new_split = (myPhiGemmTng.lpSplit[3] + 2*split) / 3;
+			new_split = (shape->lpSplit + 2*split) / 3;
 
+			shape->prevSplit = split;
 			myPhiGemmTng.prevSplit[3] = split;
-			myPhiGemmTng.split[3] = new_split;
+			shape->split = new_split;
 
 #if defined(__PHIGEMM_DEBUG_2)
 #if defined(__PHIGEMM_PROFILE)
@@ -749,7 +895,7 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 			*m,
 			m_gpu[iDev],
 			m_cpu,
-#if defined(__PHIGEMM_SELFTUNE)
+#if defined(__PHIGEMM_SELFTUNE) && !defined(__PHIGEMM_SPLIT_MODEL)
 			myPhiGemmTng.prevSplit[3],
 #else
 			split,
@@ -765,7 +911,7 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 			0.0,
 #endif
 			time_gemm_cuda,
-			1.e-6 * PHIGEMM_FLOPS( (double)m_gpu[iDev], (double)(*n), (double)(*k) )/(time_gemm_cuda*1000),
+			1.e-6 * PHIGEMM_FLOPS( (double)m_gpu[iDev], (double)n_gpu[iDev], (double)k_gpu[iDev] )/(time_gemm_cuda*1000),
 			time_mem_d2h,
 			m_gpu[iDev]*n_gpu[iDev]/time_mem_d2h/(1024*1024*1024/sizeof(phiDoubleComplex)),
 			unbalance,
@@ -783,7 +929,7 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 			*n,
 			n_gpu[iDev],
 			n_cpu,
-#if defined(__PHIGEMM_SELFTUNE)
+#if defined(__PHIGEMM_SELFTUNE) && !defined(__PHIGEMM_SPLIT_MODEL)
 			myPhiGemmTng.prevSplit[3],
 #else                                   
 			split,
@@ -798,7 +944,7 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 			0.0,
 #endif
 			time_gemm_cuda,
-			1.e-6 * PHIGEMM_FLOPS( (double)(*m), (double)n_gpu[iDev], (double)(*k) )/(time_gemm_cuda*1000),
+			1.e-6 * PHIGEMM_FLOPS( (double)m_gpu[iDev], (double)n_gpu[iDev], (double)k_gpu[iDev] )/(time_gemm_cuda*1000),
 			time_mem_d2h,
 			m_gpu[iDev]*n_gpu[iDev]/time_mem_d2h/(1024*1024*1024/sizeof(phiDoubleComplex)),
 			unbalance,
@@ -810,12 +956,6 @@ void PHIGEMM_ZGEMM_MF(const char *transa, const char *transb, const int *m,
 
 	}
 
-	/* Destroy CUDA events */
-	for (i = 0; i < myPhiGemmEnv.numDevices * NSTREAMS; i++) {
-		cudaSetDevice(myPhiGemmHdl.devId[i % myPhiGemmEnv.numDevices]);
-		for (j = 0; j < __PHIGEMM_EVENTS; j++)
-			cudaEventDestroy(events[i][j]);
-	}
 #endif
 }
 
@@ -10,6 +10,9 @@
  */
 
 
+#include <math.h>
+#include <pthread.h>
+
 #include "phigemm.h"
 #include "phigemm_auxiliary.h"
 
@@ -25,7 +28,35 @@
 #define PHIGEMM_M phizgemm_specialK
 #define PHIGEMM_GEMM_MF phigemm_specialK
 
-#define MAX_N_STREAM 2
+#define MAX_N_STREAM __PHIGEMM_SPECIALK_MAX_DEPTH
+
+#if !defined(__PHIGEMM_CPUONLY) && !defined(__PHIGEMM_GPUONLY)
+/* The share of K computed by the host BLAS, into a private accumulator,
+ * while the devices run their chunks */
+typedef struct phiGemmSpecialKCpu
+{
+	const char *transa, *transb;
+	const int *m, *n, *lda, *ldb;
+	int k;
+	const phiDoubleComplex *alpha, *A, *B;
+	phiDoubleComplex *acc;
+	double time;
+} phiGemmSpecialKCpu_t;
+
+static void * specialKCpu(void *arg)
+{
+	phiGemmSpecialKCpu_t *cpu = (phiGemmSpecialKCpu_t *) arg;
+	phiDoubleComplex zero = {0.0, 0.0};
+	double start = phigemm_cclock();
+
+	gemm_mkl(cpu->transa, cpu->transb, cpu->m, cpu->n, &cpu->k, cpu->alpha, cpu->A, cpu->lda,
+			cpu->B, cpu->ldb, &zero, cpu->acc, cpu->m);
+
+	cpu->time = phigemm_cclock() - start;
+
+	return NULL;
+}
+#endif
 
 #if defined(__PHIGEMM_PROFILE)
 void PHIGEMM_GEMM_MF(const char *transa, const char *transb, const int *m,
@@ -58,25 +89,61 @@ void PHIGEMM_M (const char *transa, const char *transb, const int *m,
 	// The method is empty if defined(__PHIGEMM_CPUONLY) *BUT* it is never called by phgemm_zgemm
 #if !defined(__PHIGEMM_CPUONLY)
 
-	phiDoubleComplex * C_buf[MAX_N_STREAM];
-	phiDoubleComplex *devPtrA[MAX_N_STREAM], *devPtrB[MAX_N_STREAM], *devPtrC[MAX_N_STREAM];
+	/* The K range is cut in a share for the devices (the split factor) and
+	 * one for the host BLAS, computed by a helper thread meanwhile. The
+	 * devices' share is cut in one contiguous range per device, proportional
+	 * to the per-chunk rate the cost model predicts for it. Every device
+	 * runs its own pipeline of K chunks, with the chunk size and the
+	 * buffers in flight (2 to __PHIGEMM_SPECIALK_MAX_DEPTH) the cost model
+	 * balances best for it, and the host reduces
+	 * the chunks into C always in the same order (chunk by chunk, device by
+	 * device, the host share last), whatever the timing. The partition is
+	 * the one of the first call of the shape (see phigemm_shape.c), not
+	 * moved by the model and the split factor learning meanwhile: as long
+	 * as the scratch memory holds its chunks, the result is reproducible
+	 * bit for bit. When the traffic model says so (as a rule, with more
+	 * than a chunk), a device accumulates its chunks in a single C on board
+	 * (beta = 1 after the first one) and copies it back once, instead of
+	 * copying back and reducing every chunk. The last chunk of every device
+	 * and the host reductions are timed to refine the model online. The
+	 * pinned buffers of the chunks are shared out among the devices from
+	 * the resource pool; should one be missing, it is pageable instead */
+	phiDoubleComplex * C_buf[MAX_GPUS][MAX_N_STREAM] = { { NULL } };
+	int C_pageable[MAX_GPUS][MAX_N_STREAM] = { { 0 } };
+	phiDoubleComplex *devPtrA[MAX_GPUS][MAX_N_STREAM], *devPtrB[MAX_GPUS][MAX_N_STREAM], *devPtrC[MAX_GPUS][MAX_N_STREAM];
 	int iDev = 0, i = 0, count = 0, stream = 0;
-	int offsetA = 0, offsetB = 0, offsetC = 0;
 	int is_transa = 0, is_transb = 0;
 	int gpu_lda = 0, gpu_ldb = 0;
 	cublasStatus_t status;
-	cudaError_t cudaErr;
-	cudaStream_t streamPtr[MAX_N_STREAM];
+	cudaStream_t streamPtr[MAX_GPUS][MAX_N_STREAM];
+	cudaEvent_t chained[MAX_GPUS], timing[MAX_GPUS][5];
 	cublasOperation_t cu_transa, cu_transb;
 
-	int loop_times = 0;
-
-	int size = (* m) * (* n), inc = 1;
-	phiDoubleComplex DA = {1.0, 0.0};
-	phiDoubleComplex gpu_beta = {0.0, 0.0};
+	int nDev = 0, steps = 0, reduced = 0, k_start[MAX_GPUS], k_share[MAX_GPUS], loop_times[MAX_GPUS];
+	int last_split[MAX_GPUS], local_split[MAX_GPUS], max_split, splitted_size, k_offset;
+	int accumulate[MAX_GPUS], depth[MAX_GPUS], timed_size[MAX_GPUS], buffer, beta_applied = 0;
+	int min_split, tile_m, tile_n, sub_m, sub_n, i0, j0, buffers;
+	size_t room;
+	double rate[MAX_GPUS], rate_total = 0.0;
+	phiGemmSpecialKPlan_t *kplan;
+	int planned;
+	float split = 1.0;
+	int k_gpu = (* k);
+
+#if !defined(__PHIGEMM_GPUONLY)
+	pthread_t cpu_thread;
+	phiGemmSpecialKCpu_t cpu;
+	double start_specialk, time_gpu = 0.0, unbalance = 0.0;
+	float new_split;
+#if defined(__PHIGEMM_SELFTUNE) && !defined(__PHIGEMM_SPLIT_MODEL)
+	phiGemmShapeEntry_t *shape = phiGemmShapeLookup('z', transa, transb, *m, *n, *k, (beta->x == 0.0 && beta->y == 0.0));
+#endif
+#endif
 
-	int last_split = 0, local_split = myPhiGemmTng.SPLITK_ZGEMM, splitted_size;
-	size_t mem_buffer = 0L, memsize_gpu = myPhiGemmHdl.smem[iDev];
+	phiDoubleComplex gpu_beta = {0.0, 0.0}, gpu_one = {1.0, 0.0};
+	size_t mem_buffer[MAX_GPUS], bytes_reduce = 0;
+	double start_reduce, time_reduce = 0.0;
+	float ms_h2d, ms_gemm, ms_d2h;
 
 #if defined(__PHIGEMM_DEBUG)
 	double start_axpy, start_gemm_total, stop_axpy, stop_gemm_total;
@@ -85,17 +152,6 @@ void PHIGEMM_M (const char *transa, const char *transb, const int *m,
 	start_gemm_total = phigemm_cclock();
 #endif
 
-	do{
-
-		loop_times = (* k) / local_split;
-		if( (* k) % local_split != 0){
-			last_split = local_split + ( (* k) % local_split );
-		}
-
-		mem_buffer = ( (*m ) * (last_split != 0 ? last_split : local_split) + (* n) * (last_split != 0 ? last_split : local_split) + (* n) * (* m) ) * 2 * sizeof(phiDoubleComplex) ;
-
-	}while( (mem_buffer > memsize_gpu) && (local_split/=2) );
-
 	if ( (*transa != 'n') && (*transa != 'N') )	is_transa = 1;
 	if ( (*transb != 'n') && (*transb != 'N') ) is_transb = 1;
 	cu_transa = ((*transa == 'c')||(*transa == 'C')) ? CUBLAS_OP_C : CUBLAS_OP_N;
@@ -105,131 +161,412 @@ void PHIGEMM_M (const char *transa, const char *transb, const int *m,
 	cu_transb = ((*transb == 't')||(*transb == 'T')) ? CUBLAS_OP_T : cu_transb;
 	cu_transb = ((*transb == 'n')||(*transb == 'N')) ? CUBLAS_OP_N : cu_transb;
 
-	devPtrA[0] = (phiDoubleComplex *)(myPhiGemmHdl.pmem[iDev]);
-	devPtrA[1] = devPtrA[0] + (* m) * (last_split != 0 ? last_split : local_split);
-	devPtrB[0] = devPtrA[1] + (* m) * (last_split != 0 ? last_split : local_split);
-	devPtrB[1] = devPtrB[0] + (* n) * (last_split != 0 ? last_split : local_split);
-	devPtrC[0] = devPtrB[1] + (last_split != 0 ? last_split : local_split) * (* n);
-	devPtrC[1] = devPtrC[0] + (* m) * (* n);
+	/* C is tiled when a device cannot hold it together with K chunks of
+	 * __PHIGEMM_SPECIALK_MIN_SPLIT at least (the do-while below would
+	 * shrink the chunks to nothing): every C tile is a Special-K of its
+	 * own, streaming the K chunks of the row panel of A and of the column
+	 * panel of B it needs */
+	min_split = imin( (* k), __PHIGEMM_SPECIALK_MIN_SPLIT );
+	for (iDev = 0, room = myPhiGemmHdl.smem[0]; iDev < myPhiGemmEnv.numDevices; iDev++)
+		room = imin( room, myPhiGemmHdl.smem[iDev] );
+
+	tile_m = (* m);
+	tile_n = (* n);
+	while ( ( ( (size_t) tile_m + tile_n ) * 4 * min_split + (size_t) tile_m * tile_n * 2 ) * sizeof(phiDoubleComplex) > room &&
+			imax( tile_m, tile_n ) > myPhiGemmTng.LOWER_LIMIT ) {
+		if ( tile_m >= tile_n )
+			tile_m = ( tile_m + 1 ) / 2;
+		else
+			tile_n = ( tile_n + 1 ) / 2;
+	}
 
-	for( i = 0; i < MAX_N_STREAM; i++){
-		if( cudaHostAlloc( (void **) &C_buf[i], (* n) * (* ldc) * sizeof(phiDoubleComplex), cudaHostAllocPortable) != cudaSuccess )
-		{
-			printf( "*** ERROR allocating PINNED MEMORY on CPU\n" );
-			exit( EXIT_FAILURE );
+	if ( tile_m < (* m) || tile_n < (* n) ) {
+
+#if defined(__PHIGEMM_DEBUG)
+		printf ("[PHIGEMM_DEBUG] %d %d %d ~ Special K ~ C tiled in %d x %d tiles\n",
+				*m, *n, *k, tile_m, tile_n); fflush(stdout);
+#endif
+
+		for (j0 = 0; j0 < (* n); j0 += tile_n) {
+			sub_n = imin( tile_n, (* n) - j0 );
+
+			for (i0 = 0; i0 < (* m); i0 += tile_m) {
+				sub_m = imin( tile_m, (* m) - i0 );
+
+#if defined(__PHIGEMM_PROFILE)
+				PHIGEMM_M( transa, transb, &sub_m, &sub_n, k, alpha,
+						is_transa ? A + (size_t) i0 * (* lda) : A + i0, lda,
+						is_transb ? B + j0 : B + (size_t) j0 * (* ldb), ldb,
+						beta, C + i0 + (size_t) j0 * (* ldc), ldc, file, line );
+#else
+				PHIGEMM_M( transa, transb, &sub_m, &sub_n, k, alpha,
+						is_transa ? A + (size_t) i0 * (* lda) : A + i0, lda,
+						is_transb ? B + j0 : B + (size_t) j0 * (* ldb), ldb,
+						beta, C + i0 + (size_t) j0 * (* ldc), ldc );
+#endif
+			}
 		}
+
+		return;
 	}
 
-	splitted_size = local_split;
+	for (iDev = 0; iDev < myPhiGemmEnv.numDevices; iDev++)
+		rate[iDev] = 1.0 / phiGemmModelTime('z', transa, transb, (* m), (* n), myPhiGemmTng.SPLITK_ZGEMM, 1, iDev);
+
+	/* Assign the split factor (the devices' share of K) */
+#if !defined(__PHIGEMM_GPUONLY)
+#if defined(__PHIGEMM_SPLIT_MODEL)
+	for (iDev = 0; iDev < myPhiGemmEnv.numDevices; iDev++)
+		rate_total += rate[iDev];
+	split = rate_total / ( rate_total + 1.0 / phiGemmModelTime('z', transa, transb, (* m), (* n), myPhiGemmTng.SPLITK_ZGEMM, 1, -1) );
+	rate_total = 0.0;
+#elif defined(__PHIGEMM_SELFTUNE)
+	split = shape->split;
+#else
+	split = myPhiGemmTng.split[3];
+#endif
 
-	gpu_lda = (* m);
-	gpu_ldb = splitted_size;
+	k_gpu = imin( (* k), imax( myPhiGemmTng.SPLITK_ZGEMM, (int) ( (* k) * split ) ) );
 
-	if ( is_transa ) gpu_lda = splitted_size;
-	if ( is_transb ) gpu_ldb = (* n);
+	/* a thin host share is not worth it */
+	if ( (* k) - k_gpu < myPhiGemmTng.LOWER_LIMIT ) k_gpu = (* k);
+#endif
 
-	cudaStreamCreate( &streamPtr[0] );
-	cudaStreamCreate( &streamPtr[1] );
+	/* every device used gets at least one full chunk */
+	nDev = imin( myPhiGemmEnv.numDevices, imax( 1, k_gpu / myPhiGemmTng.SPLITK_ZGEMM ) );
+
+	/* a shape run before keeps its partition */
+	kplan = phiGemmSpecialKPlanLookup('z', transa, transb, (* m), (* n), (* k), &planned);
+	if ( planned ) {
+		k_gpu = kplan->k_gpu;
+		nDev = kplan->nDev;
+	} else {
+		kplan->k_gpu = k_gpu;
+		kplan->nDev = nDev;
+	}
 
-	for (count = 0; count < loop_times ; count++) {
+	for (iDev = 0; iDev < nDev; iDev++)
+		rate_total += rate[iDev];
 
-		if( count == (loop_times - 1) && last_split != 0 ){
-			splitted_size = last_split;
-			if ( is_transa ) gpu_lda = last_split;
-			if ( !is_transb ) gpu_ldb = last_split;
-		}
+	for (iDev = 0, k_offset = 0; iDev < nDev; iDev++) {
 
-		stream = count % MAX_N_STREAM;
+		k_start[iDev] = k_offset;
+		if ( planned )
+			k_share[iDev] = kplan->k_share[iDev];
+		else if ( iDev == nDev - 1 )
+			k_share[iDev] = k_gpu - k_offset;
+		else
+			k_share[iDev] = imin( k_gpu - k_offset - ( nDev - 1 - iDev ) * myPhiGemmTng.SPLITK_ZGEMM,
+					imax( myPhiGemmTng.SPLITK_ZGEMM, (int) ( k_gpu * rate[iDev] / rate_total ) ) );
+		k_offset += k_share[iDev];
 
-		cublasSetStream( myPhiGemmHdl.handle[ iDev ], streamPtr[stream] );
+		/* the pinned buffers left, shared out among the devices left */
+		buffers = phiGemmPoolHostAvailable() / ( nDev - iDev );
 
-		if( is_transa ){
-			status = cublasSetMatrixAsync ( splitted_size, (* m), sizeof(phiDoubleComplex), A + offsetA, (* lda), devPtrA[stream], gpu_lda, streamPtr[stream] );
+		if ( planned ) {
+			local_split[iDev] = kplan->local_split[iDev];
+			depth[iDev] = kplan->depth[iDev];
+			accumulate[iDev] = kplan->accumulate[iDev];
 		} else {
-			status = cublasSetMatrixAsync ( (* m), splitted_size, sizeof(phiDoubleComplex), A + offsetA, (* lda), devPtrA[stream], gpu_lda, streamPtr[stream] );
+			phiGemmModelSpecialKPlan('z', transa, transb, (* m), (* n), k_share[iDev], myPhiGemmTng.SPLITK_ZGEMM,
+					myPhiGemmHdl.smem[iDev], buffers, iDev, &local_split[iDev], &depth[iDev], &accumulate[iDev]);
 		}
 
-		if(is_transb ){
-			status = cublasSetMatrixAsync ( (* n), splitted_size, sizeof(phiDoubleComplex), B + offsetB, (* ldb), devPtrB[stream], gpu_ldb, streamPtr[stream] );
-		} else {
-			status = cublasSetMatrixAsync ( splitted_size, (* n), sizeof(phiDoubleComplex), B + offsetB, (* ldb), devPtrB[stream], gpu_ldb, streamPtr[stream] );
+		do{
+
+			loop_times[iDev] = k_share[iDev] / local_split[iDev];
+			last_split[iDev] = 0;
+			if( k_share[iDev] % local_split[iDev] != 0){
+				last_split[iDev] = local_split[iDev] + ( k_share[iDev] % local_split[iDev] );
+			}
+
+			max_split = (last_split[iDev] != 0 ? last_split[iDev] : local_split[iDev]);
+			mem_buffer[iDev] = ( ( (size_t) (*m ) * max_split + (size_t) (* n) * max_split ) * depth[iDev] + (size_t) (* n) * (* m) * ( accumulate[iDev] ? 1 : depth[iDev] ) ) * sizeof(phiDoubleComplex) ;
+
+		}while( (mem_buffer[iDev] > myPhiGemmHdl.smem[iDev]) && (local_split[iDev]/=2) );
+
+		if ( local_split[iDev] == 0 ) {
+			printf( "*** ERROR *** GPU %d: not enough memory for a Special-K chunk\n", iDev );
+			exit( EXIT_FAILURE );
 		}
 
-		status = cublasGemm ( myPhiGemmHdl.handle[ iDev ], cu_transa, cu_transb, (* m), (* n), splitted_size, alpha, devPtrA[stream], gpu_lda, devPtrB[stream], gpu_ldb, &gpu_beta, devPtrC[stream], (* m) );
+		kplan->k_share[iDev] = k_share[iDev];
+		kplan->local_split[iDev] = local_split[iDev];
+		kplan->depth[iDev] = depth[iDev];
+		kplan->accumulate[iDev] = accumulate[iDev];
 
-		status = cublasGetMatrixAsync ( (* m), (* n), sizeof(phiDoubleComplex), devPtrC[stream], (* m), C_buf[stream], *ldc, streamPtr[stream] );
+		/* the chunk r is reduced at the step r + depth - 1 */
+		steps = imax( steps, loop_times[iDev] + depth[iDev] - 1 );
 
-#if defined(__PHIGEMM_DEBUG)
-		start_axpy = phigemm_cclock();
+		for( i = 0; i < depth[iDev]; i++){
+			devPtrA[iDev][i] = (phiDoubleComplex *)(myPhiGemmHdl.pmem[iDev]) + (size_t) i * (* m) * max_split;
+			devPtrB[iDev][i] = (phiDoubleComplex *)(myPhiGemmHdl.pmem[iDev]) + (size_t) depth[iDev] * (* m) * max_split + (size_t) i * (* n) * max_split;
+			devPtrC[iDev][i] = (phiDoubleComplex *)(myPhiGemmHdl.pmem[iDev]) + (size_t) depth[iDev] * ( (* m) + (* n) ) * max_split +
+					( accumulate[iDev] ? 0 : (size_t) i * (* m) * (* n) );
+		}
+
+		for( i = 0; i < depth[iDev]; i++){
+			if( ( i == 0 || !accumulate[iDev] ) &&
+					( C_buf[iDev][i] = phiGemmPoolHostAlloc( (size_t) (* n) * (* m) * sizeof(phiDoubleComplex) ) ) == NULL )
+			{
+				/* the copies back to a pageable buffer are not asynchronous, yet correct */
+				C_pageable[iDev][i] = 1;
+				if( ( C_buf[iDev][i] = malloc( (size_t) (* n) * (* m) * sizeof(phiDoubleComplex) ) ) == NULL ) {
+					printf( "*** ERROR allocating MEMORY on CPU\n" );
+					exit( EXIT_FAILURE );
+				}
+			}
+			streamPtr[iDev][i] = phiGemmPoolStream( iDev, i );
+		}
+
+		if ( accumulate[iDev] ) chained[iDev] = phiGemmPoolEvent( iDev, 0 );
+		for( i = 0; i < 5; i++)
+			timing[iDev][i] = phiGemmPoolEvent( iDev, i + 1 );
+	}
+
+#if !defined(__PHIGEMM_GPUONLY)
+	start_specialk = phigemm_cclock();
+
+	if ( k_gpu < (* k) ) {
+
+		cpu.transa = transa;
+		cpu.transb = transb;
+		cpu.m = m;
+		cpu.n = n;
+		cpu.k = (* k) - k_gpu;
+		cpu.lda = lda;
+		cpu.ldb = ldb;
+		cpu.alpha = alpha;
+		cpu.A = is_transa ? A + k_gpu : A + (size_t) k_gpu * (* lda);
+		cpu.B = is_transb ? B + (size_t) k_gpu * (* ldb) : B + k_gpu;
+		cpu.time = 0.0;
+
+		if( ( cpu.acc = (phiDoubleComplex *) malloc( (size_t) (* m) * (* n) * sizeof(phiDoubleComplex) ) ) == NULL ||
+				pthread_create( &cpu_thread, NULL, specialKCpu, &cpu ) != 0 )
+		{
+			printf( "*** ERROR starting the CPU share of Special-K\n" );
+			exit( EXIT_FAILURE );
+		}
+	}
 #endif
 
-		if( count != 0 ) {
-			cudaStreamSynchronize( streamPtr[(stream+1)%MAX_N_STREAM] );
-			for(i=0, offsetC=0; i<(*n); i++){
-				zaxpy_( m, &DA, C_buf[(stream+1)%MAX_N_STREAM]+offsetC, &inc, C+offsetC, &inc);
-				offsetC += (* ldc);
+	/* step count enqueues the chunk count of every device and reduces the
+	 * chunk count - depth + 1 meanwhile (see phigemm_reduce.c) */
+	for (count = 0; count < steps; count++) {
+
+		for (iDev = 0; iDev < nDev; iDev++) {
+
+			if ( count >= loop_times[iDev] ) continue;
+
+			stream = count % depth[iDev];
+
+			splitted_size = local_split[iDev];
+			if( count == (loop_times[iDev] - 1) && last_split[iDev] != 0 ) splitted_size = last_split[iDev];
+			k_offset = k_start[iDev] + count * local_split[iDev];
+
+			gpu_lda = is_transa ? splitted_size : (* m);
+			gpu_ldb = is_transb ? (* n) : splitted_size;
+
+			cudaSetDevice( myPhiGemmHdl.devId[iDev] );
+			cublasSetStream( myPhiGemmHdl.handle[ iDev ], streamPtr[iDev][stream] );
+
+			if ( count == loop_times[iDev] - 1 ) {
+				timed_size[iDev] = splitted_size;
+				cudaEventRecord( timing[iDev][0], streamPtr[iDev][stream] );
+			}
+
+			if( is_transa ){
+				status = cublasSetMatrixAsync ( splitted_size, (* m), sizeof(phiDoubleComplex), A + k_offset, (* lda), devPtrA[iDev][stream], gpu_lda, streamPtr[iDev][stream] );
+			} else {
+				status = cublasSetMatrixAsync ( (* m), splitted_size, sizeof(phiDoubleComplex), A + (size_t) k_offset * (* lda), (* lda), devPtrA[iDev][stream], gpu_lda, streamPtr[iDev][stream] );
+			}
+
+			if(is_transb ){
+				status = cublasSetMatrixAsync ( (* n), splitted_size, sizeof(phiDoubleComplex), B + (size_t) k_offset * (* ldb), (* ldb), devPtrB[iDev][stream], gpu_ldb, streamPtr[iDev][stream] );
+			} else {
+				status = cublasSetMatrixAsync ( splitted_size, (* n), sizeof(phiDoubleComplex), B + k_offset, (* ldb), devPtrB[iDev][stream], gpu_ldb, streamPtr[iDev][stream] );
 			}
-		} else{
-			for(i=0, offsetC=0; i<(*n); i++){
-				zscal_( m, beta, C+offsetC, &inc );
-				offsetC += (* ldc);
+
+			if ( count == loop_times[iDev] - 1 ) cudaEventRecord( timing[iDev][1], streamPtr[iDev][stream] );
+
+			/* on board, the GEMMs of the chunks follow each other on the same C */
+			buffer = accumulate[iDev] ? 0 : stream;
+			if ( accumulate[iDev] && count > 0 )
+				cudaStreamWaitEvent( streamPtr[iDev][stream], chained[iDev], 0 );
+
+			if ( count == loop_times[iDev] - 1 ) cudaEventRecord( timing[iDev][2], streamPtr[iDev][stream] );
+
+			status = cublasGemm ( myPhiGemmHdl.handle[ iDev ], cu_transa, cu_transb, (* m), (* n), splitted_size, alpha, devPtrA[iDev][stream], gpu_lda, devPtrB[iDev][stream], gpu_ldb, ( accumulate[iDev] && count > 0 ) ? &gpu_one : &gpu_beta, devPtrC[iDev][buffer], (* m) );
+
+			if ( accumulate[iDev] && count < loop_times[iDev] - 1 ) {
+				cudaEventRecord( chained[iDev], streamPtr[iDev][stream] );
+				continue;
 			}
+
+			if ( count == loop_times[iDev] - 1 ) cudaEventRecord( timing[iDev][3], streamPtr[iDev][stream] );
+
+			status = cublasGetMatrixAsync ( (* m), (* n), sizeof(phiDoubleComplex), devPtrC[iDev][buffer], (* m), C_buf[iDev][buffer], (* m), streamPtr[iDev][stream] );
+
+			if ( count == loop_times[iDev] - 1 ) cudaEventRecord( timing[iDev][4], streamPtr[iDev][stream] );
 		}
 
 #if defined(__PHIGEMM_DEBUG)
-		stop_axpy = phigemm_cclock();
-		time_axpy += stop_axpy - start_axpy;
+		start_axpy = phigemm_cclock();
 #endif
 
-		if( is_transa) offsetA += splitted_size;
-		else offsetA += (* m) * splitted_size;
+		/* beta is applied with the first chunk reduced */
+		for (iDev = 0; iDev < nDev; iDev++) {
 
-		if( is_transb) offsetB += (* n) * splitted_size;
-		else offsetB += splitted_size;
+			reduced = count - depth[iDev] + 1;
+			if ( reduced < 0 || reduced >= loop_times[iDev] ) continue;
 
+			/* a device accumulating on board has a result after its last chunk only */
+			if ( accumulate[iDev] && reduced < loop_times[iDev] - 1 ) continue;
+
+			cudaSetDevice( myPhiGemmHdl.devId[iDev] );
+			cudaStreamSynchronize( streamPtr[iDev][reduced % depth[iDev]] );
+
+			start_reduce = phigemm_cclock();
+			phiGemmReduce( 'z', (* m), (* n), beta_applied ? NULL : beta,
+					C_buf[iDev][accumulate[iDev] ? 0 : reduced % depth[iDev]], (* m), C, (* ldc) );
+			time_reduce += phigemm_cclock() - start_reduce;
+			bytes_reduce += (size_t) 3 * (* m) * (* n) * sizeof(phiDoubleComplex);
+			beta_applied = 1;
+		}
+
+#if defined(__PHIGEMM_DEBUG)
+		stop_axpy = phigemm_cclock();
+		time_axpy += stop_axpy - start_axpy;
+#endif
 	}
 
+#if !defined(__PHIGEMM_GPUONLY)
+	if ( k_gpu < (* k) ) {
+
+		time_gpu = phigemm_cclock() - start_specialk;
+		pthread_join( cpu_thread, NULL );
+
 #if defined(__PHIGEMM_DEBUG)
-	start_axpy = phigemm_cclock();
+		start_axpy = phigemm_cclock();
 #endif
 
-	cudaStreamSynchronize( streamPtr[stream] );
-	for(i=0, offsetC=0; i<(*n); i++){
-		zaxpy_( m, &DA, C_buf[stream]+offsetC, &inc, C+offsetC, &inc);
-		offsetC += (* ldc);
-	}
+		start_reduce = phigemm_cclock();
+		phiGemmReduce( 'z', (* m), (* n), NULL, cpu.acc, (* m), C, (* ldc) );
+		time_reduce += phigemm_cclock() - start_reduce;
+		bytes_reduce += (size_t) 3 * (* m) * (* n) * sizeof(phiDoubleComplex);
 
 #if defined(__PHIGEMM_DEBUG)
-	stop_axpy = phigemm_cclock();
-	time_axpy += stop_axpy - start_axpy;
+		stop_axpy = phigemm_cclock();
+		time_axpy += stop_axpy - start_axpy;
+#endif
+
+		free( cpu.acc );
+
+		/* the devices (reductions included) against the host share */
+		unbalance = time_gpu - cpu.time;
+
+#if defined(__PHIGEMM_SPLIT_MODEL)
+		phiGemmModelUpdate('z', 0, (* m), (* n), cpu.k, cpu.time, 0, 0, 0, 0.0, 0, 0.0, 0.0, 0);
+#elif defined(__PHIGEMM_SELFTUNE)
+		phiGemmShapeRecord(shape, unbalance);
+
+		/* the same rule as the split factor of the standard path */
+		if ((unbalance > 0.0f) && (fabs(unbalance) > 0.0005f ) ) {
+			/* less K to the devices */
+			if (fabs(unbalance) > 0.1)
+				new_split = split - 0.005;
+			else if (fabs(unbalance) > 0.03)
+				new_split = split - 0.002;
+			else
+				new_split = split - 0.001;
+
+			shape->lpSplit = split;
+			shape->prevSplit = split;
+			myPhiGemmTng.prevSplit[3] = split;
+			shape->split = new_split;
+
+#if defined(__PHIGEMM_DEBUG_2)
+			printf ("[PHIGEMM_DEBUG] Special K: adjusting split-factor (balance %9.6f), previous: %5.4f - new: %5.4f \n",
+					unbalance, split, new_split); fflush(stdout);
+#endif
+		}
+
+		if ((unbalance < 0.0f) && (fabs(unbalance) > 0.001f) ) {
+			/* more K to the devices */
+			new_split = (shape->lpSplit + 2*split) / 3;
+
+			shape->prevSplit = split;
+			myPhiGemmTng.prevSplit[3] = split;
+			shape->split = new_split;
+
+#if defined(__PHIGEMM_DEBUG_2)
+			printf ("[PHIGEMM_DEBUG] Special K: adjusting split-factor (balance %9.6f), previous: %5.4f - new: %5.4f \n",
+					unbalance, split, new_split); fflush(stdout);
+#endif
+		}
+#endif
+	}
 #endif
 
-	cudaStreamDestroy( streamPtr[0] );
-	cudaStreamDestroy( streamPtr[1] );
+	/* the last chunk of every device refines the rates of the cost model */
+	for (iDev = 0; iDev < nDev; iDev++) {
+		cudaSetDevice( myPhiGemmHdl.devId[iDev] );
+		cudaEventElapsedTime( &ms_h2d, timing[iDev][0], timing[iDev][1] );
+		cudaEventElapsedTime( &ms_gemm, timing[iDev][2], timing[iDev][3] );
+		cudaEventElapsedTime( &ms_d2h, timing[iDev][3], timing[iDev][4] );
+
+		phiGemmModelUpdate('z', iDev, 0, 0, 0, 0.0, (* m), (* n), timed_size[iDev],
+				ms_h2d / 1000, (size_t) ( (* m) + (* n) ) * timed_size[iDev] * sizeof(phiDoubleComplex),
+				ms_gemm / 1000, ms_d2h / 1000, (size_t) (* m) * (* n) * sizeof(phiDoubleComplex));
+	}
+	phiGemmModelUpdateReduce( bytes_reduce, time_reduce );
 
 	for (i = 0; i < myPhiGemmEnv.numDevices * NSTREAMS; i++)
 		cublasSetStream( myPhiGemmHdl.handle[ i ], myPhiGemmHdl.stream[ i ] );
 
-	for( i = 0; i < MAX_N_STREAM; i++){
-		cudaFreeHost( C_buf[i] );
+	for (iDev = 0; iDev < nDev; iDev++) {
+		for( i = 0; i < depth[iDev]; i++){
+			if ( C_pageable[iDev][i] )
+				free( C_buf[iDev][i] );
+			else if ( C_buf[iDev][i] != NULL )
+				phiGemmPoolHostFree( C_buf[iDev][i] );
+		}
 	}
 
+	cudaSetDevice( myPhiGemmHdl.devId[0] );
+
 #if defined(__PHIGEMM_DEBUG)
+
 	stop_gemm_total = phigemm_cclock();
 
 	double time_total = stop_gemm_total - start_gemm_total;
 
+	for (iDev = 0; iDev < nDev; iDev++) {
 #if defined(__PHIGEMM_PROFILE)
-	printf ("[PHIGEMM_DEBUG - %s:%s - GPU %d] %d %d %d ~ Special K ~ local_split:%d (loop_times=%d, last_split:%d) ~ Total:%9.6fs (axpy:%9.6fs)\n",
-			file, line, iDev % myPhiGemmEnv.numDevices, *m, *n, *k, local_split, loop_times, last_split, time_total, time_axpy); fflush(stdout);
+		printf ("[PHIGEMM_DEBUG - %s:%s - GPU %d] %d %d %d ~ Special K ~ k share:%d local_split:%d depth:%d (loop_times=%d, last_split:%d, %s) ~ Total:%9.6fs (axpy:%9.6fs)\n",
+				file, line, iDev, *m, *n, *k, k_share[iDev], local_split[iDev], depth[iDev], loop_times[iDev], last_split[iDev],
+				accumulate[iDev] ? "accumulated on board" : "reduced by chunk", time_total, time_axpy); fflush(stdout);
 #else
-	printf ("[PHIGEMM_DEBUG - GPU %d] %d %d %d ~ Special K ~ local_split:%d (loop_times=%d, last_split:%d) ~ Total:%9.6fs (axpy:%9.6fs)\n",
-			iDev % myPhiGemmEnv.numDevices, *m, *n, *k, local_split, loop_times, last_split, time_total, time_axpy); fflush(stdout);
+		printf ("[PHIGEMM_DEBUG - GPU %d] %d %d %d ~ Special K ~ k share:%d local_split:%d depth:%d (loop_times=%d, last_split:%d, %s) ~ Total:%9.6fs (axpy:%9.6fs)\n",
+				iDev, *m, *n, *k, k_share[iDev], local_split[iDev], depth[iDev], loop_times[iDev], last_split[iDev],
+				accumulate[iDev] ? "accumulated on board" : "reduced by chunk", time_total, time_axpy); fflush(stdout);
+#endif
+	}
+
+#if !defined(__PHIGEMM_GPUONLY)
+	if ( k_gpu < (* k) ) {
+		printf ("[PHIGEMM_DEBUG - CPU] %d %d %d ~ Special K ~ k share:%d (split %5.4f) ~ CPU:%9.6fs GPU:%9.6fs ~ BALANCE: %9.6fs\n",
+				*m, *n, *k, cpu.k, split, cpu.time, time_gpu, unbalance); fflush(stdout);
+	}
 #endif
 #endif
 
 #if defined(__PHIGEMM_MEMSET)
-	cudaMemset( myPhiGemmHdl.pmem[iDev], 0, mem_buffer );
+	for (iDev = 0; iDev < nDev; iDev++) {
+		cudaSetDevice( myPhiGemmHdl.devId[iDev] );
+		cudaMemset( myPhiGemmHdl.pmem[iDev], 0, mem_buffer[iDev] );
+	}
+	cudaSetDevice( myPhiGemmHdl.devId[0] );
 #endif
 
 #endif
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# Regression tests on the emulated devices: the library is built in every
+# configuration below and regression_test.x runs on 1, 2 and 8 devices,
+# then on 2 devices with a small scratch memory (streaming, Special-K C
+# tiling) and with a slow host link (packing, merge of C on the host).
+# The configurations must keep -D__PHIGEMM_EMULATE.
+
+CONFIGS=(
+	"-D__PHIGEMM_EMULATE -D__PHIGEMM_PINNED -D__PHIGEMM_ENABLE_SPECIALK -D__PHIGEMM_SELFTUNE"
+	"-D__PHIGEMM_EMULATE -D__PHIGEMM_ENABLE_SPECIALK -D__PHIGEMM_SPLIT_MODEL -D__PHIGEMM_TILING -D__PHIGEMM_OPERAND_CACHE"
+	"-D__PHIGEMM_EMULATE -D__PHIGEMM_MULTI_GPU -D__PHIGEMM_ENABLE_SPECIALK -D__PHIGEMM_WORK_STEALING"
+	"-D__PHIGEMM_EMULATE -D__PHIGEMM_GPUONLY -D__PHIGEMM_TILING -D__PHIGEMM_MULTI_STREAMS"
+)
+
+RUN="env LD_LIBRARY_PATH=../lib:${LD_LIBRARY_PATH} PHI_EMU_DEVICES=8 OMP_NUM_THREADS=2"
+FAILED=0
+
+for OPT in "${CONFIGS[@]}"; do
+
+	echo -e "\nTesting ${OPT}\n"
+
+	( cd .. && make clean > /dev/null 2>&1 && make PHIGEMM_GEMM_OPT="${OPT}" > /dev/null 2>&1 ) || exit 1
+	make regression PHIGEMM_GEMM_OPT="${OPT}" > /dev/null || exit 1
+
+	for NGPU in 1 2 8; do
+		${RUN} ../bin/regression_test.x ${NGPU} | grep -E "FAIL|checks failed"
+		[ ${PIPESTATUS[0]} -eq 0 ] || FAILED=1
+	done
+
+	${RUN} PHI_EMU_MEMSIZE=4 ../bin/regression_test.x 2 | grep -E "FAIL|checks failed"
+	[ ${PIPESTATUS[0]} -eq 0 ] || FAILED=1
+
+	${RUN} PHI_MODEL_H2D_BW=1 ../bin/regression_test.x 2 | grep -E "FAIL|checks failed"
+	[ ${PIPESTATUS[0]} -eq 0 ] || FAILED=1
+done
+
+exit ${FAILED}
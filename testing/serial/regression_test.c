@@ -0,0 +1,1059 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+/*
+ * Regression tests on the emulated devices (__PHIGEMM_EMULATE).
+ *
+ * Every case compares phiGEMM to the CPU BLAS on random operands, or
+ * checks a property of the library state. The checks are grouped by the
+ * feature they cover:
+ *
+ *   gemm      the standard path: all the precisions and transposes, thin,
+ *             CPU-only, empty and k == 0 products (with the configuration
+ *             and the environment of regression.sh: the split of the
+ *             emulated devices, streaming, work stealing, pipeline, merge
+ *             of C on the host and packing)
+ *   model     the cost model and the split factor it chooses
+ *   shapes    the per-shape split factors
+ *   tuningdb  the tuning database stored at shutdown and seeded from a
+ *             profile file
+ *   contexts  the batched, grouped and shared-A calls and the cost model
+ *             on a created context
+ *   specialk  Special-K (several devices, host share, device accumulation,
+ *             C tiling, chunk and depth per call, a fixed summation order)
+ *   batched, grouped, shared-a, async
+ *             the calls of the same names
+ *   pool      the reuse of the resource pool
+ *   tiling    the tile plan on devices of different rates
+ *   cache     the operand cache (__PHIGEMM_OPERAND_CACHE)
+ *
+ * Usage: regression_test.x [devices [group ...]], all the groups if none
+ * is given; PHI_EMU_DEVICES must expose that many devices. regression.sh
+ * runs it on every library configuration, with a scratch memory large
+ * enough for every tile and with a small one (streaming, Special-K C
+ * tiling, asynchronous calls run whole). The exit status is the number of
+ * failed checks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#define _STRING_LINE_(s) #s
+#define _STRING_LINE2_(s) _STRING_LINE_(s)
+#define __LINESTR__ _STRING_LINE2_(__LINE__)
+
+#if defined(__PHIGEMM_PROFILE)
+#define PROFILE_ARGS , __FILE__, __LINESTR__
+#else
+#define PROFILE_ARGS
+#endif
+
+#define MAX_GPU_REGRESSION_TEST 8
+
+// Largest error allowed per term of the dot products
+#define MAX_ERROR_SINGLE 0.00001
+#define MAX_ERROR_DOUBLE 0.0000000000001
+
+void sgemm_(), dgemm_(), cgemm_(), zgemm_();
+
+static int failures = 0, checks = 0;
+
+/* the groups of checks to run (all if none) */
+static char **groups = NULL;
+static int ngroups = 0;
+
+/* an operation C = alpha * op(A) * op(B) + beta * C and its reference R */
+typedef struct regProblem
+{
+	char type, transa, transb;
+	int m, n, k, lda, ldb, ldc;
+	double alpha[2], beta[2];
+	void *A, *B, *C, *R;
+} regProblem_t;
+
+static size_t typeSize(char type)
+{
+	switch (type)
+	{
+	case 's': return sizeof(float);
+	case 'd': return sizeof(double);
+	case 'c': return sizeof(phiComplex);
+	default: return sizeof(phiDoubleComplex);
+	}
+}
+
+static int isSingle(char type)
+{
+	return ( type == 's' || type == 'c' );
+}
+
+static int isComplex(char type)
+{
+	return ( type == 'c' || type == 'z' );
+}
+
+static int components(char type)
+{
+	return isComplex(type) ? 2 : 1;
+}
+
+/* count elements of the precision of type, in [-0.5, 0.5) */
+static void fillRandom(char type, void *x, size_t count)
+{
+	size_t i;
+
+	count *= components(type);
+
+	for (i = 0; i < count; i++) {
+		if ( isSingle(type) )
+			((float *) x)[i] = (float) ( drand48() - 0.5 );
+		else
+			((double *) x)[i] = drand48() - 0.5;
+	}
+
+	return;
+}
+
+/* a scalar of the precision of type (alpha and beta are stored as such) */
+static void setScalar(char type, double *s, double re, double im)
+{
+	memset(s, 0, 2 * sizeof(double));
+
+	if ( isSingle(type) ) {
+		((float *) s)[0] = (float) re;
+		if ( isComplex(type) ) ((float *) s)[1] = (float) im;
+	} else {
+		s[0] = re;
+		if ( isComplex(type) ) s[1] = im;
+	}
+
+	return;
+}
+
+static void * regAlloc(size_t bytes)
+{
+	void *ptr = malloc( bytes > 0 ? bytes : 1 );
+
+	if ( ptr == NULL ) {
+		printf("*** ERROR *** cannot allocate %lu bytes\n", (unsigned long) bytes);
+		exit(EXIT_FAILURE);
+	}
+
+	return ptr;
+}
+
+/* random operands (leading dimensions padded) for an m x n x k product */
+static void problemInit(regProblem_t *p, char type, char transa, char transb,
+		int m, int n, int k, int beta_is_zero)
+{
+	size_t ts = typeSize(type), sizeA, sizeB, sizeC;
+	int is_transa = ( transa != 'n' && transa != 'N' );
+	int is_transb = ( transb != 'n' && transb != 'N' );
+
+	p->type = type;
+	p->transa = transa;
+	p->transb = transb;
+	p->m = m;
+	p->n = n;
+	p->k = k;
+	p->lda = imax(1, ( is_transa ? k : m ) + 3);
+	p->ldb = imax(1, ( is_transb ? n : k ) + 2);
+	p->ldc = imax(1, m + 1);
+
+	setScalar(type, p->alpha, 1.25, -0.5);
+	if ( beta_is_zero )
+		setScalar(type, p->beta, 0.0, 0.0);
+	else
+		setScalar(type, p->beta, 0.75, 0.25);
+
+	sizeA = (size_t) p->lda * imax(1, is_transa ? m : k);
+	sizeB = (size_t) p->ldb * imax(1, is_transb ? k : n);
+	sizeC = (size_t) p->ldc * imax(1, n);
+
+	p->A = regAlloc(sizeA * ts);
+	p->B = regAlloc(sizeB * ts);
+	p->C = regAlloc(sizeC * ts);
+	p->R = regAlloc(sizeC * ts);
+
+	fillRandom(type, p->A, sizeA);
+	fillRandom(type, p->B, sizeB);
+	fillRandom(type, p->C, sizeC);
+	memcpy(p->R, p->C, sizeC * ts);
+
+	return;
+}
+
+static void problemFree(regProblem_t *p)
+{
+	free(p->A);
+	free(p->B);
+	free(p->C);
+	free(p->R);
+
+	return;
+}
+
+/* the reference product, on R */
+static void problemReference(regProblem_t *p)
+{
+	const char *ta = &p->transa, *tb = &p->transb;
+
+	switch (p->type)
+	{
+	case 's':
+		sgemm_(ta, tb, &p->m, &p->n, &p->k, p->alpha, p->A, &p->lda, p->B, &p->ldb, p->beta, p->R, &p->ldc);
+		break;
+	case 'd':
+		dgemm_(ta, tb, &p->m, &p->n, &p->k, p->alpha, p->A, &p->lda, p->B, &p->ldb, p->beta, p->R, &p->ldc);
+		break;
+	case 'c':
+		cgemm_(ta, tb, &p->m, &p->n, &p->k, p->alpha, p->A, &p->lda, p->B, &p->ldb, p->beta, p->R, &p->ldc);
+		break;
+	case 'z':
+		zgemm_(ta, tb, &p->m, &p->n, &p->k, p->alpha, p->A, &p->lda, p->B, &p->ldb, p->beta, p->R, &p->ldc);
+		break;
+	}
+
+	return;
+}
+
+/* the product by phiGEMM, on the default context if ctx is NULL */
+static void problemCompute(regProblem_t *p, phiGemmContext_t *ctx)
+{
+	const char *ta = &p->transa, *tb = &p->transb;
+
+	switch (p->type)
+	{
+	case 's':
+		if ( ctx == NULL )
+			phisgemm_(ta, tb, &p->m, &p->n, &p->k, (float *) p->alpha, (float *) p->A, &p->lda,
+					(float *) p->B, &p->ldb, (float *) p->beta, (float *) p->C, &p->ldc PROFILE_ARGS);
+		else
+			phiSgemmEx(ctx, ta, tb, &p->m, &p->n, &p->k, (float *) p->alpha, (float *) p->A, &p->lda,
+					(float *) p->B, &p->ldb, (float *) p->beta, (float *) p->C, &p->ldc PROFILE_ARGS);
+		break;
+	case 'd':
+		if ( ctx == NULL )
+			phidgemm_(ta, tb, &p->m, &p->n, &p->k, (double *) p->alpha, (double *) p->A, &p->lda,
+					(double *) p->B, &p->ldb, (double *) p->beta, (double *) p->C, &p->ldc PROFILE_ARGS);
+		else
+			phiDgemmEx(ctx, ta, tb, &p->m, &p->n, &p->k, (double *) p->alpha, (double *) p->A, &p->lda,
+					(double *) p->B, &p->ldb, (double *) p->beta, (double *) p->C, &p->ldc PROFILE_ARGS);
+		break;
+	case 'c':
+		if ( ctx == NULL )
+			phicgemm_(ta, tb, &p->m, &p->n, &p->k, (phiComplex *) p->alpha, (phiComplex *) p->A, &p->lda,
+					(phiComplex *) p->B, &p->ldb, (phiComplex *) p->beta, (phiComplex *) p->C, &p->ldc PROFILE_ARGS);
+		else
+			phiCgemmEx(ctx, ta, tb, &p->m, &p->n, &p->k, (phiComplex *) p->alpha, (phiComplex *) p->A, &p->lda,
+					(phiComplex *) p->B, &p->ldb, (phiComplex *) p->beta, (phiComplex *) p->C, &p->ldc PROFILE_ARGS);
+		break;
+	case 'z':
+		if ( ctx == NULL )
+			phizgemm_(ta, tb, &p->m, &p->n, &p->k, (phiDoubleComplex *) p->alpha, (phiDoubleComplex *) p->A, &p->lda,
+					(phiDoubleComplex *) p->B, &p->ldb, (phiDoubleComplex *) p->beta, (phiDoubleComplex *) p->C, &p->ldc PROFILE_ARGS);
+		else
+			phiZgemmEx(ctx, ta, tb, &p->m, &p->n, &p->k, (phiDoubleComplex *) p->alpha, (phiDoubleComplex *) p->A, &p->lda,
+					(phiDoubleComplex *) p->B, &p->ldb, (phiDoubleComplex *) p->beta, (phiDoubleComplex *) p->C, &p->ldc PROFILE_ARGS);
+		break;
+	}
+
+	return;
+}
+
+/* the product by phi?gemmAsync */
+static phiGemmRequest_t * problemIssue(regProblem_t *p, phiGemmContext_t *ctx)
+{
+	const char *ta = &p->transa, *tb = &p->transb;
+
+	switch (p->type)
+	{
+	case 's':
+		return phiSgemmAsync(ctx, ta, tb, &p->m, &p->n, &p->k, (float *) p->alpha, (float *) p->A, &p->lda,
+				(float *) p->B, &p->ldb, (float *) p->beta, (float *) p->C, &p->ldc PROFILE_ARGS);
+	case 'd':
+		return phiDgemmAsync(ctx, ta, tb, &p->m, &p->n, &p->k, (double *) p->alpha, (double *) p->A, &p->lda,
+				(double *) p->B, &p->ldb, (double *) p->beta, (double *) p->C, &p->ldc PROFILE_ARGS);
+	case 'c':
+		return phiCgemmAsync(ctx, ta, tb, &p->m, &p->n, &p->k, (phiComplex *) p->alpha, (phiComplex *) p->A, &p->lda,
+				(phiComplex *) p->B, &p->ldb, (phiComplex *) p->beta, (phiComplex *) p->C, &p->ldc PROFILE_ARGS);
+	default:
+		return phiZgemmAsync(ctx, ta, tb, &p->m, &p->n, &p->k, (phiDoubleComplex *) p->alpha, (phiDoubleComplex *) p->A, &p->lda,
+				(phiDoubleComplex *) p->B, &p->ldb, (phiDoubleComplex *) p->beta, (phiDoubleComplex *) p->C, &p->ldc PROFILE_ARGS);
+	}
+}
+
+/* largest difference between C and R, component by component */
+static double problemError(const regProblem_t *p)
+{
+	int i, j, c = components(p->type);
+	double err = 0.0, d;
+	size_t e;
+
+	for (j = 0; j < p->n; j++) {
+		for (i = 0; i < p->m * c; i++) {
+			e = (size_t) j * p->ldc * c + i;
+			if ( isSingle(p->type) )
+				d = fabs( (double) ((float *) p->C)[e] - (double) ((float *) p->R)[e] );
+			else
+				d = fabs( ((double *) p->C)[e] - ((double *) p->R)[e] );
+			if ( d > err || d != d ) err = d;
+		}
+	}
+
+	return err;
+}
+
+/* record a check on an m x n x k product */
+static void check(const char *name, char type, char transa, char transb, int m, int n, int k, double err)
+{
+	double tol = ( isSingle(type) ? MAX_ERROR_SINGLE : MAX_ERROR_DOUBLE ) * ( k + 10 );
+	int ok = ( err <= tol );
+
+	checks++;
+	if ( !ok ) failures++;
+
+	printf("%-14s %c %c%c %6d %6d %6d   err %9.3e   %s\n", name, type, transa, transb, m, n, k, err,
+			ok ? "PASS" : "FAIL");
+	fflush(stdout);
+
+	return;
+}
+
+/* record a check on a condition */
+static void checkTrue(const char *name, const char *what, int ok)
+{
+	checks++;
+	if ( !ok ) failures++;
+
+	printf("%-14s %-43s %s\n", name, what, ok ? "PASS" : "FAIL");
+	fflush(stdout);
+
+	return;
+}
+
+/* one product on ctx (the default context if NULL), checked */
+static void runProblem(const char *name, phiGemmContext_t *ctx, char type, char transa, char transb,
+		int m, int n, int k, int beta_is_zero)
+{
+	regProblem_t p;
+
+	problemInit(&p, type, transa, transb, m, n, k, beta_is_zero);
+	problemCompute(&p, ctx);
+	problemReference(&p);
+	check(name, type, transa, transb, m, n, k, problemError(&p));
+	problemFree(&p);
+
+	return;
+}
+
+/* whether the group of checks is to be run */
+static int selected(const char *group)
+{
+	int i;
+
+	if ( ngroups == 0 ) return 1;
+
+	for (i = 0; i < ngroups; i++)
+		if ( strcmp(groups[i], group) == 0 ) return 1;
+
+	return 0;
+}
+
+/* the transposes: 'c' stands for 't' in the complex precisions */
+static char transChar(char type, char t)
+{
+	return ( t == 't' && isComplex(type) ) ? 'c' : t;
+}
+
+
+/* the standard path, every precision and transpose */
+static void testGemm()
+{
+	const char *types = "sdcz", *trans[4] = { "nn", "tn", "nt", "tt" };
+	int shapes[][3] = {
+			{  517,  389,  301 },		// split A
+			{  256, 1100,  200 },		// split B
+			{ 1500,   64,  200 },		// thin
+			{   40,   50,   30 },		// CPU-only (below PHI_LOWER_LIMIT)
+			{  300,  200,    0 },		// k == 0: C = beta * C
+			{    0,  100,  100 },		// empty
+	};
+	int t, s, x;
+
+	for (t = 0; t < 4; t++)
+		for (x = 0; x < 4; x++)
+			for (s = 0; s < (int) ( sizeof(shapes) / sizeof(shapes[0]) ); s++)
+				runProblem("gemm", NULL, types[t], transChar(types[t], trans[x][0]), transChar(types[t], trans[x][1]),
+						shapes[s][0], shapes[s][1], shapes[s][2], ( s + x ) % 2);
+
+	return;
+}
+
+/* Special-K sized products (k much larger than m and n) */
+static void testSpecialK(int nGPU, int *ids)
+{
+	const char *types = "dz", *trans[3] = { "nn", "tn", "nt" };
+	phiGemmContext_t *ctx;
+	void *initial, *first;
+	regProblem_t p;
+	size_t bytes;
+	int t, x;
+
+	for (t = 0; t < 2; t++)
+		for (x = 0; x < 3; x++)
+			runProblem("specialk", NULL, types[t], transChar(types[t], trans[x][0]), transChar(types[t], trans[x][1]),
+					160, 144, 8192, x % 2);
+
+	/* a chunk larger than k: a single chunk, shorter than the chunk size */
+	setenv("PHI_SPLITK_DGEMM", "16384", 1);
+	setenv("PHI_SPLITK_ZGEMM", "16384", 1);
+	ctx = phiGemmCreate(nGPU, NULL, NULL, ids, 0);
+
+	for (t = 0; t < 2; t++)
+		runProblem("specialk-chunk", ctx, types[t], 'n', 'n', 160, 144, 8192, t);
+
+	phiGemmDestroy(ctx);
+	unsetenv("PHI_SPLITK_DGEMM");
+	unsetenv("PHI_SPLITK_ZGEMM");
+
+	/* the same call gives the same bits, whatever the model learns in between */
+	for (t = 0; t < 2; t++) {
+		problemInit(&p, types[t], 'n', 'n', 176, 144, 8192, 0);
+		bytes = (size_t) p.ldc * p.n * typeSize(types[t]);
+		initial = malloc(bytes);
+		first = malloc(bytes);
+		memcpy(initial, p.C, bytes);
+
+		problemCompute(&p, NULL);
+		memcpy(first, p.C, bytes);
+
+		for (x = 0; x < 3; x++)
+			runProblem("specialk", NULL, types[t], 'n', 'n', 160, 144, 8192 + 1024 * x, 1);
+
+		memcpy(p.C, initial, bytes);
+		problemCompute(&p, NULL);
+		checkTrue("specialk", "the same call twice, the same bits", memcmp(first, p.C, bytes) == 0);
+
+		free(initial);
+		free(first);
+		problemFree(&p);
+	}
+
+	return;
+}
+
+/* batches of products of the same shape, on the default context if ctx is NULL */
+static void testBatched(phiGemmContext_t *ctx)
+{
+	int m = 48, n = 40, k = 32, count = 37, i, x;
+	const char *trans[2] = { "nn", "tn" };
+	long long strideA, strideB, strideC;
+	regProblem_t p[37], q;
+	const void *A[37], *B[37];
+	void *C[37];
+	double err;
+
+	for (x = 0; x < 2; x++) {
+
+		/* double: array of pointers */
+		for (i = 0; i < count; i++) {
+			problemInit(&p[i], 'd', trans[x][0], trans[x][1], m, n, k, x);
+			A[i] = p[i].A;
+			B[i] = p[i].B;
+			C[i] = p[i].C;
+		}
+		if ( ctx == NULL )
+			phiDgemmBatched(&p[0].transa, &p[0].transb, &m, &n, &k, (double *) p[0].alpha,
+					(const double *const *) A, &p[0].lda, (const double *const *) B, &p[0].ldb,
+					(double *) p[0].beta, (double *const *) C, &p[0].ldc, &count);
+		else
+			phiDgemmBatchedEx(ctx, &p[0].transa, &p[0].transb, &m, &n, &k, (double *) p[0].alpha,
+					(const double *const *) A, &p[0].lda, (const double *const *) B, &p[0].ldb,
+					(double *) p[0].beta, (double *const *) C, &p[0].ldc, &count);
+		for (i = 0, err = 0.0; i < count; i++) {
+			problemReference(&p[i]);
+			err = fmax(err, problemError(&p[i]));
+			problemFree(&p[i]);
+		}
+		check("batched", 'd', trans[x][0], trans[x][1], m, n, k, err);
+
+		/* double complex: array of pointers */
+		for (i = 0; i < count; i++) {
+			problemInit(&p[i], 'z', transChar('z', trans[x][0]), trans[x][1], m, n, k, x);
+			A[i] = p[i].A;
+			B[i] = p[i].B;
+			C[i] = p[i].C;
+		}
+		if ( ctx == NULL )
+			phiZgemmBatched(&p[0].transa, &p[0].transb, &m, &n, &k, (phiDoubleComplex *) p[0].alpha,
+					(const phiDoubleComplex *const *) A, &p[0].lda, (const phiDoubleComplex *const *) B, &p[0].ldb,
+					(phiDoubleComplex *) p[0].beta, (phiDoubleComplex *const *) C, &p[0].ldc, &count);
+		else
+			phiZgemmBatchedEx(ctx, &p[0].transa, &p[0].transb, &m, &n, &k, (phiDoubleComplex *) p[0].alpha,
+					(const phiDoubleComplex *const *) A, &p[0].lda, (const phiDoubleComplex *const *) B, &p[0].ldb,
+					(phiDoubleComplex *) p[0].beta, (phiDoubleComplex *const *) C, &p[0].ldc, &count);
+		for (i = 0, err = 0.0; i < count; i++) {
+			problemReference(&p[i]);
+			err = fmax(err, problemError(&p[i]));
+			problemFree(&p[i]);
+		}
+		check("batched", 'z', transChar('z', trans[x][0]), trans[x][1], m, n, k, err);
+	}
+
+	/* strided, with A shared (stride 0): the batch is a single product
+	 * of count * n columns */
+	for (x = 0; x < 2; x++) {
+		char type = x ? 'z' : 'd';
+
+		problemInit(&q, type, 'n', 'n', m, n * count, k, 0);
+		strideA = 0;
+		strideB = (long long) q.ldb * n;
+		strideC = (long long) q.ldc * n;
+
+		if ( type == 'd' && ctx == NULL )
+			phiDgemmStridedBatched(&q.transa, &q.transb, &m, &n, &k, (double *) q.alpha,
+					(double *) q.A, &q.lda, &strideA, (double *) q.B, &q.ldb, &strideB,
+					(double *) q.beta, (double *) q.C, &q.ldc, &strideC, &count);
+		else if ( type == 'd' )
+			phiDgemmStridedBatchedEx(ctx, &q.transa, &q.transb, &m, &n, &k, (double *) q.alpha,
+					(double *) q.A, &q.lda, &strideA, (double *) q.B, &q.ldb, &strideB,
+					(double *) q.beta, (double *) q.C, &q.ldc, &strideC, &count);
+		else if ( ctx == NULL )
+			phiZgemmStridedBatched(&q.transa, &q.transb, &m, &n, &k, (phiDoubleComplex *) q.alpha,
+					(phiDoubleComplex *) q.A, &q.lda, &strideA, (phiDoubleComplex *) q.B, &q.ldb, &strideB,
+					(phiDoubleComplex *) q.beta, (phiDoubleComplex *) q.C, &q.ldc, &strideC, &count);
+		else
+			phiZgemmStridedBatchedEx(ctx, &q.transa, &q.transb, &m, &n, &k, (phiDoubleComplex *) q.alpha,
+					(phiDoubleComplex *) q.A, &q.lda, &strideA, (phiDoubleComplex *) q.B, &q.ldb, &strideB,
+					(phiDoubleComplex *) q.beta, (phiDoubleComplex *) q.C, &q.ldc, &strideC, &count);
+
+		problemReference(&q);
+		check("strided", type, 'n', 'n', m, n, k, problemError(&q));
+		problemFree(&q);
+	}
+
+	return;
+}
+
+/* groups of products of different shapes, on the default context if ctx is NULL */
+static void testGrouped(phiGemmContext_t *ctx)
+{
+	const char *types = "sdcz";
+	int shapes[][3] = {
+			{  600,  500,  400 },
+			{   30,   20,   10 },
+			{    0,   50,   50 },		// empty
+			{  200,  300,    0 },		// k == 0
+			{  333,  111,  222 },
+			{  128,  128, 4096 },
+			{ 1000,    8,  100 },
+			{    1,    1,    1 },
+	};
+	int count = (int) ( sizeof(shapes) / sizeof(shapes[0]) ), t, i;
+	phiGemmProblem_t group[8];
+	regProblem_t p[8];
+
+	for (t = 0; t < 4; t++) {
+		for (i = 0; i < count; i++) {
+			problemInit(&p[i], types[t], transChar(types[t], ( i % 2 ) ? 't' : 'n'), ( i % 3 ) ? 'n' : 't',
+					shapes[i][0], shapes[i][1], shapes[i][2], i % 2);
+			group[i].transa = p[i].transa;
+			group[i].transb = p[i].transb;
+			group[i].m = p[i].m;
+			group[i].n = p[i].n;
+			group[i].k = p[i].k;
+			group[i].alpha = p[i].alpha;
+			group[i].A = p[i].A;
+			group[i].lda = p[i].lda;
+			group[i].B = p[i].B;
+			group[i].ldb = p[i].ldb;
+			group[i].beta = p[i].beta;
+			group[i].C = p[i].C;
+			group[i].ldc = p[i].ldc;
+		}
+
+		switch (types[t])
+		{
+		case 's': if ( ctx == NULL ) phiSgemmGrouped(group, count); else phiSgemmGroupedEx(ctx, group, count); break;
+		case 'd': if ( ctx == NULL ) phiDgemmGrouped(group, count); else phiDgemmGroupedEx(ctx, group, count); break;
+		case 'c': if ( ctx == NULL ) phiCgemmGrouped(group, count); else phiCgemmGroupedEx(ctx, group, count); break;
+		case 'z': if ( ctx == NULL ) phiZgemmGrouped(group, count); else phiZgemmGroupedEx(ctx, group, count); break;
+		}
+
+		for (i = 0; i < count; i++) {
+			problemReference(&p[i]);
+			check("grouped", types[t], p[i].transa, p[i].transb, p[i].m, p[i].n, p[i].k, problemError(&p[i]));
+			problemFree(&p[i]);
+		}
+	}
+
+	return;
+}
+
+/* right-hand sides sharing A, on the default context if ctx is NULL */
+static void testSharedA(phiGemmContext_t *ctx)
+{
+	const char *types = "sdcz";
+	int m = 300, k = 200, count = 5, widths[5] = { 100, 0, 257, 1, 64 }, t, i;
+	phiGemmRhs_t rhs[5];
+	regProblem_t p[5];
+	char transb;
+
+	for (t = 0; t < 4; t++) {
+		transb = transChar(types[t], ( t % 2 ) ? 't' : 'n');
+
+		/* the same A and alpha in every problem */
+		for (i = 0; i < count; i++) {
+			problemInit(&p[i], types[t], 'n', transb, m, widths[i], k, i % 2);
+			if ( i > 0 ) {
+				memcpy(p[i].A, p[0].A, (size_t) p[0].lda * k * typeSize(types[t]));
+				memcpy(p[i].alpha, p[0].alpha, sizeof(p[0].alpha));
+			}
+			rhs[i].n = p[i].n;
+			rhs[i].B = p[i].B;
+			rhs[i].ldb = p[i].ldb;
+			rhs[i].beta = p[i].beta;
+			rhs[i].C = p[i].C;
+			rhs[i].ldc = p[i].ldc;
+		}
+
+		if ( ctx == NULL ) {
+			switch (types[t])
+			{
+			case 's': phiSgemmSharedA('n', transb, m, k, (float *) p[0].alpha, (float *) p[0].A, p[0].lda, rhs, count); break;
+			case 'd': phiDgemmSharedA('n', transb, m, k, (double *) p[0].alpha, (double *) p[0].A, p[0].lda, rhs, count); break;
+			case 'c': phiCgemmSharedA('n', transb, m, k, (phiComplex *) p[0].alpha, (phiComplex *) p[0].A, p[0].lda, rhs, count); break;
+			case 'z': phiZgemmSharedA('n', transb, m, k, (phiDoubleComplex *) p[0].alpha, (phiDoubleComplex *) p[0].A, p[0].lda, rhs, count); break;
+			}
+		} else {
+			switch (types[t])
+			{
+			case 's': phiSgemmSharedAEx(ctx, 'n', transb, m, k, (float *) p[0].alpha, (float *) p[0].A, p[0].lda, rhs, count); break;
+			case 'd': phiDgemmSharedAEx(ctx, 'n', transb, m, k, (double *) p[0].alpha, (double *) p[0].A, p[0].lda, rhs, count); break;
+			case 'c': phiCgemmSharedAEx(ctx, 'n', transb, m, k, (phiComplex *) p[0].alpha, (phiComplex *) p[0].A, p[0].lda, rhs, count); break;
+			case 'z': phiZgemmSharedAEx(ctx, 'n', transb, m, k, (phiDoubleComplex *) p[0].alpha, (phiDoubleComplex *) p[0].A, p[0].lda, rhs, count); break;
+			}
+		}
+
+		for (i = 0; i < count; i++) {
+			problemReference(&p[i]);
+			check("shared-a", types[t], 'n', transb, m, widths[i], k, problemError(&p[i]));
+			problemFree(&p[i]);
+		}
+	}
+
+	return;
+}
+
+/* the batched, grouped and shared-A calls and the cost model of a created context */
+static void testContexts(int nGPU, int *ids)
+{
+	phiGemmContext_t *ctx = phiGemmCreate(nGPU, NULL, NULL, ids, 0);
+	phiGemmPrediction_t pred;
+	float split;
+
+	testBatched(ctx);
+	testGrouped(ctx);
+	testSharedA(ctx);
+
+	split = phiGemmModelSplitEx(ctx, 'd', "n", "n", 700, 600, 500, 0);
+	phiGemmPredictEx(ctx, 'd', "n", "n", 700, 600, 500, 0, -1.0f, &pred);
+	checkTrue("contexts", "model split of the context", split >= 0.0f && split <= 1.0f && pred.split == split);
+
+	phiGemmDestroy(ctx);
+
+	return;
+}
+
+/* asynchronous requests, on the default and on a created context */
+static void testAsync(int nGPU, int *ids)
+{
+	const char *types = "sdcz";
+	phiGemmContext_t *ctx = phiGemmCreate(nGPU, NULL, NULL, ids, 0);
+	phiGemmRequest_t *req[4];
+	regProblem_t p[3];
+	int t, polls;
+
+	for (t = 0; t < 4; t++) {
+		problemInit(&p[0], types[t], 'n', 'n', 700, 600, 500, 0);
+		problemInit(&p[1], types[t], transChar(types[t], 't'), 'n', 64, 64, 4000, 1);
+		problemInit(&p[2], types[t], 'n', transChar(types[t], 't'), 513, 700, 129, 0);
+
+		/* the second request on p[0] depends on the first one */
+		req[0] = problemIssue(&p[0], NULL);
+		req[1] = problemIssue(&p[1], ctx);
+		req[2] = problemIssue(&p[2], NULL);
+		req[3] = problemIssue(&p[0], NULL);
+
+		problemReference(&p[0]);
+		problemReference(&p[0]);
+		problemReference(&p[1]);
+		problemReference(&p[2]);
+
+		for (polls = 0; !phiGemmTest(req[3]); polls++) ;
+		phiGemmWait(req[2]);
+		phiGemmWait(req[1]);
+		phiGemmWait(req[0]);
+
+		check("async", types[t], 'n', 'n', 700, 600, 500, problemError(&p[0]));
+		check("async", types[t], p[1].transa, 'n', 64, 64, 4000, problemError(&p[1]));
+		check("async", types[t], 'n', p[2].transb, 513, 700, 129, problemError(&p[2]));
+
+		/* a blocking call right after */
+		problemCompute(&p[2], NULL);
+		problemReference(&p[2]);
+		check("async-then", types[t], 'n', p[2].transb, 513, 700, 129, problemError(&p[2]));
+
+		problemFree(&p[0]);
+		problemFree(&p[1]);
+		problemFree(&p[2]);
+	}
+
+	/* a request still in flight when the context is destroyed */
+	problemInit(&p[0], 'd', 'n', 'n', 300, 300, 300, 0);
+	req[0] = problemIssue(&p[0], ctx);
+	phiGemmDestroy(ctx);
+	phiGemmWait(req[0]);
+	problemReference(&p[0]);
+	check("async-destroy", 'd', 'n', 'n', 300, 300, 300, problemError(&p[0]));
+	problemFree(&p[0]);
+
+	return;
+}
+
+/* the split factor of the cost model is the one of the shortest predicted makespan */
+static void testModel()
+{
+	int shapes[][3] = {
+			{ 2000, 1800, 1500 },
+			{  300, 4000,  200 },
+			{ 1500,   64,  200 },
+	};
+	phiGemmPrediction_t best, pred;
+	float split;
+	int s, i, ok = 1;
+
+	for (s = 0; s < (int) ( sizeof(shapes) / sizeof(shapes[0]) ); s++) {
+		split = phiGemmModelSplit('d', "n", "n", shapes[s][0], shapes[s][1], shapes[s][2], s % 2);
+		phiGemmPredict('d', "n", "n", shapes[s][0], shapes[s][1], shapes[s][2], s % 2, split, &best);
+
+		if ( split < 0.0f || split > 1.0f || best.split != split ) ok = 0;
+
+		for (i = 0; i <= 20; i++) {
+			phiGemmPredict('d', "n", "n", shapes[s][0], shapes[s][1], shapes[s][2], s % 2, i * 0.05f, &pred);
+			if ( pred.makespan < best.makespan * ( 1.0 - 1.e-6 ) ) ok = 0;
+		}
+	}
+	checkTrue("model", "the model split minimizes the makespan", ok);
+
+	/* all on the CPU: no transfer, no device time */
+	phiGemmPredict('d', "n", "n", 2000, 1800, 1500, 0, 0.0f, &pred);
+	checkTrue("model", "no device share, no device time",
+			pred.cpu_time > 0.0 && pred.gpu_time == 0.0 && pred.h2d_time == 0.0 && pred.makespan >= pred.cpu_time);
+
+	return;
+}
+
+/* every class of shapes owns its split factor */
+static void testShapes()
+{
+	phiGemmShapeEntry_t *e[4];
+
+	e[0] = phiGemmShapeLookup('d', "n", "n", 517, 389, 301, 0);
+	e[1] = phiGemmShapeLookup('d', "n", "n", 520, 390, 300, 0);
+	e[2] = phiGemmShapeLookup('d', "n", "n", 4000, 4000, 64, 0);
+	e[3] = phiGemmShapeLookup('d', "n", "t", 517, 389, 301, 0);
+
+	checkTrue("shapes", "close shapes share their entry", e[0] == e[1]);
+	checkTrue("shapes", "other sizes or transposes do not",
+			e[2] != e[0] && e[3] != e[0] && e[3] != e[2]);
+
+	/* a split tuned for one class leaves the others alone */
+	e[0]->split = 0.3f;
+	e[2]->split = 0.9f;
+	checkTrue("shapes", "split factors kept per class",
+			phiGemmShapeLookup('d', "n", "n", 517, 389, 301, 0)->split == 0.3f &&
+			phiGemmShapeLookup('d', "n", "n", 4000, 4000, 64, 0)->split == 0.9f);
+
+	phiGemmShapeReset();
+
+	return;
+}
+
+/* the resource pool does not grow over repeated calls */
+static void testPool()
+{
+	size_t bytes[2], high[2];
+	int streams[2], events[2], i;
+	regProblem_t p;
+
+	problemInit(&p, 'd', 'n', 'n', 517, 389, 301, 0);
+
+	problemCompute(&p, NULL);
+	phiGemmPoolStats(&bytes[0], &high[0], &streams[0], &events[0]);
+
+	for (i = 0; i < 10; i++) {
+		problemCompute(&p, NULL);
+		problemReference(&p);
+	}
+	problemReference(&p);
+	phiGemmPoolStats(&bytes[1], &high[1], &streams[1], &events[1]);
+
+	check("pool", 'd', 'n', 'n', 517, 389, 301, problemError(&p));
+	checkTrue("pool", "pinned memory reused", bytes[1] == bytes[0] && high[1] == high[0]);
+	checkTrue("pool", "streams and events reused", streams[1] == streams[0] && events[1] == events[0]);
+
+	problemFree(&p);
+
+	return;
+}
+
+/* the tiles follow the rate of the worker they go to, also when empty
+ * rows of tiles are dropped (white box: the plan of phiGemmTilePlan) */
+static void testTiling(int nGPU)
+{
+	double saved_rate[MAX_GPUS], time, worst = 0.0, total = 0.0;
+	size_t saved_smem[NSTREAMS * MAX_GPUS];
+	phiGemmTilePlan_t plan;
+	int w, d;
+
+	/* a slow device between fast ones: 2 rows of C leave empty rows */
+	if ( nGPU < 3 ) return;
+
+	for (d = 0; d < nGPU; d++) {
+		saved_rate[d] = myPhiGemmMdl.gpu_gflops[1][d];
+		myPhiGemmMdl.gpu_gflops[1][d] = ( d == 0 || d == nGPU - 1 ) ? 1000.0 : 1.0;
+		total += myPhiGemmMdl.gpu_gflops[1][d];
+	}
+	for (w = 0; w < nGPU * NSTREAMS; w++) {
+		saved_smem[w] = myPhiGemmHdl.smem[w];
+		myPhiGemmHdl.smem[w] = (size_t) 64 << 20;
+	}
+
+	phiGemmTilePlan('d', 1, 1.0f, 2, 500, 64, &plan);
+
+	for (w = 0; w < plan.workers; w++) {
+		time = (double) plan.m[w] * plan.n[w] * plan.k[w] / myPhiGemmMdl.gpu_gflops[1][w % nGPU];
+		if ( time > worst ) worst = time;
+	}
+	checkTrue("tiling", "tiles follow the rate of their worker",
+			worst <= 4.0 * 2 * 500 * 64 / total);
+
+	for (d = 0; d < nGPU; d++)
+		myPhiGemmMdl.gpu_gflops[1][d] = saved_rate[d];
+	for (w = 0; w < nGPU * NSTREAMS; w++)
+		myPhiGemmHdl.smem[w] = saved_smem[w];
+
+	return;
+}
+
+#if defined(__PHIGEMM_OPERAND_CACHE)
+/* operands used again are not uploaded again, unless updated (the cache
+ * lives in the scratch memory, given by the caller or kept by phiGEMM) */
+static void testCache(int nGPU, int *ids)
+{
+	phiGemmMemDevPtr ptr;
+	phiGemmMemSizes size;
+	phiGemmContext_t *ctx;
+	unsigned long hits[2], misses[2];
+	size_t saved[2], avail, total;
+	regProblem_t p;
+	int i;
+
+	/* the default context gives the memory it keeps for its cache back */
+	phiGemmShutdown();
+	phiGemmInit(nGPU, NULL, NULL, ids, 0);
+
+	for (i = 0; i < nGPU; i++) {
+		cudaSetDevice(ids[i]);
+		cudaMemGetInfo(&avail, &total);
+		size[i] = avail / 2;
+		if ( cudaMalloc(&ptr[i], size[i]) != cudaSuccess ) {
+			checkTrue("cache", "scratch memory allocation", 0);
+			return;
+		}
+	}
+	ctx = phiGemmCreate(nGPU, &ptr, &size, ids, 0);
+
+	problemInit(&p, 'd', 'n', 'n', 256, 192, 160, 0);
+
+	phiGemmCacheSetGenerationEx(ctx, p.A, 1);
+	problemCompute(&p, ctx);
+	problemReference(&p);
+	phiGemmCacheStatsEx(ctx, &hits[0], &misses[0], &saved[0]);
+
+	problemCompute(&p, ctx);
+	problemReference(&p);
+	phiGemmCacheStatsEx(ctx, &hits[1], &misses[1], &saved[1]);
+	check("cache", 'd', 'n', 'n', 256, 192, 160, problemError(&p));
+	checkTrue("cache", "operands used again hit the cache", hits[1] > hits[0]);
+
+	/* an update of A, announced by a new generation */
+	((double *) p.A)[0] += 1.0;
+	phiGemmCacheSetGenerationEx(ctx, p.A, 2);
+	problemCompute(&p, ctx);
+	problemReference(&p);
+	check("cache-update", 'd', 'n', 'n', 256, 192, 160, problemError(&p));
+
+	problemFree(&p);
+	phiGemmDestroy(ctx);
+
+	for (i = 0; i < nGPU; i++) {
+		cudaSetDevice(ids[i]);
+		cudaFree(ptr[i]);
+	}
+
+	/* the memory allocated internally (default context) keeps the cache too */
+	problemInit(&p, 'd', 'n', 'n', 256, 192, 160, 0);
+
+	problemCompute(&p, NULL);
+	problemReference(&p);
+	phiGemmCacheStats(&hits[0], &misses[0], &saved[0]);
+
+	problemCompute(&p, NULL);
+	problemReference(&p);
+	phiGemmCacheStats(&hits[1], &misses[1], &saved[1]);
+	check("cache-internal", 'd', 'n', 'n', 256, 192, 160, problemError(&p));
+	checkTrue("cache-internal", "operands used again hit the cache", hits[1] > hits[0]);
+
+	problemFree(&p);
+
+	return;
+}
+#endif
+
+/* the tuning state survives a shutdown through PHI_TUNING_DB */
+static void testTuningDB(int nGPU, int *ids)
+{
+	char dir[] = "/tmp/phigemm_regressionXXXXXX", base[FILENAME_MAX], csv[FILENAME_MAX], path[FILENAME_MAX];
+	float split[2][4];
+	struct dirent *entry;
+	int i, stored = 0, seeded, same = 1;
+	DIR *dp;
+	FILE *fp;
+
+	if ( mkdtemp(dir) == NULL ) {
+		checkTrue("tuningdb", "temporary directory", 0);
+		return;
+	}
+	snprintf(base, sizeof(base), "%s/tuning", dir);
+	snprintf(csv, sizeof(csv), "%s/profile.csv", dir);
+
+	/* a DGEMM split away from the default, so that only the database can restore it */
+	phiGemmShutdown();
+	setenv("PHI_TUNING_DB", base, 1);
+	setenv("PHI_DGEMM_SPLIT", "0.6", 1);
+	phiGemmInit(nGPU, NULL, NULL, ids, 0);
+	unsetenv("PHI_DGEMM_SPLIT");
+
+	runProblem("tuningdb", NULL, 'd', 'n', 'n', 517, 389, 301, 0);
+	for (i = 0; i < 4; i++) split[0][i] = phigemmGetSplitFactor(i);
+	phiGemmShutdown();
+
+	/* the database is stored at shutdown ... */
+	if ( ( dp = opendir(dir) ) != NULL ) {
+		while ( ( entry = readdir(dp) ) != NULL )
+			if ( strncmp(entry->d_name, "tuning.", 7) == 0 ) stored++;
+		closedir(dp);
+	}
+	checkTrue("tuningdb", "stored at shutdown", stored == 1);
+
+	/* ... and restored at the next initialization */
+	phiGemmInit(nGPU, NULL, NULL, ids, 0);
+	for (i = 0; i < 4; i++) {
+		split[1][i] = phigemmGetSplitFactor(i);
+		if ( split[1][i] != split[0][i] ) same = 0;
+	}
+	checkTrue("tuningdb", "split factors restored", same);
+	runProblem("tuningdb", NULL, 'd', 'n', 'n', 517, 389, 301, 1);
+
+	/* the shapes of a profile file */
+	fp = fopen(csv, "w");
+	if ( fp != NULL ) {
+		fprintf(fp, "regression_test.c, 1, %d, 1, n, n, 517, 389, 301, 0.700, 0.100000, 1.0000\n", nGPU);
+		fprintf(fp, "regression_test.c, 2, %d, 1, n, n, 160, 144, 8192, -1.000, 0.100000, 1.0000\n", nGPU);
+		fclose(fp);
+	}
+	seeded = phiGemmTuningDBSeed(csv, 'd');
+	checkTrue("tuningdb", "profile file seeded", seeded == 1);
+	runProblem("tuningdb", NULL, 'd', 'n', 'n', 517, 389, 301, 0);
+
+	phiGemmShutdown();
+	unsetenv("PHI_TUNING_DB");
+	phiGemmInit(nGPU, NULL, NULL, ids, 0);
+
+	if ( ( dp = opendir(dir) ) != NULL ) {
+		while ( ( entry = readdir(dp) ) != NULL ) {
+			if ( entry->d_name[0] == '.' ) continue;
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			unlink(path);
+		}
+		closedir(dp);
+	}
+	rmdir(dir);
+
+	return;
+}
+
+
+int main(int argc, char **argv)
+{
+	int nGPU = 1, ids[MAX_GPU_REGRESSION_TEST], i;
+
+	if ( argc > 1 ) nGPU = atoi(argv[1]);
+	if ( nGPU < 1 || nGPU > MAX_GPU_REGRESSION_TEST ) {
+		printf("usage: %s [devices (1 to %d) [group ...]]\n", argv[0], MAX_GPU_REGRESSION_TEST);
+		return EXIT_FAILURE;
+	}
+
+	if ( argc > 2 ) {
+		groups = argv + 2;
+		ngroups = argc - 2;
+	}
+
+	for (i = 0; i < nGPU; i++) ids[i] = i;
+
+	srand48(20121);
+
+	printf("phiGEMM regression tests on %d device(s)\n\n", nGPU); fflush(stdout);
+
+	phiGemmInit(nGPU, NULL, NULL, ids, 0);
+
+	if ( selected("gemm") ) testGemm();
+	if ( selected("model") ) testModel();
+	if ( selected("shapes") ) testShapes();
+	if ( selected("specialk") ) testSpecialK(nGPU, ids);
+	if ( selected("batched") ) testBatched(NULL);
+	if ( selected("grouped") ) testGrouped(NULL);
+	if ( selected("shared-a") ) testSharedA(NULL);
+	if ( selected("contexts") ) testContexts(nGPU, ids);
+	if ( selected("async") ) testAsync(nGPU, ids);
+	if ( selected("pool") ) testPool();
+	if ( selected("tiling") ) testTiling(nGPU);
+#if defined(__PHIGEMM_OPERAND_CACHE)
+	if ( selected("cache") ) testCache(nGPU, ids);
+#endif
+	if ( selected("tuningdb") ) testTuningDB(nGPU, ids);
+
+	phiGemmShutdown();
+
+	printf("\n%d of %d checks failed\n", failures, checks); fflush(stdout);
+
+	return failures;
+}
@@ -14,7 +14,9 @@
 #include <string.h>
 #include <math.h>
 
-#if !defined(__PHIGEMM_CPUONLY)
+#if defined(__PHIGEMM_EMULATE)
+#include "phigemm_emulator.h"
+#elif !defined(__PHIGEMM_CPUONLY)
 #include "cuda.h"
 #include "cuda_runtime.h"
 #include "cublas_v2.h"
@@ -76,7 +78,7 @@
 #elif defined(__CUDA_TYPE_COMPLEX)
 #define XTYPE phiComplex
 #define SUBXTYPE float
-#define MKL_CALL cgemm
+#define MKL_CALL cgemm_
 #define PHIGEMM_CALL phicgemm_
 #if !defined(__PHIGEMM_CPUONLY)
 #define CUBLAS_GEMM cublasCgemm
@@ -0,0 +1,688 @@
+/*
+ * Copyright (C) 2011-2012 Quantum ESPRESSO Foundation
+ * Copyright (C) 2010-2011 Irish Centre for High-End Computing (ICHEC)
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License. See the file `License'
+ * in the root directory of the present distribution,
+ * or http://www.gnu.org/copyleft/gpl.txt .
+ *
+ */
+
+/*
+ * phigemm_autotune: offline tuning of phiGEMM on the current node.
+ *
+ * The tool sweeps a grid of shapes (m, n, k), transposes and precisions and
+ * measures, through the phiGEMM interface built with the same flags:
+ *
+ * - the best split factor of every shape (and the per-precision average)
+ * - the CPU/GPU crossover size (LOWER_LIMIT)
+ * - the SpecialK chunk size (SPLITK_DGEMM/SPLITK_ZGEMM) and the k/m ratios
+ *   from which SpecialK beats the standard split (SPLITK_FACTOR, THRESHOLD),
+ *   if the library is built with __PHIGEMM_ENABLE_SPECIALK
+ * - the host GEMM rate of every precision (PHI_MODEL_CPU_GFLOPS)
+ *
+ * The results are written to <output>.env, a shell file exporting the PHI_*
+ * variables read by phiGEMM, and (device builds) to the tuning database
+ * <output>.<signature>.db consumed at phiGemmInit() when PHI_TUNING_DB is
+ * set to <output>. CPU-only builds only measure the host rates.
+ *
+ * Usage: phigemm_autotune.x [-g nGPU] [-p precisions] [-t transposes]
+ *                           [-s min:max] [-k min:max] [-S size] [-b 0|1|2]
+ *                           [-r repetitions] [-o output]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "phigemm.h"
+#include "phigemm_auxiliary.h"
+
+#define _STRING_LINE_(s) #s
+#define _STRING_LINE2_(s) _STRING_LINE_(s)
+#define __LINESTR__ _STRING_LINE2_(__LINE__)
+
+#if defined(__PHIGEMM_PROFILE)
+#define PROFILE_ARGS , __FILE__, __LINESTR__
+#else
+#define PROFILE_ARGS
+#endif
+
+#define GEMM_FLOPS(type, m, n, k) ( ( (type) == 'c' || (type) == 'z' ? 8.0 : 2.0 ) * (double)(m) * (double)(n) * (double)(k) )
+
+#define MAX_GRID 16
+
+// Smallest split searched (the devices always get a non-empty share)
+#define MIN_SPLIT 0.05f
+
+// Values that disable SpecialK in cpuGPUheuristic
+#define NEVER_SPECIALK 1.e9
+
+void sgemm_(const char *, const char *, const int *, const int *, const int *, const float *,
+		const float *, const int *, const float *, const int *, const float *, float *, const int *);
+void dgemm_(const char *, const char *, const int *, const int *, const int *, const double *,
+		const double *, const int *, const double *, const int *, const double *, double *, const int *);
+void cgemm_(const char *, const char *, const int *, const int *, const int *, const phiComplex *,
+		const phiComplex *, const int *, const phiComplex *, const int *, const phiComplex *, phiComplex *, const int *);
+void zgemm_(const char *, const char *, const int *, const int *, const int *, const phiDoubleComplex *,
+		const phiDoubleComplex *, const int *, const phiDoubleComplex *, const int *, const phiDoubleComplex *, phiDoubleComplex *, const int *);
+
+typedef struct tuneOptions
+{
+	int nGPU;
+	char precisions[8];
+	char transposes[8][3];
+	int ntransposes;
+	int grid[ MAX_GRID ];
+	int ngrid;
+	int kgrid[ MAX_GRID ];
+	int nkgrid;
+	int specialk_size;
+	int beta_mode;
+	int reps;
+	char output[ FILENAME_MAX - 64 ];
+} tuneOptions_t;
+
+typedef struct tuneResult
+{
+	char type;
+	char transa, transb;
+	int m, n, k;
+	int beta_is_zero;
+	float split;
+	double time;
+} tuneResult_t;
+
+static tuneOptions_t opt;
+
+/* Host operands, reallocated (pinned if possible) when a larger problem comes */
+static void *bufA = NULL, *bufB = NULL, *bufC = NULL;
+static size_t bufBytes = 0;
+
+/* Split imposed to every phiGEMM call while searching (< 0: none) */
+static float forcedSplit = -1.0f;
+
+static double seconds()
+{
+	struct timeval tmp;
+
+	gettimeofday( &tmp, (struct timezone *)0 );
+
+	return tmp.tv_sec + ((double)tmp.tv_usec)/1000000.0;
+}
+
+static size_t typeSize(char type)
+{
+	switch (type)
+	{
+	case 's': return sizeof(float);
+	case 'd': return sizeof(double);
+	case 'c': return sizeof(phiComplex);
+	default : return sizeof(phiDoubleComplex);
+	}
+}
+
+static int typeIndex(char type)
+{
+	switch (type)
+	{
+	case 's': return 0;
+	case 'd': return 1;
+	case 'c': return 2;
+	default : return 3;
+	}
+}
+
+static void hostFree(void *ptr)
+{
+	if (ptr == NULL) return;
+#if !defined(__PHIGEMM_CPUONLY)
+	cudaFreeHost(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+static void * hostAlloc(size_t bytes)
+{
+	void *ptr = NULL;
+
+#if !defined(__PHIGEMM_CPUONLY)
+	if ( cudaHostAlloc( &ptr, bytes, cudaHostAllocPortable ) != cudaSuccess )
+		ptr = NULL;
+#else
+	ptr = malloc(bytes);
+#endif
+
+	if (ptr == NULL) {
+		fprintf(stderr, "*** ERROR allocating %lu bytes of host memory\n", (unsigned long) bytes);
+		exit(EXIT_FAILURE);
+	}
+
+	return ptr;
+}
+
+/* Make room for the largest of A (m x k), B (k x n), C (m x n) */
+static void ensureBuffers(char type, int m, int n, int k)
+{
+	size_t bytes, i;
+	double *p;
+
+	bytes = typeSize(type) * (size_t) imax( imax(m * (size_t) k, k * (size_t) n), m * (size_t) n );
+	bytes = (bytes + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+
+	if (bytes <= bufBytes) return;
+
+	hostFree(bufA); hostFree(bufB); hostFree(bufC);
+
+	bufA = hostAlloc(bytes);
+	bufB = hostAlloc(bytes);
+	bufC = hostAlloc(bytes);
+	bufBytes = bytes;
+
+	/* Values in [0,1) are fine for every precision (complex = 2 reals) */
+	srand( time(NULL) );
+	for (i = 0, p = (double *) bufA; i < bytes / sizeof(double); i++) p[i] = rand()/(RAND_MAX+1.0);
+	for (i = 0, p = (double *) bufB; i < bytes / sizeof(double); i++) p[i] = rand()/(RAND_MAX+1.0);
+	memset(bufC, 0, bytes);
+}
+
+#if !defined(__PHIGEMM_CPUONLY)
+static void forceSplit(char type, char transa, char transb, int m, int n, int k, int beta_is_zero, float split)
+{
+	myPhiGemmTng.split[ typeIndex(type) ] = split;
+	myPhiGemmTng.prevSplit[ typeIndex(type) ] = split;
+#if defined(__PHIGEMM_SELFTUNE) && !defined(__PHIGEMM_SPLIT_MODEL)
+	/* the self-tuning moves it after every call */
+	phiGemmShapeLookup(type, &transa, &transb, m, n, k, beta_is_zero)->split = split;
+#endif
+}
+#endif
+
+/* Run C = alpha op(A) op(B) + beta C through phiGEMM (device = 1) or the host BLAS */
+static void runGemm(int device, char type, char transa, char transb, int m, int n, int k, int beta_is_zero)
+{
+	float sa[2] = { 1.0f, 0.0f }, sb[2] = { 0.0f, 0.0f };
+	double da[2] = { 1.0, 0.0 }, db[2] = { 0.0, 0.0 };
+	int lda, ldb, ldc = m;
+
+	lda = (transa == 'n') ? m : k;
+	ldb = (transb == 'n') ? k : n;
+
+	if ( !beta_is_zero ) {
+		sb[0] = 0.5f;
+		db[0] = 0.5;
+	}
+
+#if !defined(__PHIGEMM_CPUONLY)
+	if (device && forcedSplit > 0.0f)
+		forceSplit(type, transa, transb, m, n, k, beta_is_zero, forcedSplit);
+#endif
+
+	switch (type)
+	{
+	case 's':
+		if (device) phisgemm_(&transa, &transb, &m, &n, &k, sa, bufA, &lda, bufB, &ldb, sb, bufC, &ldc PROFILE_ARGS);
+		else sgemm_(&transa, &transb, &m, &n, &k, sa, bufA, &lda, bufB, &ldb, sb, bufC, &ldc);
+		break;
+	case 'd':
+		if (device) phidgemm_(&transa, &transb, &m, &n, &k, da, bufA, &lda, bufB, &ldb, db, bufC, &ldc PROFILE_ARGS);
+		else dgemm_(&transa, &transb, &m, &n, &k, da, bufA, &lda, bufB, &ldb, db, bufC, &ldc);
+		break;
+	case 'c':
+		if (device) phicgemm_(&transa, &transb, &m, &n, &k, (phiComplex *) sa, bufA, &lda, bufB, &ldb, (phiComplex *) sb, bufC, &ldc PROFILE_ARGS);
+		else cgemm_(&transa, &transb, &m, &n, &k, (phiComplex *) sa, bufA, &lda, bufB, &ldb, (phiComplex *) sb, bufC, &ldc);
+		break;
+	default:
+		if (device) phizgemm_(&transa, &transb, &m, &n, &k, (phiDoubleComplex *) da, bufA, &lda, bufB, &ldb, (phiDoubleComplex *) db, bufC, &ldc PROFILE_ARGS);
+		else zgemm_(&transa, &transb, &m, &n, &k, (phiDoubleComplex *) da, bufA, &lda, bufB, &ldb, (phiDoubleComplex *) db, bufC, &ldc);
+		break;
+	}
+}
+
+/* Best time out of opt.reps runs (plus a warm-up) */
+static double timeGemm(int device, char type, char transa, char transb, int m, int n, int k, int beta_is_zero)
+{
+	double t, best = -1.0;
+	int r;
+
+	ensureBuffers(type, m, n, k);
+
+	runGemm(device, type, transa, transb, m, n, k, beta_is_zero);
+
+	for (r = 0; r < opt.reps; r++) {
+		t = seconds();
+		runGemm(device, type, transa, transb, m, n, k, beta_is_zero);
+		t = seconds() - t;
+
+		if (best < 0.0 || t < best) best = t;
+	}
+
+	return best;
+}
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+/* Scan the split in [lo, hi] with the given step, returns the fastest */
+static float scanSplit(char type, char transa, char transb, int m, int n, int k, int beta_is_zero,
+		float lo, float hi, float step, float best, double *best_time)
+{
+	float split;
+	double t;
+
+	for (split = lo; split <= hi + 1.e-4f; split += step) {
+		forcedSplit = split;
+		t = timeGemm(1, type, transa, transb, m, n, k, beta_is_zero);
+		forcedSplit = -1.0f;
+
+		if (*best_time < 0.0 || t < *best_time) {
+			*best_time = t;
+			best = split;
+		}
+	}
+
+	return best;
+}
+
+/* Coarse scan of the whole range, then refinement around the minimum */
+static float searchSplit(char type, char transa, char transb, int m, int n, int k, int beta_is_zero,
+		float coarse, double *best_time)
+{
+	float best;
+
+	*best_time = -1.0;
+	best = scanSplit(type, transa, transb, m, n, k, beta_is_zero, MIN_SPLIT, 1.0f, coarse, 1.0f, best_time);
+
+	if (coarse > 0.01f)
+		best = scanSplit(type, transa, transb, m, n, k, beta_is_zero,
+				(best - coarse < MIN_SPLIT) ? MIN_SPLIT : best - coarse + 0.01f,
+				(best + coarse > 1.0f) ? 1.0f : best + coarse - 0.01f,
+				0.01f, best, best_time);
+
+	return best;
+}
+
+/* Smallest size from which the CPU+GPU path beats the host BLAS */
+static int tuneLowerLimit(char type)
+{
+	const int sizes[] = { 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024 };
+	const int nsizes = sizeof(sizes) / sizeof(int);
+	double t_cpu, t_dev;
+	int i, crossover = sizes[nsizes - 1];
+
+	myPhiGemmTng.LOWER_LIMIT = 0;
+
+	for (i = nsizes - 1; i >= 0; i--) {
+		t_cpu = timeGemm(0, type, 'n', 'n', sizes[i], sizes[i], sizes[i], 0);
+		searchSplit(type, 'n', 'n', sizes[i], sizes[i], sizes[i], 0, 0.1f, &t_dev);
+
+		printf("  LOWER_LIMIT   %5d: host %9.6fs, host+device %9.6fs\n", sizes[i], t_cpu, t_dev); fflush(stdout);
+
+		if (t_dev >= t_cpu) break;
+		crossover = sizes[i];
+	}
+
+	return crossover;
+}
+
+#if defined(__PHIGEMM_ENABLE_SPECIALK)
+
+static double timeSpecialK(char type, int mn, int k, int use_specialk)
+{
+	float factor = myPhiGemmTng.SPLITK_FACTOR, threshold = myPhiGemmTng.THRESHOLD;
+	int *target = (type == 'd') ? &myPhiGemmTng.SPLITK_DGEMM : &myPhiGemmTng.SPLITK_ZGEMM;
+	int chunk = *target;
+	double t;
+
+	if (use_specialk) {
+		myPhiGemmTng.SPLITK_FACTOR = 0.0f;
+		myPhiGemmTng.THRESHOLD = 0.0f;
+		/* The SpecialK kernels compute k / chunk slices: never less than one */
+		*target = imin(chunk, k);
+		t = timeGemm(1, type, 'n', 'n', mn, mn, k, 0);
+		*target = chunk;
+	} else {
+		myPhiGemmTng.SPLITK_FACTOR = NEVER_SPECIALK;
+		myPhiGemmTng.THRESHOLD = NEVER_SPECIALK;
+		searchSplit(type, 'n', 'n', mn, mn, k, 0, 0.1f, &t);
+	}
+
+	myPhiGemmTng.SPLITK_FACTOR = factor;
+	myPhiGemmTng.THRESHOLD = threshold;
+
+	return t;
+}
+
+/* Chunk (along k) of the SpecialK decomposition */
+static int tuneSpecialKChunk(char type, int mn)
+{
+	const int chunks[] = { 512, 1024, 2048, 4096, 8192 };
+	int i, best = chunks[0], *target;
+	double t, best_time = -1.0;
+
+	target = (type == 'd') ? &myPhiGemmTng.SPLITK_DGEMM : &myPhiGemmTng.SPLITK_ZGEMM;
+
+	for (i = 0; i < sizeof(chunks) / sizeof(int); i++) {
+		*target = chunks[i];
+		t = timeSpecialK(type, mn, 16 * mn, 1);
+
+		printf("  SPLITK_%cGEMM  %5d: %9.6fs\n", type == 'd' ? 'D' : 'Z', chunks[i], t); fflush(stdout);
+
+		if (best_time < 0.0 || t < best_time) {
+			best_time = t;
+			best = chunks[i];
+		}
+	}
+
+	*target = best;
+
+	return best;
+}
+
+/* Smallest k/m ratio from which SpecialK beats the standard split (the
+ * gain grows with k/m, so the scan stops at the first win) */
+static float tuneSpecialKRatio(char type, int mn, const char *name)
+{
+	const int ratios[] = { 2, 4, 8, 16, 32 };
+	const int nratios = sizeof(ratios) / sizeof(int);
+	double t_std, t_spk;
+	int i;
+
+	for (i = 0; i < nratios; i++) {
+		t_spk = timeSpecialK(type, mn, ratios[i] * mn, 1);
+		t_std = timeSpecialK(type, mn, ratios[i] * mn, 0);
+
+		printf("  %-13s %5d: standard %9.6fs, SpecialK %9.6fs\n", name, ratios[i], t_std, t_spk); fflush(stdout);
+
+		if (t_spk < t_std)
+			return ratios[i];
+	}
+
+	/* SpecialK never wins: push the ratio beyond the measured range */
+	return 2 * ratios[nratios - 1];
+}
+#endif
+
+#endif
+
+static void parseRange(const char *arg, int *grid, int *ngrid)
+{
+	int lo, hi, v;
+
+	if ( sscanf(arg, "%d:%d", &lo, &hi) != 2 ) {
+		lo = atoi(arg);
+		hi = lo;
+	}
+
+	if (lo < 1 || hi < lo) {
+		fprintf(stderr, "*** ERROR invalid range %s\n", arg);
+		exit(EXIT_FAILURE);
+	}
+
+	/* powers of two from lo to hi */
+	for (*ngrid = 0, v = lo; v <= hi && *ngrid < MAX_GRID; v *= 2)
+		grid[ (*ngrid)++ ] = v;
+}
+
+static void usage(const char *exe)
+{
+	fprintf(stderr, "\nUse %s [options]\n"
+			"  -g <nGPU>          devices to use (default 1)\n"
+			"  -p <precisions>    any of s,d,c,z (default d)\n"
+			"  -t <transposes>    comma list of nn,nt,tn,tt (default nn)\n"
+			"  -s <min>:<max>     m and n grid, powers of two (default 1024:4096)\n"
+			"  -k <min>:<max>     k grid, powers of two (default 1024:4096)\n"
+			"  -S <size>          m=n of the SpecialK tests (default 1024)\n"
+			"  -b <0|1|2>         tune beta==0, beta!=0 or both (default 2)\n"
+			"  -r <repetitions>   timed runs per point (default 2)\n"
+			"  -o <output>        output base name (default phigemm.tuning)\n\n", exe);
+	exit(EXIT_FAILURE);
+}
+
+static void parseOptions(int argc, char **argv)
+{
+	char *tok, *list;
+	int c;
+
+	opt.nGPU = 1;
+	strcpy(opt.precisions, "d");
+	strcpy(opt.transposes[0], "nn");
+	opt.ntransposes = 1;
+	parseRange("1024:4096", opt.grid, &opt.ngrid);
+	parseRange("1024:4096", opt.kgrid, &opt.nkgrid);
+	opt.specialk_size = 1024;
+	opt.beta_mode = 2;
+	opt.reps = 2;
+	strcpy(opt.output, "phigemm.tuning");
+
+	while ( (c = getopt(argc, argv, "g:p:t:s:k:S:b:r:o:h")) != -1 ) {
+		switch (c)
+		{
+		case 'g': opt.nGPU = atoi(optarg); break;
+		case 'p':
+			strncpy(opt.precisions, optarg, sizeof(opt.precisions) - 1);
+			if ( strspn(opt.precisions, "sdcz") != strlen(opt.precisions) ) usage(argv[0]);
+			break;
+		case 't':
+			list = strdup(optarg);
+			for (opt.ntransposes = 0, tok = strtok(list, ","); tok != NULL && opt.ntransposes < 8; tok = strtok(NULL, ",")) {
+				if ( strlen(tok) != 2 || strspn(tok, "nt") != 2 ) usage(argv[0]);
+				strcpy(opt.transposes[ opt.ntransposes++ ], tok);
+			}
+			free(list);
+			break;
+		case 's': parseRange(optarg, opt.grid, &opt.ngrid); break;
+		case 'k': parseRange(optarg, opt.kgrid, &opt.nkgrid); break;
+		case 'S': opt.specialk_size = atoi(optarg); break;
+		case 'b': opt.beta_mode = atoi(optarg); break;
+		case 'r': opt.reps = atoi(optarg); break;
+		case 'o': strncpy(opt.output, optarg, sizeof(opt.output) - 1); break;
+		default : usage(argv[0]);
+		}
+	}
+
+	if (opt.reps < 1 || opt.beta_mode < 0 || opt.beta_mode > 2 || opt.nGPU < 1) usage(argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	double cpu_gflops[4] = { 0.0, 0.0, 0.0, 0.0 };
+	char filename[ FILENAME_MAX ], host[128];
+	int p, i, devices[ MAX_GPUS ];
+	FILE *fp;
+	time_t now;
+	char type;
+
+#if !defined(__PHIGEMM_CPUONLY)
+	tuneResult_t *results;
+	int nresults = 0, t, im, in, ik, beta, count[4] = { 0, 0, 0, 0 };
+	float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, tuned_split[4];
+	int lower_limit = -1;
+#if defined(__PHIGEMM_ENABLE_SPECIALK)
+	int chunk[4] = { 0, 0, 0, 0 };
+	float splitk_factor = -1.0f, threshold = -1.0f;
+	float default_factor = myPhiGemmTng.SPLITK_FACTOR, default_threshold = myPhiGemmTng.THRESHOLD;
+#endif
+#endif
+
+	parseOptions(argc, argv);
+
+	for (i = 0; i < opt.nGPU && i < MAX_GPUS; i++) devices[i] = i;
+
+#if !defined(__PHIGEMM_CPUONLY)
+	phiGemmInit( opt.nGPU, NULL, NULL, devices, -1);
+
+	results = (tuneResult_t *) malloc( strlen(opt.precisions) * opt.ntransposes * opt.ngrid * opt.ngrid * opt.nkgrid * 2 * sizeof(tuneResult_t) );
+#else
+	phiGemmInit( opt.nGPU, NULL, NULL, devices, -1);
+#endif
+
+	for (p = 0; p < strlen(opt.precisions); p++) {
+
+		type = opt.precisions[p];
+
+		/* Host rate (cost model) */
+		i = opt.grid[ opt.ngrid - 1 ];
+		cpu_gflops[ typeIndex(type) ] = 1.e-9 * GEMM_FLOPS(type, i, i, i) / timeGemm(0, type, 'n', 'n', i, i, i, 0);
+		printf("%cGEMM host rate: %.2f GFlops\n", type, cpu_gflops[ typeIndex(type) ]); fflush(stdout);
+
+#if !defined(__PHIGEMM_CPUONLY)
+
+#if defined(__PHIGEMM_ENABLE_SPECIALK)
+		/* The split search measures the standard path only */
+		myPhiGemmTng.SPLITK_FACTOR = NEVER_SPECIALK;
+		myPhiGemmTng.THRESHOLD = NEVER_SPECIALK;
+#endif
+
+#if defined(__PHIGEMM_SPLIT_MODEL)
+		printf("%cGEMM split: chosen by the cost model (__PHIGEMM_SPLIT_MODEL), not searched\n", type);
+#else
+		for (t = 0; t < opt.ntransposes; t++)
+			for (im = 0; im < opt.ngrid; im++)
+				for (in = 0; in < opt.ngrid; in++)
+					for (ik = 0; ik < opt.nkgrid; ik++)
+						for (beta = 0; beta < 2; beta++) {
+
+							/* beta: 0 (beta != 0) or 1 (beta == 0) */
+							if (opt.beta_mode != 2 && beta != opt.beta_mode) continue;
+
+							tuneResult_t *r = &results[ nresults++ ];
+
+							r->type = type;
+							r->transa = opt.transposes[t][0];
+							r->transb = opt.transposes[t][1];
+							r->m = opt.grid[im];
+							r->n = opt.grid[in];
+							r->k = opt.kgrid[ik];
+							r->beta_is_zero = beta;
+
+							/* Tiny LOWER_LIMIT: this grid is meant for the hybrid path */
+							myPhiGemmTng.LOWER_LIMIT = 0;
+
+							r->split = searchSplit(type, r->transa, r->transb, r->m, r->n, r->k, beta, 0.05f, &r->time);
+
+							printf("  %cGEMM %c%c %5d %5d %5d beta%s0: split %5.3f (%9.6fs, %8.2f GFlops)\n",
+									type, r->transa, r->transb, r->m, r->n, r->k, beta ? "==" : "!=",
+									r->split, r->time, 1.e-9 * GEMM_FLOPS(type, r->m, r->n, r->k) / r->time);
+							fflush(stdout);
+
+							sum[ typeIndex(type) ] += r->split;
+							count[ typeIndex(type) ]++;
+						}
+
+		if ( count[ typeIndex(type) ] )
+			tuned_split[ typeIndex(type) ] = sum[ typeIndex(type) ] / count[ typeIndex(type) ];
+#endif
+
+		/* The crossover is a single value: tune it on the first precision */
+		if (lower_limit < 0) {
+			lower_limit = tuneLowerLimit(type);
+			printf("LOWER_LIMIT: %d\n", lower_limit); fflush(stdout);
+		}
+		myPhiGemmTng.LOWER_LIMIT = lower_limit;
+
+#if defined(__PHIGEMM_ENABLE_SPECIALK)
+		if (type == 'd' || type == 'z') {
+			chunk[ typeIndex(type) ] = tuneSpecialKChunk(type, imax(opt.specialk_size, myPhiGemmTng.LOWER_LIMIT));
+
+			if (splitk_factor < 0.0f) {
+				/* SPLITK_FACTOR rules m,n >= UPPER_LIMIT_K, THRESHOLD the smaller ones */
+				splitk_factor = tuneSpecialKRatio(type, imax(opt.specialk_size, myPhiGemmTng.UPPER_LIMIT_K), "SPLITK_FACTOR");
+				if (myPhiGemmTng.LOWER_LIMIT < myPhiGemmTng.UPPER_LIMIT_K)
+					threshold = tuneSpecialKRatio(type, imin( imax(myPhiGemmTng.UPPER_LIMIT_K / 4, myPhiGemmTng.LOWER_LIMIT),
+							myPhiGemmTng.UPPER_LIMIT_K - 1 ), "THRESHOLD");
+				else
+					threshold = default_threshold;
+				printf("SPLITK_FACTOR: %.1f, THRESHOLD: %.1f\n", splitk_factor, threshold); fflush(stdout);
+			}
+		}
+		myPhiGemmTng.SPLITK_FACTOR = (splitk_factor > 0.0f) ? splitk_factor : default_factor;
+		myPhiGemmTng.THRESHOLD = (splitk_factor > 0.0f) ? threshold : default_threshold;
+#endif
+#endif
+	}
+
+#if !defined(__PHIGEMM_CPUONLY)
+	/* The LOWER_LIMIT and SpecialK searches force their own splits */
+	for (p = 0; p < 4; p++)
+		if ( count[p] )
+			myPhiGemmTng.split[p] = myPhiGemmTng.prevSplit[p] = tuned_split[p];
+#endif
+
+	/* ---------------------------- env file ------------------------------ */
+
+	snprintf(filename, sizeof(filename), "%s.env", opt.output);
+
+	fp = fopen(filename, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "*** ERROR cannot write %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	if ( gethostname(host, sizeof(host)) != 0 ) strcpy(host, "unknown");
+	host[ sizeof(host) - 1 ] = '\0';
+	now = time(NULL);
+
+	fprintf(fp, "# phiGEMM tuning parameters for %s (%d device(s)), %s", host, opt.nGPU, ctime(&now));
+	fprintf(fp, "# generated by phigemm_autotune -p %s -s %d:%d -k %d:%d\n", opt.precisions,
+			opt.grid[0], opt.grid[ opt.ngrid - 1 ], opt.kgrid[0], opt.kgrid[ opt.nkgrid - 1 ]);
+
+	for (p = 0; p < 4; p++)
+		if ( cpu_gflops[p] > 0.0 )
+			fprintf(fp, "# %cGEMM host rate: %.2f GFlops\n", "sdcz"[p], cpu_gflops[p]);
+
+	if ( cpu_gflops[1] > 0.0 )
+		fprintf(fp, "export PHI_MODEL_CPU_GFLOPS=%.2f\n", cpu_gflops[1]);
+
+#if !defined(__PHIGEMM_CPUONLY)
+	for (p = 0; p < 4; p++)
+		if ( count[p] )
+			fprintf(fp, "export PHI_%cGEMM_SPLIT=%.3f\n", "SDCZ"[p], myPhiGemmTng.split[p]);
+
+	if (lower_limit > 0)
+		fprintf(fp, "export PHI_LOWER_LIMIT=%d\n", lower_limit);
+
+#if defined(__PHIGEMM_ENABLE_SPECIALK)
+	if (splitk_factor > 0.0f) {
+		fprintf(fp, "export PHI_SPLITK_FACTOR=%.1f\n", splitk_factor);
+		fprintf(fp, "export PHI_THRESHOLD=%.1f\n", threshold);
+	}
+	if (chunk[1]) fprintf(fp, "export PHI_SPLITK_DGEMM=%d\n", chunk[1]);
+	if (chunk[3]) fprintf(fp, "export PHI_SPLITK_ZGEMM=%d\n", chunk[3]);
+#endif
+
+	fprintf(fp, "export PHI_TUNING_DB=%s\n", opt.output);
+#endif
+
+	fclose(fp);
+	printf("\nTuning parameters written to %s\n", filename);
+
+#if !defined(__PHIGEMM_CPUONLY)
+	/* ------------------------- tuning database -------------------------- */
+
+	/* Drop the entries polluted by the search, keep only the best splits */
+	phiGemmShapeReset();
+
+	for (i = 0; i < nresults; i++) {
+		phiGemmShapeEntry_t *entry = phiGemmShapeLookup(results[i].type, &results[i].transa, &results[i].transb,
+				results[i].m, results[i].n, results[i].k, results[i].beta_is_zero);
+
+		entry->split = entry->prevSplit = entry->lpSplit = results[i].split;
+	}
+
+	strncpy(myPhiGemmEnv.tuningdb, opt.output, FILENAME_MAX - 1);
+	printf("Tuning database %s.<signature>.db written at shutdown\n", opt.output);
+
+	free(results);
+#endif
+
+	phiGemmShutdown();
+
+	hostFree(bufA); hostFree(bufB); hostFree(bufC);
+
+	return 0;
+}